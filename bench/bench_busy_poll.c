@@ -0,0 +1,114 @@
+/**
+ * @file bench_busy_poll.c
+ * @brief Round-trip latency of a sleeping versus a busy-polling receive loop.
+ *
+ * A forked echo server receives UDP packets on loopback the way the proxy
+ * does (busy_poll_flags() / busy_poll_update()), once sleeping in
+ * recvfrom() and once spinning, while the parent sends paced pings and
+ * records round trips. Busy polling only pays off when the spinning loop
+ * has a core of its own, so the CPU count is printed with the results.
+ * Run with:
+ *
+ * ```
+ * make bench
+ * ```
+ * or directly, with an optional ping count and gap in microseconds:
+ * ```
+ * ./bench_busy_poll 20000 50
+ * ```
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "scheduler.h"
+
+#define BENCH_PINGS 20000   /**< Round trips per mode. */
+#define BENCH_GAP_US 50     /**< Pause between pings, so a sleeping loop really sleeps. */
+#define BENCH_WARMUP 200    /**< Round trips not recorded. */
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Echo server loop; never returns.
+ */
+static void serve(int sock, int busy) {
+    BusyPoll bp;
+    busy_poll_init(&bp, busy, 10);
+    if (busy) busy_poll_socket(sock, 50);
+    unsigned char buf[512];
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(sock, buf, sizeof(buf), busy_poll_flags(&bp, now_ms()),
+                             (struct sockaddr *)&from, &from_len);
+        busy_poll_update(&bp, n >= 0, now_ms());
+        if (n > 0) sendto(sock, buf, (size_t)n, 0, (struct sockaddr *)&from, from_len);
+    }
+}
+
+/**
+ * @brief Measures one mode and prints its latency line.
+ *
+ * @return 0 on success, -1 if the sockets cannot be set up.
+ */
+static int run(int busy, int pings, int gap_us) {
+    int srv = socket(AF_INET, SOCK_DGRAM, 0);
+    int cli = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (srv < 0 || cli < 0 || bind(srv, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(srv, (struct sockaddr *)&addr, &len) < 0) {
+        perror("bench socket");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) serve(srv, busy);
+    close(srv);
+
+    LatencyHistogram h;
+    memset(&h, 0, sizeof(h));
+    struct timespec gap = { 0, gap_us * 1000L };
+    unsigned char ping[64] = { 0 }, pong[64];
+    for (int i = 0; i < pings + BENCH_WARMUP; i++) {
+        double start = now_ms();
+        sendto(cli, ping, sizeof(ping), 0, (struct sockaddr *)&addr, sizeof(addr));
+        if (recv(cli, pong, sizeof(pong), 0) < 0) break;
+        if (i >= BENCH_WARMUP) latency_add(&h, (now_ms() - start) * 1e3);
+        if (gap_us > 0) nanosleep(&gap, NULL);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(cli);
+    latency_print(&h, busy ? "busy-poll" : "sleeping ", stdout);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int pings = argc > 1 ? atoi(argv[1]) : BENCH_PINGS;
+    int gap_us = argc > 2 ? atoi(argv[2]) : BENCH_GAP_US;
+    printf("UDP loopback round trips: %d pings, %d us apart, %ld CPUs online\n", pings, gap_us,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    if (run(0, pings, gap_us) < 0 || run(1, pings, gap_us) < 0) return 1;
+    return 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file bench_matchers.c
+ * @brief Microbenchmarks for the blocklist matcher representations.
+ *
+ * Builds each matcher backend (see matcher.h) from the same synthetic
+ * blocklist and reports build time, memory per entry and lookup latency
+ * for listed names, subdomains of listed names and unlisted names. Run with:
+ *
+ * ```
+ * make bench
+ * ```
+ * or directly, with optional list sizes:
+ * ```
+ * ./bench_matchers 100000 1000000
+ * ```
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "domain_trie.h"
+#include "matcher.h"
+
+#define BENCH_QUERIES 200000 /**< Distinct query names per query kind. */
+#define BENCH_MIN_MS 200.0   /**< Minimum duration of each timed lookup loop. */
+#define BENCH_NAME_LEN 64
+
+static const char *const tlds[] = { "com", "net", "org", "io", "de", "ru", "info", "co.uk", "xyz" };
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+/**
+ * @brief xorshift64* generator; deterministic so runs are comparable.
+ */
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Writes a random label of 3 to 12 lower-case letters and digits.
+ */
+static int random_label(char *out) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    int len = 3 + (int)(rng() % 10);
+    for (int i = 0; i < len; i++) out[i] = alphabet[rng() % 36];
+    return len;
+}
+
+/**
+ * @brief Generates a blocklist-like name: one to three labels under a TLD.
+ */
+static void random_name(char *out) {
+    int n = 0, labels = 1 + (int)(rng() % 3);
+    for (int i = 0; i < labels; i++) {
+        n += random_label(out + n);
+        out[n++] = '.';
+    }
+    strcpy(out + n, tlds[rng() % (sizeof(tlds) / sizeof(tlds[0]))]);
+}
+
+/**
+ * @brief Returns the mean lookup latency in nanoseconds over @p names.
+ */
+static double time_lookups(const Matcher *m, char (*names)[BENCH_NAME_LEN], size_t count,
+                           size_t *hits) {
+    size_t lookups = 0;
+    double start = now_ms(), elapsed;
+    *hits = 0;
+    do {
+        for (size_t i = 0; i < count; i++) {
+            TrieMatch tm;
+            *hits += matcher_match(m, names[i], &tm) != DT_NONE;
+        }
+        lookups += count;
+        elapsed = now_ms() - start;
+    } while (elapsed < BENCH_MIN_MS);
+    *hits = *hits * count / lookups;
+    return elapsed * 1e6 / (double)lookups;
+}
+
+/**
+ * @brief Prints one result row.
+ */
+static void report(const Matcher *m, double build_ms, char (*queries[3])[BENCH_NAME_LEN], size_t nq) {
+    size_t hits[3], entries = matcher_count(m), bytes = matcher_memory(m);
+    double ns[3];
+    for (int k = 0; k < 3; k++) ns[k] = time_lookups(m, queries[k], nq, &hits[k]);
+    printf("%-8s %10zu %10.1f %12zu %8.1f %9.1f %9.1f %9.1f   %zu/%zu/%zu\n", m->ops->name, entries,
+           build_ms, bytes, (double)bytes / (double)entries, ns[0], ns[1], ns[2],
+           hits[0], hits[1], hits[2]);
+}
+
+/**
+ * @brief Benchmarks every representation for a list of @p entries names.
+ */
+static int bench_size(size_t entries) {
+    char (*list)[BENCH_NAME_LEN] = malloc(entries * sizeof(*list));
+    char (*queries[3])[BENCH_NAME_LEN];
+    size_t nq = entries < BENCH_QUERIES ? entries : BENCH_QUERIES;
+    for (int k = 0; k < 3; k++) queries[k] = malloc(nq * sizeof(*queries[k]));
+    if (!list || !queries[0] || !queries[1] || !queries[2]) return -1;
+
+    for (size_t i = 0; i < entries; i++) random_name(list[i]);
+    for (size_t i = 0; i < nq; i++) {
+        const char *hit = list[rng() % entries];
+        strcpy(queries[0][i], hit);
+        snprintf(queries[1][i], BENCH_NAME_LEN, "www.%.*s", BENCH_NAME_LEN - 5, hit);
+        random_name(queries[2][i]);
+    }
+
+    for (size_t b = 0; matcher_backend(b); b++) {
+        double t0 = now_ms();
+        DomainTrie *trie = domain_trie_new();
+        for (size_t i = 0; trie && i < entries; i++) {
+            if (domain_trie_insert(trie, list[i], DT_BLOCK) < 0) {
+                domain_trie_free(trie);
+                trie = NULL;
+            }
+        }
+        Matcher m;
+        if (!trie || matcher_build(&m, matcher_backend(b), trie) < 0) return -1;
+        report(&m, now_ms() - t0, queries, nq);
+        matcher_free(&m);
+    }
+
+    for (int k = 0; k < 3; k++) free(queries[k]);
+    free(list);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    printf("Columns: entries, build ms, bytes, bytes/entry, lookup ns (exact hit, subdomain hit, miss),\n"
+           "matched queries per kind. Build time includes parsing the names into a trie.\n\n");
+    printf("%-8s %10s %10s %12s %8s %9s %9s %9s   %s\n", "backend", "entries", "build_ms",
+           "bytes", "B/entry", "exact_ns", "sub_ns", "miss_ns", "hits");
+
+    size_t defaults[] = { 10000, 100000, 1000000 };
+    int n = argc > 1 ? argc - 1 : (int)(sizeof(defaults) / sizeof(defaults[0]));
+    for (int i = 0; i < n; i++) {
+        size_t entries = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : defaults[i];
+        if (entries == 0) continue;
+        if (bench_size(entries) < 0) {
+            fprintf(stderr, "Benchmark of %zu entries failed\n", entries);
+            return 1;
+        }
+    }
+    return 0;
+}
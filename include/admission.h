@@ -0,0 +1,56 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+/**
+ * @brief Overload detector and admission policy for the listening socket.
+ *
+ * Two signals are sampled after every received query: how full the
+ * socket's receive queue is, and the loop lag, i.e. how long the loop has
+ * been busy without finding the queue empty. Once either crosses its
+ * limit the proxy is overloaded until both fall below half their limits.
+ * While overloaded, cheap answers (cache hits, policy answers) are still
+ * served, but queries that would go upstream are shed: answered REFUSED,
+ * or dropped, so the kernel queue drains instead of overflowing at random.
+ */
+typedef struct {
+    int sock;                /**< Listening socket. */
+    int queue_limit;         /**< Receive-queue fill (percent) that signals overload; 0 = off. */
+    double lag_limit_ms;     /**< Loop lag that signals overload; 0 = off. */
+    int drop;                /**< Drop shed queries instead of answering REFUSED. */
+    int queue_pct;           /**< Last receive-queue fill, -1 if unknown. */
+    double idle_at_ms;       /**< Last time the receive queue was found empty. */
+    double lag_ms;           /**< Last loop lag. */
+    int overloaded;          /**< Currently shedding. */
+    unsigned long episodes;  /**< Times overload was entered. */
+    unsigned long admitted;  /**< Upstream-bound queries let through. */
+    unsigned long shed;      /**< Upstream-bound queries refused or dropped. */
+} Admission;
+
+/**
+ * @brief Sets up the detector for a socket.
+ *
+ * @param sock Listening socket.
+ * @param queue_limit Receive-queue fill in percent (0 disables the signal).
+ * @param lag_limit_ms Loop lag in milliseconds (0 disables the signal).
+ * @param drop Non-zero to drop shed queries silently.
+ * @param now_ms Current monotonic time in milliseconds.
+ */
+void admission_init(Admission *a, int sock, int queue_limit, double lag_limit_ms, int drop,
+                    double now_ms);
+
+/**
+ * @brief Samples both signals; call after each received query.
+ *
+ * @param now_ms Current monotonic time in milliseconds.
+ * @return Non-zero while overloaded.
+ */
+int admission_sample(Admission *a, double now_ms);
+
+/**
+ * @brief Decides whether a query may be forwarded upstream.
+ *
+ * @return 1 to forward, 0 to shed it.
+ */
+int admission_forward(Admission *a);
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CACHE_PROBE 8        /**< Slots examined per lookup or insert. */
+#define CACHE_MAX_TTL 86400  /**< Longest time an answer is kept, in seconds. */
+#define CACHE_SHARED_BLOB 1024 /**< Name plus response bytes per shared-cache slot. */
+
+/**
+ * @brief One cached upstream answer.
+ */
+typedef struct {
+    uint32_t hash;        /**< Hash of (name, type, class); 0 marks an empty slot. */
+    uint16_t type;        /**< Query type. */
+    uint16_t class;       /**< Query class. */
+    uint8_t name_len;     /**< Wire length of the QNAME, root byte included. */
+    uint16_t data_len;    /**< Length of the response. */
+    int64_t stored;       /**< Wall-clock time the answer was received. */
+    int64_t expires;      /**< Wall-clock time the answer expires. */
+    unsigned char *blob;  /**< Wire QNAME followed by the response. */
+} CacheEntry;
+
+/**
+ * @brief Fixed-size cache of upstream responses keyed by question.
+ *
+ * An open-addressing table where every key may live in any of the
+ * CACHE_PROBE slots following its home slot. An insert takes a free or
+ * expired slot of that window, or else evicts the entry closest to
+ * expiry, so the table never needs tombstones or rehashing. Expiry
+ * times are absolute wall-clock seconds so that entries keep their
+ * meaning across a snapshot and restart.
+ *
+ * A cache made by cache_attach_shared() keeps the same table in a POSIX
+ * shared-memory segment instead, so that every proxy process on the host
+ * shares it (see cache.c for the layout).
+ */
+typedef struct {
+    CacheEntry *slots;    /**< Slot array (private cache only). */
+    size_t mask;          /**< Slot count minus one (count is a power of two). */
+    size_t count;         /**< Occupied slots, some maybe expired (private cache only). */
+    unsigned char *shm;   /**< Mapped shared segment, or NULL for a private cache. */
+    size_t shm_len;       /**< Size of the mapping. */
+    unsigned long hits;   /**< Lookups answered from the cache. */
+    unsigned long misses; /**< Lookups not found or expired. */
+} ResponseCache;
+
+/**
+ * @brief Creates a cache holding up to about @p entries answers.
+ *
+ * @return Newly allocated cache, or NULL on allocation failure.
+ */
+ResponseCache *cache_new(size_t entries);
+
+/**
+ * @brief Attaches to (or creates) a cache in a POSIX shared-memory segment.
+ *
+ * The first process creates the segment with room for about @p entries
+ * answers; later processes use it at whatever size it was created with.
+ * Answers larger than CACHE_SHARED_BLOB bytes are not shared. The segment
+ * outlives the processes, so it also survives restarts.
+ *
+ * @param name Segment name as for shm_open(), e.g. "/dns_proxy_cache".
+ * @param entries Slot count used when creating the segment.
+ * @return Cache backed by the segment, or NULL on failure.
+ */
+ResponseCache *cache_attach_shared(const char *name, size_t entries);
+
+/**
+ * @brief Releases a cache (a shared segment is only unmapped).
+ *
+ * @param c Cache to free (may be NULL).
+ */
+void cache_free(ResponseCache *c);
+
+/**
+ * @brief Answers a query from the cache.
+ *
+ * Names match case-insensitively. The stored response gets the query's
+ * ID and QNAME spelling (preserving 0x20 randomization) and TTLs reduced
+ * by the time the answer has spent in the cache.
+ *
+ * @param c Cache.
+ * @param query Client query.
+ * @param qlen Length of the query.
+ * @param resp Output buffer for the response.
+ * @param resp_cap Capacity of @p resp.
+ * @param now Current wall-clock time.
+ * @return Length of the response, or -1 if the cache cannot answer.
+ */
+int cache_lookup(ResponseCache *c, const unsigned char *query, int qlen, unsigned char *resp,
+                 int resp_cap, time_t now);
+
+/**
+ * @brief Stores an upstream response to a query.
+ *
+ * Only complete NOERROR and NXDOMAIN answers to the same question (in any
+ * casing) with a non-zero TTL are kept, under the case-folded name. They
+ * live for their smallest record TTL, capped at CACHE_MAX_TTL.
+ *
+ * @return 0 if stored, -1 if the response is not cacheable or memory runs out.
+ */
+int cache_store(ResponseCache *c, const unsigned char *query, int qlen,
+                const unsigned char *resp, int rlen, time_t now);
+
+/**
+ * @brief Writes the unexpired entries to a snapshot file.
+ *
+ * The file is written under a temporary name and renamed into place, so a
+ * crash never leaves a truncated snapshot behind.
+ *
+ * @return Number of entries written, or -1 on I/O error.
+ */
+int cache_save(const ResponseCache *c, const char *path, time_t now);
+
+/**
+ * @brief Loads a snapshot written by cache_save(), skipping expired entries.
+ *
+ * @return Number of entries loaded, or -1 if the file cannot be read or is
+ *         not a snapshot.
+ */
+int cache_load(ResponseCache *c, const char *path, time_t now);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef CIDR_H
+#define CIDR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Node of a path-compressed binary trie over IPv4 prefixes.
+ */
+typedef struct CidrNode {
+    uint32_t prefix;            /**< Prefix bits in host byte order, masked to @c len. */
+    uint8_t len;                /**< Prefix length in bits (0-32). */
+    int value;                  /**< Value stored for this prefix, or -1 for interior nodes. */
+    struct CidrNode *child[2];  /**< Children selected by the bit following the prefix. */
+} CidrNode;
+
+/**
+ * @brief Longest-prefix-match table mapping IPv4 prefixes to integer values.
+ */
+typedef struct {
+    CidrNode *root;  /**< Root of the trie, or NULL when empty. */
+    size_t nodes;    /**< Number of allocated nodes. */
+} CidrTable;
+
+/**
+ * @brief Parses an IPv4 CIDR string such as "10.0.0.0/8".
+ *
+ * A bare address is treated as a /32.
+ *
+ * @param s Input string.
+ * @param addr Output network address in host byte order (masked).
+ * @param len Output prefix length.
+ * @return 0 on success, -1 on malformed input.
+ */
+int cidr_parse(const char *s, uint32_t *addr, int *len);
+
+/**
+ * @brief Inserts or replaces a prefix in the table.
+ *
+ * @param t Table to modify.
+ * @param addr Network address in host byte order.
+ * @param len Prefix length (0-32).
+ * @param value Non-negative value to associate with the prefix.
+ * @return 0 on success, -1 on allocation failure or invalid arguments.
+ */
+int cidr_table_insert(CidrTable *t, uint32_t addr, int len, int value);
+
+/**
+ * @brief Finds the value of the longest prefix containing an address.
+ *
+ * @param t Table to search.
+ * @param addr Address in host byte order.
+ * @return The stored value, or -1 if no prefix matches.
+ */
+int cidr_table_lookup(const CidrTable *t, uint32_t addr);
+
+/**
+ * @brief Releases all nodes of a table, leaving it empty.
+ *
+ * @param t Table to clear.
+ */
+void cidr_table_free(CidrTable *t);
+
+#endif
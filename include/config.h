@@ -1,8 +1,59 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdint.h>
+#include "cidr.h"
+#include "domain_trie.h"
+#include "pattern.h"
+#include "matcher.h"
+#include "workers.h"
+#include "netopt.h"
+#include "upstream.h"
+
 #define MAX_BLACKLIST 100
 #define MAX_STR_LEN 256
+#define MAX_GROUPS 16
+
+/**
+ * @brief Policy applied to clients whose source address falls in a group's CIDRs.
+ *
+ * Group 0 is the default group built from the top-level `response`,
+ * `fake_ip` and `blacklist` keys; it serves every client not covered by
+ * another group.
+ */
+typedef struct {
+    char name[MAX_STR_LEN];      /**< Group name as used in `group.<name>.*` keys. */
+    char response[MAX_STR_LEN];  /**< Response type for blocked domains (NXDOMAIN, REFUSED, or FAKE). */
+    char fake_ip[MAX_STR_LEN];   /**< IP address to return in FAKE responses. */
+    DomainTrie *blocklist;       /**< Lists being compiled; once loaded, the trie matcher's data or NULL. */
+    Matcher lists;               /**< Matcher built from the lists; may be shared with the default group. */
+    int owns_blocklist;          /**< Non-zero if @c blocklist / @c lists are freed with this group. */
+    PatternSet *patterns;        /**< Compiled regex/glob block rules, or NULL if none. */
+    int owns_patterns;           /**< Non-zero if @c patterns is freed with this group. */
+} ClientGroup;
+
+/**
+ * @brief Where load_config() spent its time, filled in while loading.
+ *
+ * List files go through four phases: read (file I/O into memory), parse
+ * (splitting lines into names), build (trie insertion, which also merges
+ * duplicates) and merge (joining per-thread partial tries). Parse and
+ * build run on worker threads; their times are wall-clock.
+ */
+typedef struct {
+    double read_ms;        /**< Reading list files into memory. */
+    double parse_ms;       /**< Splitting list files into names. */
+    double merge_ms;       /**< Merging per-thread partial tries. */
+    double build_ms;       /**< Inserting names into the tries. */
+    double rpz_ms;         /**< Loading RPZ zones (read, parse and build). */
+    double compile_ms;     /**< Compiling pattern rules into automata. */
+    double total_ms;       /**< Whole load_config() call. */
+    size_t files;          /**< List and zone files read. */
+    size_t bytes;          /**< Bytes read from list files. */
+    size_t names;          /**< Names parsed from lists (files and inline). */
+    size_t duplicates;     /**< Names that were already in their trie. */
+    int threads;           /**< Most worker threads used for one file. */
+} LoadStats;
 
 /**
  * @brief Configuration structure for the DNS proxy server.
@@ -13,11 +64,37 @@
 typedef struct {
     char upstream_dns[MAX_STR_LEN];   /**< IP address or hostname of the upstream DNS server. */
     int upstream_port;                /**< Port of the upstream DNS server. */
+    UpstreamHealth upstream_health;   /**< Health probes and circuit breaker of the upstreams. */
     char response[MAX_STR_LEN];       /**< Response type for blacklisted domains (NXDOMAIN, REFUSED, or FAKE). */
     char fake_ip[MAX_STR_LEN];        /**< IP address to return in FAKE responses. */
     int listen_port;                  /**< Port on which the proxy server listens for DNS queries. */
     char blacklist[MAX_BLACKLIST][MAX_STR_LEN]; /**< Array of domain names to be filtered. */
     int blacklist_count;              /**< Number of domains currently in the blacklist. */
+    ClientGroup groups[MAX_GROUPS];   /**< Client groups; groups[0] is the default group. */
+    int group_count;                  /**< Number of groups in use (0 if not loaded). */
+    CidrTable group_table;            /**< Maps client prefixes to group indices. */
+    char rpz_update_file[MAX_STR_LEN];/**< RPZ update applied to the default group on SIGHUP ("" if unset). */
+    int load_threads;                 /**< Worker threads for list files (0 = online CPUs). */
+    int cache_size;                   /**< Response cache entries (0 disables the cache). */
+    char cache_snapshot[MAX_STR_LEN]; /**< Cache snapshot file ("" for none). */
+    int cache_snapshot_interval;      /**< Seconds between periodic snapshots (0 = only on shutdown). */
+    char cache_shared[MAX_STR_LEN];   /**< Shared-memory segment holding the cache ("" for a private cache). */
+    int overload_queue;               /**< Receive-queue fill (percent) that starts shedding (0 = off). */
+    int overload_lag_ms;              /**< Loop lag that starts shedding (0 = off). */
+    int overload_drop;                /**< Drop shed queries instead of answering REFUSED. */
+    int dedup_size;                   /**< Requests tracked to absorb client retransmissions (0 = off). */
+    int workers;                      /**< Worker processes (0 = one per CPU). */
+    int pin_workers;                  /**< Pin each worker to its own CPU when there are several. */
+    SteerMode steer;                  /**< How queries are spread over the workers. */
+    int busy_poll;                    /**< Busy-poll the socket, SO_BUSY_POLL microseconds (0 = off). */
+    int busy_poll_idle_ms;            /**< Idle time after which a busy-polling loop sleeps. */
+    NetOptions socket_opts;           /**< Buffer sizes and kernel options of the listening socket. */
+    char xdp_interface[MAX_STR_LEN];  /**< Interface of the AF_XDP fast path ("" = off). */
+    int xdp_queue;                    /**< Interface queue the fast path binds to. */
+    int xdp_native;                   /**< Driver (native) XDP instead of generic (SKB) mode. */
+    const MatcherOps *matcher;        /**< Backend that compiled lists are built into. */
+    char louds_file[MAX_STR_LEN];     /**< Precompiled LOUDS image mapped as the default lists ("" if unset). */
+    LoadStats load_stats;             /**< Phase timings of the last load_config(). */
 } Config;
 
 /**
@@ -29,4 +106,35 @@ typedef struct {
  */
 int load_config(const char *filename, Config *cfg);
 
+/**
+ * @brief Releases compiled structures owned by a configuration.
+ *
+ * @param cfg Configuration previously filled by load_config().
+ */
+void free_config(Config *cfg);
+
+/**
+ * @brief Finds the list policy of a group that applies to a name.
+ *
+ * @param g Client group.
+ * @param name Domain name in dotted notation.
+ * @param m Output match, as filled by domain_trie_match().
+ * @return The verdict stored in @p m.
+ */
+int group_match(const ClientGroup *g, const char *name, TrieMatch *m);
+
+/**
+ * @brief Returns the number of names in a group's compiled lists.
+ */
+size_t group_list_size(const ClientGroup *g);
+
+/**
+ * @brief Selects the client group for a source address.
+ *
+ * @param cfg Loaded configuration.
+ * @param addr Client IPv4 address in host byte order.
+ * @return The group with the longest matching CIDR, or the default group.
+ */
+const ClientGroup *config_find_group(const Config *cfg, uint32_t addr);
+
 #endif
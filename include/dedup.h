@@ -0,0 +1,86 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define DEDUP_PROBE 8          /**< Slots examined per lookup. */
+#define DEDUP_STALE_MS 10000.0 /**< An in-flight entry older than this is forgotten. */
+
+/**
+ * @brief One logical request: a hash of (client address, port, ID, question).
+ */
+typedef struct {
+    uint64_t key;        /**< Request hash; 0 = empty slot. */
+    double started_ms;   /**< When the request was queued for upstream. */
+    double done_ms;      /**< When its upstream exchange finished; 0 while in flight. */
+} DedupEntry;
+
+/**
+ * @brief Table of upstream-bound requests, to absorb client retransmissions.
+ *
+ * Stub resolvers resend a query, with the same ID, after about a second
+ * without an answer. A resend of a request that is still queued or being
+ * forwarded, or that reached the socket (by its kernel receive timestamp)
+ * before the exchange finished, is the same logical request: it is
+ * dropped rather than forwarded again, so the request costs one upstream
+ * query and produces one reply. A resend arriving after the exchange
+ * finished is served normally, since the client may have lost the reply.
+ * A request that got no reply at all is forgotten, so its resends are
+ * forwarded rather than absorbed.
+ */
+typedef struct {
+    DedupEntry *slots;        /**< mask + 1 slots. */
+    size_t mask;              /**< Slot count minus one (slot count is a power of two). */
+    unsigned long tracked;    /**< Requests tracked. */
+    unsigned long absorbed;   /**< Retransmissions dropped. */
+} Dedup;
+
+/**
+ * @brief Allocates a table of at least @p entries slots.
+ *
+ * @return 0 on success, -1 if out of memory.
+ */
+int dedup_init(Dedup *d, size_t entries);
+
+/**
+ * @brief Releases the table.
+ */
+void dedup_free(Dedup *d);
+
+/**
+ * @brief Computes the request key of a query, never 0.
+ *
+ * Covers the client address and port, the transaction ID and the question
+ * section (QNAME, QTYPE, QCLASS) byte for byte.
+ */
+uint64_t dedup_key(const struct sockaddr_in *client, const unsigned char *query, int len);
+
+/**
+ * @brief Tells whether a query repeats a request already being forwarded.
+ *
+ * @param key Key from dedup_key().
+ * @param arrived_ms When the query reached the socket (monotonic).
+ * @param now_ms Current monotonic time.
+ * @return 1 if it is a retransmission to drop (counted), 0 otherwise.
+ */
+int dedup_duplicate(Dedup *d, uint64_t key, double arrived_ms, double now_ms);
+
+/**
+ * @brief Records that a request has been queued for upstream.
+ */
+void dedup_start(Dedup *d, uint64_t key, double now_ms);
+
+/**
+ * @brief Records that the upstream exchange of a request has finished.
+ */
+void dedup_done(Dedup *d, uint64_t key, double now_ms);
+
+/**
+ * @brief Forgets a request whose exchange ended without a reply, so that
+ *        the client's retransmissions are forwarded again.
+ */
+void dedup_forget(Dedup *d, uint64_t key);
+
+#endif
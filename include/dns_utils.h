@@ -3,6 +3,8 @@
 
 #include <netinet/in.h>
 #include "config.h"
+#include "cache.h"
+#include "upstream.h"
 
 /**
  * @brief DNS message header structure.
@@ -38,6 +40,32 @@ typedef struct {
  */
 int parse_dns_query(const unsigned char *buffer, int len, char *domain, int *type, int *class);
 
+/**
+ * @brief Question of a query in the common shape, decoded by parse_dns_query_fast().
+ */
+typedef struct {
+    char name[256];  /**< QNAME in dotted notation, lower-cased. */
+    int qname_len;   /**< Wire length of the QNAME, root byte included. */
+    int type;        /**< Query type. */
+    int class;       /**< Query class. */
+    int has_opt;     /**< Non-zero if the additional section is one EDNS OPT record. */
+} DnsQuestion;
+
+/**
+ * @brief Decodes a query if it has the common shape, in a single pass.
+ *
+ * The shape is a standard query (QR = 0, OPCODE = 0) with QDCOUNT = 1, no
+ * answer or authority records, at most one additional record which must be
+ * a root-owned OPT, and an uncompressed QNAME; the packet must end exactly
+ * after those sections. Anything else is left to parse_dns_query().
+ *
+ * @param buffer Input buffer containing the DNS query.
+ * @param len Length of the buffer.
+ * @param q Output question; the wire QNAME starts at offset 12 of @p buffer.
+ * @return 0 if the packet has the common shape, -1 otherwise.
+ */
+int parse_dns_query_fast(const unsigned char *buffer, int len, DnsQuestion *q);
+
 /**
  * @brief Builds a fake DNS A record response with a specified IP.
  *
@@ -74,6 +102,56 @@ int build_nxdomain_response(const unsigned char *req, int req_len, unsigned char
  */
 int build_refused_response(const unsigned char *req, int req_len, unsigned char *resp, int resp_cap);
 
+/**
+ * @brief Builds a SERVFAIL response indicating no upstream could answer.
+ *
+ * @param req Original DNS request buffer.
+ * @param req_len Length of the request.
+ * @param resp Output buffer for the generated response.
+ * @param resp_cap Capacity of the response buffer.
+ * @return Number of bytes written to resp, or -1 on failure.
+ */
+int build_servfail_response(const unsigned char *req, int req_len, unsigned char *resp, int resp_cap);
+
+/**
+ * @brief Builds a NODATA response (NOERROR with an empty answer section).
+ *
+ * @param req Original DNS request buffer.
+ * @param req_len Length of the request.
+ * @param resp Output buffer for the generated response.
+ * @param resp_cap Capacity of the response buffer.
+ * @return Number of bytes written to resp, or -1 on failure.
+ */
+int build_nodata_response(const unsigned char *req, int req_len, unsigned char *resp, int resp_cap);
+
+/**
+ * @brief Appends an answer record for the question name to a response.
+ *
+ * The owner is written as a compression pointer to the question and ANCOUNT
+ * is incremented.
+ *
+ * @param resp Response built by one of the build_*_response() functions.
+ * @param resp_len Current length of the response.
+ * @param resp_cap Capacity of the response buffer.
+ * @param type RR type of the record.
+ * @param ttl Time-to-live of the record.
+ * @param rdata Record data in wire format.
+ * @param rdlen Length of @p rdata.
+ * @return New length of the response, or -1 if it does not fit.
+ */
+int append_answer_record(unsigned char *resp, int resp_len, int resp_cap, int type,
+                         unsigned int ttl, const unsigned char *rdata, int rdlen);
+
+/**
+ * @brief Encodes a dotted domain name in DNS wire format.
+ *
+ * @param name Domain name, with or without a trailing dot.
+ * @param out Output buffer.
+ * @param cap Capacity of @p out.
+ * @return Number of bytes written, or -1 if the name is invalid or too long.
+ */
+int dns_encode_name(const char *name, unsigned char *out, int cap);
+
 /**
  * @brief Extracts the queried domain name, type, and class from a DNS message.
  *
@@ -98,18 +176,26 @@ void extract_domain(const unsigned char *buf, int buf_len, char *domain,
 int is_blacklisted(const char *name, Config *cfg);
 
 /**
- * @brief Forwards a DNS query to the upstream server and sends back the response.
+ * @brief Sends the client the outcome of its upstream exchange.
+ *
+ * A reply is cached and relayed. Without one, the client gets SERVFAIL if
+ * every upstream is out of rotation, and nothing otherwise.
  *
  * @param sock UDP socket used for communication.
- * @param buffer DNS query buffer to forward.
+ * @param query The client's query.
  * @param len Length of the query.
- * @param upstream_dns IP address or hostname of the upstream DNS server.
- * @param upstream_port Port of the upstream DNS server.
+ * @param reply Reply from upstream_receive() (also used to build SERVFAIL).
+ * @param reply_len Its length, or -1 if the exchange failed.
+ * @param reply_cap Capacity of @p reply.
+ * @param upstream Upstream server state.
  * @param client Client address to send the response to.
  * @param client_len Length of the client address structure.
+ * @param cache Cache that keeps the response, or NULL.
+ * @return 0 if a reply was sent to the client, -1 if none was.
  */
-void forward_to_upstream(int sock, unsigned char *buffer, int len, 
-                        const char *upstream_dns, int upstream_port,
-                        struct sockaddr_in *client, socklen_t client_len);
+int relay_upstream_reply(int sock, const unsigned char *query, int len, unsigned char *reply,
+                         int reply_len, int reply_cap, const Upstream *upstream,
+                         const struct sockaddr_in *client, socklen_t client_len,
+                         ResponseCache *cache);
 
 #endif
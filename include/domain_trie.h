@@ -0,0 +1,270 @@
+#ifndef DOMAIN_TRIE_H
+#define DOMAIN_TRIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Verdict stored on a trie node.
+ */
+enum {
+    DT_NONE = 0,     /**< No policy for this scope. */
+    DT_BLOCK = 1,    /**< Blocked using the client group's response mode. */
+    DT_ALLOW = 2,    /**< Allowed (RPZ passthru), overriding any block. */
+    DT_NXDOMAIN = 3, /**< Answer NXDOMAIN regardless of the response mode. */
+    DT_NODATA = 4,   /**< Answer NOERROR with an empty answer section. */
+    DT_LOCAL = 5,    /**< Answer with the records attached to the node. */
+    DT_DROP = 6      /**< Send no answer at all. */
+};
+
+/**
+ * @brief Which names a verdict applies to.
+ */
+enum {
+    DT_SCOPE_SELF = 1, /**< The listed name itself. */
+    DT_SCOPE_SUB = 2,  /**< Every name below the listed name. */
+    DT_SCOPE_BOTH = 3  /**< The name and all of its subdomains (list semantics). */
+};
+
+/**
+ * @brief One label of a reversed domain name.
+ *
+ * Nodes are stored in a flat array; children are not linked explicitly but
+ * found through the trie's hash table keyed by (parent index, label).
+ */
+typedef struct {
+    uint32_t parent;     /**< Index of the parent node (0 is the root). */
+    uint32_t label_off;  /**< Offset of the label text in the label arena. */
+    uint32_t hash;       /**< Cached hash of (parent, label). */
+    uint8_t label_len;   /**< Length of the label in bytes. */
+    uint8_t verdict;     /**< DT_* verdict for the name itself. */
+    uint8_t sub;         /**< DT_* verdict for names below this one. */
+} TrieNode;
+
+/**
+ * @brief Resource record attached to a DT_LOCAL name.
+ */
+typedef struct {
+    uint32_t key;        /**< Owner: node index * 2 + (1 for DT_SCOPE_SUB). */
+    uint32_t next;       /**< Next record of the same owner (index + 1), or 0. */
+    uint32_t ttl;        /**< TTL to answer with. */
+    uint32_t off;        /**< Offset of the RDATA in the data arena. */
+    uint16_t type;       /**< RR type (A, AAAA, CNAME). */
+    uint16_t len;        /**< RDATA length in bytes. */
+} TrieData;
+
+/**
+ * @brief Result of a trie lookup.
+ */
+typedef struct {
+    int verdict;         /**< DT_* verdict that applies to the query name. */
+    uint32_t node;       /**< Node carrying the verdict (0 if none). */
+    int scope;           /**< DT_SCOPE_SELF or DT_SCOPE_SUB. */
+} TrieMatch;
+
+/**
+ * @brief Compiled suffix-match structure for domain names.
+ *
+ * Names are stored label by label starting from the TLD, so a single walk
+ * from the right end of a query name finds every listed suffix of it.
+ */
+typedef struct {
+    TrieNode *nodes;     /**< Node array; nodes[0] is the root. */
+    size_t node_count;   /**< Number of nodes in use. */
+    size_t node_cap;     /**< Allocated node capacity. */
+    uint32_t *slots;     /**< Open-addressing table of node indices (0 = empty). */
+    size_t slot_mask;    /**< Table size minus one (size is a power of two). */
+    char *labels;        /**< Arena holding lower-cased label text. */
+    size_t labels_len;   /**< Bytes used in the label arena. */
+    size_t labels_cap;   /**< Allocated size of the label arena. */
+    size_t entries;      /**< Number of names carrying a verdict. */
+
+    TrieData *data;      /**< Local-data records. */
+    size_t data_count;   /**< Number of records (including removed ones). */
+    size_t data_cap;     /**< Allocated record capacity. */
+    uint32_t *data_slots;/**< Owner key to first record (index + 1), open addressing. */
+    size_t data_mask;    /**< Record table size minus one, or 0 before first use. */
+    size_t data_used;    /**< Occupied record-table slots. */
+    unsigned char *rdata;/**< Arena holding record RDATA. */
+    size_t rdata_len;    /**< Bytes used in the RDATA arena. */
+    size_t rdata_cap;    /**< Allocated size of the RDATA arena. */
+} DomainTrie;
+
+/**
+ * @brief Creates an empty trie.
+ *
+ * @return Newly allocated trie, or NULL on allocation failure.
+ */
+DomainTrie *domain_trie_new(void);
+
+/**
+ * @brief Releases a trie and all memory it owns.
+ *
+ * @param t Trie to free (may be NULL).
+ */
+void domain_trie_free(DomainTrie *t);
+
+/**
+ * @brief Adds a domain name that applies to itself and all subdomains.
+ *
+ * @param t Trie to modify.
+ * @param name Domain name in dotted notation (case-insensitive).
+ * @param verdict DT_* verdict to attach to the name. DT_ALLOW is never
+ *        downgraded to another verdict by a later insert of the same name.
+ * @return 0 on success, 1 if an existing DT_ALLOW was kept instead, -1 on
+ *         invalid name or allocation failure.
+ */
+int domain_trie_insert(DomainTrie *t, const char *name, int verdict);
+
+/**
+ * @brief Adds a domain name with a verdict for the given scope only.
+ *
+ * @param t Trie to modify.
+ * @param name Domain name in dotted notation (case-insensitive).
+ * @param verdict DT_* verdict (same DT_ALLOW rule as domain_trie_insert()).
+ * @param scope DT_SCOPE_* bits the verdict applies to.
+ * @return 0 on success, 1 if an existing DT_ALLOW was kept in any of the
+ *         scopes, -1 on invalid name or allocation failure.
+ */
+int domain_trie_insert_scoped(DomainTrie *t, const char *name, int verdict, int scope);
+
+/**
+ * @brief Grows the trie so that more nodes and label text fit without
+ *        reallocating or rehashing.
+ *
+ * @param t Trie to grow.
+ * @param nodes Number of nodes to make room for.
+ * @param label_bytes Bytes of label text to make room for.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int domain_trie_reserve(DomainTrie *t, size_t nodes, size_t label_bytes);
+
+/**
+ * @brief Adds every name and verdict of @p src to @p dst.
+ *
+ * Verdicts combine as if each name had been inserted into @p dst (an
+ * existing DT_ALLOW is kept). Local-data records are not copied.
+ *
+ * Lookups in @p dst are skipped below nodes created at index @p fresh or
+ * later, other than children of the root. Pass @c dst->node_count for a
+ * general merge. When merging several tries whose names are partitioned
+ * by their last two labels, pass the node count from before the first
+ * merge, so that only top-level labels are looked up.
+ *
+ * @param dst Trie to modify.
+ * @param src Trie to copy from.
+ * @param fresh First node index of @p dst treated as newly created.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int domain_trie_merge(DomainTrie *dst, const DomainTrie *src, size_t fresh);
+
+/**
+ * @brief Clears the verdict of a name for the given scope.
+ *
+ * Nodes are kept, so removal never reorganizes the structure.
+ *
+ * @param t Trie to modify.
+ * @param name Domain name in dotted notation.
+ * @param scope DT_SCOPE_* bits to clear.
+ * @param verdict Verdict to clear; a slot holding another one is left alone.
+ *        DT_NONE clears whatever verdict the name has.
+ * @return 1 if a verdict was cleared, 0 if the name had none to clear.
+ */
+int domain_trie_remove(DomainTrie *t, const char *name, int scope, int verdict);
+
+/**
+ * @brief Attaches a local-data record to a name and marks it DT_LOCAL.
+ *
+ * @param t Trie to modify.
+ * @param name Owner name in dotted notation.
+ * @param scope DT_SCOPE_SELF or DT_SCOPE_SUB.
+ * @param type RR type.
+ * @param ttl Record TTL.
+ * @param rdata Record data in wire format.
+ * @param len Length of @p rdata.
+ * @return 0 on success, 1 if the name is DT_ALLOW in that scope (nothing is
+ *         stored), -1 on invalid name or allocation failure.
+ */
+int domain_trie_add_data(DomainTrie *t, const char *name, int scope, int type,
+                         uint32_t ttl, const unsigned char *rdata, int len);
+
+/**
+ * @brief Removes one local-data record; clears DT_LOCAL when none remain.
+ *
+ * @return 1 if a record was removed, 0 otherwise.
+ */
+int domain_trie_remove_data(DomainTrie *t, const char *name, int scope, int type,
+                            const unsigned char *rdata, int len);
+
+/**
+ * @brief Returns the first local-data record of a match.
+ *
+ * Further records are reached through TrieData::next.
+ *
+ * @param t Trie that produced @p m.
+ * @param m Match with verdict DT_LOCAL.
+ * @return First record, or NULL if there is none.
+ */
+const TrieData *domain_trie_data(const DomainTrie *t, const TrieMatch *m);
+
+/**
+ * @brief Finds the policy that applies to a name by suffix matching.
+ *
+ * @param t Trie to search (may be NULL).
+ * @param name Domain name in dotted notation.
+ * @param m Output match; verdict is DT_NONE when nothing applies.
+ * @return The verdict stored in @p m.
+ */
+int domain_trie_match(const DomainTrie *t, const char *name, TrieMatch *m);
+
+/**
+ * @brief Like domain_trie_match(), for a name in DNS wire format.
+ *
+ * @param t Trie to search (may be NULL).
+ * @param qname Uncompressed wire-format name (length-prefixed labels ending
+ *        with a zero byte), e.g. the QNAME of a query.
+ * @param len Bytes available at @p qname.
+ * @param m Output match; verdict is DT_NONE when nothing applies or the
+ *        name is malformed.
+ * @return The verdict stored in @p m.
+ */
+int domain_trie_match_wire(const DomainTrie *t, const unsigned char *qname, size_t len,
+                           TrieMatch *m);
+
+/**
+ * @brief Finds the verdict for a name by suffix matching.
+ *
+ * @param t Trie to search (may be NULL).
+ * @param name Domain name in dotted notation.
+ * @return DT_ALLOW if any listed suffix is allowed, otherwise the verdict of
+ *         the longest listed suffix, or DT_NONE.
+ */
+int domain_trie_lookup(const DomainTrie *t, const char *name);
+
+/**
+ * @brief Reconstructs the dotted name of a node.
+ *
+ * @param t Trie that owns the node.
+ * @param node Node index (e.g. TrieMatch::node).
+ * @param buf Output buffer.
+ * @param cap Size of @p buf.
+ * @return Length of the name, or -1 if it does not fit.
+ */
+int domain_trie_name(const DomainTrie *t, uint32_t node, char *buf, size_t cap);
+
+/**
+ * @brief Returns non-zero if a verdict stops the query from being forwarded.
+ */
+static inline int domain_verdict_blocks(int verdict) {
+    return verdict != DT_NONE && verdict != DT_ALLOW;
+}
+
+/**
+ * @brief Returns the heap memory used by a trie, in bytes.
+ *
+ * @param t Trie to measure (may be NULL).
+ * @return Number of bytes allocated for nodes, hash slots, labels and records.
+ */
+size_t domain_trie_memory(const DomainTrie *t);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef LIST_LOADER_H
+#define LIST_LOADER_H
+
+#include "config.h"
+
+#define LIST_LOADER_MAX_THREADS 64
+#define LIST_LOADER_CHUNK_BYTES (1 << 20) /**< Input bytes per worker thread, at least. */
+
+/**
+ * @brief Loads a list file with one domain per line into a compiled list.
+ *
+ * Both plain lists and hosts-file lines (`0.0.0.0 example.com`) are
+ * accepted; for the latter the last field is used. Text after `#` is
+ * ignored.
+ *
+ * The file is read into memory and split at line boundaries into one slice
+ * per worker thread. Workers parse their slices in parallel, then each
+ * builds a partial trie from the names in one partition (by hash of the
+ * last two labels). The partial tries are joined with domain_trie_merge().
+ * Small files are handled on the calling thread alone.
+ *
+ * @param path Path of the list file.
+ * @param trie Destination trie.
+ * @param verdict DT_BLOCK or DT_ALLOW.
+ * @param threads Maximum number of worker threads (0 = online CPUs).
+ * @param st Load statistics to update.
+ * @return 0 on success, -1 if the file cannot be read or memory runs out.
+ */
+int list_load_file(const char *path, DomainTrie *trie, int verdict, int threads, LoadStats *st);
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef LOUDS_H
+#define LOUDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "domain_trie.h"
+#include "sorted_set.h"
+
+#define LOUDS_MAGIC "DNSLOUDS"
+#define LOUDS_VERSION 1
+
+/**
+ * @brief Header at the start of a LOUDS image, in memory and on disk.
+ *
+ * All offsets are in bytes from the start of the image and 8-byte aligned.
+ * Images use the host's byte order and are meant to be built and mapped
+ * on the same architecture.
+ */
+typedef struct {
+    char magic[8];            /**< LOUDS_MAGIC, not NUL-terminated. */
+    uint32_t version;         /**< LOUDS_VERSION. */
+    uint32_t header_size;     /**< sizeof(LoudsHeader). */
+    uint64_t edges;           /**< Number of edges (key bytes). */
+    uint64_t nodes;           /**< Number of nodes, the root included. */
+    uint64_t names;           /**< Number of listed names. */
+    uint64_t off_labels;      /**< Edge label bytes, one per edge. */
+    uint64_t off_has_child;   /**< Bit per edge: the edge leads to a node. */
+    uint64_t off_louds;       /**< Bit per edge: the edge is the first of its node. */
+    uint64_t off_is_name;     /**< Bit per edge: the edge ends a listed name. */
+    uint64_t off_has_child_rank; /**< Rank directory of has_child. */
+    uint64_t off_louds_rank;  /**< Rank directory of louds. */
+    uint64_t off_is_name_rank;/**< Rank directory of is_name. */
+    uint64_t off_louds_select;/**< Select samples of louds. */
+    uint64_t off_flags;       /**< Verdict byte per listed name. */
+    uint64_t size;            /**< Total image size. */
+} LoudsHeader;
+
+/**
+ * @brief Succinct trie of label-reversed names (LOUDS-sparse encoding).
+ *
+ * The trie is stored level by level: every edge carries one key byte and
+ * three bits (leads to a child node, starts a node, ends a listed name).
+ * Child nodes are reached with rank/select over those bit vectors, so the
+ * structure needs no pointers and costs about 11 bits per distinct key
+ * byte plus a byte of verdicts per name. Keys are the sorted-set keys
+ * (`com|example|ads`), so names sharing a suffix share their path.
+ *
+ * The whole structure is one position-independent image: built in memory,
+ * written with louds_write(), and loaded again with louds_map() without
+ * any parsing.
+ */
+typedef struct {
+    const unsigned char *image;  /**< Start of the image. */
+    size_t image_len;            /**< Image size in bytes. */
+    int mapped;                  /**< Non-zero if @c image is an mmap()ed file. */
+    const uint8_t *labels;       /**< Edge labels. */
+    const uint64_t *has_child;   /**< Has-child bits. */
+    const uint64_t *louds;       /**< Node-start bits. */
+    const uint64_t *is_name;     /**< Name-end bits. */
+    const uint32_t *has_child_rank; /**< Ones before each 512-bit block of @c has_child. */
+    const uint32_t *louds_rank;  /**< Ones before each 512-bit block of @c louds. */
+    const uint32_t *is_name_rank;/**< Ones before each 512-bit block of @c is_name. */
+    const uint32_t *louds_select;/**< Word holding every 64th one of @c louds. */
+    const uint8_t *flags;        /**< Verdict (low nibble) and subdomain verdict (high nibble). */
+    size_t edges;                /**< Number of edges. */
+    size_t nodes;                /**< Number of nodes. */
+    size_t names;                /**< Number of listed names. */
+} LoudsTrie;
+
+/**
+ * @brief Builds a LOUDS trie holding every name and verdict of a trie.
+ *
+ * @param t Source trie. Local-data records (DT_LOCAL) cannot be represented.
+ * @return Newly allocated trie, or NULL if @p t holds local data or memory
+ *         runs out.
+ */
+LoudsTrie *louds_build(const DomainTrie *t);
+
+/**
+ * @brief Builds a LOUDS trie from a sorted set.
+ *
+ * @return Newly allocated trie, or NULL on allocation failure.
+ */
+LoudsTrie *louds_build_sorted(const SortedSet *s);
+
+/**
+ * @brief Writes the image of a LOUDS trie to a file.
+ *
+ * @return 0 on success, -1 on I/O error.
+ */
+int louds_write(const LoudsTrie *t, const char *path);
+
+/**
+ * @brief Maps an image written by louds_write() read-only into memory.
+ *
+ * @return Trie backed by the mapping, or NULL if the file cannot be
+ *         mapped or is not a valid image.
+ */
+LoudsTrie *louds_map(const char *path);
+
+/**
+ * @brief Releases a LOUDS trie (unmapping it if it was mapped).
+ *
+ * @param t Trie to free (may be NULL).
+ */
+void louds_free(LoudsTrie *t);
+
+/**
+ * @brief Finds the policy that applies to a name, with the semantics of
+ *        domain_trie_match().
+ *
+ * @param t Trie to search.
+ * @param name Domain name in dotted notation.
+ * @param m Output match; @c node is always 0.
+ * @return The verdict stored in @p m.
+ */
+int louds_match(const LoudsTrie *t, const char *name, TrieMatch *m);
+
+/**
+ * @brief Visits every listed name in dotted notation.
+ *
+ * @param fn Callback; a non-zero return value stops the walk.
+ * @return 0, or the first non-zero value returned by @p fn.
+ */
+int louds_foreach(const LoudsTrie *t, int (*fn)(const char *name, void *ctx), void *ctx);
+
+/**
+ * @brief Returns the memory used by a trie, in bytes (mapped or heap).
+ *
+ * @param t Trie to measure (may be NULL).
+ */
+size_t louds_memory(const LoudsTrie *t);
+
+#endif
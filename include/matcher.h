@@ -0,0 +1,116 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <stddef.h>
+#include "domain_trie.h"
+
+/**
+ * @brief Operations of one list-matcher backend.
+ *
+ * Every backend answers the same question as domain_trie_match(): which
+ * block/allow/RPZ verdict applies to a name, by suffix. Lists are always
+ * parsed into a DomainTrie first; a backend's @c build converts that trie
+ * into its own representation.
+ */
+typedef struct {
+    const char *name;     /**< Name used by the `matcher` config key. */
+    /** Builds the backend from compiled lists, or NULL to use the trie as is. */
+    void *(*build)(const DomainTrie *lists);
+    /** Suffix lookup of a dotted name. */
+    int (*match)(const void *impl, const char *name, TrieMatch *m);
+    /** Suffix lookup of a wire-format name, or NULL to decode and use @c match. */
+    int (*match_wire)(const void *impl, const unsigned char *qname, size_t len, TrieMatch *m);
+    /** Visits every listed name in dotted notation; non-zero from @p fn stops. */
+    int (*foreach)(const void *impl, int (*fn)(const char *name, void *ctx), void *ctx);
+    /** Number of listed names. */
+    size_t (*count)(const void *impl);
+    /** Memory used, in bytes. */
+    size_t (*memory)(const void *impl);
+    /** Releases the backend. */
+    void (*free)(void *impl);
+} MatcherOps;
+
+/**
+ * @brief A built matcher: a backend and its data.
+ *
+ * A zeroed Matcher is empty and matches nothing.
+ */
+typedef struct {
+    const MatcherOps *ops;  /**< Backend, or NULL if empty. */
+    void *impl;             /**< Backend data. */
+} Matcher;
+
+extern const MatcherOps matcher_trie;   /**< Hashed label trie: fastest, supports live RPZ updates. */
+extern const MatcherOps matcher_sorted; /**< Front-coded sorted array: small, read-only. */
+extern const MatcherOps matcher_louds;  /**< Succinct trie: small, fast misses, read-only, mmap-loadable. */
+
+/**
+ * @brief Finds a backend by its config name (case-insensitive).
+ *
+ * @return The backend, or NULL if the name is unknown.
+ */
+const MatcherOps *matcher_find(const char *name);
+
+/**
+ * @brief Returns the backend at @p i of the built-in list, or NULL past the end.
+ */
+const MatcherOps *matcher_backend(size_t i);
+
+/**
+ * @brief Builds a matcher from compiled lists.
+ *
+ * On success the matcher owns @p lists: the trie backend keeps it, the
+ * others free it once converted. On failure @p lists is left untouched.
+ *
+ * @param m Matcher to fill.
+ * @param ops Backend to build.
+ * @param lists Compiled lists.
+ * @return 0 on success, -1 if the backend cannot represent the lists (for
+ *         example RPZ local data) or memory runs out.
+ */
+int matcher_build(Matcher *m, const MatcherOps *ops, DomainTrie *lists);
+
+/**
+ * @brief Wraps already-built backend data (e.g. a mapped LOUDS image).
+ */
+void matcher_wrap(Matcher *m, const MatcherOps *ops, void *impl);
+
+/**
+ * @brief Finds the policy that applies to a dotted name.
+ *
+ * @return The verdict stored in @p tm.
+ */
+int matcher_match(const Matcher *m, const char *name, TrieMatch *tm);
+
+/**
+ * @brief Finds the policy that applies to a wire-format name.
+ *
+ * @param qname Uncompressed wire-format name, e.g. a query's QNAME.
+ * @param len Bytes available at @p qname.
+ * @return The verdict stored in @p tm (DT_NONE for malformed names).
+ */
+int matcher_match_wire(const Matcher *m, const unsigned char *qname, size_t len, TrieMatch *tm);
+
+/**
+ * @brief Visits every listed name in dotted notation.
+ *
+ * @return 0, or the first non-zero value returned by @p fn.
+ */
+int matcher_foreach(const Matcher *m, int (*fn)(const char *name, void *ctx), void *ctx);
+
+/**
+ * @brief Returns the number of listed names (0 for an empty matcher).
+ */
+size_t matcher_count(const Matcher *m);
+
+/**
+ * @brief Returns the memory used by a matcher, in bytes.
+ */
+size_t matcher_memory(const Matcher *m);
+
+/**
+ * @brief Releases a matcher's data and empties it.
+ */
+void matcher_free(Matcher *m);
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef NETOPT_H
+#define NETOPT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+struct timespec;
+
+#define NETOPT_GSO_SEGMENTS 64    /**< Most replies per UDP GSO send (the kernel's limit before 6.9). */
+#define NETOPT_GSO_BYTES 65507    /**< Largest UDP payload over IPv4. */
+#define NETOPT_GSO_MAX_SEGMENT 1472 /**< Largest reply coalesced: a 1500-byte MTU less IPv4 and UDP headers. */
+
+/**
+ * @brief Kernel socket options applied to a listening socket.
+ */
+typedef struct {
+    int rcvbuf;      /**< Receive buffer in bytes (0 = kernel default). */
+    int sndbuf;      /**< Send buffer in bytes (0 = kernel default). */
+    int pmtud_omit;  /**< Ignore path-MTU discovery (IP_PMTUDISC_OMIT). */
+    int timestamps;  /**< Ask for kernel receive timestamps (SO_TIMESTAMPING or SO_TIMESTAMPNS). */
+    int gso;         /**< Coalesce replies to one client with UDP_SEGMENT. */
+    int gro;         /**< Accept coalesced query bursts (UDP_GRO). */
+} NetOptions;
+
+/**
+ * @brief What the kernel reported about received packets.
+ */
+typedef struct {
+    int rcvbuf;             /**< Effective receive buffer, comparable to NetOptions::rcvbuf. */
+    int sndbuf;             /**< Effective send buffer. */
+    uint32_t kernel_drops;  /**< Packets dropped on a full receive buffer (SO_RXQ_OVFL). */
+    int gso;                /**< The kernel accepted UDP_SEGMENT. */
+    int gro;                /**< The kernel accepted UDP_GRO. */
+    unsigned long gro_receives; /**< Receives that returned a coalesced burst. */
+    unsigned long gro_segments; /**< Queries those bursts carried. */
+} NetStats;
+
+/**
+ * @brief One coalesced UDP GRO receive, handed out a segment at a time.
+ */
+typedef struct GroBuffer GroBuffer;
+
+/**
+ * @brief Replies waiting to go out as one UDP GSO send.
+ *
+ * Consecutive replies of equal size to the same client are gathered and
+ * sent with a single sendmsg() carrying UDP_SEGMENT; the kernel (or NIC)
+ * splits them into datagrams again. A shorter reply may end a run. Replies
+ * larger than NETOPT_GSO_MAX_SEGMENT are never coalesced, since segments
+ * above the path MTU would be fragmented or refused. A send the kernel
+ * rejects with EINVAL goes out one sendto() per reply; if the kernel does
+ * not support the offload at all, the batch stops coalescing for good.
+ */
+typedef struct {
+    int sock;                   /**< Socket replies are sent from. */
+    int gso;                    /**< Coalescing enabled (cleared if the kernel lacks it). */
+    struct sockaddr_in to;      /**< Client of the pending run. */
+    socklen_t to_len;           /**< Length of @c to. */
+    size_t segment;             /**< Size of each reply in the run. */
+    int count;                  /**< Replies pending. */
+    size_t len;                 /**< Bytes pending. */
+    unsigned long gso_sends;    /**< Coalesced sends made. */
+    unsigned long gso_replies;  /**< Replies those sends carried. */
+    unsigned char data[NETOPT_GSO_BYTES]; /**< Pending replies, back to back. */
+} ReplyBatch;
+
+/**
+ * @brief Applies @p o to a socket and turns on drop counting.
+ *
+ * Buffer sizes above the net.core.rmem_max/wmem_max sysctls are retried
+ * with SO_RCVBUFFORCE/SO_SNDBUFFORCE, which need CAP_NET_ADMIN; a buffer
+ * that still ends up smaller than requested is reported. IP_PMTUDISC_OMIT
+ * keeps replies from being fragmented according to (possibly forged)
+ * ICMP "fragmentation needed" messages. Receive timestamps are software
+ * stamps taken when the packet entered the stack, before it waited in the
+ * socket buffer. GSO and GRO support is probed and recorded in @p st.
+ *
+ * @param sock UDP socket.
+ * @param o Options to apply.
+ * @param st Receives the effective buffer sizes.
+ * @return 0 if every option was applied, -1 if any was not (the socket
+ *         stays usable).
+ */
+int netopt_apply(int sock, const NetOptions *o, NetStats *st);
+
+/**
+ * @brief Receives one datagram and the kernel's ancillary data.
+ *
+ * Works like recvfrom(); additionally updates @p st->kernel_drops from the
+ * SO_RXQ_OVFL counter the kernel attaches after drops.
+ *
+ * @param rx If not NULL, receives the kernel's CLOCK_REALTIME receive
+ *           timestamp, or zero if the datagram carried none.
+ * @return Bytes received, or -1 with errno set.
+ */
+ssize_t netopt_recv(int sock, void *buf, size_t cap, struct sockaddr_in *from,
+                    socklen_t *from_len, int flags, NetStats *st, struct timespec *rx);
+
+/**
+ * @brief Receives the next query, splitting UDP GRO bursts.
+ *
+ * With @p g NULL this is netopt_recv(). Otherwise a coalesced burst is
+ * received into @p g once and its segments are returned by this and the
+ * following calls, without a system call and regardless of @p flags, each
+ * with the burst's sender and timestamp.
+ */
+ssize_t netopt_recv_segment(int sock, GroBuffer *g, void *buf, size_t cap,
+                            struct sockaddr_in *from, socklen_t *from_len, int flags,
+                            NetStats *st, struct timespec *rx);
+
+/**
+ * @brief Allocates an empty GRO buffer, or returns NULL.
+ */
+GroBuffer *gro_buffer_new(void);
+
+/**
+ * @brief Releases a GRO buffer (NULL is ignored).
+ */
+void gro_buffer_free(GroBuffer *g);
+
+/**
+ * @brief Prepares an empty reply batch for @p sock.
+ *
+ * @param gso Non-zero to coalesce (normally NetStats::gso).
+ */
+void reply_batch_init(ReplyBatch *b, int sock, int gso);
+
+/**
+ * @brief Sends a reply, or queues it to go out with the replies around it.
+ *
+ * Without GSO, or for a reply above NETOPT_GSO_MAX_SEGMENT, this sends the
+ * pending replies and then @p data with a plain sendto(). Call
+ * reply_flush() before the loop may block, so no reply waits for the next
+ * query.
+ */
+void reply_send(ReplyBatch *b, const struct sockaddr_in *to, socklen_t to_len,
+                const void *data, size_t len);
+
+/**
+ * @brief Sends every pending reply.
+ */
+void reply_flush(ReplyBatch *b);
+
+/**
+ * @brief Returns how long ago a kernel receive timestamp was taken, in ms.
+ *
+ * This is the time the datagram spent in the socket buffer (plus the
+ * receive call itself). Kernel stamps use CLOCK_REALTIME, so a clock step
+ * can make the age meaningless; negative ages are clamped to 0.
+ *
+ * @param rx Timestamp from netopt_recv(); zero gives 0.
+ */
+double netopt_age_ms(const struct timespec *rx);
+
+#endif
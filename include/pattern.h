@@ -0,0 +1,103 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PATTERN_MAX_DFA_STATES 65536
+
+#define PATTERN_ANCHOR_START 1 /**< Rule must match from the first byte. */
+#define PATTERN_ANCHOR_END 2   /**< Rule must match up to the last byte. */
+
+/**
+ * @brief Deterministic automaton over byte equivalence classes.
+ */
+typedef struct {
+    uint8_t classmap[256]; /**< Byte to equivalence-class mapping. */
+    int nclasses;          /**< Number of byte equivalence classes. */
+    int nstates;           /**< Number of states (state 0 is the dead state). */
+    int start;             /**< Initial state. */
+    int32_t *trans;        /**< Transition table, nstates x nclasses. */
+    int32_t *accept;       /**< Rule accepted at end of input in each state, or -1. */
+} PatternDfa;
+
+/**
+ * @brief Set of regular-expression and glob rules compiled for one-pass matching.
+ *
+ * Rules are collected with pattern_set_add() and determinized by
+ * pattern_set_compile(). Rules anchored at the start of the name and
+ * floating rules are kept in two automata that are stepped together in
+ * the same loop, which keeps counted anchored rules (`^[a-z]{20,}`) from
+ * multiplying the state count of the floating ones. Matching costs two
+ * table lookups per byte of the query name no matter how many rules exist.
+ *
+ * Supported regex syntax: literals, `.`, `[...]` classes with ranges and
+ * negation, `\d \w \s` (and upper-case negations), grouping `( )`, `|`,
+ * `* + ?`, `{m}`, `{m,}`, `{m,n}`, and `^`/`$` anchors at the ends of a
+ * pattern. Unanchored patterns match anywhere in the name. Globs support
+ * `*` and `?` and must match the whole name. Matching is case-insensitive.
+ */
+typedef struct {
+    char **sources;        /**< Original rule text, indexed by rule number. */
+    int *roots;            /**< AST root of each rule (builder state). */
+    uint8_t *anchors;      /**< PATTERN_ANCHOR_* bits of each rule. */
+    int count;             /**< Number of rules added. */
+    int cap;               /**< Allocated capacity of the per-rule arrays. */
+    void *ast;             /**< AST node pool (builder state, freed on compile). */
+    int ast_count;         /**< Number of AST nodes in use. */
+    int ast_cap;           /**< Allocated AST node capacity. */
+
+    int compiled;          /**< Non-zero once pattern_set_compile() succeeded. */
+    PatternDfa dfa[2];     /**< Automata for start-anchored [0] and floating [1] rules. */
+} PatternSet;
+
+/**
+ * @brief Creates an empty pattern set.
+ *
+ * @return Newly allocated set, or NULL on allocation failure.
+ */
+PatternSet *pattern_set_new(void);
+
+/**
+ * @brief Releases a pattern set.
+ *
+ * @param ps Set to free (may be NULL).
+ */
+void pattern_set_free(PatternSet *ps);
+
+/**
+ * @brief Parses a rule and adds it to the set.
+ *
+ * @param ps Set that has not been compiled yet.
+ * @param pattern Rule text.
+ * @param is_glob Non-zero to interpret @p pattern as a glob, zero for a regex.
+ * @return Rule number on success, -1 on syntax error or allocation failure.
+ */
+int pattern_set_add(PatternSet *ps, const char *pattern, int is_glob);
+
+/**
+ * @brief Builds the automata for all rules added so far.
+ *
+ * @param ps Set to compile.
+ * @return 0 on success, -1 if an automaton exceeds PATTERN_MAX_DFA_STATES
+ *         or memory runs out.
+ */
+int pattern_set_compile(PatternSet *ps);
+
+/**
+ * @brief Runs a name through the compiled automata in a single pass.
+ *
+ * @param ps Compiled set (may be NULL).
+ * @param name Domain name in dotted notation.
+ * @return Number of a matching rule, or -1 if none match.
+ */
+int pattern_set_match(const PatternSet *ps, const char *name);
+
+/**
+ * @brief Returns the heap memory used by the compiled automata, in bytes.
+ *
+ * @param ps Set to measure (may be NULL).
+ */
+size_t pattern_set_memory(const PatternSet *ps);
+
+#endif
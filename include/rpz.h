@@ -0,0 +1,57 @@
+#ifndef RPZ_H
+#define RPZ_H
+
+#include <stddef.h>
+#include "domain_trie.h"
+
+/**
+ * @brief Counters reported by the RPZ loader.
+ */
+typedef struct {
+    size_t added;        /**< Triggers or local-data records added. */
+    size_t removed;      /**< Triggers or local-data records removed. */
+    size_t unsupported;  /**< Records skipped (IP/NSDNAME triggers, unknown types). */
+    size_t malformed;    /**< Lines that could not be parsed. */
+} RpzStats;
+
+/**
+ * @brief Loads a response-policy zone file into a trie.
+ *
+ * QNAME triggers are supported with these actions:
+ *  - `CNAME .` -> NXDOMAIN
+ *  - `CNAME *.` -> NODATA
+ *  - `CNAME rpz-passthru.` -> passthru (allow)
+ *  - `CNAME rpz-drop.` -> drop
+ *  - `A`, `AAAA` or any other `CNAME` target -> local data
+ *
+ * An owner `name` triggers on that name only and `*.name` on its
+ * subdomains. `$ORIGIN` and `$TTL` directives are honoured; SOA and NS
+ * records at the apex are ignored. A trigger for an owner that already
+ * has passthru is ignored and not counted as added.
+ *
+ * @param path Zone file path.
+ * @param t Destination trie.
+ * @param st Optional counters to accumulate into (may be NULL).
+ * @return 0 on success, -1 if the file cannot be opened or memory runs out
+ *         (the records read so far stay applied).
+ */
+int rpz_load_file(const char *path, DomainTrie *t, RpzStats *st);
+
+/**
+ * @brief Applies an incremental update to a live trie.
+ *
+ * The update file uses zone-file syntax with every record prefixed by `+`
+ * (add) or `-` (remove); directives are written without a prefix. Changes
+ * are applied in place, so the cost is proportional to the size of the
+ * update, not of the policy. An added trigger replaces whatever action the
+ * owner had, passthru included.
+ *
+ * @param path Update file path.
+ * @param t Trie to modify.
+ * @param st Optional counters to accumulate into (may be NULL).
+ * @return 0 on success, -1 if the file cannot be opened or memory runs out
+ *         (the records read so far stay applied).
+ */
+int rpz_apply_update(const char *path, DomainTrie *t, RpzStats *st);
+
+#endif
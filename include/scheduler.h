@@ -0,0 +1,154 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define SCHED_PACKET 1500      /**< Largest query kept in the miss queue. */
+#define SCHED_QUEUE 256        /**< Queued misses before new ones are shed. */
+#define SCHED_BATCH 32         /**< Packets received per loop iteration. */
+#define SCHED_MISS_BUDGET 4    /**< Queued misses sent upstream per loop iteration. */
+#define LATENCY_BUCKETS 24     /**< Log2 microsecond buckets: up to about 16 s. */
+
+/**
+ * @brief A received query waiting for its turn to go upstream.
+ */
+typedef struct {
+    struct sockaddr_in client;        /**< Client address. */
+    socklen_t client_len;             /**< Length of @c client. */
+    int len;                          /**< Query length. */
+    double received_ms;               /**< Monotonic time recvmsg() returned it. */
+    double arrived_ms;                /**< Monotonic time the kernel received it (received_ms if unknown). */
+    unsigned char data[SCHED_PACKET]; /**< Query. */
+} SchedPacket;
+
+/**
+ * @brief FIFO of queries that missed every local answer (the slow class).
+ *
+ * Each loop iteration first receives and answers a batch of packets
+ * (blocked names and cache hits, the fast class), then relays the upstream
+ * replies that have arrived and sends at most SCHED_MISS_BUDGET queued
+ * misses. Sending does not wait for the reply: exchanges stay in flight
+ * while the loop goes on, so a hit waits for at most one batch and a few
+ * sends, never for an upstream round trip or timeout, and misses cannot
+ * starve either. Packets are received straight into the next free slot,
+ * which is committed only if the query misses.
+ */
+typedef struct {
+    SchedPacket *ring;       /**< SCHED_QUEUE slots. */
+    size_t head;             /**< Oldest queued packet. */
+    size_t count;            /**< Queued packets. */
+    size_t peak;             /**< Highest @c count seen. */
+    unsigned long overflows; /**< Misses shed because the queue was full. */
+} MissQueue;
+
+/**
+ * @brief Latency distribution in power-of-two microsecond buckets.
+ *
+ * Bucket 0 counts latencies below 2 us, bucket b (b > 0) those in
+ * [2^b, 2^(b+1)) us; the last bucket also takes everything longer.
+ */
+typedef struct {
+    unsigned long count[LATENCY_BUCKETS]; /**< Samples per bucket. */
+    unsigned long total;                  /**< Samples. */
+    double sum_us;                        /**< Sum of all samples. */
+    double max_us;                        /**< Largest sample. */
+} LatencyHistogram;
+
+/**
+ * @brief Adaptive busy polling of the listening socket.
+ *
+ * While enabled, the loop polls the socket without blocking, so a query
+ * is picked up microseconds after it arrives instead of after a wakeup.
+ * Once the socket has stayed empty for @c idle_limit_ms the loop blocks
+ * again until the next packet, so an idle proxy does not burn its CPU.
+ */
+typedef struct {
+    int enabled;               /**< Busy polling is on. */
+    double idle_limit_ms;      /**< Empty spinning before falling back to a blocking receive. */
+    double idle_since_ms;      /**< Start of the current run of empty polls, or -1. */
+    int polling;               /**< The last receive was non-blocking. */
+    unsigned long polls;       /**< Non-blocking receive attempts. */
+    unsigned long empty_polls; /**< Attempts that found nothing. */
+    unsigned long sleeps;      /**< Blocking receives after going idle. */
+} BusyPoll;
+
+/**
+ * @brief Allocates an empty miss queue.
+ *
+ * @return 0 on success, -1 if memory runs out.
+ */
+int miss_queue_init(MissQueue *q);
+
+/**
+ * @brief Releases a miss queue.
+ */
+void miss_queue_free(MissQueue *q);
+
+/**
+ * @brief Returns the slot the next packet should be received into.
+ *
+ * @return The slot, or NULL if the queue is full.
+ */
+SchedPacket *miss_queue_reserve(MissQueue *q);
+
+/**
+ * @brief Queues the packet in the slot returned by miss_queue_reserve().
+ */
+void miss_queue_commit(MissQueue *q);
+
+/**
+ * @brief Removes and returns the oldest queued packet, or NULL if empty.
+ *
+ * The slot stays valid until the next miss_queue_reserve().
+ */
+SchedPacket *miss_queue_pop(MissQueue *q);
+
+/**
+ * @brief Sets up busy polling (disabled when @p enabled is 0).
+ */
+void busy_poll_init(BusyPoll *b, int enabled, double idle_limit_ms);
+
+/**
+ * @brief Asks the kernel to busy-poll the device queue for the socket.
+ *
+ * Sets SO_BUSY_POLL to @p usec and, where available, SO_PREFER_BUSY_POLL.
+ * Raising SO_BUSY_POLL above the net.core.busy_read sysctl needs
+ * CAP_NET_ADMIN; without it the loop still spins in user space.
+ *
+ * @return 0 if the kernel accepted both options, -1 otherwise.
+ */
+int busy_poll_socket(int sock, int usec);
+
+/**
+ * @brief Returns the receive flags for the first receive of a loop iteration.
+ *
+ * @return MSG_DONTWAIT while spinning, 0 to block once idle for long enough.
+ */
+int busy_poll_flags(BusyPoll *b, double now_ms);
+
+/**
+ * @brief Records the outcome of that receive.
+ *
+ * @param received Non-zero if a packet was received.
+ */
+void busy_poll_update(BusyPoll *b, int received, double now_ms);
+
+/**
+ * @brief Records one latency sample.
+ */
+void latency_add(LatencyHistogram *h, double us);
+
+/**
+ * @brief Returns an upper bound of the @p p quantile (0 < p <= 1), in us.
+ */
+double latency_quantile(const LatencyHistogram *h, double p);
+
+/**
+ * @brief Prints count, mean, p50/p90/p99 (bucket upper bounds) and max on one line.
+ */
+void latency_print(const LatencyHistogram *h, const char *label, FILE *out);
+
+#endif
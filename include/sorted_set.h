@@ -0,0 +1,96 @@
+#ifndef SORTED_SET_H
+#define SORTED_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "domain_trie.h"
+
+#define SORTED_SET_BLOCK 16 /**< Names per front-coded block. */
+#define SORTED_SET_SEP 0x01 /**< Label separator inside keys; sorts below every label byte. */
+
+/**
+ * @brief Read-only name set stored as one sorted, front-coded byte array.
+ *
+ * Every listed name is kept as a key of its labels in reverse order
+ * (`ads.example.com` becomes `com|example|ads`, with a separator byte that
+ * sorts below any label character). Keys are sorted and cut into blocks of
+ * SORTED_SET_BLOCK; inside a block each key stores only the bytes that
+ * differ from the previous one. Blocks are found by binary search over
+ * their first keys, laid out in Eytzinger (breadth-first) order so that
+ * the first probes of every search share a few cache lines.
+ *
+ * This is the smallest of the matcher representations, at the cost of a
+ * binary search per label of the query name instead of one hash probe.
+ */
+typedef struct {
+    unsigned char *data;  /**< Front-coded blocks. */
+    size_t data_len;      /**< Bytes used in @c data. */
+    uint32_t *block_off;  /**< Offset of each block in @c data. */
+    uint32_t *eytz;       /**< Block indices in Eytzinger order, 1-based (eytz[0] unused). */
+    uint32_t *eytz_off;   /**< Head offsets in the same order, saving a load per probe. */
+    size_t nblocks;       /**< Number of blocks. */
+    size_t count;         /**< Number of names. */
+} SortedSet;
+
+/**
+ * @brief Builds a sorted set holding every name and verdict of a trie.
+ *
+ * @param t Source trie. Local-data records (DT_LOCAL) cannot be represented.
+ * @return Newly allocated set, or NULL if @p t holds local data or memory
+ *         runs out.
+ */
+SortedSet *sorted_set_build(const DomainTrie *t);
+
+/**
+ * @brief Releases a sorted set.
+ *
+ * @param s Set to free (may be NULL).
+ */
+void sorted_set_free(SortedSet *s);
+
+/**
+ * @brief Finds the policy that applies to a name, with the semantics of
+ *        domain_trie_match().
+ *
+ * @param s Set to search.
+ * @param name Domain name in dotted notation.
+ * @param m Output match; @c node is always 0.
+ * @return The verdict stored in @p m.
+ */
+int sorted_set_match(const SortedSet *s, const char *name, TrieMatch *m);
+
+/**
+ * @brief Writes the dotted form of the @p i-th name of the set.
+ *
+ * @return Length of the name, or -1 if @p i is out of range or the name
+ *         does not fit in @p cap bytes.
+ */
+int sorted_set_name(const SortedSet *s, size_t i, char *buf, size_t cap);
+
+/**
+ * @brief Callback for sorted_set_foreach().
+ *
+ * @param key Label-reversed key, labels separated by SORTED_SET_SEP.
+ * @param len Key length.
+ * @param verdict DT_* verdict for the name itself.
+ * @param sub DT_* verdict for names below it.
+ * @param ctx Caller context.
+ * @return 0 to continue, non-zero to stop.
+ */
+typedef int (*SortedSetVisit)(const unsigned char *key, size_t len, int verdict, int sub, void *ctx);
+
+/**
+ * @brief Visits every key of the set in sorted order.
+ *
+ * @return 0, or the first non-zero value returned by @p fn.
+ */
+int sorted_set_foreach(const SortedSet *s, SortedSetVisit fn, void *ctx);
+
+/**
+ * @brief Returns the heap memory used by a set, in bytes.
+ *
+ * @param s Set to measure (may be NULL).
+ */
+size_t sorted_set_memory(const SortedSet *s);
+
+#endif
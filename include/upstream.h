@@ -0,0 +1,256 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdint.h>
+#include <poll.h>
+#include <netinet/in.h>
+
+#define UPSTREAM_POOL_SIZE 16       /**< Sockets, each on its own source port. */
+#define UPSTREAM_PORT_USES 64       /**< Queries sent from a port before it is replaced. */
+#define UPSTREAM_TIMEOUT_MS 2000    /**< How long to wait for a valid reply. */
+#define UPSTREAM_MAX_REJECTS 16     /**< Rejected replies tolerated per query. */
+#define UPSTREAM_MAX_SERVERS 4      /**< Servers in rotation. */
+#define UPSTREAM_HEALTH_TICK_MS 50  /**< How often the caller should run health checks. */
+#define UPSTREAM_PROBE_MAX 272      /**< Room for a probe query (header, name, type, class). */
+#define UPSTREAM_MAX_PENDING 64     /**< Exchanges in flight at once. */
+#define UPSTREAM_QUESTION_MAX 259   /**< Longest question checked: a 255-byte QNAME, type and class. */
+
+/** Circuit-breaker states of an upstream server. */
+enum {
+    UPSTREAM_CLOSED,     /**< Healthy: in rotation. */
+    UPSTREAM_OPEN,       /**< Failing: out of rotation until the cooldown ends. */
+    UPSTREAM_HALF_OPEN   /**< Cooldown over: one probe decides whether it returns. */
+};
+
+/**
+ * @brief ChaCha20 keystream used as a fast CSPRNG.
+ *
+ * Seeded once from /dev/urandom; each 64-byte block yields sixteen
+ * 32-bit values, so a draw is a few nanoseconds on average.
+ */
+typedef struct {
+    uint32_t key[8];     /**< Secret key. */
+    uint64_t counter;    /**< Block counter. */
+    uint32_t block[16];  /**< Current keystream block. */
+    unsigned used;       /**< Words of @c block already returned. */
+} UpstreamRng;
+
+/**
+ * @brief Counters of the upstream exchange, including rejected replies.
+ *
+ * A reply is rejected when it comes from the wrong address, carries the
+ * wrong transaction ID or does not echo the question with the exact
+ * (0x20-randomized) casing sent. Such replies are the footprint of a
+ * cache-poisoning attempt, or occasionally of a reply arriving late.
+ */
+typedef struct {
+    unsigned long queries;       /**< Queries sent. */
+    unsigned long answered;      /**< Queries that got a valid reply. */
+    unsigned long timeouts;      /**< Queries that got none in time. */
+    unsigned long reject_limit;  /**< Queries abandoned after UPSTREAM_MAX_REJECTS rejected replies. */
+    unsigned long bad_source;    /**< Replies from an unexpected address or port. */
+    unsigned long bad_id;        /**< Replies with the wrong transaction ID. */
+    unsigned long bad_question;  /**< Replies whose question (or its casing) differs. */
+    unsigned long port_rotations;/**< Sockets replaced with a fresh random port. */
+    unsigned long unavailable;   /**< Queries failed at once because every server was out. */
+} UpstreamStats;
+
+/**
+ * @brief Health-check and circuit-breaker settings.
+ */
+typedef struct {
+    char name[256];      /**< Name the probes ask for (dotted, "." for the root). */
+    int interval_ms;     /**< Between probes of a server in rotation (0 = none). */
+    int timeout_ms;      /**< How long a probe may wait for its reply. */
+    int max_failures;    /**< Consecutive failures that open the breaker (0 = never). */
+    int cooldown_ms;     /**< Time out of rotation before a half-open probe. */
+} UpstreamHealth;
+
+/**
+ * @brief One upstream server and its circuit breaker.
+ *
+ * Client exchanges and probes both feed the breaker: a valid reply resets
+ * the failure count, a timeout, a send error or an unusable probe reply
+ * adds to it. Rejected replies, which anyone can send, never count. At
+ * max_failures the server leaves the rotation; once the cooldown is over a
+ * single probe is sent, and its answer either restores the server or
+ * starts another cooldown. No client query waits on a server in doubt.
+ */
+typedef struct {
+    struct sockaddr_in addr;      /**< Server address. */
+    int state;                    /**< UPSTREAM_CLOSED, UPSTREAM_OPEN or UPSTREAM_HALF_OPEN. */
+    int failures;                 /**< Consecutive failed exchanges and probes. */
+    double opened_ms;             /**< When the breaker last opened. */
+    double probed_ms;             /**< When the last probe was sent. */
+    int probing;                  /**< A probe is waiting for its reply. */
+    uint16_t probe_id;            /**< Its transaction ID. */
+    unsigned long trips;          /**< Times the breaker opened. */
+    unsigned long probes;         /**< Probes sent. */
+    unsigned long probe_failures; /**< Probes that timed out or got an error reply. */
+} UpstreamServer;
+
+/**
+ * @brief A query sent upstream whose reply has not been accepted yet.
+ *
+ * Found again by the pool slot its reply arrives on and the transaction ID
+ * it carries; it keeps what is needed to check the reply and to give it
+ * back the client's ID and QNAME casing.
+ */
+typedef struct {
+    int active;                   /**< Entry in use. */
+    int slot;                     /**< Pool socket the query went out on. */
+    int server;                   /**< Index of the server asked. */
+    uint16_t id;                  /**< Transaction ID sent. */
+    unsigned char client_id[2];   /**< The client's transaction ID. */
+    int qlen;                     /**< QNAME length, or -1 if the question is not checked. */
+    unsigned char question[UPSTREAM_QUESTION_MAX]; /**< Question as sent (randomized casing). */
+    unsigned char qname[UPSTREAM_QUESTION_MAX];    /**< QNAME with the client's casing. */
+    int rejects;                  /**< Rejected replies on its socket so far. */
+    double sent_ms;               /**< When the query went out. */
+} UpstreamPending;
+
+/**
+ * @brief Connection state for the upstream servers.
+ */
+typedef struct {
+    UpstreamServer servers[UPSTREAM_MAX_SERVERS]; /**< Servers, tried in turn. */
+    int count;                        /**< Servers configured. */
+    unsigned next;                    /**< Rotation position. */
+    UpstreamHealth health;            /**< Probe and breaker settings. */
+    int probe_sock;                   /**< Socket the probes use, -1 until the first. */
+    unsigned char probe[UPSTREAM_PROBE_MAX]; /**< Probe query (ID filled in per probe). */
+    int probe_len;                    /**< Its length. */
+    int socks[UPSTREAM_POOL_SIZE];    /**< Socket pool, -1 for a slot not open. */
+    unsigned uses[UPSTREAM_POOL_SIZE];/**< Queries sent from each socket. */
+    UpstreamRng rng;                  /**< Source of IDs, ports, slots and casing. */
+    UpstreamStats stats;              /**< Exchange counters. */
+    UpstreamPending pending[UPSTREAM_MAX_PENDING]; /**< Exchanges in flight. */
+    int in_flight;                    /**< Active entries of @c pending. */
+    int slot_in_flight[UPSTREAM_POOL_SIZE]; /**< Exchanges waiting on each socket. */
+    int recv_slot;                    /**< Socket upstream_receive() reads next. */
+} Upstream;
+
+/**
+ * @brief Seeds a generator from /dev/urandom.
+ *
+ * @return 0 on success, -1 if no kernel randomness was available (the
+ *         generator is then seeded from the clock and should not be trusted).
+ */
+int upstream_rng_seed(UpstreamRng *r);
+
+/**
+ * @brief Returns 32 random bits.
+ */
+uint32_t upstream_random(UpstreamRng *r);
+
+/**
+ * @brief Randomizes the case of every letter of a wire-format name (0x20).
+ *
+ * @param qname Name to modify.
+ * @param len Length of the name.
+ */
+void upstream_randomize_case(unsigned char *qname, int len, UpstreamRng *r);
+
+/**
+ * @brief Fills in the default health settings.
+ *
+ * Probes for the root every second with a 500 ms deadline; three
+ * consecutive failures take a server out of rotation for five seconds.
+ */
+void upstream_health_defaults(UpstreamHealth *h);
+
+/**
+ * @brief Prepares the upstreams: parses their addresses and seeds the generator.
+ *
+ * Sockets are opened lazily, each bound to a random source port.
+ *
+ * @param ips Comma-separated IPv4 addresses (at most UPSTREAM_MAX_SERVERS).
+ * @param port Upstream UDP port, shared by every server.
+ * @param health Probe and breaker settings, or NULL for the defaults.
+ * @return 0 on success, -1 if an address is invalid.
+ */
+int upstream_init(Upstream *u, const char *ips, int port, const UpstreamHealth *health);
+
+/**
+ * @brief Closes every pooled socket and the probe socket.
+ */
+void upstream_close(Upstream *u);
+
+/**
+ * @brief Returns the number of servers in rotation.
+ */
+int upstream_available(const Upstream *u);
+
+/**
+ * @brief Runs the health checks: collects probe replies, times out probes
+ *        and sends the probes that are due.
+ *
+ * Never blocks. Call it about every UPSTREAM_HEALTH_TICK_MS.
+ *
+ * @param now_ms Current monotonic time in milliseconds.
+ */
+void upstream_health_check(Upstream *u, double now_ms);
+
+/**
+ * @brief Sends a query upstream without waiting for the reply.
+ *
+ * The next server in rotation is used; if every breaker is open the call
+ * fails at once. The query goes out with a random transaction ID and
+ * randomized QNAME casing from a randomly chosen pooled port. A port due
+ * for rotation is replaced only once no exchange waits on it.
+ *
+ * @param query Client query.
+ * @param len Length of @p query.
+ * @param now_ms Current monotonic time in milliseconds.
+ * @return Handle of the exchange (an index into @c pending), or -1 on
+ *         error, with no server in rotation or with UPSTREAM_MAX_PENDING
+ *         exchanges already in flight.
+ */
+int upstream_send(Upstream *u, const unsigned char *query, int len, double now_ms);
+
+/**
+ * @brief Collects the next finished exchange. Never blocks.
+ *
+ * Reads the replies waiting on the pool sockets. Replies that fail any
+ * check are counted and ignored; each one also counts against every
+ * exchange waiting on that socket. An accepted reply is returned with the
+ * client's ID and QNAME casing restored. Once the sockets are empty,
+ * exchanges older than UPSTREAM_TIMEOUT_MS or with more than
+ * UPSTREAM_MAX_REJECTS rejected replies are given up. Call it until it
+ * returns -1.
+ *
+ * @param now_ms Current monotonic time in milliseconds.
+ * @param resp Output buffer for the reply.
+ * @param resp_cap Capacity of @p resp.
+ * @param resp_len Receives the length of the reply, or -1 if the exchange
+ *                 was given up.
+ * @return Handle of the finished exchange, or -1 if none has finished.
+ */
+int upstream_receive(Upstream *u, double now_ms, unsigned char *resp, int resp_cap,
+                     int *resp_len);
+
+/**
+ * @brief Fills in a poll entry for every pool socket an exchange waits on.
+ *
+ * @param fds Room for UPSTREAM_POOL_SIZE entries.
+ * @return Entries filled in.
+ */
+int upstream_poll_fds(const Upstream *u, struct pollfd *fds);
+
+/**
+ * @brief Sends a query upstream and waits for a valid reply.
+ *
+ * upstream_send() followed by upstream_receive() until that exchange ends,
+ * for callers with no other exchange in flight.
+ *
+ * @param query Client query.
+ * @param len Length of @p query.
+ * @param resp Output buffer for the reply.
+ * @param resp_cap Capacity of @p resp.
+ * @return Length of the reply, or -1 on error, timeout or with no server
+ *         in rotation.
+ */
+int upstream_exchange(Upstream *u, const unsigned char *query, int len, unsigned char *resp,
+                      int resp_cap);
+
+#endif
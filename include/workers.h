@@ -0,0 +1,90 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <sys/types.h>
+
+#define WORKERS_MAX 256 /**< Most worker processes started. */
+
+/**
+ * @brief How packets are spread over the workers' SO_REUSEPORT sockets.
+ */
+typedef enum {
+    STEER_KERNEL = 0, /**< The kernel's 4-tuple hash (no program). */
+    STEER_CLIENT,     /**< Hash of the client IP: one worker per client. */
+    STEER_QNAME       /**< Hash of the QNAME's start: one worker per name. */
+} SteerMode;
+
+/**
+ * @brief A set of worker processes sharing the listening port.
+ *
+ * Each worker is a process pinned to one CPU with its own SO_REUSEPORT
+ * socket, cache, upstream pool and queues. Everything a worker allocates
+ * after workers_start() is first touched on its pinned CPU, so the kernel's
+ * default local-allocation policy places it on that CPU's NUMA node.
+ */
+typedef struct {
+    int count;               /**< Workers, including the first (the parent). */
+    int index;               /**< This process's worker index (0 = parent). */
+    int cpu;                 /**< CPU this worker is pinned to, -1 if unpinned. */
+    int node;                /**< NUMA node of @c cpu, -1 if unknown. */
+    pid_t pids[WORKERS_MAX]; /**< Child PIDs (parent only; pids[0] unused). */
+} Workers;
+
+/**
+ * @brief Returns the NUMA node a CPU belongs to, or -1 if unknown.
+ */
+int worker_cpu_node(int cpu);
+
+/**
+ * @brief Forks @p count - 1 workers and pins every worker, parent included.
+ *
+ * Worker i is pinned to the i-th CPU the process may run on (wrapping
+ * around if there are fewer CPUs than workers).
+ *
+ * @param w Filled in for the calling process, in every worker.
+ * @param count Workers wanted (0 = one per allowed CPU).
+ * @param pin Non-zero to pin workers to CPUs.
+ * @return 0 in every worker, -1 if the workers could not be started.
+ */
+int workers_start(Workers *w, int count, int pin);
+
+/**
+ * @brief Opens the listening UDP socket of one worker.
+ *
+ * With @p reuseport the socket joins the port's SO_REUSEPORT group, and
+ * with @p cpu >= 0 it also asks (SO_INCOMING_CPU) for packets processed
+ * on that CPU, so a query stays on the core its NIC queue interrupted.
+ *
+ * @return The bound socket, or -1 on error.
+ */
+int worker_socket(int port, int reuseport, int cpu);
+
+/**
+ * @brief Attaches a classic BPF program that steers the socket's reuseport group.
+ *
+ * The program picks socket (hash % @p workers) of the group. In
+ * STEER_QNAME mode the hash covers the first 16 bytes of the QNAME,
+ * case-folded so 0x20-randomized queries agree; shorter queries fall back
+ * to the client IP. Sockets are indexed in the order they joined the
+ * group, and an index past the group's end makes the kernel use its own
+ * hash, so a missing worker degrades gracefully.
+ *
+ * @param sock A bound socket of the group.
+ * @param workers Sockets expected in the group.
+ * @param mode Steering mode (STEER_KERNEL attaches nothing).
+ * @return 0 on success, -1 if the kernel refused the program (the kernel
+ *         hash then stays in effect).
+ */
+int worker_steer(int sock, int workers, SteerMode mode);
+
+/**
+ * @brief Sends a signal to every child worker (parent only).
+ */
+void workers_signal(const Workers *w, int sig);
+
+/**
+ * @brief Waits for every child worker to exit (parent only).
+ */
+void workers_wait(Workers *w);
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef XDP_H
+#define XDP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define XDP_FRAME_SIZE 2048   /**< UMEM chunk: one Ethernet frame. */
+#define XDP_FRAMES 4096       /**< UMEM chunks (8 MiB). */
+#define XDP_RING 2048         /**< RX and TX ring entries. */
+#define XDP_HEADERS 42        /**< Ethernet + IPv4 (no options) + UDP. */
+
+/**
+ * @brief A producer/consumer ring shared with the kernel.
+ */
+typedef struct {
+    uint32_t *producer;   /**< Kernel- or user-advanced producer index. */
+    uint32_t *consumer;   /**< The other side's consumer index. */
+    uint32_t *flags;      /**< XDP_RING_NEED_WAKEUP and friends. */
+    void *desc;           /**< Entries: uint64_t addresses or struct xdp_desc. */
+    uint32_t size;        /**< Entries (a power of two). */
+    void *map;            /**< The mmap()ed region. */
+    size_t map_len;       /**< Its length. */
+} XdpRing;
+
+/**
+ * @brief Counters of the XDP datapath.
+ */
+typedef struct {
+    unsigned long received;   /**< Frames taken from the RX ring. */
+    unsigned long answered;   /**< Queries answered by rewriting the frame. */
+    unsigned long passed;     /**< Queries not answered in place (forwarded, shed or dropped). */
+    unsigned long malformed;  /**< Frames that were not a usable DNS query. */
+    unsigned long tx_full;    /**< Answers left to the socket on a full TX ring. */
+} XdpStats;
+
+/**
+ * @brief An AF_XDP socket bound to one queue of one interface.
+ *
+ * An XDP program on the interface redirects IPv4 UDP packets for the
+ * listening port into the socket's UMEM, and passes everything else to
+ * the kernel stack. Answers are written over the query's own frame and
+ * sent back out of the same queue, so a blocked or cached name never
+ * touches the kernel's UDP stack. The program and socket are removed
+ * when the process exits.
+ */
+typedef struct {
+    int fd;                  /**< AF_XDP socket. */
+    int map_fd;              /**< XSKMAP the program redirects through. */
+    int prog_fd;             /**< The XDP program. */
+    int link_fd;             /**< Attachment of the program to the interface. */
+    int queue;               /**< Interface queue bound to. */
+    unsigned char *umem;     /**< XDP_FRAMES frames of XDP_FRAME_SIZE bytes. */
+    XdpRing fill;            /**< Frames handed to the kernel for receiving. */
+    XdpRing comp;            /**< Frames the kernel has finished sending. */
+    XdpRing rx;              /**< Received frames. */
+    XdpRing tx;              /**< Frames to send. */
+    int tx_pending;          /**< Frames queued since the last kick. */
+    XdpStats stats;          /**< Counters. */
+} XdpPath;
+
+/**
+ * @brief A query received on the XDP path; its frame stays ours until
+ *        xdp_reply() or xdp_release().
+ */
+typedef struct {
+    uint64_t addr;              /**< Frame offset in the UMEM. */
+    unsigned char *frame;       /**< The frame. */
+    size_t frame_len;           /**< Its length. */
+    struct sockaddr_in client;  /**< Sender of the query. */
+    const unsigned char *data;  /**< DNS message inside the frame. */
+    size_t len;                 /**< DNS message length. */
+} XdpQuery;
+
+/**
+ * @brief Checks a frame is an IPv4 UDP datagram for @p port and locates it.
+ *
+ * @param frame Ethernet frame.
+ * @param len Frame length.
+ * @param port Listening port (host order).
+ * @param client Receives the sender's address.
+ * @param dns_len Receives the UDP payload length (the payload starts at
+ *                XDP_HEADERS).
+ * @return 0 if the frame carries a query, -1 if not.
+ */
+int xdp_parse(const unsigned char *frame, size_t len, uint16_t port, struct sockaddr_in *client,
+              size_t *dns_len);
+
+/**
+ * @brief Turns a query frame into its answer, in place.
+ *
+ * Swaps the Ethernet, IPv4 and UDP source and destination, replaces the
+ * payload with @p reply and fixes the lengths and the IPv4 checksum. The
+ * UDP checksum is left at zero, which IPv4 permits.
+ *
+ * @param frame Frame accepted by xdp_parse().
+ * @param cap Room in the frame buffer.
+ * @param reply DNS answer.
+ * @param reply_len Its length.
+ * @return The answer frame's length, or -1 if it does not fit.
+ */
+int xdp_build_reply(unsigned char *frame, size_t cap, const unsigned char *reply,
+                    size_t reply_len);
+
+/**
+ * @brief Opens the XDP datapath on an interface queue.
+ *
+ * @param x Filled in on success.
+ * @param ifname Interface name.
+ * @param queue Interface queue.
+ * @param port Listening port (host order).
+ * @param native Non-zero for driver (native) mode; zero for generic (SKB)
+ *               mode, which works on any interface including veth.
+ * @return 0 on success, -1 on error (nothing is left attached).
+ */
+int xdp_open(XdpPath *x, const char *ifname, int queue, uint16_t port, int native);
+
+/**
+ * @brief Takes the next query from the RX ring.
+ *
+ * Frames that are not usable queries are recycled and counted.
+ *
+ * @return 1 with @p q filled in, 0 if the ring is empty.
+ */
+int xdp_next(XdpPath *x, uint16_t port, XdpQuery *q);
+
+/**
+ * @brief Sends @p reply as the answer to @p q, reusing its frame.
+ *
+ * Overwrites the query in the frame, so @p reply must not point into it.
+ *
+ * @return 0 if queued for sending, -1 if the answer does not fit a frame
+ *         or the TX ring is full; the caller then sends it through the
+ *         socket. The frame is recycled either way.
+ */
+int xdp_reply(XdpPath *x, XdpQuery *q, const unsigned char *reply, size_t reply_len);
+
+/**
+ * @brief Gives the frame of @p q back to the kernel without answering.
+ */
+void xdp_release(XdpPath *x, XdpQuery *q);
+
+/**
+ * @brief Kicks the kernel to send queued answers and recycles sent frames.
+ */
+void xdp_flush(XdpPath *x);
+
+/**
+ * @brief Detaches the program and releases the socket and UMEM.
+ */
+void xdp_close(XdpPath *x);
+
+#endif
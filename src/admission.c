@@ -0,0 +1,84 @@
+/**
+ * @file admission.c
+ * @brief Overload detection and shedding of upstream-bound queries.
+ *
+ * On Linux the receive-queue fill comes from SO_MEMINFO (bytes queued
+ * against the receive buffer). Elsewhere only emptiness can be observed,
+ * by peeking, so the loop lag is the sole signal.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "admission.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <asm/socket.h>
+#include <linux/sock_diag.h>
+#endif
+
+void admission_init(Admission *a, int sock, int queue_limit, double lag_limit_ms, int drop,
+                    double now_ms) {
+    a->sock = sock;
+    a->queue_limit = queue_limit;
+    a->lag_limit_ms = lag_limit_ms;
+    a->drop = drop;
+    a->queue_pct = -1;
+    a->idle_at_ms = now_ms;
+    a->lag_ms = 0;
+    a->overloaded = 0;
+    a->episodes = a->admitted = a->shed = 0;
+}
+
+/**
+ * @brief Returns how full the receive queue is, in percent, or -1 if unknown.
+ *
+ * @param empty Set to 1 if the queue is known to be empty.
+ */
+static int queue_fill(int sock, int *empty) {
+#ifdef SO_MEMINFO
+    uint32_t mem[SK_MEMINFO_VARS];
+    socklen_t len = sizeof(mem);
+    if (getsockopt(sock, SOL_SOCKET, SO_MEMINFO, mem, &len) == 0 && mem[SK_MEMINFO_RCVBUF] > 0) {
+        *empty = mem[SK_MEMINFO_RMEM_ALLOC] == 0;
+        return (int)((uint64_t)mem[SK_MEMINFO_RMEM_ALLOC] * 100 / mem[SK_MEMINFO_RCVBUF]);
+    }
+#endif
+    char byte;
+    *empty = recv(sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0;
+    return -1;
+}
+
+int admission_sample(Admission *a, double now_ms) {
+    if (a->queue_limit <= 0 && a->lag_limit_ms <= 0) return 0;
+
+    int empty;
+    a->queue_pct = queue_fill(a->sock, &empty);
+    if (empty) a->idle_at_ms = now_ms;
+    a->lag_ms = now_ms - a->idle_at_ms;
+
+    int queue_high = a->queue_limit > 0 && a->queue_pct >= a->queue_limit;
+    int lag_high = a->lag_limit_ms > 0 && a->lag_ms >= a->lag_limit_ms;
+    if (!a->overloaded && (queue_high || lag_high)) {
+        a->overloaded = 1;
+        a->episodes++;
+        fprintf(stderr, "Overload: receive queue %d%%, loop lag %.0f ms; shedding cache misses\n",
+                a->queue_pct, a->lag_ms);
+    } else if (a->overloaded && (a->queue_limit <= 0 || a->queue_pct < a->queue_limit / 2) &&
+               (a->lag_limit_ms <= 0 || a->lag_ms < a->lag_limit_ms / 2)) {
+        a->overloaded = 0;
+        fprintf(stderr, "Overload cleared: %lu queries shed so far, %lu forwarded\n", a->shed,
+                a->admitted);
+    }
+    return a->overloaded;
+}
+
+int admission_forward(Admission *a) {
+    if (a->overloaded) {
+        a->shed++;
+        return 0;
+    }
+    a->admitted++;
+    return 1;
+}
@@ -0,0 +1,605 @@
+/**
+ * @file cache.c
+ * @brief Response cache for forwarded queries, with disk snapshots.
+ *
+ * Snapshot format (all integers big-endian):
+ *
+ * ```
+ * "DNSCACHE" u32 version u32 count
+ * count * { i64 stored, i64 expires, u16 type, u16 class,
+ *           u8 name_len, u16 data_len, name[name_len], data[data_len] }
+ * ```
+ *
+ * Shared segment layout (host byte order, offsets from the segment start):
+ *
+ * ```
+ * ShmCacheHeader | ShmSlot[slots] | blob[slots][blob_size]
+ * ```
+ *
+ * Slots refer to their blob by index, never by pointer, because every
+ * process maps the segment at a different address. Each slot is guarded
+ * by a sequence lock: a writer makes the sequence odd (by compare-and-swap,
+ * which also excludes other writers), writes, and makes it even again;
+ * a reader copies the slot and accepts the copy only if the sequence was
+ * even and unchanged. Readers never block and never write to the segment.
+ *
+ * Keys are case-insensitive: stored names are folded to lower case, and a
+ * hit gets the client's own QNAME spelling back, so resolvers using 0x20
+ * mixed-case queries see exactly the casing they sent.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC "DNSCACHE"
+#define CACHE_VERSION 1
+#define CACHE_RECORD_HEADER 23 /**< Fixed bytes of a snapshot record. */
+#define SHM_CACHE_MAGIC 0x44435348u /**< "HSCD" */
+#define SHM_CACHE_VERSION 1
+#define SHM_ATTACH_WAIT_MS 1000 /**< How long to wait for another process to create the segment. */
+
+/** @brief Start of a shared cache segment. */
+typedef struct {
+    uint32_t magic;      /**< SHM_CACHE_MAGIC. */
+    uint32_t version;    /**< SHM_CACHE_VERSION. */
+    uint32_t ready;      /**< Set by the creator once the header is complete. */
+    uint32_t blob_size;  /**< Bytes per blob. */
+    uint64_t slots;      /**< Slot count (a power of two). */
+    uint64_t slot_off;   /**< Offset of the slot array. */
+    uint64_t blob_off;   /**< Offset of the blob arena. */
+    uint64_t size;       /**< Segment size. */
+} ShmCacheHeader;
+
+/** @brief One shared cache slot; its blob is blob_off + index * blob_size. */
+typedef struct {
+    uint32_t seq;        /**< Sequence lock: odd while being written. */
+    uint32_t hash;       /**< Key hash; 0 marks an empty slot. */
+    int64_t stored;      /**< Wall-clock time the answer was received. */
+    int64_t expires;     /**< Wall-clock time the answer expires. */
+    uint16_t type;       /**< Query type. */
+    uint16_t class;      /**< Query class. */
+    uint16_t data_len;   /**< Response length. */
+    uint8_t name_len;    /**< Wire QNAME length. */
+    uint8_t pad;
+} ShmSlot;
+
+/**
+ * @brief Locates the question of a packet with QDCOUNT = 1.
+ *
+ * @return 0 on success, -1 if the question is missing, compressed or truncated.
+ */
+static int question(const unsigned char *pkt, int len, int *name_len, uint16_t *type,
+                    uint16_t *class) {
+    if (len < 12 + 5 || pkt[4] != 0 || pkt[5] != 1) return -1;
+    int p = 12;
+    while (pkt[p] != 0) {
+        if (pkt[p] > 63) return -1;
+        p += 1 + pkt[p];
+        if (p >= len) return -1;
+    }
+    *name_len = p - 12 + 1;
+    if (*name_len > 255 || p + 1 + 4 > len) return -1;
+    *type = (uint16_t)((pkt[p + 1] << 8) | pkt[p + 2]);
+    *class = (uint16_t)((pkt[p + 3] << 8) | pkt[p + 4]);
+    return 0;
+}
+
+/**
+ * @brief Returns the offset just past a (possibly compressed) name, or -1.
+ */
+static int skip_name(const unsigned char *pkt, int len, int p) {
+    while (p < len) {
+        unsigned l = pkt[p];
+        if (l == 0) return p + 1;
+        if ((l & 0xC0) == 0xC0) return p + 2 <= len ? p + 2 : -1;
+        if (l > 63) return -1;
+        p += 1 + (int)l;
+    }
+    return -1;
+}
+
+/**
+ * @brief Visits the TTL of every record after the question, skipping OPT.
+ *
+ * With @p age >= 0 each TTL is reduced by @p age (not below 1).
+ *
+ * @return The smallest TTL seen (UINT32_MAX if there are no records), or
+ *         -1 if the packet is malformed.
+ */
+static int64_t visit_ttls(unsigned char *pkt, int len, int qend, int64_t age) {
+    int records = ((pkt[6] << 8) | pkt[7]) + ((pkt[8] << 8) | pkt[9]) + ((pkt[10] << 8) | pkt[11]);
+    int64_t min = UINT32_MAX;
+    int p = qend;
+    for (int i = 0; i < records; i++) {
+        p = skip_name(pkt, len, p);
+        if (p < 0 || p + 10 > len) return -1;
+        int type = (pkt[p] << 8) | pkt[p + 1];
+        int64_t ttl = ((int64_t)pkt[p + 4] << 24) | (pkt[p + 5] << 16) | (pkt[p + 6] << 8) | pkt[p + 7];
+        int rdlen = (pkt[p + 8] << 8) | pkt[p + 9];
+        if (type != 41) {
+            if (ttl < min) min = ttl;
+            if (age >= 0) {
+                ttl = ttl > age ? ttl - age : 1;
+                pkt[p + 4] = (unsigned char)(ttl >> 24);
+                pkt[p + 5] = (unsigned char)(ttl >> 16);
+                pkt[p + 6] = (unsigned char)(ttl >> 8);
+                pkt[p + 7] = (unsigned char)ttl;
+            }
+        }
+        p += 10 + rdlen;
+        if (p > len) return -1;
+    }
+    return min;
+}
+
+/**
+ * @brief Folds an ASCII letter to lower case.
+ *
+ * Label length bytes (at most 63) are below 'A', so a whole wire-format
+ * name can be folded byte by byte.
+ */
+static unsigned char fold(unsigned char ch) {
+    return (unsigned char)((unsigned)(ch - 'A') < 26u ? ch | 0x20 : ch);
+}
+
+/**
+ * @brief Compares a folded stored name with a name of any casing.
+ */
+static int name_equal(const unsigned char *folded, const unsigned char *name, int name_len) {
+    for (int i = 0; i < name_len; i++)
+        if (folded[i] != fold(name[i])) return 0;
+    return 1;
+}
+
+static void copy_folded(unsigned char *dst, const unsigned char *name, int name_len) {
+    for (int i = 0; i < name_len; i++) dst[i] = fold(name[i]);
+}
+
+static uint32_t key_hash(const unsigned char *name, int name_len, uint16_t type, uint16_t class) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < name_len; i++) h = (h ^ fold(name[i])) * 16777619u;
+    h = (h ^ type) * 16777619u;
+    h = (h ^ class) * 16777619u;
+    return h ? h : 1;
+}
+
+static int key_equal(const CacheEntry *e, uint32_t h, const unsigned char *name, int name_len,
+                     uint16_t type, uint16_t class) {
+    return e->hash == h && e->type == type && e->class == class && e->name_len == name_len &&
+           name_equal(e->blob, name, name_len);
+}
+
+/**
+ * @brief Inserts or replaces an entry of a private cache within its probe window.
+ */
+static int heap_put(ResponseCache *c, const unsigned char *name, int name_len, uint16_t type,
+               uint16_t class, const unsigned char *data, int data_len, int64_t stored,
+               int64_t expires) {
+    uint32_t h = key_hash(name, name_len, type, class);
+    CacheEntry *victim = NULL;
+    for (size_t i = 0; i < CACHE_PROBE; i++) {
+        CacheEntry *e = &c->slots[(h + i) & c->mask];
+        if (e->hash != 0 && key_equal(e, h, name, name_len, type, class)) {
+            victim = e;
+            break;
+        }
+        /* Prefer an empty slot, then an expired one, then the oldest expiry. */
+        if (!victim || (victim->hash != 0 && (e->hash == 0 || e->expires < victim->expires)))
+            victim = e;
+    }
+
+    unsigned char *blob = malloc((size_t)name_len + (size_t)data_len);
+    if (!blob) return -1;
+    copy_folded(blob, name, name_len);
+    memcpy(blob + name_len, data, (size_t)data_len);
+
+    if (victim->hash == 0) c->count++;
+    free(victim->blob);
+    victim->hash = h;
+    victim->type = type;
+    victim->class = class;
+    victim->name_len = (uint8_t)name_len;
+    victim->data_len = (uint16_t)data_len;
+    victim->stored = stored;
+    victim->expires = expires;
+    victim->blob = blob;
+    return 0;
+}
+
+static const ShmCacheHeader *shm_header(const ResponseCache *c) {
+    return (const ShmCacheHeader *)c->shm;
+}
+
+static ShmSlot *shm_slot(const ResponseCache *c, size_t i) {
+    return (ShmSlot *)(c->shm + shm_header(c)->slot_off) + i;
+}
+
+static unsigned char *shm_blob(const ResponseCache *c, size_t i) {
+    return c->shm + shm_header(c)->blob_off + i * shm_header(c)->blob_size;
+}
+
+/**
+ * @brief Copies a consistent snapshot of a shared slot.
+ *
+ * @param blob Receives the slot's name and response (CACHE_SHARED_BLOB bytes).
+ * @return 0 if the slot holds an entry and the copy is consistent, -1 otherwise.
+ */
+static int shm_read(const ResponseCache *c, size_t i, ShmSlot *copy, unsigned char *blob) {
+    ShmSlot *s = shm_slot(c, i);
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) return -1;
+    memcpy(copy, s, sizeof(*copy));
+    if (copy->hash == 0 || (size_t)copy->name_len + copy->data_len > shm_header(c)->blob_size)
+        return -1;
+    memcpy(blob, shm_blob(c, i), (size_t)copy->name_len + copy->data_len);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq ? 0 : -1;
+}
+
+/**
+ * @brief Finds a key in a shared cache and copies its response.
+ *
+ * @return Response length, or -1 if absent, expired, too large or being written.
+ */
+static int shm_find(const ResponseCache *c, uint32_t h, const unsigned char *name, int name_len,
+                    uint16_t type, uint16_t class, time_t now, unsigned char *resp, int resp_cap,
+                    int64_t *stored) {
+    unsigned char blob[CACHE_SHARED_BLOB];
+    for (size_t i = 0; i < CACHE_PROBE; i++) {
+        size_t idx = (h + i) & c->mask;
+        ShmSlot copy;
+        if (__atomic_load_n(&shm_slot(c, idx)->hash, __ATOMIC_RELAXED) != h) continue;
+        if (shm_read(c, idx, &copy, blob) < 0) continue;
+        if (copy.hash != h || copy.type != type || copy.class != class ||
+            copy.name_len != name_len || !name_equal(blob, name, name_len))
+            continue;
+        if (copy.expires <= now || copy.data_len > resp_cap) return -1;
+        memcpy(resp, blob + name_len, copy.data_len);
+        *stored = copy.stored;
+        return copy.data_len;
+    }
+    return -1;
+}
+
+/**
+ * @brief Inserts or replaces an entry of a shared cache.
+ *
+ * A slot locked by another writer is not waited for: the answer is simply
+ * not stored, which a cache can afford.
+ */
+static int shm_put(ResponseCache *c, const unsigned char *name, int name_len, uint16_t type,
+                   uint16_t class, const unsigned char *data, int data_len, int64_t stored,
+                   int64_t expires) {
+    if ((size_t)name_len + (size_t)data_len > shm_header(c)->blob_size) return -1;
+    uint32_t h = key_hash(name, name_len, type, class);
+
+    /* Unlocked reads only pick the victim; the sequence lock protects the write. */
+    size_t victim = (size_t)-1;
+    int64_t victim_expires = INT64_MAX;
+    for (size_t i = 0; i < CACHE_PROBE; i++) {
+        size_t idx = (h + i) & c->mask;
+        ShmSlot *s = shm_slot(c, idx);
+        uint32_t sh = __atomic_load_n(&s->hash, __ATOMIC_RELAXED);
+        if (sh == h && s->type == type && s->class == class && s->name_len == name_len &&
+            name_equal(shm_blob(c, idx), name, name_len)) {
+            victim = idx;
+            break;
+        }
+        int64_t e = sh == 0 ? INT64_MIN : __atomic_load_n(&s->expires, __ATOMIC_RELAXED);
+        if (victim == (size_t)-1 || e < victim_expires) {
+            victim = idx;
+            victim_expires = e;
+        }
+    }
+
+    ShmSlot *s = shm_slot(c, victim);
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) ||
+        !__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return -1;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    unsigned char *blob = shm_blob(c, victim);
+    copy_folded(blob, name, name_len);
+    memcpy(blob + name_len, data, (size_t)data_len);
+    s->type = type;
+    s->class = class;
+    s->name_len = (uint8_t)name_len;
+    s->data_len = (uint16_t)data_len;
+    s->stored = stored;
+    s->expires = expires;
+    s->hash = h;
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @brief Finds a key in a private cache and copies its response.
+ *
+ * @return Response length, or -1 if absent, expired or too large.
+ */
+static int heap_find(const ResponseCache *c, uint32_t h, const unsigned char *name, int name_len,
+                     uint16_t type, uint16_t class, time_t now, unsigned char *resp, int resp_cap,
+                     int64_t *stored) {
+    for (size_t i = 0; i < CACHE_PROBE; i++) {
+        const CacheEntry *e = &c->slots[(h + i) & c->mask];
+        if (!key_equal(e, h, name, name_len, type, class)) continue;
+        if (e->expires <= now || e->data_len > resp_cap) return -1;
+        memcpy(resp, e->blob + e->name_len, e->data_len);
+        *stored = e->stored;
+        return e->data_len;
+    }
+    return -1;
+}
+
+static int put(ResponseCache *c, const unsigned char *name, int name_len, uint16_t type,
+               uint16_t class, const unsigned char *data, int data_len, int64_t stored,
+               int64_t expires) {
+    if (c->shm) return shm_put(c, name, name_len, type, class, data, data_len, stored, expires);
+    return heap_put(c, name, name_len, type, class, data, data_len, stored, expires);
+}
+
+ResponseCache *cache_new(size_t entries) {
+    size_t size = CACHE_PROBE;
+    while (size < entries) size <<= 1;
+
+    ResponseCache *c = calloc(1, sizeof(ResponseCache));
+    if (!c) return NULL;
+    c->slots = calloc(size, sizeof(CacheEntry));
+    if (!c->slots) {
+        free(c);
+        return NULL;
+    }
+    c->mask = size - 1;
+    return c;
+}
+
+ResponseCache *cache_attach_shared(const char *name, size_t entries) {
+    size_t slots = CACHE_PROBE;
+    while (slots < entries) slots <<= 1;
+    size_t slot_off = (sizeof(ShmCacheHeader) + 63) & ~(size_t)63;
+    size_t blob_off = (slot_off + slots * sizeof(ShmSlot) + 63) & ~(size_t)63;
+    size_t size = blob_off + slots * CACHE_SHARED_BLOB;
+
+    int created = 1;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open shared cache '%s': %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (created && ftruncate(fd, (off_t)size) < 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    /* Another process may still be sizing the segment it just created. */
+    struct timespec pause = { 0, 1000000 };
+    struct stat st;
+    for (int i = 0; !created; i++) {
+        if (fstat(fd, &st) < 0 || (st.st_size == 0 && i == SHM_ATTACH_WAIT_MS)) {
+            fprintf(stderr, "Shared cache '%s' was never initialized\n", name);
+            close(fd);
+            return NULL;
+        }
+        if (st.st_size > 0) {
+            size = (size_t)st.st_size;
+            break;
+        }
+        nanosleep(&pause, NULL);
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    ShmCacheHeader *hdr = map;
+    if (created) {
+        hdr->magic = SHM_CACHE_MAGIC;
+        hdr->version = SHM_CACHE_VERSION;
+        hdr->blob_size = CACHE_SHARED_BLOB;
+        hdr->slots = slots;
+        hdr->slot_off = slot_off;
+        hdr->blob_off = blob_off;
+        hdr->size = size;
+        __atomic_store_n(&hdr->ready, 1, __ATOMIC_RELEASE);
+    } else {
+        for (int i = 0; !__atomic_load_n(&hdr->ready, __ATOMIC_ACQUIRE) && i < SHM_ATTACH_WAIT_MS; i++)
+            nanosleep(&pause, NULL);
+        if (!hdr->ready || hdr->magic != SHM_CACHE_MAGIC || hdr->version != SHM_CACHE_VERSION ||
+            hdr->size != size || (hdr->slots & (hdr->slots - 1)) != 0 ||
+            hdr->blob_off + hdr->slots * hdr->blob_size > size ||
+            hdr->slot_off + hdr->slots * sizeof(ShmSlot) > hdr->blob_off) {
+            fprintf(stderr, "'%s' is not a compatible shared cache\n", name);
+            munmap(map, size);
+            return NULL;
+        }
+    }
+
+    ResponseCache *c = calloc(1, sizeof(ResponseCache));
+    if (!c) {
+        munmap(map, size);
+        return NULL;
+    }
+    c->shm = map;
+    c->shm_len = size;
+    c->mask = hdr->slots - 1;
+    return c;
+}
+
+void cache_free(ResponseCache *c) {
+    if (!c) return;
+    if (c->shm) {
+        munmap(c->shm, c->shm_len);
+    } else {
+        for (size_t i = 0; i <= c->mask; i++) free(c->slots[i].blob);
+        free(c->slots);
+    }
+    free(c);
+}
+
+int cache_lookup(ResponseCache *c, const unsigned char *query, int qlen, unsigned char *resp,
+                 int resp_cap, time_t now) {
+    int name_len;
+    uint16_t type, class;
+    if (question(query, qlen, &name_len, &type, &class) < 0) return -1;
+
+    uint32_t h = key_hash(query + 12, name_len, type, class);
+    int64_t stored;
+    int n = c->shm ? shm_find(c, h, query + 12, name_len, type, class, now, resp, resp_cap, &stored)
+                   : heap_find(c, h, query + 12, name_len, type, class, now, resp, resp_cap, &stored);
+    if (n < 0) {
+        c->misses++;
+        return -1;
+    }
+    /* The client's ID and QNAME spelling, one copy straight into the answer. */
+    resp[0] = query[0];
+    resp[1] = query[1];
+    memcpy(resp + 12, query + 12, (size_t)name_len);
+    visit_ttls(resp, n, 12 + name_len + 4, now > stored ? now - stored : 0);
+    c->hits++;
+    return n;
+}
+
+int cache_store(ResponseCache *c, const unsigned char *query, int qlen,
+                const unsigned char *resp, int rlen, time_t now) {
+    int name_len, rname_len;
+    uint16_t type, class, rtype, rclass;
+    if (question(query, qlen, &name_len, &type, &class) < 0 ||
+        question(resp, rlen, &rname_len, &rtype, &rclass) < 0)
+        return -1;
+
+    /* A complete NOERROR/NXDOMAIN answer to exactly this question. */
+    int rcode = resp[3] & 0x0F;
+    if (!(resp[2] & 0x80) || (resp[2] & 0x02) || (rcode != 0 && rcode != 3) ||
+        name_len != rname_len || type != rtype || class != rclass ||
+        !name_equal(resp + 12, query + 12, name_len))
+        return -1;
+
+    int64_t ttl = visit_ttls((unsigned char *)resp, rlen, 12 + name_len + 4, -1);
+    if (ttl <= 0 || ttl == UINT32_MAX) return -1;
+    if (ttl > CACHE_MAX_TTL) ttl = CACHE_MAX_TTL;
+    return put(c, query + 12, name_len, type, class, resp, rlen, now, now + ttl);
+}
+
+static void put_be(unsigned char *p, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        p[i] = (unsigned char)v;
+        v >>= 8;
+    }
+}
+
+static uint64_t get_be(const unsigned char *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+int cache_save(const ResponseCache *c, const char *path, time_t now) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        fprintf(stderr, "Cannot write cache snapshot '%s': %s\n", tmp, strerror(errno));
+        return -1;
+    }
+
+    /* Shared entries change while we write, so the count is patched in last. */
+    unsigned char hdr[16];
+    memcpy(hdr, CACHE_MAGIC, 8);
+    put_be(hdr + 8, CACHE_VERSION, 4);
+    put_be(hdr + 12, 0, 4);
+    int ok = fwrite(hdr, 1, sizeof(hdr), f) == sizeof(hdr);
+
+    uint32_t count = 0;
+    unsigned char copy_blob[CACHE_SHARED_BLOB];
+    for (size_t i = 0; ok && i <= c->mask; i++) {
+        CacheEntry e;
+        if (c->shm) {
+            ShmSlot copy;
+            if (shm_read(c, i, &copy, copy_blob) < 0) continue;
+            e.stored = copy.stored;
+            e.expires = copy.expires;
+            e.type = copy.type;
+            e.class = copy.class;
+            e.name_len = copy.name_len;
+            e.data_len = copy.data_len;
+            e.blob = copy_blob;
+        } else {
+            e = c->slots[i];
+            if (e.hash == 0) continue;
+        }
+        if (e.expires <= now) continue;
+
+        unsigned char rec[CACHE_RECORD_HEADER];
+        put_be(rec, (uint64_t)e.stored, 8);
+        put_be(rec + 8, (uint64_t)e.expires, 8);
+        put_be(rec + 16, e.type, 2);
+        put_be(rec + 18, e.class, 2);
+        rec[20] = e.name_len;
+        put_be(rec + 21, e.data_len, 2);
+        size_t blob = (size_t)e.name_len + e.data_len;
+        ok = fwrite(rec, 1, sizeof(rec), f) == sizeof(rec) && fwrite(e.blob, 1, blob, f) == blob;
+        count++;
+    }
+    put_be(hdr + 12, count, 4);
+    ok = ok && fseek(f, 12, SEEK_SET) == 0 && fwrite(hdr + 12, 1, 4, f) == 4;
+
+    if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "Cannot write cache snapshot '%s': %s\n", path, strerror(errno));
+        remove(tmp);
+        return -1;
+    }
+    return (int)count;
+}
+
+int cache_load(ResponseCache *c, const char *path, time_t now) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+
+    unsigned char hdr[16];
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, CACHE_MAGIC, 8) != 0 ||
+        get_be(hdr + 8, 4) != CACHE_VERSION) {
+        fprintf(stderr, "'%s' is not a cache snapshot\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    uint32_t count = (uint32_t)get_be(hdr + 12, 4);
+    int loaded = 0;
+    unsigned char *blob = malloc(255 + 65535);
+    if (!blob) {
+        fclose(f);
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        unsigned char rec[CACHE_RECORD_HEADER];
+        if (fread(rec, 1, sizeof(rec), f) != sizeof(rec)) break;
+        int64_t stored = (int64_t)get_be(rec, 8), expires = (int64_t)get_be(rec + 8, 8);
+        int name_len = rec[20], data_len = (int)get_be(rec + 21, 2);
+        if (fread(blob, 1, (size_t)(name_len + data_len), f) != (size_t)(name_len + data_len)) break;
+        if (expires <= now || name_len == 0) continue;
+        if (put(c, blob, name_len, (uint16_t)get_be(rec + 16, 2), (uint16_t)get_be(rec + 18, 2),
+                blob + name_len, data_len, stored, expires) == 0)
+            loaded++;
+    }
+    free(blob);
+    fclose(f);
+    return loaded;
+}
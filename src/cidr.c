@@ -0,0 +1,133 @@
+/**
+ * @file cidr.c
+ * @brief Longest-prefix matching of IPv4 addresses against CIDR blocks.
+ *
+ * Prefixes are kept in a path-compressed binary trie: a node only exists
+ * where prefixes diverge or a value is stored, so a lookup touches at most
+ * one node per distinct prefix length on the path to the address.
+ */
+
+#include "cidr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/**
+ * @brief Returns the netmask for a prefix length.
+ */
+static uint32_t prefix_mask(int len) {
+    return len == 0 ? 0 : 0xFFFFFFFFu << (32 - len);
+}
+
+/**
+ * @brief Returns bit @p i of @p addr, counting from the most significant bit.
+ */
+static int addr_bit(uint32_t addr, int i) {
+    return (addr >> (31 - i)) & 1;
+}
+
+/**
+ * @brief Returns the number of leading bits shared by two addresses, capped at @p max.
+ */
+static int common_bits(uint32_t a, uint32_t b, int max) {
+    uint32_t diff = a ^ b;
+    int n = diff ? __builtin_clz(diff) : 32;
+    return n < max ? n : max;
+}
+
+static CidrNode *new_node(CidrTable *t, uint32_t prefix, int len, int value) {
+    CidrNode *n = calloc(1, sizeof(CidrNode));
+    if (!n) return NULL;
+    n->prefix = prefix & prefix_mask(len);
+    n->len = (uint8_t)len;
+    n->value = value;
+    t->nodes++;
+    return n;
+}
+
+int cidr_parse(const char *s, uint32_t *addr, int *len) {
+    char buf[INET_ADDRSTRLEN + 4];
+    strncpy(buf, s, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    int plen = 32;
+    char *slash = strchr(buf, '/');
+    if (slash) {
+        *slash = '\0';
+        char *end;
+        long v = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || v < 0 || v > 32) return -1;
+        plen = (int)v;
+    }
+
+    struct in_addr in;
+    if (inet_pton(AF_INET, buf, &in) != 1) return -1;
+
+    *addr = ntohl(in.s_addr) & prefix_mask(plen);
+    *len = plen;
+    return 0;
+}
+
+/**
+ * @brief Inserts a prefix, splitting an existing edge where the new prefix diverges.
+ */
+int cidr_table_insert(CidrTable *t, uint32_t addr, int len, int value) {
+    if (len < 0 || len > 32 || value < 0) return -1;
+    addr &= prefix_mask(len);
+
+    CidrNode **pp = &t->root;
+    while (*pp) {
+        CidrNode *n = *pp;
+        int common = common_bits(n->prefix, addr, n->len < len ? n->len : len);
+
+        if (common < n->len) {
+            CidrNode *split = new_node(t, addr, common, -1);
+            if (!split) return -1;
+            split->child[addr_bit(n->prefix, common)] = n;
+            *pp = split;
+            if (common == len) {
+                split->value = value;
+                return 0;
+            }
+            CidrNode *leaf = new_node(t, addr, len, value);
+            if (!leaf) return -1;
+            split->child[addr_bit(addr, common)] = leaf;
+            return 0;
+        }
+
+        if (n->len == len) {
+            n->value = value;
+            return 0;
+        }
+        pp = &n->child[addr_bit(addr, n->len)];
+    }
+
+    *pp = new_node(t, addr, len, value);
+    return *pp ? 0 : -1;
+}
+
+int cidr_table_lookup(const CidrTable *t, uint32_t addr) {
+    int best = -1;
+    const CidrNode *n = t->root;
+    while (n) {
+        if ((addr & prefix_mask(n->len)) != n->prefix) break;
+        if (n->value >= 0) best = n->value;
+        if (n->len == 32) break;
+        n = n->child[addr_bit(addr, n->len)];
+    }
+    return best;
+}
+
+static void free_nodes(CidrNode *n) {
+    if (!n) return;
+    free_nodes(n->child[0]);
+    free_nodes(n->child[1]);
+    free(n);
+}
+
+void cidr_table_free(CidrTable *t) {
+    free_nodes(t->root);
+    t->root = NULL;
+    t->nodes = 0;
+}
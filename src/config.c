@@ -4,14 +4,31 @@
  *
  * This module provides functions for loading and parsing the configuration
  * file that defines DNS proxy parameters such as the upstream DNS server,
- * blacklist, fake IP, response type, and listening port.
+ * blacklist, fake IP, response type, and listening port, and for compiling
+ * per-client groups into their lookup structures.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "config.h"
+#include "rpz.h"
+#include "list_loader.h"
+#include "louds.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <strings.h>
+#include <time.h>
+
+/**
+ * @brief Returns a monotonic timestamp in milliseconds.
+ */
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
 
 /**
  * @brief Trims leading and trailing whitespace characters from a string.
@@ -33,28 +50,299 @@ static void trim(char *s) {
     if (start != s) memmove(s, start, strlen(start) + 1);
 }
 
+/**
+ * @brief Validates a response mode, falling back to FAKE for unknown values.
+ *
+ * @param dst Destination buffer of at least MAX_STR_LEN bytes.
+ * @param val Candidate value (converted to upper case in place).
+ */
+static void set_response(char *dst, char *val) {
+    for (int i = 0; val[i]; i++) val[i] = toupper((unsigned char)val[i]);
+    if (strcmp(val, "NXDOMAIN") == 0 || strcmp(val, "REFUSED") == 0 || strcmp(val, "FAKE") == 0) {
+        strncpy(dst, val, MAX_STR_LEN - 1);
+        dst[MAX_STR_LEN - 1] = '\0';
+    } else {
+        fprintf(stderr, "Unknown response mode '%s'. Using FAKE.\n", val);
+        strcpy(dst, "FAKE");
+    }
+}
+
+/**
+ * @brief Adds every name of a comma-separated list to a compiled list.
+ *
+ * @param val Comma-separated names (modified by tokenization).
+ * @param trie Destination trie.
+ * @param verdict DT_BLOCK or DT_ALLOW.
+ * @param st Load statistics to update.
+ * @param cfg If non-NULL, names are also recorded in @c cfg->blacklist for display.
+ */
+static void add_list(char *val, DomainTrie *trie, int verdict, LoadStats *st, Config *cfg) {
+    double t0 = now_ms();
+    char *tok = strtok(val, ",");
+    while (tok) {
+        trim(tok);
+        size_t before = trie->entries;
+        if (tok[0] != '\0') {
+            st->names++;
+            if (domain_trie_insert(trie, tok, verdict) < 0) {
+                fprintf(stderr, "Ignoring invalid domain '%s'\n", tok);
+            } else {
+                if (trie->entries == before) st->duplicates++;
+                if (cfg && cfg->blacklist_count < MAX_BLACKLIST) {
+                    strncpy(cfg->blacklist[cfg->blacklist_count], tok, MAX_STR_LEN - 1);
+                    cfg->blacklist[cfg->blacklist_count][MAX_STR_LEN - 1] = '\0';
+                    cfg->blacklist_count++;
+                }
+            }
+        }
+        tok = strtok(NULL, ",");
+    }
+    st->build_ms += now_ms() - t0;
+}
+
+/**
+ * @brief Loads an RPZ zone into a compiled list and reports what was read.
+ *
+ * @return 0 on success, -1 if the file cannot be opened.
+ */
+static int load_rpz_file(const char *path, DomainTrie *trie, LoadStats *ls) {
+    RpzStats st;
+    memset(&st, 0, sizeof(st));
+    double t0 = now_ms();
+    if (rpz_load_file(path, trie, &st) < 0) return -1;
+    ls->rpz_ms += now_ms() - t0;
+    ls->files++;
+    printf("RPZ %s: %zu rules, %zu unsupported, %zu malformed\n",
+           path, st.added, st.unsupported, st.malformed);
+    return 0;
+}
+
+/**
+ * @brief Returns the group with the given name, creating it if needed.
+ *
+ * @return Group index, or -1 if the name is invalid or MAX_GROUPS is reached.
+ */
+static int get_group(Config *cfg, const char *name, size_t len) {
+    if (len == 0 || len >= MAX_STR_LEN) return -1;
+    for (int i = 1; i < cfg->group_count; i++) {
+        if (strlen(cfg->groups[i].name) == len && strncmp(cfg->groups[i].name, name, len) == 0)
+            return i;
+    }
+    if (cfg->group_count >= MAX_GROUPS) {
+        fprintf(stderr, "Too many client groups (max %d)\n", MAX_GROUPS);
+        return -1;
+    }
+    ClientGroup *g = &cfg->groups[cfg->group_count];
+    memcpy(g->name, name, len);
+    g->name[len] = '\0';
+    return cfg->group_count++;
+}
+
+/**
+ * @brief Returns a group's own block/allow list trie, creating it on first use.
+ */
+static DomainTrie *group_blocklist(ClientGroup *g) {
+    if (!g->blocklist) {
+        g->blocklist = domain_trie_new();
+        g->owns_blocklist = g->blocklist != NULL;
+    }
+    return g->blocklist;
+}
+
+/**
+ * @brief Adds block rules to a group's pattern set, creating it on first use.
+ *
+ * A regex is taken whole (it may contain commas); globs are comma-separated.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int add_patterns(ClientGroup *g, char *val, int is_glob) {
+    if (!g->patterns) {
+        g->patterns = pattern_set_new();
+        if (!g->patterns) return -1;
+        g->owns_patterns = 1;
+    }
+
+    char *tok = is_glob ? strtok(val, ",") : val;
+    while (tok) {
+        trim(tok);
+        if (tok[0] != '\0' && pattern_set_add(g->patterns, tok, is_glob) < 0)
+            fprintf(stderr, "Ignoring invalid %s '%s'\n", is_glob ? "glob" : "regex", tok);
+        tok = is_glob ? strtok(NULL, ",") : NULL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Applies one `group.<name>.<key> = value` line.
+ *
+ * @return 0 on success, -1 on a fatal error (unreadable list, out of memory).
+ */
+static int parse_group_key(Config *cfg, const char *key, char *val) {
+    const char *name = key + strlen("group.");
+    const char *dot = strchr(name, '.');
+    if (!dot) {
+        fprintf(stderr, "Malformed group key '%s'\n", key);
+        return 0;
+    }
+    int idx = get_group(cfg, name, (size_t)(dot - name));
+    if (idx < 0) return 0;
+
+    ClientGroup *g = &cfg->groups[idx];
+    const char *sub = dot + 1;
+
+    if (strcmp(sub, "cidr") == 0) {
+        char *tok = strtok(val, ",");
+        while (tok) {
+            trim(tok);
+            uint32_t addr;
+            int len;
+            if (cidr_parse(tok, &addr, &len) < 0) {
+                fprintf(stderr, "Group '%s': invalid CIDR '%s'\n", g->name, tok);
+            } else if (cidr_table_insert(&cfg->group_table, addr, len, idx) < 0) {
+                return -1;
+            }
+            tok = strtok(NULL, ",");
+        }
+    } else if (strcmp(sub, "response") == 0) {
+        set_response(g->response, val);
+    } else if (strcmp(sub, "fake_ip") == 0) {
+        strncpy(g->fake_ip, val, MAX_STR_LEN - 1);
+        g->fake_ip[MAX_STR_LEN - 1] = '\0';
+    } else if (strcmp(sub, "blacklist") == 0 || strcmp(sub, "allowlist") == 0) {
+        if (!group_blocklist(g)) return -1;
+        add_list(val, g->blocklist, sub[0] == 'a' ? DT_ALLOW : DT_BLOCK, &cfg->load_stats, NULL);
+    } else if (strcmp(sub, "blacklist_file") == 0 || strcmp(sub, "allowlist_file") == 0) {
+        if (!group_blocklist(g)) return -1;
+        return list_load_file(val, g->blocklist, sub[0] == 'a' ? DT_ALLOW : DT_BLOCK,
+                              cfg->load_threads, &cfg->load_stats);
+    } else if (strcmp(sub, "rpz_file") == 0) {
+        if (!group_blocklist(g)) return -1;
+        return load_rpz_file(val, g->blocklist, &cfg->load_stats);
+    } else if (strcmp(sub, "blacklist_regex") == 0 || strcmp(sub, "blacklist_glob") == 0) {
+        return add_patterns(g, val, sub[10] == 'g');
+    } else {
+        fprintf(stderr, "Unknown group key '%s'\n", key);
+    }
+    return 0;
+}
+
 /**
  * @brief Loads DNS proxy configuration from a text file.
  *
  * This function reads key-value pairs from a configuration file and fills
  * a `Config` structure with corresponding values. Supported keys include:
  *
- * - `upstream_dns`: IP address of the upstream DNS server.
+ * - `upstream_dns`: IP address of the upstream DNS server, or up to four
+ *   comma-separated addresses used in turn.
  * - `upstream_port`: Port of the upstream DNS server (default: 53).
+ * - `health_check_name`: Name the upstream health probes ask for
+ *   (default `.`, the root).
+ * - `health_check_interval_ms`: Time between probes of each upstream in
+ *   rotation (default 1000; 0 probes only upstreams taken out).
+ * - `health_check_timeout_ms`: Time a probe may wait for its reply
+ *   (default 500).
+ * - `breaker_failures`: Consecutive timeouts or failed probes that take an
+ *   upstream out of rotation (default 3; 0 never does).
+ * - `breaker_cooldown_ms`: Time out of rotation before a single probe
+ *   decides whether the upstream returns (default 5000). With every
+ *   upstream out, forwarded queries are answered SERVFAIL at once.
  * - `response`: Type of DNS response for blacklisted domains.
  *   Possible values: `FAKE`, `NXDOMAIN`, `REFUSED`.
  * - `fake_ip`: IP address to use in fake responses (default: 127.0.0.1).
  * - `listen_port`: Port where the proxy listens for DNS queries (default: 5353).
  * - `blacklist`: Comma-separated list of domain names to block.
+ * - `blacklist_file`: File with one domain name to block per line.
+ * - `matcher`: Representation of the compiled lists, `trie` (default),
+ *   `sorted` (front-coded sorted array) or `louds` (succinct trie). The
+ *   compact forms are read-only: RPZ local data and live RPZ updates need
+ *   the trie.
+ * - `louds_file`: LOUDS image written by `--compile-louds`, mapped as the
+ *   default group's lists instead of parsing them; cannot be combined with
+ *   top-level lists.
+ * - `load_threads`: Worker threads used to parse list files that follow
+ *   (default 0: one per online CPU).
+ * - `allowlist`, `allowlist_file`: Names that are never blocked, even when
+ *   they or a parent domain appear in a blocklist.
+ * - `blacklist_regex`: One regular expression per line (the key may repeat).
+ * - `blacklist_glob`: Comma-separated globs such as `ads*.example.net`.
+ * - `rpz_file`: Response-policy zone whose QNAME triggers are compiled into
+ *   the same structure as the lists (the key may repeat).
+ * - `cache_size`: Number of upstream answers kept in the response cache
+ *   (default 4096; 0 disables caching).
+ * - `cache_snapshot`: File the cache is saved to periodically and on
+ *   shutdown, and warmed from at startup (entries that expired meanwhile
+ *   are skipped).
+ * - `cache_snapshot_interval`: Seconds between periodic snapshots (default
+ *   300; 0 saves only on shutdown).
+ * - `cache_shared`: POSIX shared-memory name (e.g. `/dns_proxy_cache`) for
+ *   a cache shared by every proxy process on the host that names it.
+ * - `overload_queue`, `overload_lag_ms`: Receive-queue fill in percent
+ *   (default 50) and loop lag (default 200) at which the proxy counts as
+ *   overloaded; 0 disables a signal. While overloaded, cache hits and
+ *   policy answers are still served but cache misses are shed.
+ * - `overload_action`: `refuse` (default) answers shed queries REFUSED,
+ *   `drop` discards them.
+ * - `dedup_size`: Upstream-bound requests remembered so that client
+ *   retransmissions of one still in flight are dropped instead of
+ *   forwarded again (default 1024; 0 disables). Retransmissions that
+ *   queued up during an exchange are only recognized with rx_timestamps.
+ * - `workers`: Worker processes sharing the listening port through
+ *   SO_REUSEPORT (default 1; 0 = one per CPU). Each has its own cache
+ *   unless `cache_shared` is set.
+ * - `pin_workers`: Pin each worker to its own CPU, which also keeps its
+ *   memory on that CPU's NUMA node (default 1; only with several workers).
+ * - `reuseport_steering`: How queries are spread over the workers:
+ *   `kernel` (default, 4-tuple hash), `client` (by client IP, so each
+ *   client keeps one worker) or `qname` (by name, so each name is cached
+ *   by one worker).
+ * - `busy_poll`: Spin on the socket instead of sleeping, for the lowest
+ *   latency at the cost of a CPU per worker; the value is passed to
+ *   SO_BUSY_POLL in microseconds (default 0: off).
+ * - `busy_poll_idle_ms`: Time without queries after which a spinning
+ *   loop sleeps until the next one (default 10).
+ * - `socket_rcvbuf`, `socket_sndbuf`: Listening-socket buffer sizes in
+ *   bytes (defaults 4 MiB and 0 = kernel default); sizes above the
+ *   net.core sysctl limits need CAP_NET_ADMIN.
+ * - `pmtud_omit`: Ignore ICMP path-MTU updates for replies (default 1).
+ * - `rx_timestamps`: Take latency from the kernel's receive timestamp, so
+ *   it includes time queued in the socket buffer (default 1).
+ * - `udp_gso`: Send equal-sized replies to one client as a single UDP GSO
+ *   (UDP_SEGMENT) send (default 0).
+ * - `udp_gro`: Accept coalesced query bursts with UDP_GRO (default 0).
+ * - `xdp_interface`, `xdp_queue`: Answer blocked and cached queries that
+ *   arrive on this interface queue (default 0) with AF_XDP, rewriting the
+ *   frame in place; other queries continue on the socket path. Needs
+ *   CAP_NET_ADMIN and CAP_BPF; only the first worker uses it.
+ * - `xdp_mode`: `skb` (default, generic XDP on any interface) or `native`
+ *   (driver XDP, zero-copy where supported).
+ * - `rpz_update_file`: RPZ update (`+`/`-` records) applied to the live
+ *   default policy whenever the proxy receives SIGHUP.
+ * - `group.<name>.cidr`: Comma-separated client prefixes belonging to a group.
+ * - `group.<name>.response`, `group.<name>.fake_ip`: Per-group response
+ *   template; unset values are inherited from the top-level keys.
+ * - `group.<name>.blacklist`, `group.<name>.allowlist`, their `_file`
+ *   variants and `group.<name>.rpz_file`: Per-group lists; a group without
+ *   any uses the top-level lists.
+ * - `group.<name>.blacklist_regex`, `group.<name>.blacklist_glob`: Per-group
+ *   pattern rules; a group without any uses the top-level rules.
+ *
+ * Listed names match the name itself and all of its subdomains. Block and
+ * allow entries are compiled into one trie so a single lookup yields the
+ * verdict, with allow entries taking precedence. Names not decided by the
+ * lists are run through the pattern rules, which are compiled into a single
+ * DFA once the whole file has been read. Clients
+ * are mapped to the group whose CIDR is the longest match for their address.
  *
  * Lines starting with `#` are treated as comments.
  * Whitespace is automatically trimmed from keys and values.
  *
  * @param filename Path to the configuration file to load.
  * @param cfg Pointer to the `Config` structure to populate.
- * @return 0 on success, or -1 if the file cannot be opened.
+ * @return 0 on success, or -1 if the file or a list file cannot be opened.
  */
 int load_config(const char *filename, Config *cfg) {
+    double start = now_ms();
     FILE *f = fopen(filename, "r");
     if (!f) {
         perror("fopen");
@@ -62,15 +350,41 @@ int load_config(const char *filename, Config *cfg) {
     }
 
     // Default values
+    memset(cfg, 0, sizeof(*cfg));
     strcpy(cfg->upstream_dns, "8.8.8.8");
     cfg->upstream_port = 53;
+    upstream_health_defaults(&cfg->upstream_health);
     strcpy(cfg->response, "FAKE");
     strcpy(cfg->fake_ip, "127.0.0.1");
     cfg->listen_port = 5353;
     cfg->blacklist_count = 0;
+    cfg->matcher = &matcher_trie;
+    cfg->cache_size = 4096;
+    cfg->cache_snapshot_interval = 300;
+    cfg->overload_queue = 50;
+    cfg->overload_lag_ms = 200;
+    cfg->dedup_size = 1024;
+    cfg->workers = 1;
+    cfg->pin_workers = 1;
+    cfg->busy_poll_idle_ms = 10;
+    cfg->socket_opts.rcvbuf = 4 << 20;
+    cfg->socket_opts.pmtud_omit = 1;
+    cfg->socket_opts.timestamps = 1;
 
+    LoadStats *st = &cfg->load_stats;
+    ClientGroup *def = &cfg->groups[0];
+    strcpy(def->name, "default");
+    def->blocklist = domain_trie_new();
+    def->owns_blocklist = 1;
+    cfg->group_count = 1;
+    if (!def->blocklist) {
+        fclose(f);
+        return -1;
+    }
+
+    int rc = 0;
     char line[512];
-    while (fgets(line, sizeof(line), f)) {
+    while (rc == 0 && fgets(line, sizeof(line), f)) {
         trim(line);
         if (line[0] == '#' || line[0] == '\0')
             continue;
@@ -89,32 +403,207 @@ int load_config(const char *filename, Config *cfg) {
             cfg->upstream_dns[MAX_STR_LEN - 1] = '\0';
         } else if (strcmp(key, "upstream_port") == 0) {
             cfg->upstream_port = atoi(val);
+        } else if (strcmp(key, "health_check_name") == 0) {
+            strncpy(cfg->upstream_health.name, val, sizeof(cfg->upstream_health.name) - 1);
+            cfg->upstream_health.name[sizeof(cfg->upstream_health.name) - 1] = '\0';
+        } else if (strcmp(key, "health_check_interval_ms") == 0) {
+            cfg->upstream_health.interval_ms = atoi(val);
+        } else if (strcmp(key, "health_check_timeout_ms") == 0) {
+            cfg->upstream_health.timeout_ms = atoi(val);
+        } else if (strcmp(key, "breaker_failures") == 0) {
+            cfg->upstream_health.max_failures = atoi(val);
+        } else if (strcmp(key, "breaker_cooldown_ms") == 0) {
+            cfg->upstream_health.cooldown_ms = atoi(val);
         } else if (strcmp(key, "response") == 0) {
-            for (int i = 0; val[i]; i++) val[i] = toupper((unsigned char)val[i]);
-            if (strcmp(val, "NXDOMAIN") == 0 || strcmp(val, "REFUSED") == 0 || strcmp(val, "FAKE") == 0) {
-                strncpy(cfg->response, val, MAX_STR_LEN - 1);
-                cfg->response[MAX_STR_LEN - 1] = '\0';
-            } else {
-                fprintf(stderr, "Unknown response mode '%s'. Using FAKE.\n", val);
-                strcpy(cfg->response, "FAKE");
-            }
+            set_response(cfg->response, val);
         } else if (strcmp(key, "fake_ip") == 0) {
             strncpy(cfg->fake_ip, val, MAX_STR_LEN - 1);
             cfg->fake_ip[MAX_STR_LEN - 1] = '\0';
         } else if (strcmp(key, "listen_port") == 0) {
             cfg->listen_port = atoi(val);
         } else if (strcmp(key, "blacklist") == 0) {
-            char *tok = strtok(val, ",");
-            while (tok && cfg->blacklist_count < MAX_BLACKLIST) {
-                trim(tok);
-                strncpy(cfg->blacklist[cfg->blacklist_count], tok, MAX_STR_LEN - 1);
-                cfg->blacklist[cfg->blacklist_count][MAX_STR_LEN - 1] = '\0';
-                cfg->blacklist_count++;
-                tok = strtok(NULL, ",");
-            }
+            add_list(val, def->blocklist, DT_BLOCK, st, cfg);
+        } else if (strcmp(key, "blacklist_file") == 0) {
+            rc = list_load_file(val, def->blocklist, DT_BLOCK, cfg->load_threads, st);
+        } else if (strcmp(key, "allowlist") == 0) {
+            add_list(val, def->blocklist, DT_ALLOW, st, NULL);
+        } else if (strcmp(key, "allowlist_file") == 0) {
+            rc = list_load_file(val, def->blocklist, DT_ALLOW, cfg->load_threads, st);
+        } else if (strcmp(key, "blacklist_regex") == 0 || strcmp(key, "blacklist_glob") == 0) {
+            rc = add_patterns(def, val, key[10] == 'g');
+        } else if (strcmp(key, "rpz_file") == 0) {
+            rc = load_rpz_file(val, def->blocklist, st);
+        } else if (strcmp(key, "matcher") == 0) {
+            const MatcherOps *ops = matcher_find(val);
+            if (ops) cfg->matcher = ops;
+            else fprintf(stderr, "Unknown matcher '%s'. Using %s.\n", val, cfg->matcher->name);
+        } else if (strcmp(key, "louds_file") == 0) {
+            strncpy(cfg->louds_file, val, MAX_STR_LEN - 1);
+            cfg->louds_file[MAX_STR_LEN - 1] = '\0';
+        } else if (strcmp(key, "load_threads") == 0) {
+            cfg->load_threads = atoi(val);
+        } else if (strcmp(key, "cache_size") == 0) {
+            cfg->cache_size = atoi(val);
+        } else if (strcmp(key, "cache_snapshot") == 0) {
+            strncpy(cfg->cache_snapshot, val, MAX_STR_LEN - 1);
+            cfg->cache_snapshot[MAX_STR_LEN - 1] = '\0';
+        } else if (strcmp(key, "cache_shared") == 0) {
+            strncpy(cfg->cache_shared, val, MAX_STR_LEN - 1);
+            cfg->cache_shared[MAX_STR_LEN - 1] = '\0';
+        } else if (strcmp(key, "overload_queue") == 0) {
+            cfg->overload_queue = atoi(val);
+        } else if (strcmp(key, "overload_lag_ms") == 0) {
+            cfg->overload_lag_ms = atoi(val);
+        } else if (strcmp(key, "dedup_size") == 0) {
+            cfg->dedup_size = atoi(val);
+        } else if (strcmp(key, "workers") == 0) {
+            cfg->workers = atoi(val);
+        } else if (strcmp(key, "reuseport_steering") == 0) {
+            if (strcasecmp(val, "client") == 0) cfg->steer = STEER_CLIENT;
+            else if (strcasecmp(val, "qname") == 0) cfg->steer = STEER_QNAME;
+            else if (strcasecmp(val, "kernel") == 0) cfg->steer = STEER_KERNEL;
+            else fprintf(stderr, "Unknown reuseport_steering '%s'. Using kernel.\n", val);
+        } else if (strcmp(key, "busy_poll") == 0) {
+            cfg->busy_poll = atoi(val);
+        } else if (strcmp(key, "busy_poll_idle_ms") == 0) {
+            cfg->busy_poll_idle_ms = atoi(val);
+        } else if (strcmp(key, "socket_rcvbuf") == 0) {
+            cfg->socket_opts.rcvbuf = atoi(val);
+        } else if (strcmp(key, "socket_sndbuf") == 0) {
+            cfg->socket_opts.sndbuf = atoi(val);
+        } else if (strcmp(key, "pmtud_omit") == 0) {
+            cfg->socket_opts.pmtud_omit = atoi(val);
+        } else if (strcmp(key, "rx_timestamps") == 0) {
+            cfg->socket_opts.timestamps = atoi(val);
+        } else if (strcmp(key, "udp_gso") == 0) {
+            cfg->socket_opts.gso = atoi(val);
+        } else if (strcmp(key, "udp_gro") == 0) {
+            cfg->socket_opts.gro = atoi(val);
+        } else if (strcmp(key, "xdp_interface") == 0) {
+            strncpy(cfg->xdp_interface, val, MAX_STR_LEN - 1);
+            cfg->xdp_interface[MAX_STR_LEN - 1] = '\0';
+        } else if (strcmp(key, "xdp_queue") == 0) {
+            cfg->xdp_queue = atoi(val);
+        } else if (strcmp(key, "xdp_mode") == 0) {
+            cfg->xdp_native = strcasecmp(val, "native") == 0;
+            if (!cfg->xdp_native && strcasecmp(val, "skb") != 0)
+                fprintf(stderr, "Unknown xdp_mode '%s'. Using skb.\n", val);
+        } else if (strcmp(key, "pin_workers") == 0) {
+            cfg->pin_workers = atoi(val);
+        } else if (strcmp(key, "overload_action") == 0) {
+            cfg->overload_drop = strcasecmp(val, "drop") == 0;
+            if (!cfg->overload_drop && strcasecmp(val, "refuse") != 0)
+                fprintf(stderr, "Unknown overload_action '%s'. Using refuse.\n", val);
+        } else if (strcmp(key, "cache_snapshot_interval") == 0) {
+            cfg->cache_snapshot_interval = atoi(val);
+        } else if (strcmp(key, "rpz_update_file") == 0) {
+            strncpy(cfg->rpz_update_file, val, MAX_STR_LEN - 1);
+            cfg->rpz_update_file[MAX_STR_LEN - 1] = '\0';
+        } else if (strncmp(key, "group.", 6) == 0) {
+            rc = parse_group_key(cfg, key, val);
         }
     }
 
     fclose(f);
+
+    double compile_start = now_ms();
+    for (int i = 0; rc == 0 && i < cfg->group_count; i++) {
+        if (cfg->groups[i].owns_patterns && pattern_set_compile(cfg->groups[i].patterns) < 0) {
+            fprintf(stderr, "Failed to compile pattern rules of group '%s'\n", cfg->groups[i].name);
+            rc = -1;
+        }
+    }
+    for (int i = 0; rc == 0 && i < cfg->group_count; i++) {
+        ClientGroup *g = &cfg->groups[i];
+        if (!g->owns_blocklist) continue;
+        if (matcher_build(&g->lists, cfg->matcher, g->blocklist) < 0) {
+            fprintf(stderr, "Group '%s' keeps the trie matcher\n", g->name);
+            matcher_build(&g->lists, &matcher_trie, g->blocklist);
+        }
+        g->blocklist = g->lists.ops == &matcher_trie ? g->lists.impl : NULL;
+    }
+    if (rc == 0 && cfg->louds_file[0]) {
+        LoudsTrie *image = NULL;
+        if (matcher_count(&def->lists) > 0)
+            fprintf(stderr, "louds_file cannot be combined with top-level lists\n");
+        else
+            image = louds_map(cfg->louds_file);
+        if (!image) {
+            rc = -1;
+        } else {
+            matcher_free(&def->lists);
+            matcher_wrap(&def->lists, &matcher_louds, image);
+            def->blocklist = NULL;
+        }
+    }
+    st->compile_ms = now_ms() - compile_start;
+    if (rc < 0) {
+        free_config(cfg);
+        return -1;
+    }
+
+    strcpy(def->response, cfg->response);
+    strcpy(def->fake_ip, cfg->fake_ip);
+    for (int i = 1; i < cfg->group_count; i++) {
+        ClientGroup *g = &cfg->groups[i];
+        if (g->response[0] == '\0') strcpy(g->response, cfg->response);
+        if (g->fake_ip[0] == '\0') strcpy(g->fake_ip, cfg->fake_ip);
+        if (!g->owns_blocklist) {
+            g->blocklist = def->blocklist;
+            g->lists = def->lists;
+        }
+        if (!g->patterns) g->patterns = def->patterns;
+    }
+    st->total_ms = now_ms() - start;
     return 0;
 }
+
+/**
+ * @brief Releases compiled structures owned by a configuration.
+ *
+ * Shared blocklists are freed only by the group that owns them.
+ *
+ * @param cfg Configuration previously filled by load_config().
+ */
+void free_config(Config *cfg) {
+    for (int i = 0; i < cfg->group_count; i++) {
+        if (cfg->groups[i].owns_blocklist) {
+            /* Until its matcher is built a group only has the trie. */
+            if (cfg->groups[i].lists.ops) matcher_free(&cfg->groups[i].lists);
+            else domain_trie_free(cfg->groups[i].blocklist);
+        }
+        cfg->groups[i].blocklist = NULL;
+        memset(&cfg->groups[i].lists, 0, sizeof(Matcher));
+        cfg->groups[i].owns_blocklist = 0;
+        if (cfg->groups[i].owns_patterns) pattern_set_free(cfg->groups[i].patterns);
+        cfg->groups[i].patterns = NULL;
+        cfg->groups[i].owns_patterns = 0;
+    }
+    cfg->group_count = 0;
+    cidr_table_free(&cfg->group_table);
+}
+
+/**
+ * @brief Selects the client group for a source address.
+ *
+ * Uses longest-prefix matching over all group CIDRs, so a /24 carved out
+ * of a /8 belongs to the more specific group.
+ *
+ * @param cfg Loaded configuration.
+ * @param addr Client IPv4 address in host byte order.
+ * @return The matching group, or the default group.
+ */
+const ClientGroup *config_find_group(const Config *cfg, uint32_t addr) {
+    int idx = cidr_table_lookup(&cfg->group_table, addr);
+    return &cfg->groups[idx > 0 ? idx : 0];
+}
+
+int group_match(const ClientGroup *g, const char *name, TrieMatch *m) {
+    if (!g->lists.ops) return domain_trie_match(g->blocklist, name, m);
+    return matcher_match(&g->lists, name, m);
+}
+
+size_t group_list_size(const ClientGroup *g) {
+    if (!g->lists.ops) return g->blocklist ? g->blocklist->entries : 0;
+    return matcher_count(&g->lists);
+}
@@ -0,0 +1,103 @@
+/**
+ * @file dedup.c
+ * @brief Absorbs client retransmissions of requests already being forwarded.
+ */
+
+#include "dedup.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+
+int dedup_init(Dedup *d, size_t entries) {
+    memset(d, 0, sizeof(*d));
+    size_t n = DEDUP_PROBE;
+    while (n < entries) n <<= 1;
+    d->slots = calloc(n, sizeof(DedupEntry));
+    if (!d->slots) return -1;
+    d->mask = n - 1;
+    return 0;
+}
+
+void dedup_free(Dedup *d) {
+    free(d->slots);
+    d->slots = NULL;
+}
+
+/**
+ * @brief Continues a 64-bit FNV-1a hash over @p n bytes.
+ */
+static uint64_t fnv64(uint64_t h, const unsigned char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * FNV64_PRIME;
+    return h;
+}
+
+/**
+ * @brief Returns the end of the question section, or @p len if it is truncated.
+ */
+static int question_end(const unsigned char *q, int len) {
+    int i = 12;
+    while (i < len && q[i] != 0) {
+        if (q[i] & 0xC0) return len; /* no compression in a question */
+        i += q[i] + 1;
+    }
+    i += 1 + 4;
+    return i < len ? i : len;
+}
+
+uint64_t dedup_key(const struct sockaddr_in *client, const unsigned char *query, int len) {
+    uint64_t h = FNV64_OFFSET;
+    h = fnv64(h, (const unsigned char *)&client->sin_addr.s_addr, sizeof(client->sin_addr.s_addr));
+    h = fnv64(h, (const unsigned char *)&client->sin_port, sizeof(client->sin_port));
+    if (len >= 12) {
+        h = fnv64(h, query, 2);
+        h = fnv64(h, query + 12, (size_t)(question_end(query, len) - 12));
+    }
+    return h ? h : 1;
+}
+
+/**
+ * @brief Returns the entry for @p key, or NULL.
+ */
+static DedupEntry *find(Dedup *d, uint64_t key) {
+    for (size_t i = 0; i < DEDUP_PROBE; i++) {
+        DedupEntry *e = &d->slots[(key + i) & d->mask];
+        if (e->key == key) return e;
+    }
+    return NULL;
+}
+
+int dedup_duplicate(Dedup *d, uint64_t key, double arrived_ms, double now_ms) {
+    DedupEntry *e = find(d, key);
+    if (!e) return 0;
+    int dup = e->done_ms == 0 ? now_ms - e->started_ms < DEDUP_STALE_MS : arrived_ms < e->done_ms;
+    if (dup) d->absorbed++;
+    return dup;
+}
+
+void dedup_start(Dedup *d, uint64_t key, double now_ms) {
+    DedupEntry *e = find(d, key);
+    if (!e) {
+        /* Take an empty slot, else the one whose request is oldest. */
+        e = &d->slots[key & d->mask];
+        for (size_t i = 0; i < DEDUP_PROBE && e->key != 0; i++) {
+            DedupEntry *c = &d->slots[(key + i) & d->mask];
+            if (c->key == 0 || c->started_ms < e->started_ms) e = c;
+        }
+    }
+    e->key = key;
+    e->started_ms = now_ms;
+    e->done_ms = 0;
+    d->tracked++;
+}
+
+void dedup_done(Dedup *d, uint64_t key, double now_ms) {
+    DedupEntry *e = find(d, key);
+    if (e && e->done_ms == 0) e->done_ms = now_ms;
+}
+
+void dedup_forget(Dedup *d, uint64_t key) {
+    DedupEntry *e = find(d, key);
+    if (e) e->key = 0;
+}
@@ -16,6 +16,7 @@
 #include <arpa/inet.h>
 #include <ctype.h>
 #include <sys/time.h>
+#include <time.h>
 #include <strings.h>
 
 #define BUF_SIZE 1500
@@ -39,6 +40,65 @@ int parse_dns_query(const unsigned char *buffer, int len, char *domain, int *typ
     return (domain[0] != '\0') ? 0 : -1;
 }
 
+/* Header bytes 4..11 (QD/AN/NS/AR counts) of the common query shape. */
+static const unsigned char fast_counts[2][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 0, 0, 0, 0, 0, 1 },
+};
+
+/**
+ * @brief Decodes a query of the common shape with fixed-offset checks.
+ *
+ * The header is checked with two 8-byte comparisons. The QNAME is copied
+ * in one pass: a dotted name is the wire name shifted by one byte with the
+ * length bytes turned into dots, so every byte is lower-cased and stored
+ * unconditionally and only label boundaries need a test.
+ */
+int parse_dns_query_fast(const unsigned char *buffer, int len, DnsQuestion *q) {
+    if (len < 12 + 1 + 4 || (buffer[2] & 0xF8) != 0) return -1;
+    int has_opt = memcmp(buffer + 4, fast_counts[1], 8) == 0;
+    if (!has_opt && memcmp(buffer + 4, fast_counts[0], 8) != 0) return -1;
+
+    const unsigned char *wire = buffer + 12;
+    int avail = len - 12 - 4 - (has_opt ? 11 : 0);
+    if (avail > 255) avail = 255;
+    if (avail < 1 || wire[0] > 63) return -1;
+    int next = 1 + wire[0], i = 1;
+    if (wire[0] != 0) {
+        for (; i < avail; i++) {
+            unsigned char c = wire[i];
+            if (i == next) {
+                if (c == 0) break;
+                if (c > 63) return -1;
+                next = i + 1 + c;
+                c = '.';
+            } else {
+                c = (unsigned char)(c | ((unsigned char)(c - 'A') < 26u) << 5);
+            }
+            q->name[i - 1] = (char)c;
+        }
+        if (i >= avail) return -1;
+    } else {
+        i = 0;
+    }
+    q->name[i > 0 ? i - 1 : 0] = '\0';
+    q->qname_len = i + 1;
+
+    const unsigned char *p = wire + i + 1;
+    q->type = (p[0] << 8) | p[1];
+    q->class = (p[2] << 8) | p[3];
+    q->has_opt = has_opt;
+    p += 4;
+    if (has_opt) {
+        /* Root owner, TYPE 41, then CLASS/TTL and an RDLENGTH covering the rest. */
+        int rdlen = (p[9] << 8) | p[10];
+        if (p[0] != 0 || p[1] != 0 || p[2] != 41 || p + 11 + rdlen != buffer + len) return -1;
+    } else if (p != buffer + len) {
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * @brief Extracts the queried domain name from a DNS packet.
  *
@@ -86,16 +146,31 @@ void extract_domain(const unsigned char *buf, int buf_len, char *domain,
 /**
  * @brief Checks whether a given domain name is blacklisted.
  *
- * Compares the provided domain name (case-insensitive) against entries
- * in the blacklist loaded from the configuration.
+ * Looks the name up (case-insensitively) in the default group's compiled
+ * blocklist; a listed name also blocks all of its subdomains, and RPZ
+ * actions other than passthru count as blocked. Names the lists do not
+ * decide are matched against the group's pattern rules.
+ * Configurations
+ * that were not compiled by load_config() fall back to scanning the raw
+ * `blacklist` array with the same suffix semantics.
  *
  * @param name The queried domain name.
  * @param cfg Pointer to the current configuration structure.
  * @return 1 if the domain is blacklisted, 0 otherwise.
  */
 int is_blacklisted(const char *name, Config *cfg) {
+    if (cfg->group_count > 0) {
+        TrieMatch m;
+        int verdict = group_match(&cfg->groups[0], name, &m);
+        if (verdict != DT_NONE) return domain_verdict_blocks(verdict);
+        return pattern_set_match(cfg->groups[0].patterns, name) >= 0;
+    }
+
+    size_t nlen = strlen(name);
     for (int i = 0; i < cfg->blacklist_count; i++) {
-        if (strcasecmp(name, cfg->blacklist[i]) == 0) return 1;
+        size_t blen = strlen(cfg->blacklist[i]);
+        if (nlen < blen || strcasecmp(name + nlen - blen, cfg->blacklist[i]) != 0) continue;
+        if (nlen == blen || name[nlen - blen - 1] == '.') return 1;
     }
     return 0;
 }
@@ -245,61 +320,161 @@ int build_refused_response(const unsigned char *req, int req_len, unsigned char
 }
 
 /**
- * @brief Forwards a DNS query to an upstream server and relays the response back to the client.
+ * @brief Builds a SERVFAIL response for a query no upstream can take.
  *
- * Opens a temporary UDP socket, sends the DNS query to the configured upstream server,
- * waits for a reply, and forwards the response back to the original client.
+ * Same shape as build_refused_response(), with RCODE 2, so the client
+ * moves on to another resolver instead of waiting out its timeout.
  *
- * @param sock The UDP socket of the proxy server.
- * @param buffer Pointer to the received DNS query.
- * @param len Length of the query.
- * @param upstream_dns IP address of the upstream DNS server.
- * @param upstream_port Port of the upstream DNS server.
- * @param client Pointer to the client address structure.
- * @param client_len Length of the client address structure.
+ * @param req Pointer to the original DNS query.
+ * @param req_len Length of the query.
+ * @param resp Output buffer for the response.
+ * @param resp_cap Capacity of the response buffer.
+ * @return Length of the generated response, or -1 on error.
  */
-void forward_to_upstream(int sock, unsigned char *buffer, int len, 
-                        const char *upstream_dns, int upstream_port,
-                        struct sockaddr_in *client, socklen_t client_len) {
-    int usock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (usock < 0) { 
-        perror("upstream socket"); 
-        return; 
-    }
+int build_servfail_response(const unsigned char *req, int req_len, unsigned char *resp, int resp_cap) {
+    int n = build_refused_response(req, req_len, resp, resp_cap);
+    if (n > 0) resp[3] = 0x82;
+    return n;
+}
 
-    struct sockaddr_in upstream;
-    memset(&upstream, 0, sizeof(upstream));
-    upstream.sin_family = AF_INET;
-    upstream.sin_port = htons(upstream_port);
-    
-    if (inet_pton(AF_INET, upstream_dns, &upstream.sin_addr) != 1) {
-        fprintf(stderr, "Invalid upstream IP: %s\n", upstream_dns);
-        close(usock);
-        return;
-    }
+/**
+ * @brief Builds a NODATA response for a policy-matched domain.
+ *
+ * Constructs a NOERROR response that echoes the question and carries no
+ * answers; local-data answers are appended to it with append_answer_record().
+ *
+ * @param req Pointer to the original DNS query.
+ * @param req_len Length of the query.
+ * @param resp Output buffer for the response.
+ * @param resp_cap Capacity of the response buffer.
+ * @return Length of the generated response, or -1 on error.
+ */
+int build_nodata_response(const unsigned char *req, int req_len, unsigned char *resp, int resp_cap) {
+    if (req_len < 12) return -1;
+
+    memcpy(resp, req, 2);
+    resp[2] = 0x84 | (req[2] & 0x01);
+    resp[3] = 0x80;
+
+    resp[4] = 0x00;
+    resp[5] = 0x01;
+    resp[6] = resp[7] = resp[8] = resp[9] = resp[10] = resp[11] = 0x00;
+
+    int i = 12;
+    while (i < req_len && req[i] != 0) i++;
+    if (i >= req_len - 4) return -1;
+
+    int qd_len = (i - 12) + 1 + 4;
+    if (12 + qd_len > resp_cap) return -1;
 
-    if (sendto(usock, buffer, len, 0, (struct sockaddr *)&upstream, sizeof(upstream)) < 0) {
-        perror("sendto upstream");
-        close(usock);
-        return;
+    memcpy(resp + 12, req + 12, qd_len);
+
+    return 12 + qd_len;
+}
+
+/**
+ * @brief Appends an answer record owned by the question name.
+ *
+ * @param resp Response whose question section starts at offset 12.
+ * @param resp_len Current length of the response.
+ * @param resp_cap Capacity of the response buffer.
+ * @param type RR type of the record.
+ * @param ttl Time-to-live of the record.
+ * @param rdata Record data in wire format.
+ * @param rdlen Length of @p rdata.
+ * @return New length of the response, or -1 if it does not fit.
+ */
+int append_answer_record(unsigned char *resp, int resp_len, int resp_cap, int type,
+                         unsigned int ttl, const unsigned char *rdata, int rdlen) {
+    if (resp_len + 12 + rdlen > resp_cap) return -1;
+
+    int offset = resp_len;
+    resp[offset++] = 0xC0;
+    resp[offset++] = 0x0C;
+    resp[offset++] = (unsigned char)(type >> 8);
+    resp[offset++] = (unsigned char)type;
+    resp[offset++] = 0x00;
+    resp[offset++] = 0x01;
+
+    uint32_t net_ttl = htonl((uint32_t)ttl);
+    memcpy(resp + offset, &net_ttl, 4);
+    offset += 4;
+
+    resp[offset++] = (unsigned char)(rdlen >> 8);
+    resp[offset++] = (unsigned char)rdlen;
+    memcpy(resp + offset, rdata, rdlen);
+    offset += rdlen;
+
+    int ancount = ((resp[6] << 8) | resp[7]) + 1;
+    resp[6] = (unsigned char)(ancount >> 8);
+    resp[7] = (unsigned char)ancount;
+    return offset;
+}
+
+/**
+ * @brief Encodes a dotted domain name as a sequence of length-prefixed labels.
+ *
+ * @param name Domain name, with or without a trailing dot.
+ * @param out Output buffer.
+ * @param cap Capacity of @p out.
+ * @return Number of bytes written, or -1 if the name is invalid or too long.
+ */
+int dns_encode_name(const char *name, unsigned char *out, int cap) {
+    int pos = 0;
+    const char *p = name;
+    while (*p) {
+        const char *dot = strchr(p, '.');
+        int len = dot ? (int)(dot - p) : (int)strlen(p);
+        if (len == 0 || len > 63 || pos + len + 2 > cap) return -1;
+        out[pos++] = (unsigned char)len;
+        memcpy(out + pos, p, len);
+        pos += len;
+        p += len;
+        if (*p == '.') p++;
     }
+    if (pos + 1 > cap || pos + 1 > 255) return -1;
+    out[pos++] = 0;
+    return pos;
+}
 
-    unsigned char response[BUF_SIZE];
-    struct timeval tv;
-    tv.tv_sec = 2; 
-    tv.tv_usec = 0;
-    setsockopt(usock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    
-    ssize_t rlen = recvfrom(usock, response, sizeof(response), 0, NULL, NULL);
+/**
+ * @brief Relays the outcome of an upstream exchange back to the client.
+ *
+ * A validated reply from the upstream's randomized socket pool (see
+ * upstream_receive()) is cached and sent to the original client. When the
+ * exchange failed because no upstream server is in rotation, the client
+ * is answered SERVFAIL immediately, and nothing is cached.
+ *
+ * @param sock The UDP socket of the proxy server.
+ * @param query Pointer to the received DNS query.
+ * @param len Length of the query.
+ * @param reply The upstream reply, overwritten by SERVFAIL if one is sent.
+ * @param reply_len Length of the reply, or -1 if the exchange failed.
+ * @param reply_cap Capacity of @p reply.
+ * @param upstream Upstream server state.
+ * @param client Pointer to the client address structure.
+ * @param client_len Length of the client address structure.
+ * @param cache Cache that keeps cacheable responses, or NULL.
+ * @return 0 if a reply was sent to the client, -1 if none was (upstream
+ *         timeout or error, or a failed send).
+ */
+int relay_upstream_reply(int sock, const unsigned char *query, int len, unsigned char *reply,
+                         int reply_len, int reply_cap, const Upstream *upstream,
+                         const struct sockaddr_in *client, socklen_t client_len,
+                         ResponseCache *cache) {
+    int rlen = reply_len;
     if (rlen < 0) {
-        perror("recvfrom upstream");
-        close(usock);
-        return;
+        /* Every server is out of rotation: fail now rather than after a timeout. */
+        if (upstream_available(upstream) > 0 ||
+            (rlen = build_servfail_response(query, len, reply, reply_cap)) < 0)
+            return -1;
+        cache = NULL;
     }
 
-    if (sendto(sock, response, rlen, 0, (struct sockaddr *)client, client_len) < 0) {
+    if (cache) cache_store(cache, query, len, reply, rlen, time(NULL));
+    if (sendto(sock, reply, rlen, 0, (const struct sockaddr *)client, client_len) < 0) {
         perror("sendto client");
+        return -1;
     }
-    
-    close(usock);
+    return 0;
 }
@@ -0,0 +1,512 @@
+/**
+ * @file domain_trie.c
+ * @brief Reversed-label trie used to match query names against domain lists.
+ *
+ * Every node holds one label; the children of a node are located through a
+ * single open-addressing hash table keyed by (parent index, label), so a
+ * lookup costs one probe per label of the query name regardless of how many
+ * names are listed. Each node carries separate verdicts for the name itself
+ * and for names below it, which covers both list entries (both scopes) and
+ * RPZ triggers (`name` vs `*.name`). Local-data records hang off a second
+ * hash table keyed by node and scope.
+ */
+
+#include "domain_trie.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+
+#define TRIE_INITIAL_NODES 64
+#define TRIE_MAX_LABEL 63
+
+/**
+ * @brief Hashes a label (case-insensitively) together with its parent's hash.
+ *
+ * Chaining the parent's hash rather than its index makes a node's hash a
+ * function of the name suffix alone, so tries built separately can be
+ * merged without rehashing their labels.
+ *
+ * @param parent Hash of the parent node (0 for the root).
+ * @param label Label text (not NUL-terminated).
+ * @param len Length of the label.
+ * @return 32-bit FNV-1a hash, never zero.
+ */
+static uint32_t label_hash(uint32_t parent, const char *label, size_t len) {
+    uint32_t h = 2166136261u ^ (parent * 0x9E3779B1u);
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)tolower((unsigned char)label[i]);
+        h *= 16777619u;
+    }
+    return h ? h : 1;
+}
+
+/**
+ * @brief Finds the child of @p parent labelled @p label.
+ *
+ * @return Node index, or 0 if no such child exists.
+ */
+static uint32_t find_child(const DomainTrie *t, uint32_t parent,
+                           const char *label, size_t len, uint32_t h) {
+    size_t i = h & t->slot_mask;
+    while (t->slots[i]) {
+        const TrieNode *n = &t->nodes[t->slots[i]];
+        if (n->hash == h && n->parent == parent && n->label_len == len &&
+            strncasecmp(t->labels + n->label_off, label, len) == 0)
+            return t->slots[i];
+        i = (i + 1) & t->slot_mask;
+    }
+    return 0;
+}
+
+/**
+ * @brief Rebuilds the hash table with @p size slots.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int resize_slots(DomainTrie *t, size_t size) {
+    uint32_t *slots = calloc(size, sizeof(uint32_t));
+    if (!slots) return -1;
+
+    for (uint32_t n = 1; n < t->node_count; n++) {
+        size_t i = t->nodes[n].hash & (size - 1);
+        while (slots[i]) i = (i + 1) & (size - 1);
+        slots[i] = n;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->slot_mask = size - 1;
+    return 0;
+}
+
+/**
+ * @brief Appends a new child node, growing storage as needed.
+ *
+ * @return Index of the new node, or 0 on allocation failure.
+ */
+static uint32_t add_child(DomainTrie *t, uint32_t parent,
+                          const char *label, size_t len, uint32_t h) {
+    if ((t->node_count + 1) * 2 > t->slot_mask + 1 && resize_slots(t, (t->slot_mask + 1) * 2) < 0)
+        return 0;
+
+    if (t->node_count == t->node_cap) {
+        size_t cap = t->node_cap * 2;
+        TrieNode *nodes = realloc(t->nodes, cap * sizeof(TrieNode));
+        if (!nodes) return 0;
+        t->nodes = nodes;
+        t->node_cap = cap;
+    }
+
+    if (t->labels_len + len > t->labels_cap) {
+        size_t cap = t->labels_cap * 2;
+        while (cap < t->labels_len + len) cap *= 2;
+        char *labels = realloc(t->labels, cap);
+        if (!labels) return 0;
+        t->labels = labels;
+        t->labels_cap = cap;
+    }
+
+    uint32_t idx = (uint32_t)t->node_count++;
+    TrieNode *n = &t->nodes[idx];
+    n->parent = parent;
+    n->label_off = (uint32_t)t->labels_len;
+    n->label_len = (uint8_t)len;
+    n->hash = h;
+    n->verdict = DT_NONE;
+    n->sub = DT_NONE;
+    for (size_t i = 0; i < len; i++)
+        t->labels[t->labels_len++] = (char)tolower((unsigned char)label[i]);
+
+    size_t i = h & t->slot_mask;
+    while (t->slots[i]) i = (i + 1) & t->slot_mask;
+    t->slots[i] = idx;
+    return idx;
+}
+
+DomainTrie *domain_trie_new(void) {
+    DomainTrie *t = calloc(1, sizeof(DomainTrie));
+    if (!t) return NULL;
+
+    t->nodes = calloc(TRIE_INITIAL_NODES, sizeof(TrieNode));
+    t->slots = calloc(TRIE_INITIAL_NODES * 2, sizeof(uint32_t));
+    t->labels = malloc(TRIE_INITIAL_NODES * 8);
+    if (!t->nodes || !t->slots || !t->labels) {
+        domain_trie_free(t);
+        return NULL;
+    }
+    t->node_cap = TRIE_INITIAL_NODES;
+    t->node_count = 1;  /* root */
+    t->slot_mask = TRIE_INITIAL_NODES * 2 - 1;
+    t->labels_cap = TRIE_INITIAL_NODES * 8;
+    return t;
+}
+
+void domain_trie_free(DomainTrie *t) {
+    if (!t) return;
+    free(t->nodes);
+    free(t->slots);
+    free(t->labels);
+    free(t->data);
+    free(t->data_slots);
+    free(t->rdata);
+    free(t);
+}
+
+/**
+ * @brief Finds the node for a name, walking labels from the TLD down.
+ *
+ * A trailing dot is ignored. Empty labels or labels longer than 63 bytes
+ * make the name invalid.
+ *
+ * @param create Non-zero to add missing nodes.
+ * @return Node index, or 0 if the name is invalid, absent (and @p create is
+ *         zero), or memory runs out.
+ */
+static uint32_t find_node(DomainTrie *t, const char *name, int create) {
+    size_t end = strlen(name);
+    if (end > 0 && name[end - 1] == '.') end--;
+    if (end == 0) return 0;
+
+    uint32_t node = 0;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && name[start - 1] != '.') start--;
+        size_t len = end - start;
+        if (len == 0 || len > TRIE_MAX_LABEL) return 0;
+
+        uint32_t h = label_hash(t->nodes[node].hash, name + start, len);
+        uint32_t child = find_child(t, node, name + start, len, h);
+        if (!child) {
+            if (!create) return 0;
+            child = add_child(t, node, name + start, len, h);
+            if (!child) return 0;
+        }
+        node = child;
+        end = start > 0 ? start - 1 : 0;
+    }
+    return node;
+}
+
+/**
+ * @brief Stores a verdict in one scope slot, keeping the entry count in step.
+ *
+ * @return 1 if the slot now holds @p verdict, 0 if an existing DT_ALLOW was kept.
+ */
+static int set_verdict(DomainTrie *t, TrieNode *n, uint8_t *slot, int verdict) {
+    int had = n->verdict != DT_NONE || n->sub != DT_NONE;
+    int applied = *slot != DT_ALLOW || verdict == DT_NONE || verdict == DT_ALLOW;
+    if (applied) *slot = (uint8_t)verdict;
+    int has = n->verdict != DT_NONE || n->sub != DT_NONE;
+    if (has && !had) t->entries++;
+    if (had && !has) t->entries--;
+    return applied;
+}
+
+int domain_trie_insert_scoped(DomainTrie *t, const char *name, int verdict, int scope) {
+    uint32_t node = find_node(t, name, 1);
+    if (!node) return -1;
+
+    TrieNode *n = &t->nodes[node];
+    int applied = 1;
+    if (scope & DT_SCOPE_SELF) applied &= set_verdict(t, n, &n->verdict, verdict);
+    if (scope & DT_SCOPE_SUB) applied &= set_verdict(t, n, &n->sub, verdict);
+    return applied ? 0 : 1;
+}
+
+int domain_trie_insert(DomainTrie *t, const char *name, int verdict) {
+    return domain_trie_insert_scoped(t, name, verdict, DT_SCOPE_BOTH);
+}
+
+int domain_trie_reserve(DomainTrie *t, size_t nodes, size_t label_bytes) {
+    size_t need = t->node_count + nodes;
+    size_t size = t->slot_mask + 1;
+    while ((need + 1) * 2 > size) size *= 2;
+    if (size > t->slot_mask + 1 && resize_slots(t, size) < 0) return -1;
+
+    if (need > t->node_cap) {
+        TrieNode *grown = realloc(t->nodes, need * sizeof(TrieNode));
+        if (!grown) return -1;
+        t->nodes = grown;
+        t->node_cap = need;
+    }
+    if (t->labels_len + label_bytes > t->labels_cap) {
+        char *grown = realloc(t->labels, t->labels_len + label_bytes);
+        if (!grown) return -1;
+        t->labels = grown;
+        t->labels_cap = t->labels_len + label_bytes;
+    }
+    return 0;
+}
+
+/**
+ * Nodes are visited in index order, which is parent-before-child, so each
+ * source node's parent is already mapped. A destination parent created at
+ * or after @p fresh only gets children from this merge or from earlier
+ * partitions that are disjoint by construction, so the child lookup is
+ * skipped for it and the node is appended directly, reusing the
+ * position-independent hash from the source.
+ */
+int domain_trie_merge(DomainTrie *dst, const DomainTrie *src, size_t fresh) {
+    if (src->node_count <= 1) return 0;
+    uint32_t *map = malloc(src->node_count * sizeof(uint32_t));
+    if (!map || domain_trie_reserve(dst, src->node_count - 1, src->labels_len) < 0) {
+        free(map);
+        return -1;
+    }
+
+    map[0] = 0;
+    for (uint32_t i = 1; i < src->node_count; i++) {
+        const TrieNode *sn = &src->nodes[i];
+        const char *label = src->labels + sn->label_off;
+        uint32_t parent = map[sn->parent];
+        uint32_t node = 0;
+        if (parent == 0 || parent < fresh)
+            node = find_child(dst, parent, label, sn->label_len, sn->hash);
+        if (!node) node = add_child(dst, parent, label, sn->label_len, sn->hash);
+        if (!node) {
+            free(map);
+            return -1;
+        }
+        map[i] = node;
+
+        TrieNode *dn = &dst->nodes[node];
+        if (sn->verdict != DT_NONE) set_verdict(dst, dn, &dn->verdict, sn->verdict);
+        if (sn->sub != DT_NONE) set_verdict(dst, dn, &dn->sub, sn->sub);
+    }
+    free(map);
+    return 0;
+}
+
+int domain_trie_remove(DomainTrie *t, const char *name, int scope, int verdict) {
+    uint32_t node = find_node(t, name, 0);
+    if (!node) return 0;
+
+    TrieNode *n = &t->nodes[node];
+    int removed = 0;
+    if ((scope & DT_SCOPE_SELF) && n->verdict != DT_NONE &&
+        (verdict == DT_NONE || n->verdict == verdict)) {
+        set_verdict(t, n, &n->verdict, DT_NONE);
+        removed = 1;
+    }
+    if ((scope & DT_SCOPE_SUB) && n->sub != DT_NONE && (verdict == DT_NONE || n->sub == verdict)) {
+        set_verdict(t, n, &n->sub, DT_NONE);
+        removed = 1;
+    }
+    return removed;
+}
+
+/**
+ * @brief Returns the record-table slot for an owner key (existing or empty).
+ */
+static size_t data_slot(const DomainTrie *t, uint32_t key) {
+    size_t i = (key * 0x9E3779B1u) & t->data_mask;
+    while (t->data_slots[i] && t->data[t->data_slots[i] - 1].key != key)
+        i = (i + 1) & t->data_mask;
+    return i;
+}
+
+/**
+ * @brief Ensures room for one more record owner in the record table.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int grow_data_slots(DomainTrie *t) {
+    if (t->data_mask && (t->data_used + 1) * 2 <= t->data_mask + 1) return 0;
+
+    size_t size = t->data_mask ? (t->data_mask + 1) * 2 : 64;
+    uint32_t *slots = calloc(size, sizeof(uint32_t));
+    if (!slots) return -1;
+    uint32_t *old = t->data_slots;
+    size_t old_size = t->data_mask ? t->data_mask + 1 : 0;
+    t->data_slots = slots;
+    t->data_mask = size - 1;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i]) t->data_slots[data_slot(t, t->data[old[i] - 1].key)] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+int domain_trie_add_data(DomainTrie *t, const char *name, int scope, int type,
+                         uint32_t ttl, const unsigned char *rdata, int len) {
+    uint32_t node = find_node(t, name, 1);
+    if (!node || len < 0 || len > 0xFFFF) return -1;
+
+    TrieNode *n = &t->nodes[node];
+    uint8_t *slot = scope == DT_SCOPE_SUB ? &n->sub : &n->verdict;
+    if (*slot == DT_ALLOW) return 1;
+    uint32_t key = node * 2 + (scope == DT_SCOPE_SUB);
+
+    if (t->data_count == t->data_cap) {
+        size_t cap = t->data_cap ? t->data_cap * 2 : 64;
+        TrieData *data = realloc(t->data, cap * sizeof(TrieData));
+        if (!data) return -1;
+        t->data = data;
+        t->data_cap = cap;
+    }
+    if (t->rdata_len + (size_t)len > t->rdata_cap) {
+        size_t cap = t->rdata_cap ? t->rdata_cap * 2 : 1024;
+        while (cap < t->rdata_len + (size_t)len) cap *= 2;
+        unsigned char *buf = realloc(t->rdata, cap);
+        if (!buf) return -1;
+        t->rdata = buf;
+        t->rdata_cap = cap;
+    }
+    if (grow_data_slots(t) < 0) return -1;
+
+    size_t i = data_slot(t, key);
+    TrieData *d = &t->data[t->data_count];
+    d->key = key;
+    d->ttl = ttl;
+    d->type = (uint16_t)type;
+    d->len = (uint16_t)len;
+    d->off = (uint32_t)t->rdata_len;
+    /* A name that was not DT_LOCAL has only stale records: start a new chain. */
+    d->next = (*slot == DT_LOCAL) ? t->data_slots[i] : 0;
+    memcpy(t->rdata + t->rdata_len, rdata, (size_t)len);
+    t->rdata_len += (size_t)len;
+    if (!t->data_slots[i]) t->data_used++;
+    t->data_slots[i] = (uint32_t)++t->data_count;
+
+    set_verdict(t, n, slot, DT_LOCAL);
+    return 0;
+}
+
+int domain_trie_remove_data(DomainTrie *t, const char *name, int scope, int type,
+                            const unsigned char *rdata, int len) {
+    uint32_t node = find_node(t, name, 0);
+    if (!node || !t->data_mask) return 0;
+
+    TrieNode *n = &t->nodes[node];
+    uint8_t *vslot = scope == DT_SCOPE_SUB ? &n->sub : &n->verdict;
+    if (*vslot != DT_LOCAL) return 0;
+
+    size_t i = data_slot(t, node * 2 + (scope == DT_SCOPE_SUB));
+    uint32_t *link = &t->data_slots[i];
+    while (*link) {
+        TrieData *d = &t->data[*link - 1];
+        if (d->type == type && d->len == len && memcmp(t->rdata + d->off, rdata, (size_t)len) == 0) {
+            uint32_t next = d->next;
+            if (link == &t->data_slots[i] && next == 0) {
+                /* Keep the slot occupied by the (dead) record so probing stays intact. */
+                set_verdict(t, n, vslot, DT_NONE);
+            } else if (link == &t->data_slots[i]) {
+                /* The head record keeps the key; move the next record's contents into it. */
+                *d = t->data[next - 1];
+            } else {
+                *link = next;
+            }
+            return 1;
+        }
+        link = &d->next;
+    }
+    return 0;
+}
+
+const TrieData *domain_trie_data(const DomainTrie *t, const TrieMatch *m) {
+    if (!t || m->verdict != DT_LOCAL || !t->data_mask) return NULL;
+    uint32_t head = t->data_slots[data_slot(t, m->node * 2 + (m->scope == DT_SCOPE_SUB))];
+    return head ? &t->data[head - 1] : NULL;
+}
+
+/**
+ * @brief Descends one label during a match and records any verdict found.
+ *
+ * @return Non-zero if the walk should continue with the next label.
+ */
+static int match_step(const DomainTrie *t, uint32_t *node, const char *label, size_t len,
+                      int last, TrieMatch *m) {
+    if (len == 0 || len > TRIE_MAX_LABEL) return 0;
+    *node = find_child(t, *node, label, len, label_hash(t->nodes[*node].hash, label, len));
+    if (!*node) return 0;
+
+    int v = last ? t->nodes[*node].verdict : t->nodes[*node].sub;
+    if (v != DT_NONE) {
+        m->verdict = v;
+        m->node = *node;
+        m->scope = last ? DT_SCOPE_SELF : DT_SCOPE_SUB;
+        if (v == DT_ALLOW) return 0;
+    }
+    return !last;
+}
+
+/**
+ * @brief Walks the query name from its rightmost label.
+ *
+ * At every node on the path the subdomain verdict applies, and at the node
+ * for the full name its own verdict applies. The walk stops at the first
+ * label with no matching child. Allow verdicts take precedence at any
+ * depth, so the walk returns as soon as it meets one; otherwise the deepest
+ * verdict found wins.
+ */
+int domain_trie_match(const DomainTrie *t, const char *name, TrieMatch *m) {
+    m->verdict = DT_NONE;
+    m->node = 0;
+    m->scope = DT_SCOPE_SELF;
+    if (!t) return DT_NONE;
+
+    size_t end = strlen(name);
+    if (end > 0 && name[end - 1] == '.') end--;
+
+    uint32_t node = 0;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && name[start - 1] != '.') start--;
+        if (!match_step(t, &node, name + start, end - start, start == 0, m)) break;
+        end = start - 1;
+    }
+    return m->verdict;
+}
+
+int domain_trie_match_wire(const DomainTrie *t, const unsigned char *qname, size_t len,
+                           TrieMatch *m) {
+    m->verdict = DT_NONE;
+    m->node = 0;
+    m->scope = DT_SCOPE_SELF;
+    if (!t) return DT_NONE;
+
+    /* Labels are length-prefixed left to right; find them, then walk back. */
+    size_t offs[128];
+    int n = 0;
+    size_t p = 0;
+    while (p < len && qname[p] != 0) {
+        if (qname[p] > TRIE_MAX_LABEL || n == 128) return DT_NONE;
+        offs[n++] = p;
+        p += 1 + (size_t)qname[p];
+    }
+    if (p >= len) return DT_NONE;
+
+    uint32_t node = 0;
+    for (int i = n - 1; i >= 0; i--) {
+        if (!match_step(t, &node, (const char *)qname + offs[i] + 1, qname[offs[i]], i == 0, m)) break;
+    }
+    return m->verdict;
+}
+
+int domain_trie_lookup(const DomainTrie *t, const char *name) {
+    TrieMatch m;
+    return domain_trie_match(t, name, &m);
+}
+
+int domain_trie_name(const DomainTrie *t, uint32_t node, char *buf, size_t cap) {
+    size_t len = 0;
+    if (cap == 0) return -1;
+    while (node != 0 && node < t->node_count) {
+        const TrieNode *n = &t->nodes[node];
+        if (len + n->label_len + 2 > cap) return -1;
+        if (len > 0) buf[len++] = '.';
+        memcpy(buf + len, t->labels + n->label_off, n->label_len);
+        len += n->label_len;
+        node = n->parent;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+size_t domain_trie_memory(const DomainTrie *t) {
+    if (!t) return 0;
+    return sizeof(DomainTrie) + t->node_cap * sizeof(TrieNode) +
+           (t->slot_mask + 1) * sizeof(uint32_t) + t->labels_cap +
+           t->data_cap * sizeof(TrieData) +
+           (t->data_mask ? (t->data_mask + 1) * sizeof(uint32_t) : 0) + t->rdata_cap;
+}
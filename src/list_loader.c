@@ -0,0 +1,349 @@
+/**
+ * @file list_loader.c
+ * @brief Multi-threaded loader for large domain list files.
+ *
+ * Loading runs in two parallel rounds followed by one serial merge:
+ *
+ *  1. Each worker parses its own slice of the file and files every name
+ *     into one of N partitions by the hash of its last two labels.
+ *  2. Each worker builds a private trie from one partition, gathered from
+ *     all slices. Duplicates collapse here.
+ *  3. The partial tries are merged into the destination. Partitions never
+ *     share a node below the top-level label, so the merge only copies
+ *     nodes, without re-hashing or probing for them.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "list_loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define LIST_MAX_NAME 253
+#define LIST_MAX_LABEL 63
+
+/** @brief A parsed name pointing into the file buffer. */
+typedef struct {
+    const char *name;    /**< Lower-cased name without trailing dot, NUL-terminated. */
+    size_t len;          /**< Length of @c name. */
+} ListName;
+
+/** @brief A growable array of parsed names. */
+typedef struct {
+    ListName *names;     /**< Names in file order. */
+    size_t count;        /**< Number of names. */
+    size_t cap;          /**< Allocated capacity. */
+} ListBucket;
+
+/** @brief Work and result of one worker thread. */
+typedef struct {
+    const char *path;    /**< File name, for diagnostics. */
+    char *begin;         /**< First byte of the slice. */
+    char *end;           /**< One past the last byte (a newline or the end of the buffer). */
+    int nparts;          /**< Number of partitions. */
+    ListBucket parts[LIST_LOADER_MAX_THREADS]; /**< Names of this slice, by partition. */
+    size_t invalid;      /**< Lines rejected as invalid names. */
+    int failed;          /**< Non-zero if memory ran out. */
+} ListChunk;
+
+/** @brief Work and result of one partition build. */
+typedef struct {
+    ListChunk *chunks;   /**< All slices. */
+    int nchunks;         /**< Number of slices. */
+    int part;            /**< Partition to build. */
+    int verdict;         /**< Verdict for every name. */
+    DomainTrie *trie;    /**< Destination (private to this worker). */
+    int failed;          /**< Non-zero if memory ran out. */
+} ListBuild;
+
+/**
+ * @brief Returns a monotonic timestamp in milliseconds.
+ */
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Reads a whole file into a NUL-terminated heap buffer.
+ *
+ * @param path File to read.
+ * @param len Output: number of bytes read.
+ * @return Buffer to be freed by the caller, or NULL on error.
+ */
+static char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open list file '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    size_t cap = 1 << 16, n = 0;
+    char *buf = malloc(cap);
+    while (buf) {
+        n += fread(buf + n, 1, cap - n - 1, f);
+        if (n < cap - 1) break;
+        char *grown = realloc(buf, cap * 2);
+        if (!grown) {
+            free(buf);
+            buf = NULL;
+            break;
+        }
+        buf = grown;
+        cap *= 2;
+    }
+    if (buf && ferror(f)) {
+        fprintf(stderr, "Cannot read list file '%s': %s\n", path, strerror(errno));
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    if (!buf) return NULL;
+
+    buf[n] = '\0';
+    *len = n;
+    return buf;
+}
+
+/**
+ * @brief Extracts the domain name from one list-file line, in place.
+ *
+ * @return The name, or NULL for blank and comment lines.
+ */
+static char *parse_list_line(char *line) {
+    char *hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+
+    char *end = line + strlen(line);
+    while (end > line && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+
+    char *name = end;
+    while (name > line && !isspace((unsigned char)name[-1])) name--;
+    return *name ? name : NULL;
+}
+
+/**
+ * @brief Lower-cases a name in place, drops a trailing dot and validates it.
+ *
+ * @return Length of the normalized name, or 0 if it is not a valid name.
+ */
+static size_t normalize_name(char *name) {
+    size_t len = strlen(name);
+    if (len > 0 && name[len - 1] == '.') name[--len] = '\0';
+    if (len == 0 || len > LIST_MAX_NAME) return 0;
+
+    size_t label = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] == '.') {
+            if (label == 0) return 0;
+            label = 0;
+        } else {
+            if (++label > LIST_MAX_LABEL) return 0;
+            name[i] = (char)tolower((unsigned char)name[i]);
+        }
+    }
+    return label > 0 ? len : 0;
+}
+
+/**
+ * @brief Returns the partition of a normalized name.
+ *
+ * Names are partitioned by their last two labels, so every name below a
+ * given second-level domain lands in the same partial trie.
+ */
+static int name_partition(const char *name, size_t len, int nparts) {
+    const char *p = name + len;
+    int dots = 0;
+    while (p > name && !(p[-1] == '.' && ++dots == 2)) p--;
+    uint32_t h = 2166136261u;
+    for (; p < name + len; p++) {
+        h ^= (unsigned char)*p;
+        h *= 16777619u;
+    }
+    return (int)(h % (uint32_t)nparts);
+}
+
+/**
+ * @brief Appends a name to a bucket.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int bucket_push(ListBucket *b, const char *name, size_t len) {
+    if (b->count == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 1024;
+        ListName *grown = realloc(b->names, cap * sizeof(ListName));
+        if (!grown) return -1;
+        b->names = grown;
+        b->cap = cap;
+    }
+    b->names[b->count].name = name;
+    b->names[b->count].len = len;
+    b->count++;
+    return 0;
+}
+
+/**
+ * @brief Worker: splits a slice into names, filed by partition.
+ */
+static void *parse_chunk(void *arg) {
+    ListChunk *c = arg;
+    char *line = c->begin;
+    while (line < c->end) {
+        char *nl = memchr(line, '\n', (size_t)(c->end - line));
+        char *next = nl ? nl + 1 : c->end;
+        if (nl) *nl = '\0';
+
+        char *name = parse_list_line(line);
+        line = next;
+        if (!name) continue;
+
+        size_t len = normalize_name(name);
+        if (len == 0) {
+            fprintf(stderr, "%s: ignoring invalid domain '%s'\n", c->path, name);
+            c->invalid++;
+            continue;
+        }
+        if (bucket_push(&c->parts[name_partition(name, len, c->nparts)], name, len) < 0) {
+            c->failed = 1;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Worker: builds the partial trie of one partition.
+ */
+static void *build_part(void *arg) {
+    ListBuild *b = arg;
+    for (int c = 0; c < b->nchunks && !b->failed; c++) {
+        const ListBucket *bucket = &b->chunks[c].parts[b->part];
+        for (size_t i = 0; i < bucket->count; i++) {
+            if (domain_trie_insert(b->trie, bucket->names[i].name, b->verdict) < 0) {
+                b->failed = 1;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs @p fn on @p n work items of @p size bytes, one thread each.
+ *
+ * The first item runs on the calling thread; an item whose thread cannot
+ * be started also runs there.
+ */
+static void run_workers(void *(*fn)(void *), void *items, size_t size, int n) {
+    pthread_t tid[LIST_LOADER_MAX_THREADS];
+    int started[LIST_LOADER_MAX_THREADS] = { 0 };
+    char *base = items;
+    for (int i = 1; i < n; i++)
+        started[i] = pthread_create(&tid[i], NULL, fn, base + (size_t)i * size) == 0;
+    fn(base);
+    for (int i = 1; i < n; i++) {
+        if (started[i]) pthread_join(tid[i], NULL);
+        else fn(base + (size_t)i * size);
+    }
+}
+
+/**
+ * @brief Picks the number of worker threads for an input of @p len bytes.
+ */
+static int thread_count(int requested, size_t len) {
+    long n = requested > 0 ? requested : sysconf(_SC_NPROCESSORS_ONLN);
+    long by_size = (long)(len / LIST_LOADER_CHUNK_BYTES) + 1;
+    if (n > by_size) n = by_size;
+    if (n > LIST_LOADER_MAX_THREADS) n = LIST_LOADER_MAX_THREADS;
+    return n < 1 ? 1 : (int)n;
+}
+
+int list_load_file(const char *path, DomainTrie *trie, int verdict, int threads, LoadStats *st) {
+    double t0 = now_ms();
+    size_t len;
+    char *buf = read_file(path, &len);
+    if (!buf) return -1;
+    double t1 = now_ms();
+
+    int n = thread_count(threads, len);
+    ListChunk *chunks = calloc((size_t)n, sizeof(ListChunk));
+    ListBuild builds[LIST_LOADER_MAX_THREADS];
+    memset(builds, 0, sizeof(builds));
+    if (!chunks) {
+        free(buf);
+        fprintf(stderr, "%s: out of memory\n", path);
+        return -1;
+    }
+
+    char *cut = buf;
+    for (int i = 0; i < n; i++) {
+        chunks[i].path = path;
+        chunks[i].nparts = n;
+        chunks[i].begin = cut;
+        char *mid = buf + len * (size_t)(i + 1) / (size_t)n;
+        if (mid < cut) mid = cut;
+        char *nl = i < n - 1 ? memchr(mid, '\n', (size_t)(buf + len - mid)) : NULL;
+        cut = nl ? nl + 1 : buf + len;
+        chunks[i].end = cut;
+    }
+
+    run_workers(parse_chunk, chunks, sizeof(ListChunk), n);
+    double t2 = now_ms();
+
+    int rc = 0;
+    size_t valid = 0, invalid = 0;
+    for (int i = 0; i < n; i++) {
+        if (chunks[i].failed) rc = -1;
+        invalid += chunks[i].invalid;
+        for (int p = 0; p < n; p++) valid += chunks[i].parts[p].count;
+    }
+
+    size_t before = trie->entries;
+    for (int p = 0; p < n; p++) {
+        builds[p].chunks = chunks;
+        builds[p].nchunks = n;
+        builds[p].part = p;
+        builds[p].verdict = verdict;
+        /* A single partition goes straight into the destination. */
+        builds[p].trie = n == 1 ? trie : domain_trie_new();
+        if (!builds[p].trie) rc = -1;
+    }
+    if (rc == 0) run_workers(build_part, builds, sizeof(ListBuild), n);
+    double t3 = now_ms();
+
+    size_t fresh = trie->node_count;
+    for (int p = 0; p < n; p++) {
+        if (builds[p].failed) rc = -1;
+        if (n > 1) {
+            if (rc == 0 && domain_trie_merge(trie, builds[p].trie, fresh) < 0) rc = -1;
+            domain_trie_free(builds[p].trie);
+        }
+    }
+    double t4 = now_ms();
+
+    if (rc < 0) fprintf(stderr, "%s: out of memory\n", path);
+    st->files++;
+    st->bytes += len;
+    st->names += valid + invalid;
+    if (rc == 0) st->duplicates += valid - (trie->entries - before);
+    st->read_ms += t1 - t0;
+    st->parse_ms += t2 - t1;
+    st->build_ms += t3 - t2;
+    st->merge_ms += t4 - t3;
+    if (n > st->threads) st->threads = n;
+
+    for (int i = 0; i < n; i++) {
+        for (int p = 0; p < n; p++) free(chunks[i].parts[p].names);
+    }
+    free(chunks);
+    free(buf);
+    return rc;
+}
@@ -0,0 +1,505 @@
+/**
+ * @file louds.c
+ * @brief LOUDS-sparse succinct trie over label-reversed domain names.
+ *
+ * Levels are emitted from a sorted key stream in one pass: a key that
+ * shares its first `lcp` bytes with the previous key adds one edge to each
+ * level from `lcp` to its last byte. Concatenating the levels yields the
+ * edges in breadth-first order, which is what rank/select navigation needs:
+ * the child of the edge at position p is the node numbered
+ * rank1(has_child, p), and that node's edges start at the matching one of
+ * the louds bit vector.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "louds.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOUDS_MAX_KEY 255
+#define LOUDS_MAX_LABEL 63
+#define LOUDS_RANK_WORDS 8     /**< 64-bit words per rank block (512 bits). */
+#define LOUDS_SELECT_SAMPLE 64 /**< Ones between select samples. */
+
+/** @brief Edges of one level while building. */
+typedef struct {
+    uint8_t *labels;     /**< Edge labels. */
+    uint8_t *bits;       /**< Per edge: 1 = has child, 2 = starts node, 4 = ends name. */
+    size_t count;        /**< Number of edges. */
+    size_t cap;          /**< Allocated capacity. */
+    uint8_t *flags;      /**< Verdict bytes of the names ending on this level. */
+    size_t nflags;       /**< Number of verdict bytes. */
+    size_t flags_cap;    /**< Allocated capacity of @c flags. */
+} LoudsLevel;
+
+/** @brief State of a build pass over the sorted keys. */
+typedef struct {
+    LoudsLevel levels[LOUDS_MAX_KEY];
+    size_t depth;        /**< Number of levels in use. */
+    unsigned char prev[LOUDS_MAX_KEY];
+    size_t prev_len;     /**< Length of the previous key (0 before the first). */
+    int failed;          /**< Non-zero if memory ran out. */
+} LoudsBuilder;
+
+static size_t popcount64(uint64_t x) {
+    return (size_t)__builtin_popcountll(x);
+}
+
+static size_t words_for(size_t bits) {
+    return (bits + 63) / 64;
+}
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static int bit_at(const uint64_t *bits, size_t p) {
+    return (int)((bits[p >> 6] >> (p & 63)) & 1);
+}
+
+/**
+ * @brief Counts the ones in positions [0, p] of a bit vector.
+ */
+static size_t rank1(const uint64_t *bits, const uint32_t *rank, size_t p) {
+    size_t w = p >> 6, r = rank[w / LOUDS_RANK_WORDS];
+    for (size_t i = w / LOUDS_RANK_WORDS * LOUDS_RANK_WORDS; i < w; i++) r += popcount64(bits[i]);
+    return r + popcount64(bits[w] & (~0ull >> (63 - (p & 63))));
+}
+
+/**
+ * @brief Returns the position of the k-th one (1-based) of the louds vector.
+ */
+static size_t select_louds(const LoudsTrie *t, size_t k) {
+    size_t w = t->louds_select[(k - 1) / LOUDS_SELECT_SAMPLE];
+    size_t b = w / LOUDS_RANK_WORDS;
+    /* Sparse regions can put many blocks between samples: skip whole blocks. */
+    while (t->louds_rank[b + 1] < k) b++;
+    if (b * LOUDS_RANK_WORDS > w) w = b * LOUDS_RANK_WORDS;
+    size_t r = t->louds_rank[b];
+    for (size_t i = b * LOUDS_RANK_WORDS; i < w; i++) r += popcount64(t->louds[i]);
+    for (;;) {
+        size_t c = popcount64(t->louds[w]);
+        if (r + c >= k) break;
+        r += c;
+        w++;
+    }
+    uint64_t x = t->louds[w];
+    for (size_t i = r + 1; i < k; i++) x &= x - 1;
+    return w * 64 + (size_t)__builtin_ctzll(x);
+}
+
+/**
+ * @brief Returns the end (exclusive) of the node whose first edge is @p start.
+ */
+static size_t node_end(const LoudsTrie *t, size_t start) {
+    size_t p = start + 1;
+    while (p < t->edges) {
+        uint64_t x = t->louds[p >> 6] >> (p & 63);
+        if (x) return p + (size_t)__builtin_ctzll(x) < t->edges ? p + (size_t)__builtin_ctzll(x) : t->edges;
+        p = (p | 63) + 1;
+    }
+    return t->edges;
+}
+
+/**
+ * @brief Returns the first edge of the node reached through edge @p p.
+ */
+static size_t child_start(const LoudsTrie *t, size_t p) {
+    return select_louds(t, rank1(t->has_child, t->has_child_rank, p) + 1);
+}
+
+/**
+ * @brief Finds the edge labelled @p c among the edges [s, e) of a node.
+ *
+ * @return Edge position, or (size_t)-1 if there is none.
+ */
+static size_t find_edge(const LoudsTrie *t, size_t s, size_t e, uint8_t c) {
+    for (size_t p = s; p < e; p++) {
+        if (t->labels[p] == c) return p;
+        if (t->labels[p] > c) break;
+    }
+    return (size_t)-1;
+}
+
+/**
+ * @brief Appends one edge to a level.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int push_edge(LoudsLevel *l, uint8_t label, uint8_t bits) {
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 256;
+        uint8_t *labels = realloc(l->labels, cap);
+        if (!labels) return -1;
+        l->labels = labels;
+        uint8_t *b = realloc(l->bits, cap);
+        if (!b) return -1;
+        l->bits = b;
+        l->cap = cap;
+    }
+    l->labels[l->count] = label;
+    l->bits[l->count] = bits;
+    l->count++;
+    return 0;
+}
+
+static int push_flags(LoudsLevel *l, uint8_t flags) {
+    if (l->nflags == l->flags_cap) {
+        size_t cap = l->flags_cap ? l->flags_cap * 2 : 256;
+        uint8_t *f = realloc(l->flags, cap);
+        if (!f) return -1;
+        l->flags = f;
+        l->flags_cap = cap;
+    }
+    l->flags[l->nflags++] = flags;
+    return 0;
+}
+
+/**
+ * @brief Adds one key (in sorted order) to the levels.
+ */
+static int add_key(const unsigned char *key, size_t len, int verdict, int sub, void *ctx) {
+    LoudsBuilder *b = ctx;
+    size_t lcp = 0;
+    while (lcp < len && lcp < b->prev_len && key[lcp] == b->prev[lcp]) lcp++;
+
+    /* The edge this key continues from now leads to a node. */
+    if (lcp > 0 && len > lcp) b->levels[lcp - 1].bits[b->levels[lcp - 1].count - 1] |= 1;
+
+    for (size_t d = lcp; d < len; d++) {
+        int starts;
+        if (d > lcp) starts = 1;
+        else if (d == 0) starts = b->prev_len == 0;
+        else starts = b->prev_len == lcp;
+
+        uint8_t bits = (uint8_t)((d + 1 < len ? 1 : 0) | (starts ? 2 : 0) | (d + 1 == len ? 4 : 0));
+        if (push_edge(&b->levels[d], key[d], bits) < 0 ||
+            (d + 1 == len && push_flags(&b->levels[d], (uint8_t)(verdict | (sub << 4))) < 0)) {
+            b->failed = 1;
+            return 1;
+        }
+    }
+    if (len > b->depth) b->depth = len;
+    memcpy(b->prev, key, len);
+    b->prev_len = len;
+    return 0;
+}
+
+/**
+ * @brief Fills a rank directory for a bit vector of @p words words.
+ */
+static void build_rank(const uint64_t *bits, size_t words, uint32_t *rank) {
+    size_t r = 0;
+    for (size_t w = 0; w < words; w++) {
+        if (w % LOUDS_RANK_WORDS == 0) rank[w / LOUDS_RANK_WORDS] = (uint32_t)r;
+        r += popcount64(bits[w]);
+    }
+    rank[words / LOUDS_RANK_WORDS + (words % LOUDS_RANK_WORDS != 0)] = (uint32_t)r;
+}
+
+/**
+ * @brief Fills in the array offsets and image size implied by the counts.
+ */
+static void layout(LoudsHeader *h) {
+    size_t words = words_for(h->edges ? h->edges : 1);
+    size_t rank_len = (words / LOUDS_RANK_WORDS + 2) * sizeof(uint32_t);
+    size_t select_len = (h->nodes / LOUDS_SELECT_SAMPLE + 1) * sizeof(uint32_t);
+
+    size_t off = align8(sizeof(LoudsHeader));
+    h->off_labels = off;           off = align8(off + h->edges);
+    h->off_has_child = off;        off += words * 8;
+    h->off_louds = off;            off += words * 8;
+    h->off_is_name = off;          off += words * 8;
+    h->off_has_child_rank = off;   off = align8(off + rank_len);
+    h->off_louds_rank = off;       off = align8(off + rank_len);
+    h->off_is_name_rank = off;     off = align8(off + rank_len);
+    h->off_louds_select = off;     off = align8(off + select_len);
+    h->off_flags = off;            off = align8(off + h->names);
+    h->size = off;
+}
+
+/**
+ * @brief Points the trie's arrays into its image after validating the header.
+ *
+ * The offsets and size must be exactly those layout() derives from the
+ * counts, so every array lies inside the image.
+ *
+ * @return 0 on success, -1 if the image is malformed.
+ */
+static int attach(LoudsTrie *t, const unsigned char *image, size_t len) {
+    const LoudsHeader *h = (const LoudsHeader *)image;
+    if (len < sizeof(LoudsHeader) || memcmp(h->magic, LOUDS_MAGIC, 8) != 0 ||
+        h->version != LOUDS_VERSION || h->header_size != sizeof(LoudsHeader) || h->size > len)
+        return -1;
+    /* Bounded by the image first, so layout() cannot overflow. */
+    if (h->edges > len || h->names > len || h->nodes > h->edges) return -1;
+    LoudsHeader want = *h;
+    layout(&want);
+    if (memcmp(&want, h, sizeof(want)) != 0) return -1;
+
+    t->image = image;
+    t->image_len = len;
+    t->edges = h->edges;
+    t->nodes = h->nodes;
+    t->names = h->names;
+    t->labels = image + h->off_labels;
+    t->has_child = (const uint64_t *)(image + h->off_has_child);
+    t->louds = (const uint64_t *)(image + h->off_louds);
+    t->is_name = (const uint64_t *)(image + h->off_is_name);
+    t->has_child_rank = (const uint32_t *)(image + h->off_has_child_rank);
+    t->louds_rank = (const uint32_t *)(image + h->off_louds_rank);
+    t->is_name_rank = (const uint32_t *)(image + h->off_is_name_rank);
+    t->louds_select = (const uint32_t *)(image + h->off_louds_select);
+    t->flags = image + h->off_flags;
+    return 0;
+}
+
+/**
+ * @brief Lays the finished levels out as one image.
+ */
+static LoudsTrie *assemble(LoudsBuilder *b) {
+    size_t edges = 0, names = 0, nodes = 0;
+    for (size_t d = 0; d < b->depth; d++) {
+        edges += b->levels[d].count;
+        names += b->levels[d].nflags;
+        for (size_t i = 0; i < b->levels[d].count; i++) nodes += (b->levels[d].bits[i] & 2) != 0;
+    }
+
+    size_t words = words_for(edges ? edges : 1);
+    LoudsHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LOUDS_MAGIC, 8);
+    h.version = LOUDS_VERSION;
+    h.header_size = sizeof(LoudsHeader);
+    h.edges = edges;
+    h.nodes = nodes;
+    h.names = names;
+    layout(&h);
+    size_t off = h.size;
+
+    unsigned char *image = calloc(1, off);
+    LoudsTrie *t = calloc(1, sizeof(LoudsTrie));
+    if (!image || !t) {
+        free(image);
+        free(t);
+        return NULL;
+    }
+    memcpy(image, &h, sizeof(h));
+
+    uint8_t *labels = image + h.off_labels;
+    uint64_t *has_child = (uint64_t *)(image + h.off_has_child);
+    uint64_t *louds = (uint64_t *)(image + h.off_louds);
+    uint64_t *is_name = (uint64_t *)(image + h.off_is_name);
+    uint32_t *select = (uint32_t *)(image + h.off_louds_select);
+    uint8_t *flags = image + h.off_flags;
+
+    size_t p = 0, f = 0, ones = 0;
+    for (size_t d = 0; d < b->depth; d++) {
+        const LoudsLevel *l = &b->levels[d];
+        for (size_t i = 0; i < l->count; i++, p++) {
+            labels[p] = l->labels[i];
+            uint64_t bit = 1ull << (p & 63);
+            if (l->bits[i] & 1) has_child[p >> 6] |= bit;
+            if (l->bits[i] & 4) is_name[p >> 6] |= bit;
+            if (l->bits[i] & 2) {
+                louds[p >> 6] |= bit;
+                if (ones % LOUDS_SELECT_SAMPLE == 0) select[ones / LOUDS_SELECT_SAMPLE] = (uint32_t)(p >> 6);
+                ones++;
+            }
+        }
+        if (l->nflags) memcpy(flags + f, l->flags, l->nflags);
+        f += l->nflags;
+    }
+    build_rank(has_child, words, (uint32_t *)(image + h.off_has_child_rank));
+    build_rank(louds, words, (uint32_t *)(image + h.off_louds_rank));
+    build_rank(is_name, words, (uint32_t *)(image + h.off_is_name_rank));
+
+    attach(t, image, off);
+    return t;
+}
+
+LoudsTrie *louds_build_sorted(const SortedSet *s) {
+    LoudsBuilder *b = calloc(1, sizeof(LoudsBuilder));
+    if (!b) return NULL;
+    sorted_set_foreach(s, add_key, b);
+    LoudsTrie *t = b->failed ? NULL : assemble(b);
+    for (size_t d = 0; d < LOUDS_MAX_KEY; d++) {
+        free(b->levels[d].labels);
+        free(b->levels[d].bits);
+        free(b->levels[d].flags);
+    }
+    free(b);
+    return t;
+}
+
+LoudsTrie *louds_build(const DomainTrie *t) {
+    SortedSet *s = sorted_set_build(t);
+    if (!s) return NULL;
+    LoudsTrie *l = louds_build_sorted(s);
+    sorted_set_free(s);
+    return l;
+}
+
+int louds_write(const LoudsTrie *t, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Cannot write LOUDS image '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    size_t n = fwrite(t->image, 1, t->image_len, f);
+    if (fclose(f) != 0 || n != t->image_len) {
+        fprintf(stderr, "Cannot write LOUDS image '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+LoudsTrie *louds_map(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open LOUDS image '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || sb.st_size < (off_t)sizeof(LoudsHeader)) {
+        fprintf(stderr, "LOUDS image '%s' is truncated\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    LoudsTrie *t = calloc(1, sizeof(LoudsTrie));
+    if (!t || attach(t, map, (size_t)sb.st_size) < 0) {
+        if (t) fprintf(stderr, "'%s' is not a valid LOUDS image\n", path);
+        munmap(map, (size_t)sb.st_size);
+        free(t);
+        return NULL;
+    }
+    t->mapped = 1;
+    return t;
+}
+
+void louds_free(LoudsTrie *t) {
+    if (!t) return;
+    if (t->mapped) munmap((void *)t->image, t->image_len);
+    else free((void *)t->image);
+    free(t);
+}
+
+int louds_match(const LoudsTrie *t, const char *name, TrieMatch *m) {
+    m->verdict = DT_NONE;
+    m->node = 0;
+    m->scope = DT_SCOPE_SELF;
+    if (!t || t->edges == 0) return DT_NONE;
+
+    size_t end = strlen(name);
+    if (end > 0 && name[end - 1] == '.') end--;
+
+    size_t s = 0, e = node_end(t, 0);
+    int first = 1;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && name[start - 1] != '.') start--;
+        size_t len = end - start;
+        if (len == 0 || len > LOUDS_MAX_LABEL) break;
+
+        size_t p;
+        if (!first) {
+            p = find_edge(t, s, e, SORTED_SET_SEP);
+            if (p == (size_t)-1 || !bit_at(t->has_child, p)) break;
+            s = child_start(t, p);
+            e = node_end(t, s);
+        }
+        first = 0;
+
+        for (size_t i = 0;; i++) {
+            p = find_edge(t, s, e, (uint8_t)tolower((unsigned char)name[start + i]));
+            if (p == (size_t)-1) return m->verdict;
+            if (i + 1 == len) break;
+            if (!bit_at(t->has_child, p)) return m->verdict;
+            s = child_start(t, p);
+            e = node_end(t, s);
+        }
+
+        int last = start == 0;
+        if (bit_at(t->is_name, p)) {
+            uint8_t fl = t->flags[rank1(t->is_name, t->is_name_rank, p) - 1];
+            int v = last ? (fl & 0x0F) : (fl >> 4);
+            if (v != DT_NONE) {
+                m->verdict = v;
+                m->scope = last ? DT_SCOPE_SELF : DT_SCOPE_SUB;
+                if (v == DT_ALLOW) break;
+            }
+        }
+        if (last || !bit_at(t->has_child, p)) break;
+        s = child_start(t, p);
+        e = node_end(t, s);
+        end = start - 1;
+    }
+    return m->verdict;
+}
+
+/** @brief State of a louds_foreach() walk. */
+typedef struct {
+    const LoudsTrie *t;
+    int (*fn)(const char *name, void *ctx);
+    void *ctx;
+    unsigned char key[LOUDS_MAX_KEY];
+} LoudsWalk;
+
+/**
+ * @brief Visits the names below the node whose edges are [s, e).
+ */
+static int walk(LoudsWalk *w, size_t s, size_t e, size_t depth) {
+    for (size_t p = s; p < e; p++) {
+        w->key[depth] = w->t->labels[p];
+        if (bit_at(w->t->is_name, p)) {
+            char name[LOUDS_MAX_KEY + 1];
+            size_t out = 0, end = depth + 1;
+            while (end > 0) {
+                size_t start = end;
+                while (start > 0 && w->key[start - 1] != SORTED_SET_SEP) start--;
+                if (out > 0) name[out++] = '.';
+                memcpy(name + out, w->key + start, end - start);
+                out += end - start;
+                end = start > 0 ? start - 1 : 0;
+            }
+            name[out] = '\0';
+            int rc = w->fn(name, w->ctx);
+            if (rc != 0) return rc;
+        }
+        if (bit_at(w->t->has_child, p) && depth + 1 < LOUDS_MAX_KEY) {
+            size_t cs = child_start(w->t, p);
+            int rc = walk(w, cs, node_end(w->t, cs), depth + 1);
+            if (rc != 0) return rc;
+        }
+    }
+    return 0;
+}
+
+int louds_foreach(const LoudsTrie *t, int (*fn)(const char *name, void *ctx), void *ctx) {
+    if (!t || t->edges == 0) return 0;
+    LoudsWalk w;
+    w.t = t;
+    w.fn = fn;
+    w.ctx = ctx;
+    return walk(&w, 0, node_end(t, 0), 0);
+}
+
+size_t louds_memory(const LoudsTrie *t) {
+    if (!t) return 0;
+    return sizeof(LoudsTrie) + t->image_len;
+}
@@ -11,68 +11,477 @@
  * The proxy operates over UDP and listens on a configurable port.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include "config.h"
 #include "dns_utils.h"
+#include "rpz.h"
+#include "louds.h"
+#include "admission.h"
+#include "scheduler.h"
+#include "workers.h"
+#include "netopt.h"
+#include "xdp.h"
+#include "dedup.h"
 
 #define BUF_SIZE 1500 /**< Maximum DNS packet size */
+#define SELFTEST_NAMES 4096   /**< Names sampled for the --check-config lookup test */
+#define SELFTEST_MS 250.0     /**< Minimum duration of the lookup test */
+
+#define FAST_PATH_REPORT_EVERY 10000 /**< Queries between fast-path ratio lines */
+
+static volatile sig_atomic_t rpz_update_requested = 0; /**< Set by SIGHUP. */
+static volatile sig_atomic_t snapshot_requested = 0;   /**< Set by SIGALRM. */
+static volatile sig_atomic_t stop_requested = 0;       /**< Set by SIGINT/SIGTERM. */
+
+/** @brief How many queries took parse_dns_query_fast() versus the general parser. */
+static struct {
+    unsigned long hits;    /**< Queries of the common shape. */
+    unsigned long misses;  /**< Queries left to parse_dns_query(). */
+} fast_path;
+
+/**
+ * @brief SIGHUP handler: asks the main loop to apply the RPZ update file.
+ */
+static void on_sighup(int sig) {
+    (void)sig;
+    rpz_update_requested = 1;
+}
+
+/**
+ * @brief SIGALRM handler: asks the main loop to snapshot the cache.
+ */
+static void on_sigalrm(int sig) {
+    (void)sig;
+    snapshot_requested = 1;
+}
+
+/**
+ * @brief SIGINT/SIGTERM handler: asks the main loop to save state and exit.
+ */
+static void on_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/**
+ * @brief Reports replies the upstream exchange rejected, if there are new ones.
+ *
+ * Called after every forwarded query; prints at the first rejection and
+ * then whenever the count has doubled, so a flood of forgeries cannot
+ * flood the log as well.
+ */
+static void report_rejected_replies(const Upstream *up) {
+    static unsigned long reported;
+    const UpstreamStats *st = &up->stats;
+    unsigned long rejected = st->bad_source + st->bad_id + st->bad_question;
+    if (rejected == 0 || rejected < 2 * reported) return;
+    reported = rejected;
+    fprintf(stderr, "Warning: %lu upstream replies rejected (%lu wrong source, %lu wrong ID, "
+            "%lu wrong question/0x20 case) over %lu queries; possible spoofing\n",
+            rejected, st->bad_source, st->bad_id, st->bad_question, st->queries);
+}
+
+/**
+ * @brief Reports packets the kernel dropped on a full receive buffer.
+ *
+ * Same doubling back-off as report_rejected_replies(): a sustained burst
+ * is logged a handful of times, not once per packet.
+ */
+static void report_kernel_drops(const NetStats *net) {
+    static uint32_t reported;
+    if (net->kernel_drops == 0 || net->kernel_drops < 2 * (uint64_t)reported) return;
+    reported = net->kernel_drops;
+    fprintf(stderr, "Warning: %u queries dropped by the kernel on a full receive buffer "
+            "(%d bytes); raise socket_rcvbuf\n", (unsigned)net->kernel_drops, net->rcvbuf);
+}
+
+/**
+ * @brief Sleeps until a query or an upstream reply can be read, or a
+ *        health tick has passed.
+ */
+static void wait_for_input(int sockfd, const XdpPath *xdp, const Upstream *up) {
+    struct pollfd fds[2 + UPSTREAM_POOL_SIZE];
+    int n = 0;
+    fds[n].fd = sockfd;
+    fds[n].events = POLLIN;
+    fds[n++].revents = 0;
+    if (xdp) {
+        fds[n].fd = xdp->fd;
+        fds[n].events = POLLIN;
+        fds[n++].revents = 0;
+    }
+    n += upstream_poll_fds(up, fds + n);
+    poll(fds, (nfds_t)n, UPSTREAM_HEALTH_TICK_MS);
+}
+
+/**
+ * @brief Returns a monotonic timestamp in milliseconds.
+ */
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Applies the configured RPZ update file to the live default policy.
+ *
+ * @param cfg Loaded configuration.
+ */
+static void apply_rpz_update(Config *cfg) {
+    if (cfg->rpz_update_file[0] == '\0') {
+        fprintf(stderr, "SIGHUP received but no rpz_update_file is configured\n");
+        return;
+    }
+
+    if (!cfg->groups[0].blocklist) {
+        fprintf(stderr, "RPZ updates need matcher = trie; ignoring SIGHUP\n");
+        return;
+    }
+
+    RpzStats st;
+    memset(&st, 0, sizeof(st));
+    double start = now_ms();
+    int rc = rpz_apply_update(cfg->rpz_update_file, cfg->groups[0].blocklist, &st);
+    double ms = now_ms() - start;
+    if (rc < 0) return;
+
+    printf("RPZ update %s: +%zu -%zu (%zu unsupported, %zu malformed) in %.3f ms\n",
+           cfg->rpz_update_file, st.added, st.removed, st.unsupported, st.malformed, ms);
+}
+
+/**
+ * @brief Builds the local answer for a query stopped by policy.
+ *
+ * RPZ actions choose the answer themselves; plain list and pattern blocks
+ * use the group's response template.
+ *
+ * @param group    Client group that matched.
+ * @param verdict  Blocking DT_* verdict.
+ * @param match    Trie match (for local-data records).
+ * @param qtype    Query type, used to select local-data records.
+ * @param req      Original DNS request.
+ * @param req_len  Length of the request.
+ * @param resp     Output buffer.
+ * @param resp_cap Capacity of the output buffer.
+ * @return Length of the response, or -1 on failure.
+ */
+static int build_policy_response(const ClientGroup *group, int verdict, const TrieMatch *match,
+                                 int qtype, const unsigned char *req, int req_len,
+                                 unsigned char *resp, int resp_cap) {
+    if (verdict == DT_NXDOMAIN)
+        return build_nxdomain_response(req, req_len, resp, resp_cap);
+    if (verdict == DT_NODATA)
+        return build_nodata_response(req, req_len, resp, resp_cap);
+
+    if (verdict == DT_LOCAL) {
+        const DomainTrie *t = group->blocklist;
+        int n = build_nodata_response(req, req_len, resp, resp_cap);
+        for (const TrieData *d = domain_trie_data(t, match); d && n > 0;
+             d = d->next ? &t->data[d->next - 1] : NULL) {
+            /* CNAME answers any type; other records only their own (or ANY). */
+            if (d->type == qtype || d->type == 5 || qtype == 255)
+                n = append_answer_record(resp, n, resp_cap, d->type, d->ttl, t->rdata + d->off, d->len);
+        }
+        return n;
+    }
+
+    if (strcmp(group->response, "FAKE") == 0)
+        return build_fake_a_response(req, req_len, resp, resp_cap, group->fake_ip, 300);
+    if (strcmp(group->response, "NXDOMAIN") == 0)
+        return build_nxdomain_response(req, req_len, resp, resp_cap);
+    if (strcmp(group->response, "REFUSED") == 0)
+        return build_refused_response(req, req_len, resp, resp_cap);
+    return -1;
+}
 
 /**
  * @brief Handle an incoming DNS query from a client.
  *
- * Parses the query, checks for blacklisted domains, and either
- * responds locally (FAKE/NXDOMAIN/REFUSED) or forwards to the
- * upstream DNS server.
+ * Parses the query (through the fixed-shape fast path when it applies),
+ * selects the client's group by source address, checks the group's policy
+ * (lists, RPZ triggers, pattern rules) and the cache, and builds the local
+ * answer (group template, RPZ action or cached answer) when there is one.
+ * The caller sends it, through the socket or the XDP frame the query came
+ * in. Anything else is left for the caller to forward upstream.
  *
- * @param sock          Server socket descriptor.
  * @param client        Pointer to client sockaddr structure.
- * @param client_len    Length of the client sockaddr structure.
  * @param buffer        Pointer to the DNS request data.
  * @param len           Length of the DNS request data.
  * @param cfg           Pointer to loaded configuration structure.
+ * @param cache         Response cache for forwarded queries, or NULL.
+ * @param response      Receives the answer.
+ * @param cap           Size of @p response.
+ * @return Answer length if answered locally, 0 if the query must be
+ *         forwarded upstream, -1 if it gets no answer (unparseable or
+ *         deliberately dropped).
  */
-void handle_query(int sock, struct sockaddr_in *client, socklen_t client_len,
-                  unsigned char *buffer, int len, Config *cfg) {
-    char domain[256];
+int handle_query(const struct sockaddr_in *client, unsigned char *buffer, int len, Config *cfg,
+                 ResponseCache *cache, unsigned char *response, int cap) {
+    DnsQuestion q;
+    const char *domain = q.name;
     int type, class;
 
-    if (parse_dns_query(buffer, len, domain, &type, &class) < 0) {
-        fprintf(stderr, "Failed to parse DNS query\n");
-        return;
+    if (parse_dns_query_fast(buffer, len, &q) == 0) {
+        fast_path.hits++;
+        type = q.type;
+        class = q.class;
+    } else {
+        fast_path.misses++;
+        if (parse_dns_query(buffer, len, q.name, &type, &class) < 0) {
+            fprintf(stderr, "Failed to parse DNS query\n");
+            return -1;
+        }
     }
+    if ((fast_path.hits + fast_path.misses) % FAST_PATH_REPORT_EVERY == 0)
+        printf("Fast path: %lu of %lu queries (%.1f%%)\n", fast_path.hits,
+               fast_path.hits + fast_path.misses,
+               100.0 * fast_path.hits / (fast_path.hits + fast_path.misses));
 
     printf("Query: %s (type=%d class=%d)\n", domain, type, class);
 
-    if (is_blacklisted(domain, cfg)) {
-        printf("  -> Blocked, mode: %s\n", cfg->response);
+    const ClientGroup *group = config_find_group(cfg, ntohl(client->sin_addr.s_addr));
+
+    /* The QNAME follows the 12-byte header. The slow-path parser does not bound it,
+       so this relies on the wire matchers stopping at the packet end and treating
+       compressed or overlong labels as no match. Both paths share this lookup. */
+    TrieMatch match;
+    int verdict = matcher_match_wire(&group->lists, buffer + 12, (size_t)len - 12, &match);
+    int rule = verdict == DT_NONE ? pattern_set_match(group->patterns, domain) : -1;
+    if (rule >= 0) verdict = DT_BLOCK;
 
-        unsigned char response[BUF_SIZE];
-        int response_len = 0;
+    if (verdict == DT_ALLOW) {
+        printf("  -> Allowed by allowlist, group: %s\n", group->name);
+    } else if (domain_verdict_blocks(verdict)) {
+        if (rule >= 0)
+            printf("  -> Blocked by pattern '%s', group: %s, mode: %s\n",
+                   group->patterns->sources[rule], group->name, group->response);
+        else
+            printf("  -> Blocked, group: %s, verdict: %d, mode: %s\n",
+                   group->name, verdict, group->response);
 
-        if (strcmp(cfg->response, "FAKE") == 0) {
-            response_len = build_fake_a_response(buffer, len, response, sizeof(response),
-                                               cfg->fake_ip, 300);
-        } else if (strcmp(cfg->response, "NXDOMAIN") == 0) {
-            response_len = build_nxdomain_response(buffer, len, response, sizeof(response));
-        } else if (strcmp(cfg->response, "REFUSED") == 0) {
-            response_len = build_refused_response(buffer, len, response, sizeof(response));
+        if (verdict == DT_DROP) return -1;
+
+        int response_len = build_policy_response(group, verdict, &match, type, buffer, len,
+                                                 response, cap);
+        if (response_len <= 0) {
+            fprintf(stderr, "Failed to build response\n");
+            return -1;
         }
+        return response_len;
+    }
 
+    if (cache) {
+        int response_len = cache_lookup(cache, buffer, len, response, cap, time(NULL));
         if (response_len > 0) {
-            sendto(sock, response, response_len, 0, (struct sockaddr *)client, client_len);
-        } else {
-            fprintf(stderr, "Failed to build response\n");
+            printf("  -> Answered from cache\n");
+            return response_len;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Sheds a query that would go upstream: answers REFUSED or drops it.
+ *
+ * @param out Reply batch of the server socket.
+ * @param p Query and its client.
+ * @param admission Overload policy (decides refuse versus drop).
+ */
+static void shed_query(ReplyBatch *out, const SchedPacket *p, const Admission *admission) {
+    if (admission->drop) return;
+    unsigned char response[BUF_SIZE];
+    int response_len = build_refused_response(p->data, p->len, response, sizeof(response));
+    if (response_len > 0)
+        reply_send(out, &p->client, p->client_len, response, (size_t)response_len);
+}
+
+/**
+ * @brief Answers a miss whose upstream exchange has ended.
+ *
+ * @param p Query and its client.
+ * @param reply Upstream reply, or room for SERVFAIL.
+ * @param reply_len Length of the reply, or -1 if the exchange failed.
+ * @param reply_cap Capacity of @p reply.
+ * @param dedup Retransmission table, or NULL.
+ * @param latency Histogram of the slow class.
+ */
+static void finish_miss(int sockfd, const SchedPacket *p, unsigned char *reply, int reply_len,
+                        int reply_cap, const Upstream *up, ResponseCache *cache, Dedup *dedup,
+                        LatencyHistogram *latency) {
+    int replied = relay_upstream_reply(sockfd, p->data, p->len, reply, reply_len, reply_cap, up,
+                                       &p->client, p->client_len, cache) == 0;
+    report_rejected_replies(up);
+    double done_ms = now_ms();
+    if (dedup) {
+        /* Without a reply the client's resends are the request's only chance. */
+        uint64_t key = dedup_key(&p->client, p->data, p->len);
+        if (replied) dedup_done(dedup, key, done_ms);
+        else dedup_forget(dedup, key);
+    }
+    latency_add(latency, (done_ms - p->arrived_ms) * 1e3);
+}
+
+/**
+ * @brief Writes the cache snapshot, if one is configured.
+ *
+ * @param cfg Loaded configuration.
+ * @param cache Response cache (may be NULL).
+ */
+static void save_cache_snapshot(const Config *cfg, const ResponseCache *cache) {
+    if (!cache || cfg->cache_snapshot[0] == '\0') return;
+    double start = now_ms();
+    int n = cache_save(cache, cfg->cache_snapshot, time(NULL));
+    if (n >= 0)
+        printf("Cache snapshot %s: %d entries in %.1f ms (%lu hits, %lu misses so far)\n",
+               cfg->cache_snapshot, n, now_ms() - start, cache->hits, cache->misses);
+}
+
+/** @brief Collects every @c step-th listed name for the self-test. */
+typedef struct {
+    char (*names)[MAX_STR_LEN];
+    int count;
+    int max;
+    size_t step;
+    size_t seen;
+} NameSample;
+
+static int sample_name(const char *name, void *ctx) {
+    NameSample *ns = ctx;
+    if (ns->seen++ % ns->step == 0) {
+        snprintf(ns->names[ns->count], MAX_STR_LEN, "%s", name);
+        if (++ns->count == ns->max) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Measures policy lookups per second against the default group.
+ *
+ * Half of the test names are listed names taken from the matcher, half are
+ * names that are not listed, so both the hit and the miss path are timed.
+ * Each lookup is the same lists-then-patterns check handle_query() does.
+ *
+ * @param cfg Loaded configuration.
+ * @return Lookups per second, or 0 if memory runs out.
+ */
+static double lookup_self_test(const Config *cfg) {
+    const ClientGroup *g = &cfg->groups[0];
+    char (*names)[MAX_STR_LEN] = malloc(SELFTEST_NAMES * sizeof(*names));
+    if (!names) return 0;
+
+    int count = 0;
+    size_t listed = group_list_size(g);
+    NameSample ns = { names, 0, SELFTEST_NAMES / 2, listed / (SELFTEST_NAMES / 2) + 1, 0 };
+    matcher_foreach(&g->lists, sample_name, &ns);
+    count = ns.count;
+    while (count < SELFTEST_NAMES) {
+        snprintf(names[count], MAX_STR_LEN, "host%d.selftest-miss.invalid", count);
+        count++;
+    }
+
+    size_t lookups = 0, hits = 0;
+    double start = now_ms(), elapsed;
+    do {
+        for (int i = 0; i < count; i++) {
+            TrieMatch m;
+            int v = group_match(g, names[i], &m);
+            if (v == DT_NONE && pattern_set_match(g->patterns, names[i]) >= 0) v = DT_BLOCK;
+            hits += v != DT_NONE;
+        }
+        lookups += (size_t)count;
+        elapsed = now_ms() - start;
+    } while (elapsed < SELFTEST_MS);
+
+    free(names);
+    printf("  Lookup test  : %zu lookups (%zu matched) in %.1f ms, %.0f ns/lookup\n",
+           lookups, hits, elapsed, elapsed * 1e6 / lookups);
+    return lookups / (elapsed / 1e3);
+}
+
+/**
+ * @brief Prints the --check-config report: phase timings, memory, lookup rate.
+ *
+ * @param cfg Configuration loaded by load_config().
+ */
+static void print_check_report(const Config *cfg) {
+    const LoadStats *st = &cfg->load_stats;
+    printf("Load phases:\n");
+    printf("  read         : %9.2f ms (%zu files, %zu bytes)\n", st->read_ms, st->files, st->bytes);
+    printf("  parse        : %9.2f ms (%zu names)\n", st->parse_ms, st->names);
+    printf("  dedupe       : %9s    (%zu duplicates merged during build)\n", "-", st->duplicates);
+    printf("  build        : %9.2f ms (%d threads)\n", st->build_ms, st->threads);
+    printf("  merge        : %9.2f ms\n", st->merge_ms);
+    printf("  rpz          : %9.2f ms\n", st->rpz_ms);
+    printf("  compile      : %9.2f ms\n", st->compile_ms);
+    printf("  total        : %9.2f ms\n", st->total_ms);
+
+    size_t total = 0;
+    printf("Memory:\n");
+    for (int i = 0; i < cfg->group_count; i++) {
+        const ClientGroup *g = &cfg->groups[i];
+        if (g->owns_blocklist) {
+            size_t bytes = matcher_memory(&g->lists), names = matcher_count(&g->lists);
+            printf("  %-8s %-7s : %10zu bytes (%zu names, %.1f bytes/name)\n", g->name,
+                   g->lists.ops ? g->lists.ops->name : "-", bytes, names,
+                   names ? (double)bytes / names : 0.0);
+            total += bytes;
+        }
+        if (g->owns_patterns) {
+            size_t bytes = pattern_set_memory(g->patterns);
+            printf("  %-8s dfa     : %10zu bytes (%d rules)\n", g->name, bytes, g->patterns->count);
+            total += bytes;
         }
-        return;
     }
+    size_t cidr = cfg->group_table.nodes * sizeof(CidrNode);
+    printf("  group table      : %10zu bytes\n", cidr);
+    total += cidr;
+    printf("  total            : %10zu bytes\n", total + sizeof(*cfg));
+
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        printf("  peak RSS         : %10ld KiB\n", ru.ru_maxrss);
 
-    forward_to_upstream(sock, buffer, len, cfg->upstream_dns, cfg->upstream_port,
-                       client, client_len);
+    printf("Self-test:\n");
+    printf("  Lookup rate  : %.0f lookups/sec\n", lookup_self_test(cfg));
+}
+
+/**
+ * @brief Writes a group's compiled lists as a LOUDS image.
+ *
+ * @param g Group whose lists are written (any matcher representation).
+ * @param path Output file.
+ * @return 0 on success, -1 on failure.
+ */
+static int compile_louds(const ClientGroup *g, const char *path) {
+    LoudsTrie *built = NULL;
+    const LoudsTrie *t = g->lists.impl;
+    if (g->lists.ops != &matcher_louds) {
+        t = built = g->lists.ops == &matcher_sorted ? louds_build_sorted(g->lists.impl)
+                                                   : louds_build(g->blocklist);
+        if (!t) {
+            fprintf(stderr, "Cannot compile the lists into a LOUDS image (RPZ local data?)\n");
+            return -1;
+        }
+    }
+    int rc = louds_write(t, path);
+    if (rc == 0)
+        printf("Wrote %s: %zu names, %zu bytes\n", path, t->names, t->image_len);
+    louds_free(built);
+    return rc;
 }
 
 /**
@@ -83,16 +492,39 @@ void handle_query(int sock, struct sockaddr_in *client, socklen_t client_len,
  *
  * Usage:
  * ```
- * ./dns_proxy [config_file]
+ * ./dns_proxy [--check-config | --dry-run] [--compile-louds image] [config_file]
  * ```
  *
+ * With `--check-config` (or its alias `--dry-run`) the configuration and
+ * policy are loaded and compiled, a timing/memory report is printed, and
+ * the program exits without binding any socket. With `--compile-louds`
+ * the default group's lists are written as a LOUDS image that a later run
+ * can map through the `louds_file` key, skipping list parsing entirely.
+ *
+ * While serving, SIGHUP applies the RPZ update file, and SIGINT/SIGTERM
+ * write the cache snapshot (see `cache_snapshot`) before exiting.
+ *
  * @param argc  Argument count.
  * @param argv  Argument vector.
  * @return int  Exit code (0 on success, non-zero on failure).
  */
 int main(int argc, char *argv[]) {
     const char *config_path = "config.txt";
-    if (argc >= 2) config_path = argv[1];
+    const char *louds_out = NULL;
+    int check_only = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--check-config") == 0 || strcmp(argv[i], "--dry-run") == 0) {
+            check_only = 1;
+        } else if (strcmp(argv[i], "--compile-louds") == 0 && i + 1 < argc) {
+            louds_out = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--check-config | --dry-run] [--compile-louds image] [config_file]\n",
+                    argv[0]);
+            return 2;
+        } else {
+            config_path = argv[i];
+        }
+    }
 
     Config cfg;
     if (load_config(config_path, &cfg) != 0) {
@@ -108,50 +540,342 @@ int main(int argc, char *argv[]) {
     printf("  Blacklist (%d):\n", cfg.blacklist_count);
     for (int i = 0; i < cfg.blacklist_count; i++)
         printf("   - %s\n", cfg.blacklist[i]);
+    printf("  Compiled blocklist: %zu names (%s matcher)\n", group_list_size(&cfg.groups[0]),
+           cfg.groups[0].lists.ops->name);
+    if (cfg.groups[0].patterns)
+        printf("  Pattern rules: %d (%d + %d DFA states)\n", cfg.groups[0].patterns->count,
+               cfg.groups[0].patterns->dfa[0].nstates, cfg.groups[0].patterns->dfa[1].nstates);
+    for (int i = 1; i < cfg.group_count; i++) {
+        const ClientGroup *g = &cfg.groups[i];
+        printf("  Group %-8s: mode %s, fake IP %s, %zu names%s\n", g->name, g->response,
+               g->fake_ip, group_list_size(g), g->owns_blocklist ? "" : " (default list)");
+    }
 
-    int sockfd;
-    struct sockaddr_in servaddr;
+    if (louds_out) {
+        int rc = compile_louds(&cfg.groups[0], louds_out);
+        free_config(&cfg);
+        return rc < 0 ? 1 : 0;
+    }
 
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        perror("socket");
+    if (check_only) {
+        print_check_report(&cfg);
+        free_config(&cfg);
+        return 0;
+    }
+
+    /* From here on every worker allocates its own state, on its own node. */
+    Workers workers;
+    if (workers_start(&workers, cfg.workers, cfg.workers != 1 && cfg.pin_workers) < 0) {
+        free_config(&cfg);
         exit(1);
     }
+    if (workers.count > 1)
+        printf("Worker %d of %d: pid %ld, CPU %d, NUMA node %d\n", workers.index, workers.count,
+               (long)getpid(), workers.cpu, workers.node);
 
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = INADDR_ANY;
-    servaddr.sin_port = htons(cfg.listen_port);
+    int sockfd = worker_socket(cfg.listen_port, workers.count > 1, workers.cpu);
+    if (sockfd < 0) {
+        workers_signal(&workers, SIGTERM);
+        workers_wait(&workers);
+        free_config(&cfg);
+        exit(1);
+    }
+    if (workers.count > 1) worker_steer(sockfd, workers.count, cfg.steer);
+    NetStats net;
+    memset(&net, 0, sizeof(net));
+    netopt_apply(sockfd, &cfg.socket_opts, &net);
 
-    if (bind(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
-        perror("bind failed");
-        fprintf(stderr, "Try sudo if port < 1024\n");
+    Upstream upstream;
+    if (upstream_init(&upstream, cfg.upstream_dns, cfg.upstream_port, &cfg.upstream_health) < 0) {
         close(sockfd);
+        free_config(&cfg);
         exit(1);
     }
+    /* Wake an idle loop now and then so the upstream health checks keep running. */
+    struct timeval tick = { 0, UPSTREAM_HEALTH_TICK_MS * 1000 };
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tick, sizeof(tick)) < 0)
+        perror("setsockopt SO_RCVTIMEO");
+    double health_ms = 0;
 
-    printf("DNS proxy listening on port %d...\n", cfg.listen_port);
+    printf("DNS proxy listening on port %d (receive buffer %d, send buffer %d bytes)...\n",
+           cfg.listen_port, net.rcvbuf, net.sndbuf);
 
-    unsigned char buf[BUF_SIZE];
-    struct sockaddr_in cliaddr;
-    socklen_t len = sizeof(cliaddr);
+    ResponseCache *cache = NULL;
+    if (cfg.cache_size > 0) {
+        if (cfg.cache_shared[0]) {
+            cache = cache_attach_shared(cfg.cache_shared, (size_t)cfg.cache_size);
+            if (cache)
+                printf("Attached to shared cache %s (%zu slots)\n", cfg.cache_shared,
+                       cache->mask + 1);
+        } else {
+            cache = cache_new((size_t)cfg.cache_size);
+        }
+        if (!cache) fprintf(stderr, "Cannot allocate the response cache; caching disabled\n");
+    }
+    if (cache && cfg.cache_snapshot[0] && (workers.index == 0 || !cache->shm)) {
+        double start = now_ms();
+        int n = cache_load(cache, cfg.cache_snapshot, time(NULL));
+        if (n >= 0)
+            printf("Cache warmed from %s: %d entries in %.1f ms\n", cfg.cache_snapshot, n,
+                   now_ms() - start);
+    }
+    /* Only the first worker writes snapshots; the others would overwrite it. */
+    if (workers.index > 0) cfg.cache_snapshot[0] = '\0';
+
+    /* No SA_RESTART: signals must interrupt the receive so their work runs promptly. */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sighup;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, NULL);
+    sa.sa_handler = on_sigalrm;
+    sigaction(SIGALRM, &sa, NULL);
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if (cache && cfg.cache_snapshot[0] && cfg.cache_snapshot_interval > 0)
+        alarm((unsigned)cfg.cache_snapshot_interval);
 
-    while (1) {
-        ssize_t n = recvfrom(sockfd, buf, sizeof(buf), 0,
-                           (struct sockaddr *)&cliaddr, &len);
-        if (n < 0) {
-            perror("recvfrom");
-            continue;
+    Admission admission;
+    admission_init(&admission, sockfd, cfg.overload_queue, cfg.overload_lag_ms, cfg.overload_drop,
+                   now_ms());
+
+    MissQueue misses;
+    if (miss_queue_init(&misses) < 0) {
+        fprintf(stderr, "Cannot allocate the miss queue\n");
+        exit(1);
+    }
+    SchedPacket scratch; /* receives packets while the miss queue is full */
+    /* Misses on their way upstream, indexed by exchange handle. */
+    SchedPacket *inflight = malloc(UPSTREAM_MAX_PENDING * sizeof(SchedPacket));
+    if (!inflight) {
+        fprintf(stderr, "Cannot allocate the miss queue\n");
+        exit(1);
+    }
+    Dedup dedup;
+    if (cfg.dedup_size > 0 && dedup_init(&dedup, (size_t)cfg.dedup_size) < 0) {
+        fprintf(stderr, "Cannot allocate the retransmission table\n");
+        exit(1);
+    }
+    BusyPoll busy;
+    busy_poll_init(&busy, cfg.busy_poll > 0, cfg.busy_poll_idle_ms);
+    if (cfg.busy_poll > 0 && busy_poll_socket(sockfd, cfg.busy_poll) < 0)
+        fprintf(stderr, "Kernel busy polling unavailable; spinning in user space only\n");
+    ReplyBatch *replies = malloc(sizeof(ReplyBatch));
+    GroBuffer *gro = net.gro ? gro_buffer_new() : NULL;
+    if (!replies || (net.gro && !gro)) {
+        fprintf(stderr, "Cannot allocate the reply batch\n");
+        exit(1);
+    }
+    reply_batch_init(replies, sockfd, net.gso);
+    /* One interface queue, so only the first worker takes the XDP path. */
+    XdpPath xdp_path, *xdp = NULL;
+    if (cfg.xdp_interface[0] && workers.index == 0) {
+        if (xdp_open(&xdp_path, cfg.xdp_interface, cfg.xdp_queue, (uint16_t)cfg.listen_port,
+                     cfg.xdp_native) == 0) {
+            xdp = &xdp_path;
+            printf("XDP fast path on %s queue %d (%s mode)\n", cfg.xdp_interface, cfg.xdp_queue,
+                   cfg.xdp_native ? "native" : "generic");
+        } else {
+            fprintf(stderr, "XDP fast path unavailable; using the socket only\n");
+        }
+    }
+    /* Wire-to-reply per class, split into socket-buffer wait and handle_query() time. */
+    LatencyHistogram fast_latency, miss_latency, queue_latency, handle_latency;
+    memset(&fast_latency, 0, sizeof(fast_latency));
+    memset(&miss_latency, 0, sizeof(miss_latency));
+    memset(&queue_latency, 0, sizeof(queue_latency));
+    memset(&handle_latency, 0, sizeof(handle_latency));
+
+    while (!stop_requested) {
+        if (rpz_update_requested) {
+            rpz_update_requested = 0;
+            workers_signal(&workers, SIGHUP);
+            apply_rpz_update(&cfg);
+        }
+        if (snapshot_requested) {
+            snapshot_requested = 0;
+            save_cache_snapshot(&cfg, cache);
+            alarm((unsigned)cfg.cache_snapshot_interval);
+        }
+        double loop_ms = now_ms();
+        if (loop_ms - health_ms >= UPSTREAM_HEALTH_TICK_MS) {
+            health_ms = loop_ms;
+            upstream_health_check(&upstream, loop_ms);
         }
 
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &cliaddr.sin_addr, client_ip, sizeof(client_ip));
-        printf("Received DNS query from %s:%d\n",
-               client_ip, ntohs(cliaddr.sin_port));
+        /* Fast class first: answer a batch. Only with no miss that could be
+           sent may the first receive block, and in busy-poll mode only once idle. */
+        int idle = misses.count == 0 || upstream.in_flight == UPSTREAM_MAX_PENDING;
+        for (int i = 0; i < SCHED_BATCH && !stop_requested; i++) {
+            SchedPacket *p = miss_queue_reserve(&misses);
+            if (!p) p = &scratch;
+            p->client_len = sizeof(p->client);
+            int first = i == 0 && idle;
+            int flags = first ? busy_poll_flags(&busy, now_ms()) : MSG_DONTWAIT;
+            struct timespec stamp;
+            ssize_t n;
+            XdpQuery xq;
+            int from_xdp = 0;
+            if (xdp) {
+                from_xdp = xdp_next(xdp, (uint16_t)cfg.listen_port, &xq);
+                if (!from_xdp && flags == 0) {
+                    /* Sleep on both paths, then take whichever woke us. */
+                    wait_for_input(sockfd, xdp, &upstream);
+                    from_xdp = xdp_next(xdp, (uint16_t)cfg.listen_port, &xq);
+                }
+                flags = MSG_DONTWAIT;
+            } else if (flags == 0 && upstream.in_flight > 0) {
+                /* An upstream reply must wake us as well as a query. */
+                wait_for_input(sockfd, NULL, &upstream);
+                flags = MSG_DONTWAIT;
+            }
+            if (from_xdp) {
+                n = (ssize_t)(xq.len < sizeof(p->data) ? xq.len : sizeof(p->data));
+                memcpy(p->data, xq.data, (size_t)n);
+                p->client = xq.client;
+                p->client_len = sizeof(p->client);
+                stamp.tv_sec = stamp.tv_nsec = 0;
+            } else {
+                n = netopt_recv_segment(sockfd, gro, p->data, sizeof(p->data), &p->client,
+                                        &p->client_len, flags, &net, &stamp);
+            }
+            if (first) busy_poll_update(&busy, n >= 0, now_ms());
+            if (n < 0) {
+                if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) perror("recvmsg");
+                break;
+            }
+            report_kernel_drops(&net);
+            p->len = (int)n;
+            p->received_ms = now_ms();
+            p->arrived_ms = p->received_ms - netopt_age_ms(&stamp);
+            latency_add(&queue_latency, (p->received_ms - p->arrived_ms) * 1e3);
 
-        handle_query(sockfd, &cliaddr, len, buf, n, &cfg);
+            char client_ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &p->client.sin_addr, client_ip, sizeof(client_ip));
+            printf("Received DNS query from %s:%d\n",
+                   client_ip, ntohs(p->client.sin_port));
+
+            admission_sample(&admission, p->received_ms);
+            /* A resend of a request already on its way upstream: that reply answers both. */
+            uint64_t key = cfg.dedup_size > 0 ? dedup_key(&p->client, p->data, p->len) : 0;
+            if (key && dedup_duplicate(&dedup, key, p->arrived_ms, p->received_ms)) {
+                if (from_xdp) xdp_release(xdp, &xq);
+                continue;
+            }
+            unsigned char response[BUF_SIZE];
+            int response_len = handle_query(&p->client, p->data, p->len, &cfg, cache, response,
+                                            sizeof(response));
+            /* An XDP query is answered by rewriting its frame; the socket is the fallback. */
+            int sent = 0;
+            if (from_xdp && response_len > 0)
+                sent = xdp_reply(xdp, &xq, response, (size_t)response_len) == 0;
+            else if (from_xdp)
+                xdp_release(xdp, &xq);
+            if (response_len > 0 && !sent)
+                reply_send(replies, &p->client, p->client_len, response, (size_t)response_len);
+            int handled = response_len != 0;
+            double handled_ms = now_ms();
+            latency_add(&handle_latency, (handled_ms - p->received_ms) * 1e3);
+            if (handled) {
+                latency_add(&fast_latency, (handled_ms - p->arrived_ms) * 1e3);
+            } else if (p == &scratch) {
+                misses.overflows++;
+                shed_query(replies, p, &admission);
+            } else if (!admission_forward(&admission)) {
+                /* Under overload only the expensive work, going upstream, is shed. */
+                shed_query(replies, p, &admission);
+            } else {
+                if (key) dedup_start(&dedup, key, handled_ms);
+                miss_queue_commit(&misses);
+            }
+        }
+        /* The next receive may block: nothing may wait behind it. */
+        reply_flush(replies);
+        if (xdp) xdp_flush(xdp);
+
+        /* Then the slow class: relay finished exchanges and send a bounded
+           share of the queued misses. Nothing here waits for upstream. */
+        for (;;) {
+            unsigned char response[BUF_SIZE];
+            int response_len;
+            int h = upstream_receive(&upstream, now_ms(), response, sizeof(response),
+                                     &response_len);
+            if (h < 0) break;
+            finish_miss(sockfd, &inflight[h], response, response_len, sizeof(response),
+                        &upstream, cache, cfg.dedup_size > 0 ? &dedup : NULL, &miss_latency);
+        }
+        for (int i = 0; i < SCHED_MISS_BUDGET && upstream.in_flight < UPSTREAM_MAX_PENDING; i++) {
+            SchedPacket *p = miss_queue_pop(&misses);
+            if (!p) break;
+            int h = upstream_send(&upstream, p->data, p->len, now_ms());
+            if (h >= 0) {
+                inflight[h] = *p;
+            } else {
+                unsigned char response[BUF_SIZE];
+                finish_miss(sockfd, p, response, -1, sizeof(response), &upstream, cache,
+                            cfg.dedup_size > 0 ? &dedup : NULL, &miss_latency);
+            }
+        }
+    }
+
+    latency_print(&fast_latency, "Latency (blocked/cached)", stdout);
+    latency_print(&miss_latency, "Latency (forwarded)", stdout);
+    latency_print(&queue_latency, "Queueing (socket buffer)", stdout);
+    latency_print(&handle_latency, "Processing (handle_query)", stdout);
+    printf("Miss queue: peak %zu, %lu shed when full, %zu unanswered at exit "
+           "(%d more awaiting upstream)\n", misses.peak, misses.overflows, misses.count,
+           upstream.in_flight);
+    miss_queue_free(&misses);
+    free(inflight);
+    if (cfg.dedup_size > 0) {
+        printf("Retransmissions: %lu absorbed over %lu forwarded requests\n", dedup.absorbed,
+               dedup.tracked);
+        dedup_free(&dedup);
+    }
+    if (busy.enabled)
+        printf("Busy poll: %lu polls, %lu empty, %lu sleeps after %.0f ms idle\n", busy.polls,
+               busy.empty_polls, busy.sleeps, busy.idle_limit_ms);
+    printf("Upstream: %lu queries, %lu answered, %lu timed out, %lu replies rejected "
+           "(%lu queries given up), %lu port rotations\n", upstream.stats.queries,
+           upstream.stats.answered, upstream.stats.timeouts,
+           upstream.stats.bad_source + upstream.stats.bad_id + upstream.stats.bad_question,
+           upstream.stats.reject_limit, upstream.stats.port_rotations);
+    for (int i = 0; i < upstream.count; i++) {
+        const UpstreamServer *srv = &upstream.servers[i];
+        static const char *const states[] = { "in rotation", "out", "half-open" };
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &srv->addr.sin_addr, ip, sizeof(ip));
+        printf("Upstream %s: %s, taken out %lu times, %lu probes (%lu failed)\n", ip,
+               states[srv->state], srv->trips, srv->probes, srv->probe_failures);
+    }
+    if (upstream.stats.unavailable)
+        printf("Upstream: %lu queries answered SERVFAIL with every server out\n",
+               upstream.stats.unavailable);
+    printf("Overload: %lu episodes, %lu cache misses shed, %lu forwarded\n", admission.episodes,
+           admission.shed, admission.admitted);
+    printf("Kernel drops: %u queries (receive buffer %d bytes)\n", (unsigned)net.kernel_drops,
+           net.rcvbuf);
+    if (net.gso)
+        printf("UDP GSO: %lu sends carried %lu replies%s\n", replies->gso_sends,
+               replies->gso_replies, replies->gso ? "" : " (disabled after a failed send)");
+    if (net.gro)
+        printf("UDP GRO: %lu receives carried %lu queries\n", net.gro_receives, net.gro_segments);
+    if (xdp) {
+        printf("XDP: %lu frames, %lu answered in place, %lu to the socket path, %lu malformed, "
+               "%lu TX ring full\n", xdp->stats.received, xdp->stats.answered, xdp->stats.passed,
+               xdp->stats.malformed, xdp->stats.tx_full);
+        xdp_close(xdp);
     }
+    free(replies);
+    gro_buffer_free(gro);
+    upstream_close(&upstream);
 
+    save_cache_snapshot(&cfg, cache);
+    cache_free(cache);
     close(sockfd);
+    workers_signal(&workers, SIGTERM);
+    workers_wait(&workers);
+    free_config(&cfg);
     return 0;
 }
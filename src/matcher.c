@@ -0,0 +1,200 @@
+/**
+ * @file matcher.c
+ * @brief Backend table for the list matchers and the shared entry points.
+ */
+
+#include "matcher.h"
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include "sorted_set.h"
+#include "louds.h"
+
+#define MATCHER_NAME_MAX 256
+
+/* ---- trie ---- */
+
+static int trie_match(const void *impl, const char *name, TrieMatch *m) {
+    return domain_trie_match(impl, name, m);
+}
+
+static int trie_match_wire(const void *impl, const unsigned char *qname, size_t len, TrieMatch *m) {
+    return domain_trie_match_wire(impl, qname, len, m);
+}
+
+static int trie_foreach(const void *impl, int (*fn)(const char *name, void *ctx), void *ctx) {
+    const DomainTrie *t = impl;
+    char name[MATCHER_NAME_MAX];
+    for (size_t i = 1; i < t->node_count; i++) {
+        if (t->nodes[i].verdict == DT_NONE && t->nodes[i].sub == DT_NONE) continue;
+        if (domain_trie_name(t, (uint32_t)i, name, sizeof(name)) <= 0) continue;
+        int rc = fn(name, ctx);
+        if (rc != 0) return rc;
+    }
+    return 0;
+}
+
+static size_t trie_count(const void *impl) {
+    return ((const DomainTrie *)impl)->entries;
+}
+
+static size_t trie_memory(const void *impl) {
+    return domain_trie_memory(impl);
+}
+
+static void trie_free(void *impl) {
+    domain_trie_free(impl);
+}
+
+const MatcherOps matcher_trie = {
+    "trie", NULL, trie_match, trie_match_wire, trie_foreach, trie_count, trie_memory, trie_free
+};
+
+/* ---- sorted ---- */
+
+static void *sorted_build(const DomainTrie *lists) {
+    return sorted_set_build(lists);
+}
+
+static int sorted_match(const void *impl, const char *name, TrieMatch *m) {
+    return sorted_set_match(impl, name, m);
+}
+
+static int sorted_foreach(const void *impl, int (*fn)(const char *name, void *ctx), void *ctx) {
+    const SortedSet *s = impl;
+    char name[MATCHER_NAME_MAX];
+    for (size_t i = 0; i < s->count; i++) {
+        if (sorted_set_name(s, i, name, sizeof(name)) <= 0) continue;
+        int rc = fn(name, ctx);
+        if (rc != 0) return rc;
+    }
+    return 0;
+}
+
+static size_t sorted_count(const void *impl) {
+    return ((const SortedSet *)impl)->count;
+}
+
+static size_t sorted_memory(const void *impl) {
+    return sorted_set_memory(impl);
+}
+
+static void sorted_free(void *impl) {
+    sorted_set_free(impl);
+}
+
+const MatcherOps matcher_sorted = {
+    "sorted", sorted_build, sorted_match, NULL, sorted_foreach, sorted_count, sorted_memory,
+    sorted_free
+};
+
+/* ---- louds ---- */
+
+static void *louds_build_lists(const DomainTrie *lists) {
+    return louds_build(lists);
+}
+
+static int louds_match_name(const void *impl, const char *name, TrieMatch *m) {
+    return louds_match(impl, name, m);
+}
+
+static int louds_foreach_name(const void *impl, int (*fn)(const char *name, void *ctx), void *ctx) {
+    return louds_foreach(impl, fn, ctx);
+}
+
+static size_t louds_count(const void *impl) {
+    return ((const LoudsTrie *)impl)->names;
+}
+
+static size_t louds_memory_used(const void *impl) {
+    return louds_memory(impl);
+}
+
+static void louds_release(void *impl) {
+    louds_free(impl);
+}
+
+const MatcherOps matcher_louds = {
+    "louds", louds_build_lists, louds_match_name, NULL, louds_foreach_name, louds_count,
+    louds_memory_used, louds_release
+};
+
+static const MatcherOps *const backends[] = { &matcher_trie, &matcher_sorted, &matcher_louds };
+
+const MatcherOps *matcher_find(const char *name) {
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (strcasecmp(backends[i]->name, name) == 0) return backends[i];
+    }
+    return NULL;
+}
+
+const MatcherOps *matcher_backend(size_t i) {
+    return i < sizeof(backends) / sizeof(backends[0]) ? backends[i] : NULL;
+}
+
+int matcher_build(Matcher *m, const MatcherOps *ops, DomainTrie *lists) {
+    void *impl = ops->build ? ops->build(lists) : lists;
+    if (!impl) return -1;
+    if (impl != (void *)lists) domain_trie_free(lists);
+    m->ops = ops;
+    m->impl = impl;
+    return 0;
+}
+
+void matcher_wrap(Matcher *m, const MatcherOps *ops, void *impl) {
+    m->ops = ops;
+    m->impl = impl;
+}
+
+int matcher_match(const Matcher *m, const char *name, TrieMatch *tm) {
+    if (!m->ops) {
+        tm->verdict = DT_NONE;
+        tm->node = 0;
+        tm->scope = DT_SCOPE_SELF;
+        return DT_NONE;
+    }
+    return m->ops->match(m->impl, name, tm);
+}
+
+int matcher_match_wire(const Matcher *m, const unsigned char *qname, size_t len, TrieMatch *tm) {
+    if (m->ops && m->ops->match_wire) return m->ops->match_wire(m->impl, qname, len, tm);
+
+    /* Generic path: decode to dotted form, rejecting anything malformed. */
+    char name[MATCHER_NAME_MAX];
+    size_t p = 0, out = 0;
+    while (p < len && qname[p] != 0) {
+        size_t l = qname[p];
+        if (l > 63 || p + 1 + l > len || out + l + 1 >= sizeof(name)) {
+            p = len;
+            break;
+        }
+        if (out > 0) name[out++] = '.';
+        memcpy(name + out, qname + p + 1, l);
+        out += l;
+        p += 1 + l;
+    }
+    if (p >= len) {
+        Matcher empty = { NULL, NULL };
+        return matcher_match(&empty, "", tm);
+    }
+    name[out] = '\0';
+    return matcher_match(m, name, tm);
+}
+
+int matcher_foreach(const Matcher *m, int (*fn)(const char *name, void *ctx), void *ctx) {
+    return m->ops ? m->ops->foreach(m->impl, fn, ctx) : 0;
+}
+
+size_t matcher_count(const Matcher *m) {
+    return m->ops ? m->ops->count(m->impl) : 0;
+}
+
+size_t matcher_memory(const Matcher *m) {
+    return m->ops ? m->ops->memory(m->impl) : 0;
+}
+
+void matcher_free(Matcher *m) {
+    if (m->ops) m->ops->free(m->impl);
+    m->ops = NULL;
+    m->impl = NULL;
+}
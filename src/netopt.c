@@ -0,0 +1,310 @@
+/**
+ * @file netopt.c
+ * @brief Listening-socket tuning, kernel ancillary data and UDP GSO/GRO.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "netopt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#endif
+
+#define NETOPT_CONTROL 256 /**< Room for the ancillary data of one datagram. */
+
+/**
+ * @brief One coalesced UDP GRO receive, handed out a segment at a time.
+ */
+struct GroBuffer {
+    unsigned char data[65536];  /**< The coalesced datagram. */
+    size_t len;                 /**< Bytes in @c data (0 = empty). */
+    size_t off;                 /**< Start of the next segment. */
+    size_t segment;             /**< Segment size (the last may be shorter). */
+    struct sockaddr_in from;    /**< Sender of every segment. */
+    socklen_t from_len;         /**< Length of @c from. */
+    struct timespec stamp;      /**< Kernel receive timestamp of the burst. */
+};
+
+/**
+ * @brief Sets one buffer size, forcing it past the sysctl limit if allowed.
+ *
+ * @return The effective size (half what the kernel reports, as the kernel
+ *         doubles the request for bookkeeping), or -1 if it could not be read back.
+ */
+static int set_buffer(int sock, int opt, int force_opt, int bytes, const char *what) {
+    if (bytes > 0) {
+        setsockopt(sock, SOL_SOCKET, opt, &bytes, sizeof(bytes));
+        int got = 0;
+        socklen_t len = sizeof(got);
+        if (getsockopt(sock, SOL_SOCKET, opt, &got, &len) == 0 && got / 2 < bytes)
+            setsockopt(sock, SOL_SOCKET, force_opt, &bytes, sizeof(bytes));
+    }
+    int got = -1;
+    socklen_t len = sizeof(got);
+    if (getsockopt(sock, SOL_SOCKET, opt, &got, &len) < 0) return -1;
+    got /= 2;
+    if (bytes > 0 && got < bytes)
+        fprintf(stderr, "Socket %s buffer capped at %d of %d bytes (raise net.core.%s_max "
+                "or run with CAP_NET_ADMIN)\n", what, got, bytes, what[0] == 'r' ? "rmem" : "wmem");
+    return got;
+}
+
+int netopt_apply(int sock, const NetOptions *o, NetStats *st) {
+    int rc = 0;
+    st->rcvbuf = set_buffer(sock, SO_RCVBUF, SO_RCVBUFFORCE, o->rcvbuf, "receive");
+    st->sndbuf = set_buffer(sock, SO_SNDBUF, SO_SNDBUFFORCE, o->sndbuf, "send");
+    if ((o->rcvbuf > 0 && st->rcvbuf < o->rcvbuf) || (o->sndbuf > 0 && st->sndbuf < o->sndbuf))
+        rc = -1;
+
+    int one = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0) {
+        perror("SO_RXQ_OVFL");
+        rc = -1;
+    }
+    if (o->pmtud_omit) {
+        int mode = IP_PMTUDISC_OMIT;
+        if (setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) < 0) {
+            perror("IP_PMTUDISC_OMIT");
+            rc = -1;
+        }
+    }
+    if (o->timestamps) {
+        int stamped = 0;
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        stamped = setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+#endif
+#ifdef SO_TIMESTAMPNS
+        /* Older kernels and non-Linux stacks: the plain nanosecond stamp. */
+        if (!stamped) stamped = setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) == 0;
+#endif
+        if (!stamped) {
+            fprintf(stderr, "Kernel receive timestamps unavailable; latency starts at recvmsg()\n");
+            rc = -1;
+        }
+    }
+
+    st->gso = st->gro = 0;
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+    /* A zero segment size only probes for support; each send sets its own. */
+    int zero = 0;
+    if (o->gso) st->gso = setsockopt(sock, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0;
+    if (o->gro) st->gro = setsockopt(sock, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+#endif
+    if (o->gso && !st->gso) {
+        fprintf(stderr, "UDP GSO unavailable; sending replies one by one\n");
+        rc = -1;
+    }
+    if (o->gro && !st->gro) {
+        fprintf(stderr, "UDP GRO unavailable; receiving queries one by one\n");
+        rc = -1;
+    }
+    return rc;
+}
+
+/**
+ * @brief recvmsg() plus ancillary data; @p segment receives the UDP GRO
+ *        segment size, or 0 if the datagram was not coalesced.
+ */
+static ssize_t recv_msg(int sock, void *buf, size_t cap, struct sockaddr_in *from,
+                        socklen_t *from_len, int flags, NetStats *st, struct timespec *rx,
+                        size_t *segment) {
+    union {
+        char buf[NETOPT_CONTROL];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = cap;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = from;
+    msg.msg_namelen = *from_len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n = recvmsg(sock, &msg, flags);
+    if (n < 0) return n;
+    *from_len = msg.msg_namelen;
+    if (rx) rx->tv_sec = rx->tv_nsec = 0;
+    *segment = 0;
+
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+            if (drops > st->kernel_drops) st->kernel_drops = drops;
+        }
+#ifdef SO_TIMESTAMPING
+        /* Three stamps (software, deprecated, hardware); only the first is asked for. */
+        if (rx && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_TIMESTAMPING)
+            memcpy(rx, CMSG_DATA(c), sizeof(*rx));
+#endif
+#ifdef SO_TIMESTAMPNS
+        if (rx && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_TIMESTAMPNS)
+            memcpy(rx, CMSG_DATA(c), sizeof(*rx));
+#endif
+#ifdef UDP_GRO
+        if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(c), sizeof(size));
+            if (size > 0 && (size_t)size < (size_t)n) *segment = (size_t)size;
+        }
+#endif
+    }
+    return n;
+}
+
+ssize_t netopt_recv(int sock, void *buf, size_t cap, struct sockaddr_in *from,
+                    socklen_t *from_len, int flags, NetStats *st, struct timespec *rx) {
+    size_t segment;
+    return recv_msg(sock, buf, cap, from, from_len, flags, st, rx, &segment);
+}
+
+GroBuffer *gro_buffer_new(void) {
+    return calloc(1, sizeof(GroBuffer));
+}
+
+void gro_buffer_free(GroBuffer *g) {
+    free(g);
+}
+
+ssize_t netopt_recv_segment(int sock, GroBuffer *g, void *buf, size_t cap,
+                            struct sockaddr_in *from, socklen_t *from_len, int flags,
+                            NetStats *st, struct timespec *rx) {
+    if (!g) return netopt_recv(sock, buf, cap, from, from_len, flags, st, rx);
+    if (g->off >= g->len) {
+        g->from_len = sizeof(g->from);
+        ssize_t n = recv_msg(sock, g->data, sizeof(g->data), &g->from, &g->from_len, flags, st,
+                             &g->stamp, &g->segment);
+        if (n < 0) return n;
+        g->len = (size_t)n;
+        g->off = 0;
+        if (g->segment) {
+            st->gro_receives++;
+            st->gro_segments += (g->len + g->segment - 1) / g->segment;
+        } else {
+            g->segment = g->len;
+        }
+    }
+    /* Every segment is segment bytes long except possibly the last. */
+    size_t n = g->len - g->off;
+    if (n > g->segment) n = g->segment;
+    memcpy(buf, g->data + g->off, n < cap ? n : cap);
+    g->off += n;
+    if (g->off == g->len) g->len = g->off = 0;
+    memcpy(from, &g->from, g->from_len < *from_len ? g->from_len : *from_len);
+    *from_len = g->from_len;
+    if (rx) *rx = g->stamp;
+    return (ssize_t)(n < cap ? n : cap);
+}
+
+double netopt_age_ms(const struct timespec *rx) {
+    if (rx->tv_sec == 0 && rx->tv_nsec == 0) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    double age = (double)(now.tv_sec - rx->tv_sec) * 1e3 + (now.tv_nsec - rx->tv_nsec) / 1e6;
+    return age > 0 ? age : 0;
+}
+
+void reply_batch_init(ReplyBatch *b, int sock, int gso) {
+    memset(b, 0, sizeof(*b));
+    b->sock = sock;
+    b->gso = gso;
+}
+
+/**
+ * @brief Sends the batched replies one datagram each.
+ */
+static void send_each(ReplyBatch *b) {
+    for (size_t off = 0; off < b->len; off += b->segment) {
+        size_t n = b->len - off < b->segment ? b->len - off : b->segment;
+        if (sendto(b->sock, b->data + off, n, 0, (struct sockaddr *)&b->to, b->to_len) < 0)
+            perror("sendto client");
+    }
+}
+
+void reply_flush(ReplyBatch *b) {
+    if (b->count == 0) return;
+    if (b->count == 1) {
+        send_each(b);
+    } else {
+#ifdef UDP_SEGMENT
+        union {
+            char buf[CMSG_SPACE(sizeof(uint16_t))];
+            struct cmsghdr align;
+        } control;
+        memset(&control, 0, sizeof(control));
+        struct iovec iov;
+        iov.iov_base = b->data;
+        iov.iov_len = b->len;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &b->to;
+        msg.msg_namelen = b->to_len;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_UDP;
+        c->cmsg_type = UDP_SEGMENT;
+        c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t segment = (uint16_t)b->segment;
+        memcpy(CMSG_DATA(c), &segment, sizeof(segment));
+
+        if (sendmsg(b->sock, &msg, 0) >= 0) {
+            b->gso_sends++;
+            b->gso_replies += (unsigned long)b->count;
+        } else if (errno == EINVAL) {
+            /* This send only (e.g. a route with a smaller MTU): the next may work. */
+            send_each(b);
+        } else if (errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP) {
+            /* No segmentation offload on this path: stop trying. */
+            fprintf(stderr, "UDP GSO send failed (%s); sending replies one by one\n",
+                    strerror(errno));
+            b->gso = 0;
+            send_each(b);
+        } else {
+            perror("sendmsg client");
+        }
+#else
+        send_each(b);
+#endif
+    }
+    b->count = 0;
+    b->len = 0;
+}
+
+void reply_send(ReplyBatch *b, const struct sockaddr_in *to, socklen_t to_len,
+                const void *data, size_t len) {
+    if (!b->gso || len > NETOPT_GSO_MAX_SEGMENT) {
+        reply_flush(b);
+        if (sendto(b->sock, data, len, 0, (const struct sockaddr *)to, to_len) < 0)
+            perror("sendto client");
+        return;
+    }
+    if (b->count > 0 &&
+        (len > b->segment || b->len + len > NETOPT_GSO_BYTES || b->count >= NETOPT_GSO_SEGMENTS ||
+         to->sin_addr.s_addr != b->to.sin_addr.s_addr || to->sin_port != b->to.sin_port))
+        reply_flush(b);
+    if (b->count == 0) {
+        memcpy(&b->to, to, to_len < sizeof(b->to) ? to_len : sizeof(b->to));
+        b->to_len = to_len;
+        b->segment = len;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->count++;
+    /* Only the last segment may be shorter: a short reply ends the run. */
+    if (len < b->segment) reply_flush(b);
+}
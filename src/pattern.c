@@ -0,0 +1,798 @@
+/**
+ * @file pattern.c
+ * @brief Compilation of regex and glob rules into a single combined DFA.
+ *
+ * Each rule is parsed into a small syntax tree. At compile time the trees
+ * of each partition (start-anchored or floating rules) are turned into one
+ * Thompson NFA whose branches end in per-rule accept states, and the NFA is
+ * determinized by subset construction over byte equivalence classes.
+ * Floating rules share a single leading `.*` loop, and once a rule without
+ * an end anchor has matched the DFA collapses into an absorbing state, so
+ * the automaton never tracks what happens after a decided match. Only the
+ * transition tables are kept for matching.
+ */
+
+#include "pattern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_REPEAT 255
+
+/** @brief 256-bit byte set. */
+typedef struct {
+    uint32_t bits[8];
+} ByteSet;
+
+enum { AST_SET, AST_CAT, AST_ALT, AST_STAR, AST_PLUS, AST_QUEST, AST_REPEAT, AST_EMPTY };
+
+/** @brief Syntax tree node; children are indices into the node pool. */
+typedef struct {
+    int type;
+    int left, right;
+    int min, max;     /**< Bounds for AST_REPEAT; max < 0 means unbounded. */
+    ByteSet set;      /**< Accepted bytes for AST_SET. */
+} AstNode;
+
+enum { NFA_SET, NFA_SPLIT, NFA_EPS, NFA_ACCEPT };
+
+/** @brief Thompson NFA state. */
+typedef struct {
+    int type;
+    int out, out1;    /**< Successors (out1 only for NFA_SPLIT). */
+    int ast;          /**< AST node holding the byte set for NFA_SET. */
+    int rule;         /**< Rule number for NFA_ACCEPT. */
+    int final;        /**< NFA_ACCEPT of a rule not anchored at the end: the match is decided. */
+} NfaState;
+
+typedef struct {
+    NfaState *states;
+    int count, cap;
+} Nfa;
+
+typedef struct {
+    int start, end;   /**< Entry state and dangling NFA_EPS exit state. */
+} Frag;
+
+typedef struct {
+    PatternSet *ps;
+    const char *p;
+    int error;
+} Parser;
+
+static void set_add(ByteSet *s, int c) { s->bits[c >> 5] |= 1u << (c & 31); }
+static int set_has(const ByteSet *s, int c) { return (s->bits[c >> 5] >> (c & 31)) & 1; }
+
+static void set_range(ByteSet *s, int lo, int hi) {
+    for (int c = lo; c <= hi; c++) set_add(s, c);
+}
+
+static void set_invert(ByteSet *s) {
+    for (int i = 0; i < 8; i++) s->bits[i] = ~s->bits[i];
+}
+
+/** @brief Makes a set case-insensitive by adding the other case of every letter. */
+static void set_fold(ByteSet *s) {
+    for (int c = 'a'; c <= 'z'; c++) {
+        if (set_has(s, c) || set_has(s, c - 'a' + 'A')) {
+            set_add(s, c);
+            set_add(s, c - 'a' + 'A');
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+/* Parser                                                                 */
+/* ---------------------------------------------------------------------- */
+
+static int ast_new(Parser *ps, int type, int left, int right) {
+    PatternSet *set = ps->ps;
+    if (set->ast_count == set->ast_cap) {
+        int cap = set->ast_cap ? set->ast_cap * 2 : 64;
+        AstNode *pool = realloc(set->ast, (size_t)cap * sizeof(AstNode));
+        if (!pool) {
+            ps->error = 1;
+            return -1;
+        }
+        set->ast = pool;
+        set->ast_cap = cap;
+    }
+    AstNode *n = &((AstNode *)set->ast)[set->ast_count];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->left = left;
+    n->right = right;
+    return set->ast_count++;
+}
+
+static int ast_set(Parser *ps, const ByteSet *s) {
+    int n = ast_new(ps, AST_SET, -1, -1);
+    if (n < 0) return -1;
+    AstNode *node = &((AstNode *)ps->ps->ast)[n];
+    node->set = *s;
+    set_fold(&node->set);
+    return n;
+}
+
+/**
+ * @brief Fills @p s for a backslash escape; returns 0 if @p c is not a class escape.
+ */
+static int escape_class(int c, ByteSet *s) {
+    memset(s, 0, sizeof(*s));
+    switch (tolower(c)) {
+    case 'd': set_range(s, '0', '9'); break;
+    case 'w': set_range(s, 'a', 'z'); set_range(s, 'A', 'Z'); set_range(s, '0', '9'); set_add(s, '_'); break;
+    case 's': set_add(s, ' '); set_range(s, '\t', '\r'); break;
+    default: return 0;
+    }
+    if (isupper(c)) set_invert(s);
+    return 1;
+}
+
+static int parse_alt(Parser *ps);
+
+static int parse_class(Parser *ps) {
+    ByteSet s;
+    memset(&s, 0, sizeof(s));
+    int negate = 0;
+    if (*ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+
+    int first = 1;
+    while (*ps->p && (*ps->p != ']' || first)) {
+        first = 0;
+        int lo = (unsigned char)*ps->p++;
+        if (lo == '\\') {
+            if (!*ps->p) break;
+            ByteSet esc;
+            if (escape_class(*ps->p, &esc)) {
+                for (int i = 0; i < 8; i++) s.bits[i] |= esc.bits[i];
+                ps->p++;
+                continue;
+            }
+            lo = (unsigned char)*ps->p++;
+        }
+        int hi = lo;
+        if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+            ps->p++;
+            hi = (unsigned char)*ps->p++;
+            if (hi == '\\' && *ps->p) hi = (unsigned char)*ps->p++;
+            if (hi < lo) {
+                ps->error = 1;
+                return -1;
+            }
+        }
+        set_range(&s, lo, hi);
+    }
+    if (*ps->p != ']') {
+        ps->error = 1;
+        return -1;
+    }
+    ps->p++;
+
+    if (negate) {
+        set_fold(&s);
+        set_invert(&s);
+    }
+    return ast_set(ps, &s);
+}
+
+static int parse_atom(Parser *ps) {
+    ByteSet s;
+    memset(&s, 0, sizeof(s));
+    int c = (unsigned char)*ps->p;
+
+    switch (c) {
+    case '(': {
+        ps->p++;
+        if (ps->p[0] == '?' && ps->p[1] == ':') ps->p += 2;
+        int n = parse_alt(ps);
+        if (*ps->p != ')') {
+            ps->error = 1;
+            return -1;
+        }
+        ps->p++;
+        return n;
+    }
+    case '[':
+        ps->p++;
+        return parse_class(ps);
+    case '.':
+        ps->p++;
+        set_invert(&s);
+        return ast_set(ps, &s);
+    case '\\':
+        ps->p++;
+        if (!*ps->p) {
+            ps->error = 1;
+            return -1;
+        }
+        if (!escape_class(*ps->p, &s)) set_add(&s, (unsigned char)*ps->p);
+        ps->p++;
+        return ast_set(ps, &s);
+    case '*': case '+': case '?': case '{': case ')': case '^': case '$':
+        ps->error = 1;
+        return -1;
+    default:
+        ps->p++;
+        set_add(&s, c);
+        return ast_set(ps, &s);
+    }
+}
+
+static int parse_number(Parser *ps) {
+    if (!isdigit((unsigned char)*ps->p)) return -1;
+    int v = 0;
+    while (isdigit((unsigned char)*ps->p)) {
+        v = v * 10 + (*ps->p++ - '0');
+        if (v > MAX_REPEAT) v = MAX_REPEAT + 1;
+    }
+    return v;
+}
+
+static int parse_repeat(Parser *ps) {
+    int n = parse_atom(ps);
+    while (!ps->error) {
+        char c = *ps->p;
+        if (c == '*' || c == '+' || c == '?') {
+            ps->p++;
+            n = ast_new(ps, c == '*' ? AST_STAR : c == '+' ? AST_PLUS : AST_QUEST, n, -1);
+        } else if (c == '{') {
+            ps->p++;
+            int min = parse_number(ps), max = min;
+            if (*ps->p == ',') {
+                ps->p++;
+                max = *ps->p == '}' ? -1 : parse_number(ps);
+                if (max == -1 && *ps->p != '}') min = -1;
+            }
+            if (min < 0 || min > MAX_REPEAT || max > MAX_REPEAT ||
+                (max >= 0 && max < min) || *ps->p != '}') {
+                ps->error = 1;
+                return -1;
+            }
+            ps->p++;
+            int r = ast_new(ps, AST_REPEAT, n, -1);
+            if (r < 0) return -1;
+            ((AstNode *)ps->ps->ast)[r].min = min;
+            ((AstNode *)ps->ps->ast)[r].max = max;
+            n = r;
+        } else {
+            break;
+        }
+    }
+    return n;
+}
+
+static int parse_concat(Parser *ps) {
+    int left = -1;
+    while (!ps->error && *ps->p && *ps->p != '|' && *ps->p != ')') {
+        int atom = parse_repeat(ps);
+        left = left < 0 ? atom : ast_new(ps, AST_CAT, left, atom);
+    }
+    return left < 0 ? ast_new(ps, AST_EMPTY, -1, -1) : left;
+}
+
+static int parse_alt(Parser *ps) {
+    int left = parse_concat(ps);
+    while (!ps->error && *ps->p == '|') {
+        ps->p++;
+        int right = parse_concat(ps);
+        left = ast_new(ps, AST_ALT, left, right);
+    }
+    return left;
+}
+
+/**
+ * @brief Rewrites a glob as an anchored regex (`*` -> `.*`, `?` -> `.`).
+ *
+ * @return Newly allocated regex string, or NULL on allocation failure.
+ */
+static char *glob_to_regex(const char *glob) {
+    char *re = malloc(strlen(glob) * 2 + 3);
+    if (!re) return NULL;
+    char *o = re;
+    *o++ = '^';
+    for (const char *g = glob; *g; g++) {
+        if (*g == '*') {
+            *o++ = '.';
+            *o++ = '*';
+        } else if (*g == '?') {
+            *o++ = '.';
+        } else {
+            if (strchr("\\.[](){}|+^$", *g)) *o++ = '\\';
+            *o++ = *g;
+        }
+    }
+    *o++ = '$';
+    *o = '\0';
+    return re;
+}
+
+int pattern_set_add(PatternSet *ps, const char *pattern, int is_glob) {
+    if (ps->compiled) return -1;
+
+    char *re = is_glob ? glob_to_regex(pattern) : malloc(strlen(pattern) + 1);
+    if (!re) return -1;
+    if (!is_glob) strcpy(re, pattern);
+
+    size_t len = strlen(re);
+    int anchor_start = re[0] == '^';
+    int anchor_end = 0;
+    if (len > (size_t)anchor_start && re[len - 1] == '$') {
+        size_t bs = 0;
+        while (bs + 1 < len && re[len - 2 - bs] == '\\') bs++;
+        anchor_end = (bs % 2) == 0;
+    }
+    if (anchor_end) re[len - 1] = '\0';
+
+    int saved_ast = ps->ast_count;
+    Parser p = { ps, re + anchor_start, 0 };
+    int root = parse_alt(&p);
+    if (!p.error && *p.p != '\0') p.error = 1;
+    free(re);
+
+    if (p.error || root < 0) {
+        ps->ast_count = saved_ast;
+        return -1;
+    }
+
+    if (ps->count == ps->cap) {
+        int cap = ps->cap ? ps->cap * 2 : 8;
+        char **sources = realloc(ps->sources, (size_t)cap * sizeof(char *));
+        if (!sources) return -1;
+        ps->sources = sources;
+        int *roots = realloc(ps->roots, (size_t)cap * sizeof(int));
+        if (!roots) return -1;
+        ps->roots = roots;
+        uint8_t *anchors = realloc(ps->anchors, (size_t)cap);
+        if (!anchors) return -1;
+        ps->anchors = anchors;
+        ps->cap = cap;
+    }
+    ps->sources[ps->count] = malloc(strlen(pattern) + 1);
+    if (!ps->sources[ps->count]) return -1;
+    strcpy(ps->sources[ps->count], pattern);
+    ps->roots[ps->count] = root;
+    ps->anchors[ps->count] = (uint8_t)((anchor_start ? PATTERN_ANCHOR_START : 0) |
+                                       (anchor_end ? PATTERN_ANCHOR_END : 0));
+    return ps->count++;
+}
+
+/* ---------------------------------------------------------------------- */
+/* NFA construction                                                       */
+/* ---------------------------------------------------------------------- */
+
+static int nfa_new(Nfa *nfa, int type) {
+    if (nfa->count == nfa->cap) {
+        int cap = nfa->cap ? nfa->cap * 2 : 256;
+        NfaState *states = realloc(nfa->states, (size_t)cap * sizeof(NfaState));
+        if (!states) return -1;
+        nfa->states = states;
+        nfa->cap = cap;
+    }
+    NfaState *s = &nfa->states[nfa->count];
+    s->type = type;
+    s->out = s->out1 = -1;
+    s->ast = -1;
+    s->rule = -1;
+    s->final = 0;
+    return nfa->count++;
+}
+
+/**
+ * @brief Emits NFA states for an AST subtree.
+ *
+ * @return Fragment with @c start < 0 on allocation failure.
+ */
+static Frag build_frag(Nfa *nfa, const AstNode *ast, int n) {
+    Frag f = { -1, -1 }, a, b;
+    const AstNode *node = &ast[n];
+
+    switch (node->type) {
+    case AST_SET:
+        f.start = nfa_new(nfa, NFA_SET);
+        f.end = nfa_new(nfa, NFA_EPS);
+        if (f.start < 0 || f.end < 0) return (Frag){ -1, -1 };
+        nfa->states[f.start].ast = n;
+        nfa->states[f.start].out = f.end;
+        return f;
+    case AST_EMPTY:
+        f.start = f.end = nfa_new(nfa, NFA_EPS);
+        return f;
+    case AST_CAT:
+        a = build_frag(nfa, ast, node->left);
+        b = build_frag(nfa, ast, node->right);
+        if (a.start < 0 || b.start < 0) return (Frag){ -1, -1 };
+        nfa->states[a.end].out = b.start;
+        return (Frag){ a.start, b.end };
+    case AST_ALT:
+        a = build_frag(nfa, ast, node->left);
+        b = build_frag(nfa, ast, node->right);
+        f.start = nfa_new(nfa, NFA_SPLIT);
+        f.end = nfa_new(nfa, NFA_EPS);
+        if (a.start < 0 || b.start < 0 || f.start < 0 || f.end < 0) return (Frag){ -1, -1 };
+        nfa->states[f.start].out = a.start;
+        nfa->states[f.start].out1 = b.start;
+        nfa->states[a.end].out = f.end;
+        nfa->states[b.end].out = f.end;
+        return f;
+    case AST_STAR:
+    case AST_PLUS:
+    case AST_QUEST: {
+        a = build_frag(nfa, ast, node->left);
+        int split = nfa_new(nfa, NFA_SPLIT);
+        f.end = nfa_new(nfa, NFA_EPS);
+        if (a.start < 0 || split < 0 || f.end < 0) return (Frag){ -1, -1 };
+        nfa->states[split].out = a.start;
+        nfa->states[split].out1 = f.end;
+        nfa->states[a.end].out = node->type == AST_QUEST ? f.end : split;
+        f.start = node->type == AST_PLUS ? a.start : split;
+        return f;
+    }
+    case AST_REPEAT: {
+        f.start = f.end = nfa_new(nfa, NFA_EPS);
+        if (f.start < 0) return f;
+        int optional = node->max < 0 ? 1 : node->max - node->min;
+        for (int i = 0; i < node->min + optional; i++) {
+            a = build_frag(nfa, ast, node->left);
+            if (a.start < 0) return (Frag){ -1, -1 };
+            if (i < node->min) {
+                nfa->states[f.end].out = a.start;
+                f.end = a.end;
+                continue;
+            }
+            /* Optional copy: skip it, or (if unbounded) loop on it. */
+            int split = nfa_new(nfa, NFA_SPLIT);
+            int end = nfa_new(nfa, NFA_EPS);
+            if (split < 0 || end < 0) return (Frag){ -1, -1 };
+            nfa->states[split].out = a.start;
+            nfa->states[split].out1 = end;
+            nfa->states[a.end].out = node->max < 0 ? split : end;
+            nfa->states[f.end].out = split;
+            f.end = end;
+        }
+        return f;
+    }
+    }
+    return f;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Subset construction                                                    */
+/* ---------------------------------------------------------------------- */
+
+typedef struct {
+    int *members;     /**< Concatenated sorted NFA state lists. */
+    size_t used, cap;
+    size_t *offset;   /**< Start of each DFA state's list in @c members. */
+    int *size;        /**< Length of each DFA state's list. */
+    uint32_t *hash;   /**< Hash of each DFA state's list. */
+    int *slots;       /**< Open-addressing index of DFA states (-1 = empty). */
+    size_t slot_mask;
+} StateSets;
+
+static uint32_t hash_list(const int *list, int n) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < n; i++) {
+        h ^= (uint32_t)list[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int cmp_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * @brief Computes the epsilon closure of @p list in place.
+ *
+ * Only consuming (NFA_SET) and accepting states are kept, sorted.
+ *
+ * @param mark Per-NFA-state scratch array compared against @p gen.
+ * @param stack Scratch stack with room for every NFA state.
+ * @return Number of states in the closure.
+ */
+static int closure(const Nfa *nfa, int *list, int n, int *mark, int gen, int *stack) {
+    int sp = 0, out = 0;
+    for (int i = 0; i < n; i++) {
+        if (mark[list[i]] != gen) {
+            mark[list[i]] = gen;
+            stack[sp++] = list[i];
+        }
+    }
+    while (sp > 0) {
+        int s = stack[--sp];
+        const NfaState *st = &nfa->states[s];
+        if (st->type == NFA_SET || st->type == NFA_ACCEPT) {
+            list[out++] = s;
+            continue;
+        }
+        int next[2] = { st->out, st->type == NFA_SPLIT ? st->out1 : -1 };
+        for (int k = 0; k < 2; k++) {
+            if (next[k] >= 0 && mark[next[k]] != gen) {
+                mark[next[k]] = gen;
+                stack[sp++] = next[k];
+            }
+        }
+    }
+    qsort(list, (size_t)out, sizeof(int), cmp_int);
+    return out;
+}
+
+/**
+ * @brief Returns the DFA state for a closure, adding it if new.
+ *
+ * @return DFA state index, or -1 on allocation failure or state limit.
+ */
+static int intern_state(PatternDfa *dfa, StateSets *ss, const int *list, int n) {
+    uint32_t h = hash_list(list, n);
+    size_t i = h & ss->slot_mask;
+    while (ss->slots[i] >= 0) {
+        int d = ss->slots[i];
+        if (ss->hash[d] == h && ss->size[d] == n &&
+            memcmp(ss->members + ss->offset[d], list, (size_t)n * sizeof(int)) == 0)
+            return d;
+        i = (i + 1) & ss->slot_mask;
+    }
+
+    int d = dfa->nstates;
+    if (d >= PATTERN_MAX_DFA_STATES) return -1;
+
+    if (ss->used + (size_t)n > ss->cap) {
+        size_t cap = ss->cap ? ss->cap * 2 : 4096;
+        while (cap < ss->used + (size_t)n) cap *= 2;
+        int *m = realloc(ss->members, cap * sizeof(int));
+        if (!m) return -1;
+        ss->members = m;
+        ss->cap = cap;
+    }
+    if (n > 0) memcpy(ss->members + ss->used, list, (size_t)n * sizeof(int));
+    ss->offset[d] = ss->used;
+    ss->size[d] = n;
+    ss->hash[d] = h;
+    ss->used += (size_t)n;
+    ss->slots[i] = d;
+    dfa->nstates++;
+    return d;
+}
+
+/**
+ * @brief Partitions the 256 byte values into classes no NFA set distinguishes.
+ */
+static void build_classes(PatternDfa *dfa, const AstNode *ast, const Nfa *nfa) {
+    memset(dfa->classmap, 0, sizeof(dfa->classmap));
+    dfa->nclasses = 1;
+
+    for (int s = 0; s < nfa->count; s++) {
+        if (nfa->states[s].type != NFA_SET) continue;
+        const ByteSet *set = &ast[nfa->states[s].ast].set;
+
+        int remap[256][2];
+        memset(remap, -1, sizeof(remap));
+        int next = 0;
+        for (int c = 0; c < 256; c++) {
+            int *slot = &remap[dfa->classmap[c]][set_has(set, c)];
+            if (*slot < 0) *slot = next++;
+            dfa->classmap[c] = (uint8_t)*slot;
+        }
+        dfa->nclasses = next;
+    }
+}
+
+/** @brief Returns 1 if rule @p r may start anywhere in the name. */
+static int rule_floating(const PatternSet *ps, int r) {
+    return (ps->anchors[r] & PATTERN_ANCHOR_START) ? 0 : 1;
+}
+
+/**
+ * @brief Determinizes the rules of one partition into @p dfa.
+ *
+ * @param floating 0 for start-anchored rules, 1 for floating rules.
+ * @return 0 on success, -1 on allocation failure or state limit.
+ */
+static int build_dfa(PatternSet *ps, PatternDfa *dfa, int floating) {
+    Nfa nfa = { NULL, 0, 0 };
+    StateSets ss;
+    memset(&ss, 0, sizeof(ss));
+    int *mark = NULL, *stack = NULL, *list = NULL;
+    int rc = -1;
+
+    /* root -> [any* ->] split(rule a, split(rule b, ...)); each rule ends in its accept state. */
+    int root = nfa_new(&nfa, NFA_EPS);
+    int prev = root;
+    int rules = 0;
+    for (int r = 0; r < ps->count; r++)
+        rules += rule_floating(ps, r) == floating;
+    if (floating && rules > 0) {
+        int loop = nfa_new(&nfa, NFA_SPLIT);
+        int any = nfa_new(&nfa, NFA_SET);
+        ByteSet all;
+        memset(&all, 0, sizeof(all));
+        set_invert(&all);
+        Parser p = { ps, "", 0 };
+        int any_ast = ast_set(&p, &all);
+        if (loop < 0 || any < 0 || any_ast < 0) goto out;
+        nfa.states[root].out = loop;
+        nfa.states[loop].out = any;
+        nfa.states[any].ast = any_ast;
+        nfa.states[any].out = loop;
+        prev = loop;
+    }
+    for (int r = 0; r < ps->count; r++) {
+        if (rule_floating(ps, r) != floating) continue;
+
+        Frag f = build_frag(&nfa, ps->ast, ps->roots[r]);
+        int accept = nfa_new(&nfa, NFA_ACCEPT);
+        int split = nfa_new(&nfa, NFA_SPLIT);
+        if (f.start < 0 || accept < 0 || split < 0) goto out;
+        nfa.states[accept].rule = r;
+        nfa.states[accept].final = !(ps->anchors[r] & PATTERN_ANCHOR_END);
+        nfa.states[f.end].out = accept;
+        nfa.states[split].out = f.start;
+        if (nfa.states[prev].type == NFA_SPLIT) nfa.states[prev].out1 = split;
+        else nfa.states[prev].out = split;
+        prev = split;
+    }
+
+    build_classes(dfa, ps->ast, &nfa);
+
+    size_t max_states = PATTERN_MAX_DFA_STATES;
+    ss.offset = malloc(max_states * sizeof(size_t));
+    ss.size = malloc(max_states * sizeof(int));
+    ss.hash = malloc(max_states * sizeof(uint32_t));
+    ss.slot_mask = max_states * 2 - 1;
+    ss.slots = malloc((ss.slot_mask + 1) * sizeof(int));
+    mark = calloc((size_t)nfa.count, sizeof(int));
+    stack = malloc((size_t)nfa.count * sizeof(int));
+    list = malloc((size_t)nfa.count * sizeof(int));
+    if (!ss.offset || !ss.size || !ss.hash || !ss.slots || !mark || !stack || !list) goto out;
+    memset(ss.slots, -1, (ss.slot_mask + 1) * sizeof(int));
+
+    size_t trans_cap = 64;
+    dfa->trans = malloc(trans_cap * (size_t)dfa->nclasses * sizeof(int32_t));
+    if (!dfa->trans) goto out;
+
+    dfa->nstates = 0;
+    int gen = 1;
+    intern_state(dfa, &ss, list, 0);  /* dead state */
+    list[0] = root;
+    dfa->start = intern_state(dfa, &ss, list, closure(&nfa, list, 1, mark, gen++, stack));
+
+    int rep[256];
+    for (int c = 255; c >= 0; c--) rep[dfa->classmap[c]] = c;
+
+    const AstNode *ast = ps->ast;
+    for (int d = 0; d < dfa->nstates; d++) {
+        int absorbing = ss.size[d] == 1 && nfa.states[ss.members[ss.offset[d]]].final;
+
+        for (int k = 0; k < dfa->nclasses; k++) {
+            int n = 0;
+            for (int i = 0; !absorbing && i < ss.size[d]; i++) {
+                /* Re-read members each time: intern_state may move the array. */
+                const NfaState *st = &nfa.states[ss.members[ss.offset[d] + i]];
+                if (st->type == NFA_SET && set_has(&ast[st->ast].set, rep[k]))
+                    list[n++] = st->out;
+            }
+            int target = absorbing ? d : 0;
+            if (n) {
+                n = closure(&nfa, list, n, mark, gen++, stack);
+                /* A decided match needs no further tracking: keep only its accept state. */
+                for (int i = 0; i < n; i++) {
+                    if (nfa.states[list[i]].final) {
+                        list[0] = list[i];
+                        n = 1;
+                        break;
+                    }
+                }
+                target = intern_state(dfa, &ss, list, n);
+            }
+            if (target < 0) {
+                fprintf(stderr, "Pattern rules exceed %d DFA states\n", PATTERN_MAX_DFA_STATES);
+                goto out;
+            }
+            /* A new state needs its own row before the loop reaches it. */
+            if ((size_t)dfa->nstates > trans_cap) {
+                while ((size_t)dfa->nstates > trans_cap) trans_cap *= 2;
+                int32_t *t = realloc(dfa->trans, trans_cap * (size_t)dfa->nclasses * sizeof(int32_t));
+                if (!t) goto out;
+                dfa->trans = t;
+            }
+            dfa->trans[(size_t)d * dfa->nclasses + k] = target;
+        }
+    }
+
+    dfa->accept = malloc((size_t)dfa->nstates * sizeof(int32_t));
+    if (!dfa->accept) goto out;
+    for (int d = 0; d < dfa->nstates; d++) {
+        int best = -1;
+        const int *members = ss.members + ss.offset[d];
+        for (int i = 0; i < ss.size[d]; i++) {
+            const NfaState *st = &nfa.states[members[i]];
+            if (st->type == NFA_ACCEPT && (best < 0 || st->rule < best)) best = st->rule;
+        }
+        dfa->accept[d] = best;
+    }
+    rc = 0;
+
+out:
+    if (rc < 0) {
+        free(dfa->trans);
+        dfa->trans = NULL;
+        dfa->nstates = 0;
+    }
+    free(nfa.states);
+    free(ss.members);
+    free(ss.offset);
+    free(ss.size);
+    free(ss.hash);
+    free(ss.slots);
+    free(mark);
+    free(stack);
+    free(list);
+    return rc;
+}
+
+int pattern_set_compile(PatternSet *ps) {
+    if (ps->compiled) return 0;
+
+    for (int part = 0; part < 2; part++) {
+        if (build_dfa(ps, &ps->dfa[part], part) < 0) return -1;
+    }
+
+    free(ps->ast);
+    ps->ast = NULL;
+    ps->ast_count = ps->ast_cap = 0;
+    ps->compiled = 1;
+    return 0;
+}
+
+PatternSet *pattern_set_new(void) {
+    return calloc(1, sizeof(PatternSet));
+}
+
+void pattern_set_free(PatternSet *ps) {
+    if (!ps) return;
+    for (int i = 0; i < ps->count; i++) free(ps->sources[i]);
+    free(ps->sources);
+    free(ps->roots);
+    free(ps->anchors);
+    free(ps->ast);
+    for (int i = 0; i < 2; i++) {
+        free(ps->dfa[i].trans);
+        free(ps->dfa[i].accept);
+    }
+    free(ps);
+}
+
+/**
+ * @brief Single linear pass over the name, stepping both automata per byte.
+ *
+ * Stops early once both automata are in their dead state.
+ */
+int pattern_set_match(const PatternSet *ps, const char *name) {
+    if (!ps || !ps->compiled) return -1;
+
+    const PatternDfa *a = &ps->dfa[0], *f = &ps->dfa[1];
+    int32_t sa = a->start, sf = f->start;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        sa = a->trans[(size_t)sa * a->nclasses + a->classmap[*p]];
+        sf = f->trans[(size_t)sf * f->nclasses + f->classmap[*p]];
+        if ((sa | sf) == 0) return -1;
+    }
+
+    int ra = a->accept[sa], rf = f->accept[sf];
+    if (ra < 0) return rf;
+    return (rf < 0 || ra < rf) ? ra : rf;
+}
+
+size_t pattern_set_memory(const PatternSet *ps) {
+    if (!ps) return 0;
+    size_t bytes = sizeof(PatternSet);
+    for (int i = 0; i < 2; i++)
+        bytes += (size_t)ps->dfa[i].nstates * ((size_t)ps->dfa[i].nclasses + 1) * sizeof(int32_t);
+    return bytes;
+}
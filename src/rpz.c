@@ -0,0 +1,310 @@
+/**
+ * @file rpz.c
+ * @brief Response-policy zone (RPZ) loader.
+ *
+ * Reads RPZ zone files and incremental update files and applies their QNAME
+ * triggers directly to a DomainTrie. Only the subset of the master-file
+ * format that RPZ feeds use is understood: `$ORIGIN`, `$TTL`, relative and
+ * absolute owner names, blank owners, `;` comments and parenthesized
+ * continuation lines.
+ */
+
+#include "rpz.h"
+#include "dns_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <strings.h>
+#include <arpa/inet.h>
+
+#define RPZ_MAX_TOKENS 16
+#define RPZ_LINE_MAX 4096
+
+/** @brief Parser state carried across the lines of one file. */
+typedef struct {
+    char origin[MAX_STR_LEN];  /**< Current origin without trailing dot ("" if none). */
+    char owner[MAX_STR_LEN];   /**< Last owner, reused for lines with a blank owner. */
+    uint32_t ttl;              /**< Default TTL from `$TTL`. */
+    int update;                /**< Non-zero when parsing an update file. */
+} RpzParser;
+
+/**
+ * @brief Splits a line into whitespace-separated tokens in place.
+ *
+ * @return Number of tokens stored in @p tok.
+ */
+static int tokenize(char *line, char **tok) {
+    int n = 0;
+    char *p = line;
+    while (*p && n < RPZ_MAX_TOKENS) {
+        while (*p && isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+        tok[n++] = p;
+        while (*p && !isspace((unsigned char)*p)) p++;
+        if (*p) *p++ = '\0';
+    }
+    return n;
+}
+
+/**
+ * @brief Converts an owner name to the policy trigger name.
+ *
+ * Relative names are already triggers; absolute names have the origin
+ * stripped. Returns 0 for the zone apex or names outside the zone.
+ */
+static int owner_to_trigger(const RpzParser *rp, const char *owner, char *out, size_t cap) {
+    if (strcmp(owner, "@") == 0) return 0;
+
+    size_t len = strlen(owner);
+    if (len == 0 || len >= cap) return 0;
+    if (owner[len - 1] != '.') {
+        memcpy(out, owner, len + 1);
+        return 1;
+    }
+
+    len--;  /* drop the trailing dot */
+    size_t olen = strlen(rp->origin);
+    if (olen == 0) {
+        memcpy(out, owner, len);
+        out[len] = '\0';
+        return len > 0;
+    }
+    if (len <= olen + 1 || owner[len - olen - 1] != '.' ||
+        strncasecmp(owner + len - olen, rp->origin, olen) != 0)
+        return 0;
+    memcpy(out, owner, len - olen - 1);
+    out[len - olen - 1] = '\0';
+    return 1;
+}
+
+/**
+ * @brief Returns non-zero for triggers other than QNAME (IP, NSDNAME, ...).
+ */
+static int is_other_trigger(const char *name) {
+    static const char *const kinds[] = { "rpz-ip", "rpz-nsip", "rpz-nsdname", "rpz-client-ip" };
+    size_t len = strlen(name);
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        size_t klen = strlen(kinds[i]);
+        if (len > klen && name[len - klen - 1] == '.' && strcasecmp(name + len - klen, kinds[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Applies one resource record (owner already consumed) to the trie.
+ *
+ * Records with an invalid owner or data are counted as malformed and
+ * skipped. A zone keeps an existing passthru over a later trigger for the
+ * same owner, as lists keep allow entries; an update replaces it.
+ *
+ * @param add Non-zero to add, zero to remove.
+ * @return 0 on success, -1 if memory runs out.
+ */
+static int apply_record(RpzParser *rp, DomainTrie *t, RpzStats *st, int add,
+                        char **tok, int n) {
+    int i = 0;
+    const char *owner = rp->owner;
+    uint32_t ttl = rp->ttl;
+    while (i < n && (isdigit((unsigned char)tok[i][0]) ||
+                     strcasecmp(tok[i], "IN") == 0 || strcasecmp(tok[i], "CH") == 0)) {
+        if (isdigit((unsigned char)tok[i][0])) ttl = (uint32_t)strtoul(tok[i], NULL, 10);
+        i++;
+    }
+    if (i >= n) {
+        st->malformed++;
+        return 0;
+    }
+    const char *type = tok[i++];
+
+    char trigger[MAX_STR_LEN];
+    if (!owner_to_trigger(rp, owner, trigger, sizeof(trigger))) {
+        /* Apex SOA/NS records carry zone metadata, not policy. */
+        if (strcasecmp(type, "SOA") != 0 && strcasecmp(type, "NS") != 0) st->unsupported++;
+        return 0;
+    }
+    if (is_other_trigger(trigger)) {
+        st->unsupported++;
+        return 0;
+    }
+
+    int scope = DT_SCOPE_SELF;
+    const char *name = trigger;
+    if (name[0] == '*' && name[1] == '.') {
+        scope = DT_SCOPE_SUB;
+        name += 2;
+    }
+
+    int verdict = DT_NONE, rtype = 0, rdlen = 0;
+    unsigned char rdata[MAX_STR_LEN];
+    /* Checked up front, so the trie failing on a valid owner means memory ran out. */
+    if (name[0] == '\0' || dns_encode_name(name, rdata, sizeof(rdata)) < 0) {
+        st->malformed++;
+        return 0;
+    }
+
+    if (strcasecmp(type, "CNAME") == 0 && i < n) {
+        const char *target = tok[i];
+        if (strcmp(target, ".") == 0) verdict = DT_NXDOMAIN;
+        else if (strcmp(target, "*.") == 0) verdict = DT_NODATA;
+        else if (strcasecmp(target, "rpz-passthru.") == 0) verdict = DT_ALLOW;
+        else if (strcasecmp(target, "rpz-drop.") == 0) verdict = DT_DROP;
+        else if (target[0] == '*' || strncasecmp(target, "rpz-", 4) == 0) {
+            st->unsupported++;
+            return 0;
+        } else {
+            rtype = 5;
+            rdlen = dns_encode_name(target, rdata, sizeof(rdata));
+        }
+    } else if (strcasecmp(type, "A") == 0 && i < n) {
+        rtype = 1;
+        rdlen = inet_pton(AF_INET, tok[i], rdata) == 1 ? 4 : -1;
+    } else if (strcasecmp(type, "AAAA") == 0 && i < n) {
+        rtype = 28;
+        rdlen = inet_pton(AF_INET6, tok[i], rdata) == 1 ? 16 : -1;
+    } else {
+        st->unsupported++;
+        return 0;
+    }
+
+    if (verdict != DT_NONE) {
+        if (!add) {
+            /* Deleting a record that is not there must leave other actions alone. */
+            st->removed += (size_t)domain_trie_remove(t, name, scope, verdict);
+            return 0;
+        }
+        int rc = domain_trie_insert_scoped(t, name, verdict, scope);
+        if (rc == 1 && rp->update && domain_trie_remove(t, name, scope, DT_NONE))
+            rc = domain_trie_insert_scoped(t, name, verdict, scope);
+        if (rc < 0) return -1;
+        if (rc == 0) st->added++;
+        return 0;
+    }
+
+    if (rdlen < 0) {
+        st->malformed++;
+        return 0;
+    }
+    if (!add) {
+        st->removed += (size_t)domain_trie_remove_data(t, name, scope, rtype, rdata, rdlen);
+        return 0;
+    }
+    int rc = domain_trie_add_data(t, name, scope, rtype, ttl, rdata, rdlen);
+    if (rc == 1 && rp->update && domain_trie_remove(t, name, scope, DT_NONE))
+        rc = domain_trie_add_data(t, name, scope, rtype, ttl, rdata, rdlen);
+    if (rc < 0) return -1;
+    if (rc == 0) st->added++;
+    return 0;
+}
+
+/**
+ * @brief Handles one logical line (continuations already joined).
+ */
+static int parse_line(RpzParser *rp, DomainTrie *t, RpzStats *st, char *line) {
+    int add = 1;
+    int blank_owner = isspace((unsigned char)line[0]);
+    if (rp->update) {
+        /* Update records always name their owner: "+name ..." or "+ name ...". */
+        if (line[0] == '+' || line[0] == '-') {
+            add = line[0] == '+';
+            line++;
+            blank_owner = 0;
+        } else if (line[0] != '$' && line[strspn(line, " \t")] != '\0') {
+            st->malformed++;
+            return 0;
+        }
+    }
+
+    char *tok[RPZ_MAX_TOKENS];
+    int n = tokenize(line, tok);
+    if (n == 0) return 0;
+
+    if (strcasecmp(tok[0], "$ORIGIN") == 0 && n > 1) {
+        size_t len = strlen(tok[1]);
+        if (len > 0 && tok[1][len - 1] == '.') len--;
+        if (len >= sizeof(rp->origin)) len = sizeof(rp->origin) - 1;
+        memcpy(rp->origin, tok[1], len);
+        rp->origin[len] = '\0';
+        return 0;
+    }
+    if (strcasecmp(tok[0], "$TTL") == 0 && n > 1) {
+        rp->ttl = (uint32_t)strtoul(tok[1], NULL, 10);
+        return 0;
+    }
+    if (tok[0][0] == '$') {
+        st->unsupported++;
+        return 0;
+    }
+
+    int first = 0;
+    if (!blank_owner) {
+        strncpy(rp->owner, tok[0], sizeof(rp->owner) - 1);
+        rp->owner[sizeof(rp->owner) - 1] = '\0';
+        first = 1;
+    }
+    if (rp->owner[0] == '\0') {
+        st->malformed++;
+        return 0;
+    }
+    return apply_record(rp, t, st, add, tok + first, n - first);
+}
+
+/**
+ * @brief Reads a zone or update file, joining parenthesized continuations.
+ */
+static int parse_file(const char *path, DomainTrie *t, RpzStats *st, int update) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open RPZ file '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    RpzStats local;
+    memset(&local, 0, sizeof(local));
+    if (!st) st = &local;
+
+    RpzParser rp;
+    memset(&rp, 0, sizeof(rp));
+    rp.ttl = 300;
+    rp.update = update;
+
+    char buf[RPZ_LINE_MAX], logical[RPZ_LINE_MAX];
+    size_t llen = 0;
+    int depth = 0, rc = 0;
+    while (rc == 0 && fgets(buf, sizeof(buf), f)) {
+        char *semi = strchr(buf, ';');
+        if (semi) *semi = '\0';
+        buf[strcspn(buf, "\r\n")] = '\0';
+
+        for (char *p = buf; *p; p++) {
+            if (*p == '(') { depth++; *p = ' '; }
+            else if (*p == ')') { depth--; *p = ' '; }
+        }
+        size_t blen = strlen(buf);
+        if (llen + blen + 2 < sizeof(logical)) {
+            memcpy(logical + llen, buf, blen);
+            llen += blen;
+            logical[llen++] = ' ';
+        }
+        if (depth > 0) continue;
+
+        logical[llen] = '\0';
+        llen = 0;
+        depth = 0;
+        rc = parse_line(&rp, t, st, logical);
+    }
+
+    fclose(f);
+    if (rc < 0) fprintf(stderr, "Out of memory applying RPZ file '%s'\n", path);
+    return rc;
+}
+
+int rpz_load_file(const char *path, DomainTrie *t, RpzStats *st) {
+    return parse_file(path, t, st, 0);
+}
+
+int rpz_apply_update(const char *path, DomainTrie *t, RpzStats *st) {
+    return parse_file(path, t, st, 1);
+}
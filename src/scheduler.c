@@ -0,0 +1,121 @@
+/**
+ * @file scheduler.c
+ * @brief Miss queue and latency histograms for the two-class event loop.
+ */
+
+#include "scheduler.h"
+#include <stdlib.h>
+#ifdef __linux__
+#include <asm/socket.h>
+#endif
+
+int miss_queue_init(MissQueue *q) {
+    q->ring = malloc(SCHED_QUEUE * sizeof(SchedPacket));
+    q->head = q->count = q->peak = 0;
+    q->overflows = 0;
+    return q->ring ? 0 : -1;
+}
+
+void miss_queue_free(MissQueue *q) {
+    free(q->ring);
+    q->ring = NULL;
+    q->count = 0;
+}
+
+SchedPacket *miss_queue_reserve(MissQueue *q) {
+    if (q->count == SCHED_QUEUE) return NULL;
+    return &q->ring[(q->head + q->count) % SCHED_QUEUE];
+}
+
+void miss_queue_commit(MissQueue *q) {
+    q->count++;
+    if (q->count > q->peak) q->peak = q->count;
+}
+
+SchedPacket *miss_queue_pop(MissQueue *q) {
+    if (q->count == 0) return NULL;
+    SchedPacket *p = &q->ring[q->head];
+    q->head = (q->head + 1) % SCHED_QUEUE;
+    q->count--;
+    return p;
+}
+
+void busy_poll_init(BusyPoll *b, int enabled, double idle_limit_ms) {
+    b->enabled = enabled;
+    b->idle_limit_ms = idle_limit_ms;
+    b->idle_since_ms = -1;
+    b->polling = 0;
+    b->polls = b->empty_polls = b->sleeps = 0;
+}
+
+int busy_poll_socket(int sock, int usec) {
+    int rc = -1;
+#ifdef SO_BUSY_POLL
+    rc = setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+    if (rc < 0) perror("SO_BUSY_POLL");
+#else
+    (void)sock;
+    (void)usec;
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+    int one = 1;
+    if (rc == 0 && setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) < 0) {
+        perror("SO_PREFER_BUSY_POLL");
+        rc = -1;
+    }
+#endif
+    return rc;
+}
+
+int busy_poll_flags(BusyPoll *b, double now_ms) {
+    if (!b->enabled) return 0;
+    if (b->idle_since_ms >= 0 && now_ms - b->idle_since_ms >= b->idle_limit_ms) {
+        b->sleeps++;
+        b->polling = 0;
+        return 0;
+    }
+    b->polls++;
+    b->polling = 1;
+    return MSG_DONTWAIT;
+}
+
+void busy_poll_update(BusyPoll *b, int received, double now_ms) {
+    if (!b->enabled) return;
+    if (received) {
+        b->idle_since_ms = -1;
+    } else if (b->polling) {
+        b->empty_polls++;
+        if (b->idle_since_ms < 0) b->idle_since_ms = now_ms;
+    }
+}
+
+void latency_add(LatencyHistogram *h, double us) {
+    int b = 0;
+    for (double limit = 2; us >= limit && b < LATENCY_BUCKETS - 1; limit *= 2) b++;
+    h->count[b]++;
+    h->total++;
+    h->sum_us += us;
+    if (us > h->max_us) h->max_us = us;
+}
+
+double latency_quantile(const LatencyHistogram *h, double p) {
+    if (h->total == 0) return 0;
+    unsigned long want = (unsigned long)(p * h->total + 0.999999), seen = 0;
+    double upper = 2;
+    for (int b = 0; b < LATENCY_BUCKETS; b++, upper *= 2) {
+        seen += h->count[b];
+        if (seen >= want) return b < LATENCY_BUCKETS - 1 && upper < h->max_us ? upper : h->max_us;
+    }
+    return h->max_us;
+}
+
+void latency_print(const LatencyHistogram *h, const char *label, FILE *out) {
+    if (h->total == 0) {
+        fprintf(out, "%s: no queries\n", label);
+        return;
+    }
+    fprintf(out, "%s: %lu queries, mean %.0f us, p50 <= %.0f us, p90 <= %.0f us, "
+            "p99 <= %.0f us, max %.0f us\n", label, h->total, h->sum_us / h->total,
+            latency_quantile(h, 0.5), latency_quantile(h, 0.9), latency_quantile(h, 0.99),
+            h->max_us);
+}
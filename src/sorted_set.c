@@ -0,0 +1,333 @@
+/**
+ * @file sorted_set.c
+ * @brief Front-coded sorted array of reversed domain names.
+ *
+ * Each block is a run of entries `[shared][suffix length][suffix][flags]`,
+ * where `shared` is the number of leading bytes taken from the previous key
+ * (always 0 for the first key of a block) and `flags` packs the verdict for
+ * the name itself (low nibble) and for its subdomains (high nibble).
+ */
+
+#include "sorted_set.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define SORTED_MAX_KEY 255
+#define SORTED_MAX_LABEL 63
+
+/** @brief A key collected from the trie, before sorting. */
+typedef struct {
+    const unsigned char *key;  /**< Key bytes in the build arena. */
+    uint8_t len;               /**< Key length. */
+    uint8_t flags;             /**< Packed verdicts. */
+} SortedKey;
+
+/** @brief Position inside the encoded data, with the key decoded so far. */
+typedef struct {
+    size_t block;              /**< Current block. */
+    size_t pos;                /**< Offset of the next entry to decode. */
+    size_t end;                /**< End of the current block. */
+    int valid;                 /**< Zero once the cursor ran off the end. */
+    unsigned char key[SORTED_MAX_KEY];
+    size_t len;                /**< Length of @c key. */
+    uint8_t flags;             /**< Flags of @c key. */
+} SortedCursor;
+
+static int compare_keys(const unsigned char *a, size_t alen, const unsigned char *b, size_t blen) {
+    size_t n = alen < blen ? alen : blen;
+    int c = memcmp(a, b, n);
+    if (c != 0) return c;
+    return alen < blen ? -1 : alen > blen;
+}
+
+static int qsort_keys(const void *a, const void *b) {
+    const SortedKey *ka = a, *kb = b;
+    return compare_keys(ka->key, ka->len, kb->key, kb->len);
+}
+
+/**
+ * @brief Fills the Eytzinger array by an in-order walk of the implicit tree.
+ */
+static size_t fill_eytz(uint32_t *eytz, size_t n, size_t k, size_t next) {
+    if (k > n) return next;
+    next = fill_eytz(eytz, n, 2 * k, next);
+    eytz[k] = (uint32_t)next++;
+    return fill_eytz(eytz, n, 2 * k + 1, next);
+}
+
+/**
+ * @brief Encodes sorted keys into front-coded blocks.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int encode(SortedSet *s, const SortedKey *keys, size_t count, size_t bytes) {
+    s->count = count;
+    s->nblocks = (count + SORTED_SET_BLOCK - 1) / SORTED_SET_BLOCK;
+    s->data = malloc(bytes + 3 * count + 1);
+    s->block_off = malloc((s->nblocks + 1) * sizeof(uint32_t));
+    s->eytz = malloc((s->nblocks + 1) * sizeof(uint32_t));
+    s->eytz_off = malloc((s->nblocks + 1) * sizeof(uint32_t));
+    if (!s->data || !s->block_off || !s->eytz || !s->eytz_off) return -1;
+
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t shared = 0;
+        if (i % SORTED_SET_BLOCK == 0) {
+            s->block_off[i / SORTED_SET_BLOCK] = (uint32_t)pos;
+        } else {
+            const SortedKey *p = &keys[i - 1];
+            while (shared < p->len && shared < keys[i].len && p->key[shared] == keys[i].key[shared])
+                shared++;
+        }
+        size_t rest = keys[i].len - shared;
+        s->data[pos++] = (unsigned char)shared;
+        s->data[pos++] = (unsigned char)rest;
+        memcpy(s->data + pos, keys[i].key + shared, rest);
+        pos += rest;
+        s->data[pos++] = keys[i].flags;
+    }
+    s->data_len = pos;
+    s->block_off[s->nblocks] = (uint32_t)pos;
+    fill_eytz(s->eytz, s->nblocks, 1, 0);
+    for (size_t k = 1; k <= s->nblocks; k++) s->eytz_off[k] = s->block_off[s->eytz[k]];
+
+    unsigned char *shrunk = realloc(s->data, pos ? pos : 1);
+    if (shrunk) s->data = shrunk;
+    return 0;
+}
+
+/**
+ * @brief Returns the key length of a node: its name length, at most SORTED_MAX_KEY.
+ */
+static size_t key_length(const DomainTrie *t, uint32_t node) {
+    size_t len = 0;
+    for (; node != 0; node = t->nodes[node].parent)
+        len += t->nodes[node].label_len + (len > 0);
+    return len < SORTED_MAX_KEY ? len : SORTED_MAX_KEY;
+}
+
+SortedSet *sorted_set_build(const DomainTrie *t) {
+    SortedSet *s = calloc(1, sizeof(SortedSet));
+    SortedKey *keys = malloc((t->entries + 1) * sizeof(SortedKey));
+    unsigned char *arena = NULL;
+    size_t count = 0, bytes = 0;
+    if (!s || !keys) goto fail;
+
+    /* First pass: size the key arena and reject local data. */
+    for (uint32_t i = 1; i < t->node_count; i++) {
+        const TrieNode *n = &t->nodes[i];
+        if (n->verdict == DT_NONE && n->sub == DT_NONE) continue;
+        if (n->verdict == DT_LOCAL || n->sub == DT_LOCAL) {
+            fprintf(stderr, "Sorted matcher cannot hold RPZ local data\n");
+            goto fail;
+        }
+        bytes += key_length(t, i);
+    }
+    arena = malloc(bytes + 1);
+    if (!arena) goto fail;
+
+    bytes = 0;
+    for (uint32_t i = 1; i < t->node_count && count <= t->entries; i++) {
+        const TrieNode *n = &t->nodes[i];
+        if (n->verdict == DT_NONE && n->sub == DT_NONE) continue;
+
+        /* Collect the labels root-first by walking up, then emit them. */
+        uint32_t path[SORTED_MAX_KEY / 2 + 1];
+        size_t depth = 0;
+        for (uint32_t p = i; p != 0 && depth < sizeof(path) / sizeof(path[0]); p = t->nodes[p].parent)
+            path[depth++] = p;
+
+        unsigned char *key = arena + bytes;
+        size_t len = 0, max = key_length(t, i);
+        while (depth > 0) {
+            const TrieNode *l = &t->nodes[path[--depth]];
+            if (len + (len > 0) + l->label_len > max) break;
+            if (len > 0) key[len++] = SORTED_SET_SEP;
+            memcpy(key + len, t->labels + l->label_off, l->label_len);
+            len += l->label_len;
+        }
+        keys[count].key = key;
+        keys[count].len = (uint8_t)len;
+        keys[count].flags = (uint8_t)(n->verdict | (n->sub << 4));
+        count++;
+        bytes += len;
+    }
+
+    qsort(keys, count, sizeof(SortedKey), qsort_keys);
+    if (encode(s, keys, count, bytes) < 0) goto fail;
+    free(keys);
+    free(arena);
+    return s;
+
+fail:
+    free(keys);
+    free(arena);
+    sorted_set_free(s);
+    return NULL;
+}
+
+void sorted_set_free(SortedSet *s) {
+    if (!s) return;
+    free(s->data);
+    free(s->block_off);
+    free(s->eytz);
+    free(s->eytz_off);
+    free(s);
+}
+
+/**
+ * @brief Decodes the entry at the cursor and advances past it.
+ *
+ * Moves on to the next block when the current one is exhausted.
+ */
+static void cursor_next(const SortedSet *s, SortedCursor *c) {
+    if (c->pos >= c->end) {
+        if (++c->block >= s->nblocks) {
+            c->valid = 0;
+            return;
+        }
+        c->pos = s->block_off[c->block];
+        c->end = s->block_off[c->block + 1];
+    }
+    const unsigned char *d = s->data + c->pos;
+    size_t shared = d[0], rest = d[1];
+    memcpy(c->key + shared, d + 2, rest);
+    c->len = shared + rest;
+    c->flags = d[2 + rest];
+    c->pos += 3 + rest;
+}
+
+/**
+ * @brief Positions the cursor on the first key not less than @p key.
+ */
+static void seek(const SortedSet *s, const unsigned char *key, size_t len, SortedCursor *c) {
+    /* Eytzinger search for the first block whose head is greater than the key. */
+    size_t k = 1;
+    while (k <= s->nblocks) {
+        const unsigned char *h = s->data + s->eytz_off[k];
+        k = 2 * k + (compare_keys(h + 2, h[1], key, len) <= 0);
+    }
+    while (k & 1) k >>= 1;
+    k >>= 1;
+    size_t upper = k ? s->eytz[k] : s->nblocks;
+
+    c->valid = s->nblocks > 0;
+    if (!c->valid) return;
+    c->block = upper > 0 ? upper - 1 : 0;
+    c->pos = s->block_off[c->block];
+    c->end = s->block_off[c->block + 1];
+    cursor_next(s, c);
+
+    /*
+     * Scan the block keeping m, the prefix length the current key shares
+     * with the search key. A following key that shares more than m bytes
+     * with its predecessor is still smaller than the search key; one that
+     * shares fewer is already greater. Only ties need a byte comparison.
+     */
+    size_t m = 0;
+    for (;;) {
+        while (m < c->len && m < len && c->key[m] == key[m]) m++;
+        if (m == len || (m < c->len && c->key[m] > key[m])) return;
+        for (;;) {
+            if (c->pos >= c->end) {
+                cursor_next(s, c);  /* next block's head is greater by construction */
+                return;
+            }
+            size_t shared = s->data[c->pos];
+            cursor_next(s, c);
+            if (shared < m) return;
+            if (shared == m) break;
+        }
+    }
+}
+
+int sorted_set_match(const SortedSet *s, const char *name, TrieMatch *m) {
+    m->verdict = DT_NONE;
+    m->node = 0;
+    m->scope = DT_SCOPE_SELF;
+    if (!s) return DT_NONE;
+
+    size_t end = strlen(name);
+    if (end > 0 && name[end - 1] == '.') end--;
+
+    unsigned char key[SORTED_MAX_KEY];
+    size_t klen = 0;
+    SortedCursor c;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && name[start - 1] != '.') start--;
+        size_t len = end - start;
+        if (len == 0 || len > SORTED_MAX_LABEL || klen + len + 1 > SORTED_MAX_KEY) break;
+
+        if (klen > 0) key[klen++] = SORTED_SET_SEP;
+        for (size_t i = 0; i < len; i++)
+            key[klen++] = (unsigned char)tolower((unsigned char)name[start + i]);
+
+        seek(s, key, klen, &c);
+        if (!c.valid) break;
+
+        int last = start == 0;
+        int exact = c.len == klen && memcmp(c.key, key, klen) == 0;
+        if (exact) {
+            int v = last ? (c.flags & 0x0F) : (c.flags >> 4);
+            if (v != DT_NONE) {
+                m->verdict = v;
+                m->scope = last ? DT_SCOPE_SELF : DT_SCOPE_SUB;
+                if (v == DT_ALLOW) break;
+            }
+            if (last) break;
+            cursor_next(s, &c);
+        }
+        /* Stop once no listed key continues below this one. */
+        if (last || !c.valid || c.len <= klen || c.key[klen] != SORTED_SET_SEP ||
+            memcmp(c.key, key, klen) != 0)
+            break;
+        end = start - 1;
+    }
+    return m->verdict;
+}
+
+int sorted_set_name(const SortedSet *s, size_t i, char *buf, size_t cap) {
+    if (i >= s->count) return -1;
+    SortedCursor c;
+    c.block = i / SORTED_SET_BLOCK;
+    c.pos = s->block_off[c.block];
+    c.end = s->block_off[c.block + 1];
+    c.valid = 1;
+    for (size_t k = 0; k <= i % SORTED_SET_BLOCK; k++) cursor_next(s, &c);
+    if (c.len + 1 > cap) return -1;
+
+    /* Emit the labels of the key from last to first. */
+    size_t out = 0, end = c.len;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && c.key[start - 1] != SORTED_SET_SEP) start--;
+        if (out > 0) buf[out++] = '.';
+        memcpy(buf + out, c.key + start, end - start);
+        out += end - start;
+        end = start > 0 ? start - 1 : 0;
+    }
+    buf[out] = '\0';
+    return (int)out;
+}
+
+int sorted_set_foreach(const SortedSet *s, SortedSetVisit fn, void *ctx) {
+    SortedCursor c;
+    c.block = 0;
+    c.pos = c.end = 0;
+    c.valid = s->nblocks > 0;
+    if (c.valid) c.end = s->block_off[1];
+    for (size_t i = 0; i < s->count; i++) {
+        cursor_next(s, &c);
+        int rc = fn(c.key, c.len, c.flags & 0x0F, c.flags >> 4, ctx);
+        if (rc != 0) return rc;
+    }
+    return 0;
+}
+
+size_t sorted_set_memory(const SortedSet *s) {
+    if (!s) return 0;
+    return sizeof(SortedSet) + s->data_len + 3 * (s->nblocks + 1) * sizeof(uint32_t);
+}
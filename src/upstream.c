@@ -0,0 +1,542 @@
+/**
+ * @file upstream.c
+ * @brief Spoofing-resistant exchange with the upstream DNS server.
+ *
+ * An off-path attacker must guess the transaction ID, the source port and
+ * the casing of every letter in the QNAME to get a forged reply accepted.
+ * IDs, ports, pool slots and casing all come from one ChaCha20 keystream,
+ * and pooled sockets are replaced after UPSTREAM_PORT_USES queries so no
+ * port stays open long enough to be learned.
+ *
+ * Several servers share the pool and are used in turn. Each has a circuit
+ * breaker fed by client exchanges and by non-blocking probes, so a dead
+ * server leaves the rotation after a few failures instead of costing every
+ * query a full timeout.
+ *
+ * Exchanges do not block the caller: each query waits in a pending table
+ * and is found again by the socket and transaction ID its reply carries.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "upstream.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define BUF_SIZE 1500
+#define PORT_BIND_ATTEMPTS 8   /**< Random ports tried before letting the kernel pick. */
+
+#define ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTER(a, b, c, d) \
+    (a += b, d ^= a, d = ROTL(d, 16), c += d, b ^= c, b = ROTL(b, 12), \
+     a += b, d ^= a, d = ROTL(d, 8), c += d, b ^= c, b = ROTL(b, 7))
+
+/**
+ * @brief Computes the next ChaCha20 block (RFC 8439, zero nonce).
+ */
+static void chacha_block(UpstreamRng *r) {
+    uint32_t in[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+    memcpy(in + 4, r->key, sizeof(r->key));
+    in[12] = (uint32_t)r->counter;
+    in[13] = (uint32_t)(r->counter >> 32);
+    in[14] = in[15] = 0;
+
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        QUARTER(x[0], x[4], x[8], x[12]);
+        QUARTER(x[1], x[5], x[9], x[13]);
+        QUARTER(x[2], x[6], x[10], x[14]);
+        QUARTER(x[3], x[7], x[11], x[15]);
+        QUARTER(x[0], x[5], x[10], x[15]);
+        QUARTER(x[1], x[6], x[11], x[12]);
+        QUARTER(x[2], x[7], x[8], x[13]);
+        QUARTER(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++) r->block[i] = x[i] + in[i];
+    r->counter++;
+    r->used = 0;
+}
+
+int upstream_rng_seed(UpstreamRng *r) {
+    memset(r, 0, sizeof(*r));
+    int rc = -1;
+    FILE *f = fopen("/dev/urandom", "rb");
+    if (f) {
+        if (fread(r->key, 1, sizeof(r->key), f) == sizeof(r->key)) rc = 0;
+        fclose(f);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "No kernel randomness; upstream IDs and ports are predictable\n");
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        r->key[0] = (uint32_t)ts.tv_nsec;
+        r->key[1] = (uint32_t)ts.tv_sec;
+        r->key[2] = (uint32_t)getpid();
+    }
+    r->used = 16;
+    return rc;
+}
+
+uint32_t upstream_random(UpstreamRng *r) {
+    if (r->used == 16) chacha_block(r);
+    return r->block[r->used++];
+}
+
+void upstream_randomize_case(unsigned char *qname, int len, UpstreamRng *r) {
+    uint32_t bits = 0;
+    int left = 0;
+    for (int i = 0; i < len; i++) {
+        unsigned char ch = qname[i] | 0x20;
+        if (ch < 'a' || ch > 'z') continue; /* label lengths (<= 63) are never letters */
+        if (left == 0) {
+            bits = upstream_random(r);
+            left = 32;
+        }
+        qname[i] = (unsigned char)(bits & 1 ? ch & ~0x20 : ch);
+        bits >>= 1;
+        left--;
+    }
+}
+
+void upstream_health_defaults(UpstreamHealth *h) {
+    memset(h, 0, sizeof(*h));
+    strcpy(h->name, ".");
+    h->interval_ms = 1000;
+    h->timeout_ms = 500;
+    h->max_failures = 3;
+    h->cooldown_ms = 5000;
+}
+
+/**
+ * @brief Writes the probe query: an A question for the configured name.
+ *
+ * @return 0 on success, -1 if the name is not a valid domain name.
+ */
+static int build_probe(Upstream *u) {
+    unsigned char *q = u->probe;
+    memset(q, 0, 12);
+    q[2] = 0x01; /* RD */
+    q[5] = 1;
+    int p = 12;
+    const char *name = strcmp(u->health.name, ".") == 0 ? "" : u->health.name;
+    while (*name) {
+        size_t len = strcspn(name, ".");
+        if (len == 0 || len > 63 || p + 1 + (int)len > 12 + 254) return -1;
+        q[p++] = (unsigned char)len;
+        memcpy(q + p, name, len);
+        p += (int)len;
+        name += len;
+        if (*name == '.') name++;
+    }
+    q[p++] = 0;
+    q[p++] = 0;
+    q[p++] = 1; /* A */
+    q[p++] = 0;
+    q[p++] = 1; /* IN */
+    u->probe_len = p;
+    return 0;
+}
+
+int upstream_init(Upstream *u, const char *ips, int port, const UpstreamHealth *health) {
+    memset(u, 0, sizeof(*u));
+    for (int i = 0; i < UPSTREAM_POOL_SIZE; i++) u->socks[i] = -1;
+    u->probe_sock = -1;
+    if (health) u->health = *health;
+    else upstream_health_defaults(&u->health);
+    if (build_probe(u) < 0) {
+        fprintf(stderr, "Invalid health_check_name '%s'. Using '.'.\n", u->health.name);
+        strcpy(u->health.name, ".");
+        build_probe(u);
+    }
+
+    char list[1024];
+    strncpy(list, ips, sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+    char *save = NULL;
+    for (char *ip = strtok_r(list, ", \t", &save); ip; ip = strtok_r(NULL, ", \t", &save)) {
+        if (u->count == UPSTREAM_MAX_SERVERS) {
+            fprintf(stderr, "Only %d upstream servers are used; ignoring %s\n",
+                    UPSTREAM_MAX_SERVERS, ip);
+            continue;
+        }
+        UpstreamServer *srv = &u->servers[u->count];
+        srv->addr.sin_family = AF_INET;
+        srv->addr.sin_port = htons((uint16_t)port);
+        if (inet_pton(AF_INET, ip, &srv->addr.sin_addr) != 1) {
+            fprintf(stderr, "Invalid upstream IP: %s\n", ip);
+            return -1;
+        }
+        u->count++;
+    }
+    if (u->count == 0) {
+        fprintf(stderr, "No upstream server configured\n");
+        return -1;
+    }
+    upstream_rng_seed(&u->rng);
+    return 0;
+}
+
+void upstream_close(Upstream *u) {
+    for (int i = 0; i < UPSTREAM_POOL_SIZE; i++) {
+        if (u->socks[i] >= 0) close(u->socks[i]);
+        u->socks[i] = -1;
+    }
+    if (u->probe_sock >= 0) close(u->probe_sock);
+    u->probe_sock = -1;
+    memset(u->pending, 0, sizeof(u->pending));
+    memset(u->slot_in_flight, 0, sizeof(u->slot_in_flight));
+    u->in_flight = 0;
+    u->recv_slot = 0;
+}
+
+int upstream_available(const Upstream *u) {
+    int n = 0;
+    for (int i = 0; i < u->count; i++) n += u->servers[i].state == UPSTREAM_CLOSED;
+    return n;
+}
+
+/**
+ * @brief Opens a socket bound to a random unprivileged port.
+ *
+ * @return The socket, or -1 on error.
+ */
+static int open_random_port(Upstream *u) {
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) {
+        perror("upstream socket");
+        return -1;
+    }
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    for (int i = 0; i < PORT_BIND_ATTEMPTS; i++) {
+        local.sin_port = htons((uint16_t)(1024 + upstream_random(&u->rng) % (65536 - 1024)));
+        if (bind(s, (struct sockaddr *)&local, sizeof(local)) == 0) return s;
+    }
+    /* Ports are scarce: the kernel's ephemeral choice is still randomized. */
+    local.sin_port = 0;
+    if (bind(s, (struct sockaddr *)&local, sizeof(local)) == 0) return s;
+    perror("upstream bind");
+    close(s);
+    return -1;
+}
+
+/**
+ * @brief Returns the length of the query's QNAME, or -1 if it has no plain question
+ *        (or one too long to check).
+ */
+static int qname_length(const unsigned char *pkt, int len) {
+    if (len < 12 + 5 || pkt[4] != 0 || pkt[5] != 1) return -1;
+    int p = 12;
+    while (pkt[p] != 0) {
+        if (pkt[p] > 63) return -1;
+        p += 1 + pkt[p];
+        if (p >= len) return -1;
+    }
+    int qlen = p - 12 + 1;
+    return p + 1 + 4 <= len && qlen + 4 <= UPSTREAM_QUESTION_MAX ? qlen : -1;
+}
+
+static double monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Feeds one exchange or probe outcome to a server's breaker.
+ */
+static void server_result(Upstream *u, UpstreamServer *srv, int ok, double now_ms) {
+    char ip[INET_ADDRSTRLEN];
+    if (ok) {
+        if (srv->state != UPSTREAM_CLOSED)
+            fprintf(stderr, "Upstream %s back in rotation\n",
+                    inet_ntop(AF_INET, &srv->addr.sin_addr, ip, sizeof(ip)));
+        srv->state = UPSTREAM_CLOSED;
+        srv->failures = 0;
+        return;
+    }
+    srv->failures++;
+    if (srv->state == UPSTREAM_HALF_OPEN) {
+        srv->state = UPSTREAM_OPEN;
+        srv->opened_ms = now_ms;
+    } else if (srv->state == UPSTREAM_CLOSED && u->health.max_failures > 0 &&
+               srv->failures >= u->health.max_failures) {
+        srv->state = UPSTREAM_OPEN;
+        srv->opened_ms = now_ms;
+        srv->trips++;
+        fprintf(stderr, "Upstream %s out of rotation after %d consecutive failures\n",
+                inet_ntop(AF_INET, &srv->addr.sin_addr, ip, sizeof(ip)), srv->failures);
+    }
+}
+
+/**
+ * @brief Sends a probe to a server from the probe socket.
+ */
+static void send_probe(Upstream *u, UpstreamServer *srv, double now_ms) {
+    if (u->probe_sock < 0) u->probe_sock = open_random_port(u);
+    srv->probes++;
+    srv->probed_ms = now_ms;
+    srv->probe_id = (uint16_t)upstream_random(&u->rng);
+    u->probe[0] = (unsigned char)(srv->probe_id >> 8);
+    u->probe[1] = (unsigned char)srv->probe_id;
+    if (u->probe_sock < 0 || sendto(u->probe_sock, u->probe, (size_t)u->probe_len, 0,
+                                    (struct sockaddr *)&srv->addr, sizeof(srv->addr)) < 0) {
+        srv->probe_failures++;
+        server_result(u, srv, 0, now_ms);
+        return;
+    }
+    srv->probing = 1;
+}
+
+void upstream_health_check(Upstream *u, double now_ms) {
+    /* Replies first, so one that is merely late is not counted as lost. */
+    unsigned char resp[BUF_SIZE];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t n;
+    while (u->probe_sock >= 0 &&
+           (n = recvfrom(u->probe_sock, resp, sizeof(resp), MSG_DONTWAIT,
+                         (struct sockaddr *)&from, &from_len)) >= 0) {
+        from_len = sizeof(from);
+        for (int i = 0; i < u->count; i++) {
+            UpstreamServer *srv = &u->servers[i];
+            if (!srv->probing || from.sin_addr.s_addr != srv->addr.sin_addr.s_addr ||
+                from.sin_port != srv->addr.sin_port || n < 12 ||
+                resp[0] != (unsigned char)(srv->probe_id >> 8) ||
+                resp[1] != (unsigned char)srv->probe_id)
+                continue;
+            /* Any answer will do, but SERVFAIL or REFUSED means it cannot resolve. */
+            int rcode = resp[3] & 0x0F;
+            int ok = (resp[2] & 0x80) && rcode != 2 && rcode != 5;
+            srv->probing = 0;
+            if (!ok) srv->probe_failures++;
+            server_result(u, srv, ok, now_ms);
+            break;
+        }
+    }
+
+    for (int i = 0; i < u->count; i++) {
+        UpstreamServer *srv = &u->servers[i];
+        if (srv->probing) {
+            if (now_ms - srv->probed_ms < u->health.timeout_ms) continue;
+            srv->probing = 0;
+            srv->probe_failures++;
+            server_result(u, srv, 0, now_ms);
+        }
+        if (srv->state == UPSTREAM_OPEN && now_ms - srv->opened_ms >= u->health.cooldown_ms) {
+            srv->state = UPSTREAM_HALF_OPEN;
+            send_probe(u, srv, now_ms);
+        } else if (srv->state == UPSTREAM_CLOSED && u->health.interval_ms > 0 &&
+                   now_ms - srv->probed_ms >= u->health.interval_ms) {
+            send_probe(u, srv, now_ms);
+        }
+    }
+}
+
+int upstream_send(Upstream *u, const unsigned char *query, int len, double now_ms) {
+    unsigned char out[BUF_SIZE];
+    if (len < 12 || len > (int)sizeof(out)) return -1;
+
+    UpstreamServer *srv = NULL;
+    for (int i = 0; i < u->count && !srv; i++) {
+        UpstreamServer *c = &u->servers[u->next++ % (unsigned)u->count];
+        if (c->state == UPSTREAM_CLOSED) srv = c;
+    }
+    if (!srv) {
+        u->stats.unavailable++;
+        return -1;
+    }
+    int h = 0;
+    while (h < UPSTREAM_MAX_PENDING && u->pending[h].active) h++;
+    if (h == UPSTREAM_MAX_PENDING) return -1;
+
+    /* A worn-out port still awaited by an exchange is skipped until it is idle. */
+    int slot = -1;
+    for (int i = 0; i < UPSTREAM_POOL_SIZE && slot < 0; i++) {
+        int c = (int)(upstream_random(&u->rng) % UPSTREAM_POOL_SIZE);
+        if (u->socks[c] >= 0 && u->uses[c] >= UPSTREAM_PORT_USES) {
+            if (u->slot_in_flight[c] > 0) continue;
+            close(u->socks[c]);
+            u->socks[c] = -1;
+            u->stats.port_rotations++;
+        }
+        slot = c;
+    }
+    if (slot < 0) slot = (int)(upstream_random(&u->rng) % UPSTREAM_POOL_SIZE);
+    if (u->socks[slot] < 0) {
+        u->socks[slot] = open_random_port(u);
+        u->uses[slot] = 0;
+        if (u->socks[slot] < 0) return -1;
+    }
+    u->uses[slot]++;
+
+    /* IDs are unique per socket, so a reply names exactly one exchange. */
+    UpstreamPending *e = &u->pending[h];
+    int taken;
+    do {
+        e->id = (uint16_t)upstream_random(&u->rng);
+        taken = 0;
+        for (int i = 0; i < UPSTREAM_MAX_PENDING && !taken; i++)
+            taken = u->pending[i].active && u->pending[i].slot == slot && u->pending[i].id == e->id;
+    } while (taken);
+
+    /* Question checks apply only to queries with one plain question. */
+    memcpy(out, query, (size_t)len);
+    out[0] = (unsigned char)(e->id >> 8);
+    out[1] = (unsigned char)e->id;
+    e->qlen = qname_length(query, len);
+    if (e->qlen > 0) {
+        upstream_randomize_case(out + 12, e->qlen, &u->rng);
+        memcpy(e->question, out + 12, (size_t)e->qlen + 4);
+        memcpy(e->qname, query + 12, (size_t)e->qlen);
+    }
+
+    if (sendto(u->socks[slot], out, (size_t)len, 0, (struct sockaddr *)&srv->addr,
+               sizeof(srv->addr)) < 0) {
+        perror("sendto upstream");
+        server_result(u, srv, 0, now_ms);
+        return -1;
+    }
+    u->stats.queries++;
+    e->active = 1;
+    e->slot = slot;
+    e->server = (int)(srv - u->servers);
+    e->client_id[0] = query[0];
+    e->client_id[1] = query[1];
+    e->rejects = 0;
+    e->sent_ms = now_ms;
+    u->in_flight++;
+    u->slot_in_flight[slot]++;
+    return h;
+}
+
+/**
+ * @brief Ends an exchange.
+ */
+static void finish(Upstream *u, UpstreamPending *e) {
+    e->active = 0;
+    u->in_flight--;
+    u->slot_in_flight[e->slot]--;
+}
+
+/**
+ * @brief Checks a reply that arrived on a pool socket.
+ *
+ * @return Handle of the exchange the reply is accepted for, or -1 if it
+ *         was rejected.
+ */
+static int match_reply(Upstream *u, int slot, const struct sockaddr_in *from,
+                       unsigned char *resp, int n, double now_ms) {
+    UpstreamPending *hit = NULL;
+    int known_source = 0;
+    for (int h = 0; h < UPSTREAM_MAX_PENDING && !hit; h++) {
+        UpstreamPending *e = &u->pending[h];
+        const struct sockaddr_in *addr = &u->servers[e->server].addr;
+        if (!e->active || e->slot != slot || e->rejects > UPSTREAM_MAX_REJECTS ||
+            from->sin_addr.s_addr != addr->sin_addr.s_addr || from->sin_port != addr->sin_port)
+            continue;
+        known_source = 1;
+        if (n >= 12 && resp[0] == (unsigned char)(e->id >> 8) && resp[1] == (unsigned char)e->id)
+            hit = e;
+    }
+
+    if (!known_source) {
+        u->stats.bad_source++;
+    } else if (!hit) {
+        u->stats.bad_id++;
+    } else if (hit->qlen > 0 && (n < 12 + hit->qlen + 4 || resp[4] != 0 || resp[5] != 1 ||
+                                 memcmp(resp + 12, hit->question, (size_t)hit->qlen + 4) != 0)) {
+        u->stats.bad_question++;
+    } else {
+        resp[0] = hit->client_id[0];
+        resp[1] = hit->client_id[1];
+        if (hit->qlen > 0) memcpy(resp + 12, hit->qname, (size_t)hit->qlen);
+        u->stats.answered++;
+        server_result(u, &u->servers[hit->server], 1, now_ms);
+        finish(u, hit);
+        return (int)(hit - u->pending);
+    }
+    for (int h = 0; h < UPSTREAM_MAX_PENDING; h++)
+        if (u->pending[h].active && u->pending[h].slot == slot) u->pending[h].rejects++;
+    return -1;
+}
+
+int upstream_receive(Upstream *u, double now_ms, unsigned char *resp, int resp_cap,
+                     int *resp_len) {
+    /* Resumes at the socket that produced the last reply, so each is read dry once. */
+    for (; u->recv_slot < UPSTREAM_POOL_SIZE; u->recv_slot++) {
+        int slot = u->recv_slot;
+        if (u->slot_in_flight[slot] == 0) continue;
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n;
+        while ((n = recvfrom(u->socks[slot], resp, (size_t)resp_cap, MSG_DONTWAIT,
+                             (struct sockaddr *)&from, &from_len)) >= 0) {
+            from_len = sizeof(from);
+            int h = match_reply(u, slot, &from, resp, (int)n, now_ms);
+            if (h >= 0) {
+                *resp_len = (int)n;
+                return h;
+            }
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            perror("recvfrom upstream");
+    }
+    u->recv_slot = 0;
+
+    for (int h = 0; h < UPSTREAM_MAX_PENDING; h++) {
+        UpstreamPending *e = &u->pending[h];
+        if (!e->active) continue;
+        if (e->rejects > UPSTREAM_MAX_REJECTS) {
+            /* Forgeries say nothing about the server: leave its breaker alone. */
+            u->stats.reject_limit++;
+            fprintf(stderr, "Too many rejected upstream replies\n");
+        } else if (now_ms - e->sent_ms >= UPSTREAM_TIMEOUT_MS) {
+            u->stats.timeouts++;
+            server_result(u, &u->servers[e->server], 0, now_ms);
+            fprintf(stderr, "No valid upstream reply\n");
+        } else {
+            continue;
+        }
+        finish(u, e);
+        *resp_len = -1;
+        return h;
+    }
+    return -1;
+}
+
+int upstream_poll_fds(const Upstream *u, struct pollfd *fds) {
+    int n = 0;
+    for (int i = 0; i < UPSTREAM_POOL_SIZE; i++) {
+        if (u->slot_in_flight[i] == 0) continue;
+        fds[n].fd = u->socks[i];
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        n++;
+    }
+    return n;
+}
+
+int upstream_exchange(Upstream *u, const unsigned char *query, int len, unsigned char *resp,
+                      int resp_cap) {
+    int h = upstream_send(u, query, len, monotonic_ms());
+    if (h < 0) return -1;
+    for (;;) {
+        int rlen;
+        int done = upstream_receive(u, monotonic_ms(), resp, resp_cap, &rlen);
+        if (done == h) return rlen;
+        if (done >= 0) continue;
+        const UpstreamPending *e = &u->pending[h];
+        int wait = (int)(e->sent_ms + UPSTREAM_TIMEOUT_MS - monotonic_ms()) + 1;
+        struct pollfd pfd = { u->socks[e->slot], POLLIN, 0 };
+        if (wait > 0) poll(&pfd, 1, wait);
+    }
+}
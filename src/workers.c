@@ -0,0 +1,215 @@
+/**
+ * @file workers.c
+ * @brief Worker processes pinned to CPUs, with per-CPU listening sockets.
+ *
+ * CPU affinity needs the GNU scheduling extensions; the NUMA node of a
+ * CPU is read from sysfs, so no NUMA library is required. Steering uses
+ * classic BPF (SO_ATTACH_REUSEPORT_CBPF), which any user may attach,
+ * rather than an eBPF program that would need CAP_BPF and a loader.
+ */
+
+#define _GNU_SOURCE
+
+#include "workers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
+#define STEER_MULT 0x9E3779B1u  /**< Multiplicative hash constant (golden ratio). */
+#define STEER_FOLD 0x20202020u  /**< Sets bit 5 of every byte: ASCII case folding. */
+
+int worker_cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *d = opendir(path);
+    if (!d) return -1;
+    int node = -1;
+    struct dirent *e;
+    while (node < 0 && (e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9')
+            node = atoi(e->d_name + 4);
+    }
+    closedir(d);
+    return node;
+}
+
+/**
+ * @brief Returns the @p i-th CPU (modulo the count) of an affinity set.
+ */
+static int nth_cpu(const cpu_set_t *set, int i) {
+    int n = CPU_COUNT(set);
+    if (n == 0) return -1;
+    i %= n;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, set) && i-- == 0) return cpu;
+    }
+    return -1;
+}
+
+/**
+ * @brief Pins the calling process to @p w->cpu and records its node.
+ */
+static void pin_self(Workers *w) {
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(w->cpu, &one);
+    if (sched_setaffinity(0, sizeof(one), &one) < 0) {
+        perror("sched_setaffinity");
+        w->cpu = -1;
+        return;
+    }
+    w->node = worker_cpu_node(w->cpu);
+}
+
+int workers_start(Workers *w, int count, int pin) {
+    memset(w, 0, sizeof(*w));
+    w->cpu = w->node = -1;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        perror("sched_getaffinity");
+        pin = 0;
+        if (count <= 0) count = 1;
+    }
+    if (count <= 0) count = CPU_COUNT(&allowed);
+    if (count > WORKERS_MAX) {
+        fprintf(stderr, "At most %d workers; using %d\n", WORKERS_MAX, WORKERS_MAX);
+        count = WORKERS_MAX;
+    }
+    w->count = count;
+
+    for (int i = 1; i < count; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            w->count = i;
+            workers_signal(w, SIGTERM);
+            workers_wait(w);
+            return -1;
+        }
+        if (pid == 0) {
+            w->index = i;
+            memset(w->pids, 0, sizeof(w->pids));
+            break;
+        }
+        w->pids[i] = pid;
+    }
+
+    if (pin) {
+        w->cpu = nth_cpu(&allowed, w->index);
+        if (w->cpu >= 0) pin_self(w);
+    }
+    return 0;
+}
+
+int worker_socket(int port, int reuseport, int cpu) {
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) {
+        perror("socket");
+        return -1;
+    }
+    int one = 1;
+    if (reuseport && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("SO_REUSEPORT");
+        close(s);
+        return -1;
+    }
+#ifdef SO_INCOMING_CPU
+    /* Best effort: only a preference in the kernel's socket selection. */
+    if (cpu >= 0) setsockopt(s, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+#else
+    (void)cpu;
+#endif
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind failed");
+        if (errno == EACCES) fprintf(stderr, "Try sudo if port < 1024\n");
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+int worker_steer(int sock, int workers, SteerMode mode) {
+    if (mode == STEER_KERNEL || workers < 2) return 0;
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_NET_OFF)
+    /* The program sees the UDP payload; the IPv4 header is at SKF_NET_OFF. */
+    struct sock_filter qname[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 12 + 1 + 16, 0, 18), /* short: to tail[0] */
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 13),
+        BPF_STMT(BPF_ALU | BPF_OR | BPF_K, STEER_FOLD),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, STEER_MULT),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 17),
+        BPF_STMT(BPF_ALU | BPF_OR | BPF_K, STEER_FOLD),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, STEER_MULT),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 21),
+        BPF_STMT(BPF_ALU | BPF_OR | BPF_K, STEER_FOLD),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, STEER_MULT),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 25),
+        BPF_STMT(BPF_ALU | BPF_OR | BPF_K, STEER_FOLD),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_JMP | BPF_JA, 1),                           /* to tail[1] */
+    };
+    struct sock_filter tail[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)SKF_NET_OFF + 12),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, STEER_MULT),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)workers),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    /* QNAME mode jumps past the client-IP load into the shared tail. */
+    struct sock_filter prog[sizeof(qname) / sizeof(qname[0]) + sizeof(tail) / sizeof(tail[0])];
+    size_t n = 0;
+    if (mode == STEER_QNAME) {
+        memcpy(prog, qname, sizeof(qname));
+        n = sizeof(qname) / sizeof(qname[0]);
+    }
+    memcpy(prog + n, tail, sizeof(tail));
+    n += sizeof(tail) / sizeof(tail[0]);
+
+    struct sock_fprog fprog = { (unsigned short)n, prog };
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog)) == 0)
+        return 0;
+    perror("SO_ATTACH_REUSEPORT_CBPF");
+#else
+    (void)sock;
+#endif
+    fprintf(stderr, "Reuseport steering unavailable; using the kernel's hash\n");
+    return -1;
+}
+
+void workers_signal(const Workers *w, int sig) {
+    for (int i = 1; i < w->count; i++) {
+        if (w->pids[i] > 0) kill(w->pids[i], sig);
+    }
+}
+
+void workers_wait(Workers *w) {
+    for (int i = 1; i < w->count; i++) {
+        if (w->pids[i] > 0) waitpid(w->pids[i], NULL, 0);
+        w->pids[i] = 0;
+    }
+}
@@ -0,0 +1,403 @@
+/**
+ * @file xdp.c
+ * @brief AF_XDP datapath answering DNS queries straight from the NIC queue.
+ *
+ * Uses only the kernel's own interfaces: the redirecting program is a
+ * handful of hand-assembled eBPF instructions loaded with the bpf()
+ * system call and attached through a BPF link, so neither libbpf nor
+ * libxdp is needed. Frames are received into a UMEM in copy mode (any
+ * driver, or generic mode on veth) or zero-copy when the driver offers it.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "xdp.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#define XDP_TTL 64             /**< TTL of answers. */
+#define XDP_MAX_PAYLOAD 1472   /**< Largest answer in a 1500-byte MTU frame. */
+
+/** @brief One eBPF instruction. */
+#define INSN(code, dst, src, off, imm) { (code), (dst), (src), (off), (imm) }
+
+/**
+ * @brief Internet checksum of @p len bytes (even length).
+ */
+static uint16_t checksum(const unsigned char *p, size_t len) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2) sum += (uint32_t)(p[i] << 8 | p[i + 1]);
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+int xdp_parse(const unsigned char *frame, size_t len, uint16_t port, struct sockaddr_in *client,
+              size_t *dns_len) {
+    if (len < XDP_HEADERS + 12 || frame[12] != 0x08 || frame[13] != 0x00) return -1;
+    const unsigned char *ip = frame + 14;
+    /* IPv4 without options, UDP, not a fragment. */
+    if (ip[0] != 0x45 || ip[9] != IPPROTO_UDP || (ip[6] & 0x3f) || ip[7]) return -1;
+    size_t total = (size_t)(ip[2] << 8 | ip[3]);
+    if (total < 28 || 14 + total > len || checksum(ip, 20) != 0) return -1;
+    const unsigned char *udp = ip + 20;
+    size_t udp_len = (size_t)(udp[4] << 8 | udp[5]);
+    if ((udp[2] << 8 | udp[3]) != port || udp_len < 8 + 12 || udp_len > total - 20) return -1;
+
+    memset(client, 0, sizeof(*client));
+    client->sin_family = AF_INET;
+    memcpy(&client->sin_addr.s_addr, ip + 12, 4);
+    memcpy(&client->sin_port, udp, 2);
+    *dns_len = udp_len - 8;
+    return 0;
+}
+
+/**
+ * @brief Swaps two equally long byte ranges.
+ */
+static void swap_bytes(unsigned char *a, unsigned char *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned char t = a[i];
+        a[i] = b[i];
+        b[i] = t;
+    }
+}
+
+int xdp_build_reply(unsigned char *frame, size_t cap, const unsigned char *reply,
+                    size_t reply_len) {
+    if (reply_len > XDP_MAX_PAYLOAD || XDP_HEADERS + reply_len > cap) return -1;
+    swap_bytes(frame, frame + 6, 6);
+
+    unsigned char *ip = frame + 14;
+    size_t total = 28 + reply_len;
+    swap_bytes(ip + 12, ip + 16, 4);
+    ip[2] = (unsigned char)(total >> 8);
+    ip[3] = (unsigned char)total;
+    ip[6] = 0x40; /* DF */
+    ip[7] = 0;
+    ip[8] = XDP_TTL;
+    ip[10] = ip[11] = 0;
+    uint16_t sum = checksum(ip, 20);
+    ip[10] = (unsigned char)(sum >> 8);
+    ip[11] = (unsigned char)sum;
+
+    unsigned char *udp = ip + 20;
+    swap_bytes(udp, udp + 2, 2);
+    udp[4] = (unsigned char)((8 + reply_len) >> 8);
+    udp[5] = (unsigned char)(8 + reply_len);
+    udp[6] = udp[7] = 0;
+    memcpy(udp + 8, reply, reply_len);
+    return (int)(XDP_HEADERS + reply_len);
+}
+
+/**
+ * @brief The bpf() system call, which glibc does not wrap.
+ */
+static int sys_bpf(int cmd, union bpf_attr *attr) {
+    return (int)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * @brief Loads the program redirecting IPv4 UDP to @p port into the XSKMAP.
+ *
+ * Anything else, and any queue without a socket in the map, gets XDP_PASS.
+ *
+ * @return Program fd, or -1.
+ */
+static int load_program(int map_fd, uint16_t port) {
+    /* Packet fields are loaded as stored: compare against network-order constants. */
+    int32_t eth_ip = htons(0x0800), frag = htons(0x3fff), dport = htons(port);
+    struct bpf_insn prog[] = {
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),             /* r6 = ctx */
+        INSN(BPF_LDX | BPF_MEM | BPF_W, 2, 1, 0, 0),               /* r2 = data */
+        INSN(BPF_LDX | BPF_MEM | BPF_W, 3, 1, 4, 0),               /* r3 = data_end */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, XDP_HEADERS),
+        INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 17, 0),              /* too short */
+        INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 15, eth_ip),         /* not IPv4 */
+        INSN(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 14, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 13, 0x45),           /* IP options */
+        INSN(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 23, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 11, IPPROTO_UDP),
+        INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 20, 0),
+        INSN(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, frag),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 8, 0),               /* fragment */
+        INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 36, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 6, dport),           /* other port */
+        INSN(BPF_LDX | BPF_MEM | BPF_W, 2, 6, 16, 0),              /* r2 = rx_queue_index */
+        INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+        INSN(0, 0, 0, 0, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),      /* if no socket */
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),      /* pass: */
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+    char log[4096] = "";
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+    attr.log_buf = (uint64_t)(uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    int fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (fd < 0) {
+        perror("XDP program load");
+        if (log[0]) fprintf(stderr, "%s", log);
+    }
+    return fd;
+}
+
+/**
+ * @brief Maps one ring of @p size entries of @p entry bytes.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int map_ring(int fd, XdpRing *r, const struct xdp_ring_offset *off,
+                    uint64_t pgoff, uint32_t size, size_t entry) {
+    r->size = size;
+    r->map_len = off->desc + size * entry;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                  (off_t)pgoff);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        perror("mmap XDP ring");
+        return -1;
+    }
+    unsigned char *base = r->map;
+    r->producer = (uint32_t *)(base + off->producer);
+    r->consumer = (uint32_t *)(base + off->consumer);
+    r->flags = (uint32_t *)(base + off->flags);
+    r->desc = base + off->desc;
+    return 0;
+}
+
+/**
+ * @brief Hands a frame (by any address inside it) to the kernel for receiving.
+ *
+ * The fill ring has room for every frame, so it cannot overflow.
+ */
+static void fill_push(XdpPath *x, uint64_t addr) {
+    uint32_t prod = *x->fill.producer;
+    ((uint64_t *)x->fill.desc)[prod & (x->fill.size - 1)] = addr & ~(uint64_t)(XDP_FRAME_SIZE - 1);
+    __atomic_store_n(x->fill.producer, prod + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Returns frames the kernel has finished sending to the fill ring.
+ */
+static void reap_completions(XdpPath *x) {
+    uint32_t cons = *x->comp.consumer;
+    uint32_t prod = __atomic_load_n(x->comp.producer, __ATOMIC_ACQUIRE);
+    for (; cons != prod; cons++) fill_push(x, ((uint64_t *)x->comp.desc)[cons & (x->comp.size - 1)]);
+    __atomic_store_n(x->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+int xdp_open(XdpPath *x, const char *ifname, int queue, uint16_t port, int native) {
+    memset(x, 0, sizeof(*x));
+    x->fd = x->map_fd = x->prog_fd = x->link_fd = -1;
+    x->queue = queue;
+    unsigned ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) {
+        fprintf(stderr, "XDP: unknown interface '%s'\n", ifname);
+        return -1;
+    }
+
+    x->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (x->fd < 0) {
+        perror("AF_XDP socket");
+        return -1;
+    }
+    x->umem = mmap(NULL, (size_t)XDP_FRAMES * XDP_FRAME_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (x->umem == MAP_FAILED) {
+        x->umem = NULL;
+        perror("mmap UMEM");
+        xdp_close(x);
+        return -1;
+    }
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(uintptr_t)x->umem;
+    reg.len = (uint64_t)XDP_FRAMES * XDP_FRAME_SIZE;
+    reg.chunk_size = XDP_FRAME_SIZE;
+    int fill_size = XDP_FRAMES, ring_size = XDP_RING;
+    struct xdp_mmap_offsets off;
+    socklen_t off_len = sizeof(off);
+    if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size, sizeof(fill_size)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len) < 0) {
+        perror("AF_XDP setup");
+        xdp_close(x);
+        return -1;
+    }
+    if (map_ring(x->fd, &x->fill, &off.fr, XDP_UMEM_PGOFF_FILL_RING,
+                 XDP_FRAMES, sizeof(uint64_t)) < 0 ||
+        map_ring(x->fd, &x->comp, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, XDP_RING,
+                 sizeof(uint64_t)) < 0 ||
+        map_ring(x->fd, &x->rx, &off.rx, XDP_PGOFF_RX_RING, XDP_RING,
+                 sizeof(struct xdp_desc)) < 0 ||
+        map_ring(x->fd, &x->tx, &off.tx, XDP_PGOFF_TX_RING, XDP_RING,
+                 sizeof(struct xdp_desc)) < 0) {
+        xdp_close(x);
+        return -1;
+    }
+    for (uint64_t i = 0; i < XDP_FRAMES; i++) fill_push(x, i * XDP_FRAME_SIZE);
+
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = (uint32_t)queue;
+    sxdp.sxdp_flags = native ? 0 : XDP_COPY;
+    if (bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        perror("AF_XDP bind");
+        xdp_close(x);
+        return -1;
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = (uint32_t)queue + 1;
+    x->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (x->map_fd < 0) {
+        perror("XSKMAP create");
+        xdp_close(x);
+        return -1;
+    }
+    uint32_t key = (uint32_t)queue, value = (uint32_t)x->fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t)x->map_fd;
+    attr.key = (uint64_t)(uintptr_t)&key;
+    attr.value = (uint64_t)(uintptr_t)&value;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+        perror("XSKMAP update");
+        xdp_close(x);
+        return -1;
+    }
+
+    x->prog_fd = load_program(x->map_fd, port);
+    if (x->prog_fd < 0) {
+        xdp_close(x);
+        return -1;
+    }
+    /* A link detaches by itself when the process exits, however it exits. */
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = (uint32_t)x->prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = native ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+    x->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+    if (x->link_fd < 0) {
+        perror("XDP attach");
+        xdp_close(x);
+        return -1;
+    }
+    return 0;
+}
+
+int xdp_next(XdpPath *x, uint16_t port, XdpQuery *q) {
+    for (;;) {
+        uint32_t cons = *x->rx.consumer;
+        if (cons == __atomic_load_n(x->rx.producer, __ATOMIC_ACQUIRE)) return 0;
+        const struct xdp_desc *d = (const struct xdp_desc *)x->rx.desc + (cons & (x->rx.size - 1));
+        uint64_t addr = d->addr;
+        uint32_t len = d->len;
+        __atomic_store_n(x->rx.consumer, cons + 1, __ATOMIC_RELEASE);
+        x->stats.received++;
+
+        unsigned char *frame = x->umem + addr;
+        if (xdp_parse(frame, len, port, &q->client, &q->len) < 0) {
+            x->stats.malformed++;
+            fill_push(x, addr);
+            continue;
+        }
+        q->addr = addr;
+        q->frame = frame;
+        q->frame_len = len;
+        q->data = frame + XDP_HEADERS;
+        return 1;
+    }
+}
+
+void xdp_release(XdpPath *x, XdpQuery *q) {
+    x->stats.passed++;
+    fill_push(x, q->addr);
+}
+
+int xdp_reply(XdpPath *x, XdpQuery *q, const unsigned char *reply, size_t reply_len) {
+    size_t cap = XDP_FRAME_SIZE - (size_t)(q->addr & (XDP_FRAME_SIZE - 1));
+    int n = xdp_build_reply(q->frame, cap, reply, reply_len);
+    uint32_t prod = *x->tx.producer;
+    if (n >= 0 && prod - __atomic_load_n(x->tx.consumer, __ATOMIC_ACQUIRE) >= x->tx.size) {
+        xdp_flush(x);
+        if (prod - __atomic_load_n(x->tx.consumer, __ATOMIC_ACQUIRE) >= x->tx.size) {
+            x->stats.tx_full++;
+            n = -1;
+        }
+    }
+    if (n < 0) {
+        fill_push(x, q->addr);
+        return -1;
+    }
+    struct xdp_desc *d = (struct xdp_desc *)x->tx.desc + (prod & (x->tx.size - 1));
+    d->addr = q->addr;
+    d->len = (uint32_t)n;
+    d->options = 0;
+    __atomic_store_n(x->tx.producer, prod + 1, __ATOMIC_RELEASE);
+    x->tx_pending++;
+    x->stats.answered++;
+    return 0;
+}
+
+void xdp_flush(XdpPath *x) {
+    if (x->tx_pending) {
+        /* Copy mode transmits from this call; EAGAIN/EBUSY only mean "try later". */
+        if (sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN &&
+            errno != EBUSY && errno != ENOBUFS)
+            perror("AF_XDP send");
+        x->tx_pending = 0;
+    }
+    reap_completions(x);
+}
+
+/**
+ * @brief Unmaps one ring (if mapped).
+ */
+static void unmap_ring(XdpRing *r) {
+    if (r->map) munmap(r->map, r->map_len);
+    r->map = NULL;
+}
+
+void xdp_close(XdpPath *x) {
+    if (x->link_fd >= 0) close(x->link_fd);
+    if (x->prog_fd >= 0) close(x->prog_fd);
+    if (x->map_fd >= 0) close(x->map_fd);
+    unmap_ring(&x->fill);
+    unmap_ring(&x->comp);
+    unmap_ring(&x->rx);
+    unmap_ring(&x->tx);
+    if (x->fd >= 0) close(x->fd);
+    if (x->umem) munmap(x->umem, (size_t)XDP_FRAMES * XDP_FRAME_SIZE);
+    x->fd = x->map_fd = x->prog_fd = x->link_fd = -1;
+    x->umem = NULL;
+}
@@ -18,13 +18,31 @@
  * ```
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
 
 #include "../include/dns_utils.h"
 #include "../include/config.h"
+#include "../include/rpz.h"
+#include "../include/list_loader.h"
+#include "../include/louds.h"
+#include "../include/cache.h"
+#include "../include/upstream.h"
+#include "../include/admission.h"
+#include "../include/scheduler.h"
+#include "../include/workers.h"
+#include "../include/netopt.h"
+#include "../include/xdp.h"
+#include "../include/dedup.h"
 
 /**
  * @brief Main function running all unit tests.
@@ -33,11 +51,39 @@
  *  - **Blacklist check**: ensures domains are correctly detected.
  *  - **Fake A record response**: verifies that the proxy builds a valid fake response.
  *  - **NXDOMAIN and REFUSED responses**: checks correct RCODE handling.
+ *  - **Domain trie**: verifies suffix matching and allowlist precedence.
+ *  - **Client groups**: verifies CIDR longest-prefix group selection.
+ *  - **Pattern rules**: verifies regex and glob matching through the anchored and floating DFAs.
+ *  - **RPZ**: verifies zone actions, local data and incremental updates.
+ *  - **Load statistics**: verifies list-file parsing and duplicate counting.
+ *  - **Parallel loading**: verifies trie merging and multi-threaded list loads.
+ *  - **Sorted matcher**: verifies the front-coded set against the trie.
+ *  - **LOUDS matcher**: verifies the succinct trie and its mapped image.
+ *  - **Matcher interface**: verifies every backend, by dotted and wire name.
+ *  - **Fast query parser**: verifies shape detection and the decoded question.
+ *  - **Response cache**: verifies cacheability, TTL aging and snapshots.
+ *  - **Shared cache**: verifies two attachments see each other's answers.
+ *  - **Cache key folding**: verifies case-insensitive hits keep the client's casing.
+ *  - **Upstream anti-spoofing**: verifies the CSPRNG, 0x20 casing and reply checks.
+ *  - **Admission control**: verifies overload detection and shedding with hysteresis.
+ *  - **Scheduler**: verifies the miss queue and latency histograms.
+ *  - **Workers**: verifies pinned worker processes and SO_REUSEPORT sockets.
+ *  - **Reuseport steering**: verifies client and QNAME steering keep a key on one socket.
+ *  - **Busy polling**: verifies spinning and the back-off to sleeping when idle.
+ *  - **Socket options**: verifies buffer sizing, kernel drop counts and receive timestamps.
+ *  - **Queueing delay**: verifies kernel timestamps measure time spent in the socket buffer.
+ *  - **UDP GSO/GRO**: verifies coalesced replies arrive as the original datagrams
+ *    and replies above one MTU are sent on their own.
+ *  - **XDP frames**: verifies query frames are recognized and rewritten into answers.
+ *  - **Retransmission dedup**: verifies resends of in-flight requests are absorbed.
+ *  - **Upstream health**: verifies probes, the circuit breaker and half-open re-admission.
+ *  - **Upstream in flight**: verifies concurrent exchanges, answered out of order or timed out.
  *
  * @return 0 on success, non-zero on assertion failure.
  */
 int main() {
     Config cfg;
+    memset(&cfg, 0, sizeof(cfg));
     strcpy(cfg.response, "FAKE");
     strcpy(cfg.fake_ip, "1.2.3.4");
     cfg.blacklist_count = 2;
@@ -91,6 +137,1190 @@ int main() {
     assert((ref[3] & 0x0F) == 5); // RCODE=5
     printf("build_refused_response() passed\n");
 
+    /*** Test 5: Domain trie suffix matching ***/
+    DomainTrie *trie = domain_trie_new();
+    assert(trie != NULL);
+    assert(domain_trie_insert(trie, "Example.COM", DT_BLOCK) == 0);
+    assert(domain_trie_insert(trie, "ads.badsite.net.", DT_BLOCK) == 0);
+    assert(domain_trie_lookup(trie, "example.com") == DT_BLOCK);
+    assert(domain_trie_lookup(trie, "www.EXAMPLE.com") == DT_BLOCK);
+    assert(domain_trie_lookup(trie, "notexample.com") == DT_NONE);
+    assert(domain_trie_lookup(trie, "badsite.net") == DT_NONE);
+    assert(domain_trie_lookup(trie, "x.ads.badsite.net") == DT_BLOCK);
+    assert(domain_trie_lookup(trie, "com") == DT_NONE);
+    assert(trie->entries == 2);
+
+    assert(domain_trie_insert(trie, "good.example.com", DT_ALLOW) == 0);
+    assert(domain_trie_insert(trie, "badsite.net", DT_ALLOW) == 0);
+    assert(domain_trie_insert(trie, "badsite.net", DT_BLOCK) == 1); /* allow is kept */
+    assert(domain_trie_lookup(trie, "good.example.com") == DT_ALLOW);
+    assert(domain_trie_lookup(trie, "cdn.good.example.com") == DT_ALLOW);
+    assert(domain_trie_lookup(trie, "bad.example.com") == DT_BLOCK);
+    assert(domain_trie_lookup(trie, "x.ads.badsite.net") == DT_ALLOW);
+    domain_trie_free(trie);
+    printf("domain_trie passed\n");
+
+    /*** Test 6: Client groups with CIDR longest-prefix matching ***/
+    const char *conf_path = "test_groups.conf";
+    FILE *cf = fopen(conf_path, "w");
+    assert(cf != NULL);
+    fputs("response = NXDOMAIN\n"
+          "blacklist = example.com\n"
+          "group.lab.cidr = 10.0.0.0/8\n"
+          "group.lab.response = fake\n"
+          "group.lab.blacklist = lab-blocked.org\n"
+          "group.guest.cidr = 10.1.2.0/24, 192.168.0.1\n"
+          "group.guest.response = REFUSED\n", cf);
+    fclose(cf);
+
+    Config gcfg;
+    assert(load_config(conf_path, &gcfg) == 0);
+    remove(conf_path);
+    assert(gcfg.group_count == 3);
+
+    const ClientGroup *g = config_find_group(&gcfg, ntohl(inet_addr("10.9.9.9")));
+    assert(strcmp(g->name, "lab") == 0 && strcmp(g->response, "FAKE") == 0);
+    assert(domain_trie_lookup(g->blocklist, "lab-blocked.org") == DT_BLOCK);
+    assert(domain_trie_lookup(g->blocklist, "example.com") == DT_NONE);
+
+    g = config_find_group(&gcfg, ntohl(inet_addr("10.1.2.3")));
+    assert(strcmp(g->name, "guest") == 0 && strcmp(g->response, "REFUSED") == 0);
+    assert(domain_trie_lookup(g->blocklist, "www.example.com") == DT_BLOCK);
+
+    g = config_find_group(&gcfg, ntohl(inet_addr("192.168.0.2")));
+    assert(strcmp(g->name, "default") == 0 && strcmp(g->response, "NXDOMAIN") == 0);
+    assert(is_blacklisted("sub.example.com", &gcfg) == 1);
+    free_config(&gcfg);
+    printf("client groups passed\n");
+
+    /*** Test 7: Pattern rules compiled to anchored and floating DFAs ***/
+    PatternSet *ps = pattern_set_new();
+    assert(ps != NULL);
+    assert(pattern_set_add(ps, "^[a-z0-9]{20,}\\.example\\.net$", 0) == 0);
+    assert(pattern_set_add(ps, "*.tracker.*", 1) == 1);
+    assert(pattern_set_add(ps, "(ad|promo)s?[0-9]+", 0) == 2);
+    assert(pattern_set_add(ps, "bad[", 0) == -1);
+    assert(pattern_set_add(ps, "x{3,1}", 0) == -1);
+    assert(pattern_set_compile(ps) == 0);
+    assert(pattern_set_match(ps, "abcdefghij0123456789.example.net") == 0);
+    assert(pattern_set_match(ps, "ABCDEFGHIJ0123456789xyz.Example.NET") == 0);
+    assert(pattern_set_match(ps, "short.example.net") == -1);
+    assert(pattern_set_match(ps, "abcdefghij0123456789.example.net.evil") == -1);
+    assert(pattern_set_match(ps, "www.tracker.io") == 1);
+    assert(pattern_set_match(ps, "tracker.io") == -1);
+    assert(pattern_set_match(ps, "cdn.ads42.com") == 2);
+    assert(pattern_set_match(ps, "cdn.promo7.com") == 2);
+    assert(pattern_set_match(ps, "cdn.adsx.com") == -1);
+    assert(pattern_set_match(ps, "google.com") == -1);
+    pattern_set_free(ps);
+    printf("pattern_set passed\n");
+
+    /*** Test 8: RPZ zone loading and incremental updates ***/
+    const char *zone_path = "test_rpz.zone";
+    FILE *zf = fopen(zone_path, "w");
+    assert(zf != NULL);
+    fputs("$TTL 60\n"
+          "$ORIGIN rpz.local.\n"
+          "@ SOA ns.rpz.local. admin.rpz.local. ( 1 3600\n"
+          "      600 86400 60 )\n"
+          "  NS ns.rpz.local.\n"
+          "nx.test CNAME .\n"
+          "*.nodata.test CNAME *.\n"
+          "ok.nx.test CNAME rpz-passthru.\n"
+          "ok.nx.test CNAME .\n"
+          "drop.test.rpz.local. CNAME rpz-drop.\n"
+          "local.test A 192.0.2.7\n"
+          "  AAAA 2001:db8::7\n"
+          "32.1.0.0.10.rpz-ip CNAME .\n", zf);
+    fclose(zf);
+
+    DomainTrie *pt = domain_trie_new();
+    RpzStats rst;
+    memset(&rst, 0, sizeof(rst));
+    assert(rpz_load_file(zone_path, pt, &rst) == 0);
+    assert(rst.added == 6 && rst.unsupported == 1 && rst.malformed == 0);
+
+    TrieMatch m;
+    assert(domain_trie_match(pt, "nx.test", &m) == DT_NXDOMAIN);
+    assert(domain_trie_match(pt, "a.nx.test", &m) == DT_NONE);
+    assert(domain_trie_match(pt, "ok.nx.test", &m) == DT_ALLOW);
+    assert(domain_trie_match(pt, "nodata.test", &m) == DT_NONE);
+    assert(domain_trie_match(pt, "x.nodata.test", &m) == DT_NODATA && m.scope == DT_SCOPE_SUB);
+    assert(domain_trie_match(pt, "drop.test", &m) == DT_DROP);
+    assert(domain_trie_match(pt, "LOCAL.test", &m) == DT_LOCAL);
+    const TrieData *d = domain_trie_data(pt, &m);
+    assert(d != NULL && d->type == 28 && d->len == 16 && d->ttl == 60 && d->next != 0);
+    d = &pt->data[d->next - 1];
+    assert(d->type == 1 && d->len == 4 && memcmp(pt->rdata + d->off, "\xc0\x00\x02\x07", 4) == 0);
+
+    zf = fopen(zone_path, "w");
+    assert(zf != NULL);
+    fputs("$ORIGIN rpz.local.\n"
+          "-nx.test CNAME .\n"
+          "-local.test A 192.0.2.7\n"
+          "+new.test CNAME cdn.example.\n"
+          "+ok.nx.test CNAME .\n"
+          "bogus.test CNAME .\n", zf);
+    fclose(zf);
+    memset(&rst, 0, sizeof(rst));
+    assert(rpz_apply_update(zone_path, pt, &rst) == 0);
+    remove(zone_path);
+    assert(rst.added == 2 && rst.removed == 2 && rst.malformed == 1);
+    assert(domain_trie_match(pt, "nx.test", &m) == DT_NONE);
+    assert(domain_trie_match(pt, "ok.nx.test", &m) == DT_NXDOMAIN); /* update replaces passthru */
+    assert(domain_trie_match(pt, "local.test", &m) == DT_LOCAL);
+    d = domain_trie_data(pt, &m);
+    assert(d != NULL && d->type == 28 && d->next == 0);
+    assert(domain_trie_match(pt, "new.test", &m) == DT_LOCAL);
+    d = domain_trie_data(pt, &m);
+    assert(d != NULL && d->type == 5);
+
+    /* Deleting an action the owner does not have changes nothing. */
+    zf = fopen(zone_path, "w");
+    assert(zf != NULL);
+    fputs("$ORIGIN rpz.local.\n"
+          "+pass.test CNAME rpz-passthru.\n"
+          "-pass.test CNAME .\n"
+          "-local.test CNAME .\n"
+          "-local.test CNAME rpz-drop.\n", zf);
+    fclose(zf);
+    memset(&rst, 0, sizeof(rst));
+    assert(rpz_apply_update(zone_path, pt, &rst) == 0);
+    remove(zone_path);
+    assert(rst.added == 1 && rst.removed == 0);
+    assert(domain_trie_match(pt, "pass.test", &m) == DT_ALLOW);
+    assert(domain_trie_match(pt, "local.test", &m) == DT_LOCAL);
+    d = domain_trie_data(pt, &m);
+    assert(d != NULL && d->type == 28);
+    domain_trie_free(pt);
+
+    unsigned char nodata[512];
+    int nd_len = build_nodata_response(query, sizeof(query), nodata, sizeof(nodata));
+    assert(nd_len > 0 && (nodata[3] & 0x0F) == 0 && nodata[7] == 0);
+    nd_len = append_answer_record(nodata, nd_len, sizeof(nodata), 1, 60,
+                                  (const unsigned char *)"\x0a\x00\x00\x01", 4);
+    assert(nd_len > 0 && nodata[7] == 1);
+    printf("rpz passed\n");
+
+    /*** Test 9: List files and load statistics ***/
+    const char *list_path = "test_list.txt";
+    FILE *lf = fopen(list_path, "w");
+    assert(lf != NULL);
+    fputs("# hosts-style and plain entries\n"
+          "0.0.0.0 ads.one.test\r\n"
+          "two.test   # trailing comment\n"
+          "\n"
+          "ads.one.test\n"
+          "three.test", lf);
+    fclose(lf);
+    cf = fopen(conf_path, "w");
+    assert(cf != NULL);
+    fprintf(cf, "blacklist = two.test, bad..name\nblacklist_file = %s\n", list_path);
+    fclose(cf);
+    assert(load_config(conf_path, &gcfg) == 0);
+    remove(conf_path);
+    remove(list_path);
+    assert(gcfg.groups[0].blocklist->entries == 3);
+    assert(gcfg.load_stats.files == 1 && gcfg.load_stats.names == 6);
+    assert(gcfg.load_stats.duplicates == 2); /* the invalid name is not a duplicate */
+    assert(domain_trie_lookup(gcfg.groups[0].blocklist, "x.three.test") == DT_BLOCK);
+    free_config(&gcfg);
+    printf("load statistics passed\n");
+
+    /*** Test 10: Trie merging and multi-threaded list loading ***/
+    DomainTrie *dst = domain_trie_new();
+    DomainTrie *src = domain_trie_new();
+    assert(domain_trie_insert(dst, "keep.shared.test", DT_ALLOW) == 0);
+    assert(domain_trie_insert(src, "keep.shared.test", DT_BLOCK) == 0);
+    assert(domain_trie_insert(src, "new.shared.test", DT_BLOCK) == 0);
+    assert(domain_trie_insert(src, "Other.TEST", DT_BLOCK) == 0);
+    assert(domain_trie_merge(dst, src, dst->node_count) == 0);
+    assert(dst->entries == 3);
+    assert(domain_trie_lookup(dst, "keep.shared.test") == DT_ALLOW);
+    assert(domain_trie_lookup(dst, "a.new.shared.test") == DT_BLOCK);
+    assert(domain_trie_lookup(dst, "x.other.test") == DT_BLOCK);
+    assert(domain_trie_lookup(dst, "shared.test") == DT_NONE);
+    domain_trie_free(src);
+
+    lf = fopen(list_path, "w");
+    assert(lf != NULL);
+    for (int i = 0; i < 60000; i++)
+        fprintf(lf, "0.0.0.0 host%d.zone%d.parallel.test\nzone%d.example\n", i, i % 97, i % 500);
+    fclose(lf);
+    LoadStats ls;
+    memset(&ls, 0, sizeof(ls));
+    assert(list_load_file(list_path, dst, DT_BLOCK, 4, &ls) == 0);
+    remove(list_path);
+    assert(ls.threads > 1 && ls.names == 120000 && ls.duplicates == 120000 - 60500);
+    assert(dst->entries == 3 + 60500);
+    assert(domain_trie_lookup(dst, "host59999.zone53.parallel.test") == DT_BLOCK);
+    assert(domain_trie_lookup(dst, "www.zone499.example") == DT_BLOCK);
+    assert(domain_trie_lookup(dst, "host1.zone2.parallel.test") == DT_NONE);
+    assert(domain_trie_lookup(dst, "keep.shared.test") == DT_ALLOW);
+    domain_trie_free(dst);
+    printf("parallel loading passed\n");
+
+    /*** Test 11: Front-coded sorted set matches like the trie ***/
+    DomainTrie *st_trie = domain_trie_new();
+    const char *listed[] = { "example.com", "ads.example.com", "a-b.example.com", "com-x.net",
+                             "tracker.io", "deep.a.b.c.tracker.io", "x.y" };
+    for (size_t i = 0; i < sizeof(listed) / sizeof(listed[0]); i++)
+        assert(domain_trie_insert(st_trie, listed[i], DT_BLOCK) == 0);
+    assert(domain_trie_insert(st_trie, "ok.example.com", DT_ALLOW) == 0);
+    assert(domain_trie_insert_scoped(st_trie, "wild.test", DT_NXDOMAIN, DT_SCOPE_SUB) == 0);
+    for (int i = 0; i < 500; i++) {
+        char nm[64];
+        snprintf(nm, sizeof(nm), "n%d.bulk%d.org", i * 7919 % 1000, i % 13);
+        assert(domain_trie_insert(st_trie, nm, DT_BLOCK) == 0);
+    }
+    SortedSet *ss = sorted_set_build(st_trie);
+    assert(ss != NULL && ss->count == st_trie->entries);
+    const char *probes[] = { "example.com", "EXAMPLE.com.", "www.example.com", "ok.example.com",
+                             "x.ok.example.com", "a-b.example.com", "b.example.com", "com",
+                             "com-x.net", "y.com-x.net", "net", "io", "tracker.io", "c.tracker.io",
+                             "wild.test", "a.wild.test", "x.y", "z.x.y", "y", "n7.bulk1.org",
+                             "n8.bulk1.org", "bulk1.org", "q.n993.bulk4.org", "zz.unknown" };
+    for (size_t i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+        TrieMatch a, b;
+        domain_trie_match(st_trie, probes[i], &a);
+        sorted_set_match(ss, probes[i], &b);
+        assert(a.verdict == b.verdict && (a.verdict == DT_NONE || a.scope == b.scope));
+    }
+    char back[MAX_STR_LEN];
+    for (size_t i = 0; i < ss->count; i++) {
+        TrieMatch a;
+        assert(sorted_set_name(ss, i, back, sizeof(back)) > 0);
+        assert(domain_trie_match(st_trie, back, &a) != DT_NONE || strcmp(back, "wild.test") == 0);
+    }
+    assert(sorted_set_memory(ss) < domain_trie_memory(st_trie));
+    sorted_set_free(ss);
+    domain_trie_free(st_trie);
+
+    cf = fopen(conf_path, "w");
+    assert(cf != NULL);
+    fputs("matcher = sorted\nblacklist = example.com\nallowlist = www.example.com\n"
+          "group.lab.cidr = 10.0.0.0/8\n", cf);
+    fclose(cf);
+    assert(load_config(conf_path, &gcfg) == 0);
+    remove(conf_path);
+    assert(gcfg.groups[0].lists.ops == &matcher_sorted && gcfg.groups[0].blocklist == NULL);
+    assert(gcfg.groups[1].lists.impl == gcfg.groups[0].lists.impl);
+    assert(group_list_size(&gcfg.groups[1]) == 2);
+    assert(is_blacklisted("a.example.com", &gcfg) == 1);
+    assert(is_blacklisted("www.example.com", &gcfg) == 0);
+    free_config(&gcfg);
+    printf("sorted matcher passed\n");
+
+    /*** Test 12: LOUDS trie matches like the trie, also when mapped ***/
+    DomainTrie *lt_trie = domain_trie_new();
+    for (size_t i = 0; i < sizeof(listed) / sizeof(listed[0]); i++)
+        assert(domain_trie_insert(lt_trie, listed[i], DT_BLOCK) == 0);
+    assert(domain_trie_insert(lt_trie, "ok.example.com", DT_ALLOW) == 0);
+    assert(domain_trie_insert_scoped(lt_trie, "wild.test", DT_NXDOMAIN, DT_SCOPE_SUB) == 0);
+    for (int i = 0; i < 5000; i++) {
+        char nm[64];
+        snprintf(nm, sizeof(nm), "n%d.bulk%d.org", i * 7919 % 10000, i % 13);
+        assert(domain_trie_insert(lt_trie, nm, DT_BLOCK) == 0);
+    }
+    LoudsTrie *lt = louds_build(lt_trie);
+    assert(lt != NULL && lt->names == lt_trie->entries && !lt->mapped);
+    const char *image_path = "test_louds.img";
+    assert(louds_write(lt, image_path) == 0);
+    LoudsTrie *lm = louds_map(image_path);
+    assert(lm != NULL && lm->mapped && lm->names == lt->names);
+    for (int pass = 0; pass < 2; pass++) {
+        const LoudsTrie *cur = pass ? lm : lt;
+        for (size_t i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+            TrieMatch a, b;
+            domain_trie_match(lt_trie, probes[i], &a);
+            louds_match(cur, probes[i], &b);
+            assert(a.verdict == b.verdict && (a.verdict == DT_NONE || a.scope == b.scope));
+        }
+        for (int i = 0; i < 10000; i += 37) {
+            char nm[64];
+            TrieMatch a, b;
+            snprintf(nm, sizeof(nm), "www.n%d.bulk%d.org", i, i % 13);
+            domain_trie_match(lt_trie, nm, &a);
+            louds_match(cur, nm, &b);
+            assert(a.verdict == b.verdict);
+            domain_trie_match(lt_trie, nm + 4, &a);
+            louds_match(cur, nm + 4, &b);
+            assert(a.verdict == b.verdict);
+        }
+    }
+    /* Counts that do not fit the image's layout are rejected, not mapped. */
+    for (int bad = 0; bad < 3; bad++) {
+        LoudsHeader hdr;
+        memcpy(&hdr, lt->image, sizeof(hdr));
+        if (bad == 0) hdr.edges *= 2;
+        if (bad == 1) hdr.names += 4096;
+        if (bad == 2) hdr.size -= 8; /* truncated image whose header was fixed up */
+        FILE *bf = fopen(image_path, "wb");
+        assert(bf != NULL);
+        fwrite(&hdr, sizeof(hdr), 1, bf);
+        fwrite(lt->image + sizeof(hdr), 1, (size_t)hdr.size - sizeof(hdr), bf);
+        fclose(bf);
+        assert(louds_map(image_path) == NULL);
+    }
+    assert(louds_write(lt, image_path) == 0);
+    assert(louds_memory(lt) < domain_trie_memory(lt_trie));
+    louds_free(lt);
+    domain_trie_free(lt_trie);
+
+    cf = fopen(conf_path, "w");
+    assert(cf != NULL);
+    fprintf(cf, "louds_file = %s\ngroup.lab.cidr = 10.0.0.0/8\ngroup.lab.blacklist = lab.test\n",
+            image_path);
+    fclose(cf);
+    assert(load_config(conf_path, &gcfg) == 0);
+    assert(gcfg.groups[0].lists.ops == &matcher_louds);
+    assert(((const LoudsTrie *)gcfg.groups[0].lists.impl)->mapped);
+    assert(group_list_size(&gcfg.groups[0]) == lm->names);
+    assert(is_blacklisted("deep.a.b.c.tracker.io", &gcfg) == 1);
+    assert(is_blacklisted("ok.example.com", &gcfg) == 0);
+    assert(group_list_size(&gcfg.groups[1]) == 1);
+    free_config(&gcfg);
+    louds_free(lm);
+
+    cf = fopen(conf_path, "w");
+    assert(cf != NULL);
+    fprintf(cf, "blacklist = example.com\nlouds_file = %s\n", image_path);
+    fclose(cf);
+    assert(load_config(conf_path, &gcfg) == -1);
+
+    cf = fopen(conf_path, "w");
+    assert(cf != NULL);
+    fputs("matcher = louds\nblacklist = example.com\nallowlist = www.example.com\n", cf);
+    fclose(cf);
+    assert(load_config(conf_path, &gcfg) == 0);
+    remove(conf_path);
+    remove(image_path);
+    assert(gcfg.groups[0].lists.ops == &matcher_louds && gcfg.groups[0].blocklist == NULL);
+    assert(is_blacklisted("a.example.com", &gcfg) == 1);
+    assert(is_blacklisted("www.example.com", &gcfg) == 0);
+    free_config(&gcfg);
+    printf("LOUDS matcher passed\n");
+
+    /*** Test 13: Every matcher backend answers alike through the interface ***/
+    assert(matcher_find("SORTED") == &matcher_sorted && matcher_find("fst") == NULL);
+    const char *wire_probes[] = { "www.example.com", "ok.example.com", "x.ok.example.com",
+                                  "a.wild.test", "wild.test", "n7.bulk1.org", "zz.unknown" };
+    for (size_t b = 0; matcher_backend(b); b++) {
+        DomainTrie *ref = domain_trie_new(), *src = domain_trie_new();
+        for (size_t i = 0; i < sizeof(listed) / sizeof(listed[0]); i++) {
+            assert(domain_trie_insert(ref, listed[i], DT_BLOCK) == 0);
+            assert(domain_trie_insert(src, listed[i], DT_BLOCK) == 0);
+        }
+        assert(domain_trie_insert(ref, "ok.example.com", DT_ALLOW) == 0);
+        assert(domain_trie_insert(src, "ok.example.com", DT_ALLOW) == 0);
+        assert(domain_trie_insert_scoped(ref, "wild.test", DT_NXDOMAIN, DT_SCOPE_SUB) == 0);
+        assert(domain_trie_insert_scoped(src, "wild.test", DT_NXDOMAIN, DT_SCOPE_SUB) == 0);
+        assert(domain_trie_insert(ref, "n7.bulk1.org", DT_BLOCK) == 0);
+        assert(domain_trie_insert(src, "n7.bulk1.org", DT_BLOCK) == 0);
+
+        Matcher mt;
+        assert(matcher_build(&mt, matcher_backend(b), src) == 0);
+        assert(matcher_count(&mt) == ref->entries && matcher_memory(&mt) > 0);
+        for (size_t i = 0; i < sizeof(wire_probes) / sizeof(wire_probes[0]); i++) {
+            unsigned char wire[256];
+            size_t wl = 0;
+            const char *p = wire_probes[i];
+            while (*p) {
+                size_t l = strcspn(p, ".");
+                wire[wl++] = (unsigned char)l;
+                memcpy(wire + wl, p, l);
+                wl += l;
+                p += l + (p[l] == '.');
+            }
+            wire[wl++] = 0;
+
+            TrieMatch a, d, w;
+            domain_trie_match(ref, wire_probes[i], &a);
+            matcher_match(&mt, wire_probes[i], &d);
+            matcher_match_wire(&mt, wire, wl, &w);
+            assert(a.verdict == d.verdict && a.verdict == w.verdict);
+            assert(matcher_match_wire(&mt, wire, wl - 1, &w) == DT_NONE);
+        }
+        matcher_free(&mt);
+        domain_trie_free(ref);
+    }
+    DomainTrie *local = domain_trie_new();
+    unsigned char a_rec[4] = { 10, 0, 0, 1 };
+    assert(domain_trie_add_data(local, "local.test", DT_SCOPE_SELF, 1, 60, a_rec, 4) == 0);
+    Matcher lm_local;
+    assert(matcher_build(&lm_local, &matcher_sorted, local) == -1);
+    assert(matcher_build(&lm_local, &matcher_trie, local) == 0 && lm_local.impl == local);
+    matcher_free(&lm_local);
+    printf("matcher interface passed\n");
+
+    /*** Test 14: Fast path for the common query shape ***/
+    unsigned char fq[64] = { 0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0,
+                             3, 'W', 'w', 'W', 7, 'E', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0,
+                             0, 28, 0, 1 };
+    int fq_len = 33;
+    DnsQuestion dq;
+    assert(parse_dns_query_fast(fq, fq_len, &dq) == 0);
+    assert(strcmp(dq.name, "www.example.com") == 0 && dq.qname_len == 17);
+    assert(dq.type == 28 && dq.class == 1 && !dq.has_opt);
+    assert(parse_dns_query_fast(fq, fq_len - 1, &dq) == -1);
+    assert(parse_dns_query_fast(fq, fq_len + 1, &dq) == -1);
+
+    unsigned char opt[] = { 0, 0, 41, 0x10, 0, 0, 0, 0, 0, 0, 4, 0, 10, 0, 0 };
+    memcpy(fq + fq_len, opt, sizeof(opt));
+    fq[11] = 1;
+    assert(parse_dns_query_fast(fq, fq_len + (int)sizeof(opt), &dq) == 0 && dq.has_opt);
+    fq[fq_len + 2] = 42;
+    assert(parse_dns_query_fast(fq, fq_len + (int)sizeof(opt), &dq) == -1);
+    fq[11] = 0;
+
+    fq[2] = 0x81;
+    assert(parse_dns_query_fast(fq, fq_len, &dq) == -1);
+    fq[2] = 0x01;
+    fq[5] = 2;
+    assert(parse_dns_query_fast(fq, fq_len, &dq) == -1);
+    fq[5] = 1;
+    fq[24] = 0xC0;
+    assert(parse_dns_query_fast(fq, fq_len, &dq) == -1);
+    fq[24] = 3;
+
+    unsigned char root_q[17] = { 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 1 };
+    assert(parse_dns_query_fast(root_q, sizeof(root_q), &dq) == 0);
+    assert(dq.name[0] == '\0' && dq.qname_len == 1 && dq.type == 2);
+    printf("fast query parser passed\n");
+
+    /*** Test 15: Response cache with TTL aging and disk snapshots ***/
+    unsigned char cq[] = { 0xAA, 0x01, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0,
+                           3, 'w', 'w', 'w', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0,
+                           0, 1, 0, 1 };
+    unsigned char cr[64];
+    memcpy(cr, cq, sizeof(cq));
+    cr[2] = 0x81;
+    cr[3] = 0x80;
+    cr[7] = 1;
+    unsigned char ans[] = { 0xC0, 12, 0, 1, 0, 1, 0, 0, 0, 100, 0, 4, 192, 0, 2, 1 };
+    memcpy(cr + sizeof(cq), ans, sizeof(ans));
+    int cr_len = (int)(sizeof(cq) + sizeof(ans));
+
+    ResponseCache *rc = cache_new(64);
+    unsigned char out[512];
+    assert(rc != NULL && cache_lookup(rc, cq, sizeof(cq), out, sizeof(out), 1000) == -1);
+    assert(cache_store(rc, cq, sizeof(cq), cr, cr_len, 1000) == 0);
+    cq[0] = 0xBB;
+    assert(cache_lookup(rc, cq, sizeof(cq), out, sizeof(out), 1030) == cr_len);
+    assert(out[0] == 0xBB && out[1] == 0x01 && out[sizeof(cq) + 9] == 70);
+    assert(cache_lookup(rc, cq, sizeof(cq), out, sizeof(out), 1100) == -1);
+    assert(rc->hits == 1 && rc->misses == 2);
+
+    cr[3] = 0x82; /* SERVFAIL is never cached */
+    assert(cache_store(rc, cq, sizeof(cq), cr, cr_len, 1000) == -1);
+    cr[3] = 0x80;
+    cq[30] = 28; /* answer to a different question */
+    assert(cache_store(rc, cq, sizeof(cq), cr, cr_len, 1000) == -1);
+    cq[30] = 1;
+
+    const char *snap_path = "test_cache.snap";
+    assert(cache_store(rc, cq, sizeof(cq), cr, cr_len, 2000) == 0);
+    cr[sizeof(cq) + 9] = 5; /* short-lived twin under another name */
+    cr[13] = cq[13] = 'x';
+    assert(cache_store(rc, cq, sizeof(cq), cr, cr_len, 2000) == 0);
+    assert(cache_save(rc, snap_path, 2001) == 2);
+    cache_free(rc);
+
+    rc = cache_new(64);
+    assert(cache_load(rc, snap_path, 2050) == 1);
+    remove(snap_path);
+    assert(cache_lookup(rc, cq, sizeof(cq), out, sizeof(out), 2050) == -1);
+    cr[13] = cq[13] = 'w';
+    assert(cache_lookup(rc, cq, sizeof(cq), out, sizeof(out), 2050) == cr_len);
+    assert(out[sizeof(cq) + 9] == 50);
+    assert(cache_load(rc, snap_path, 2050) == -1);
+    cache_free(rc);
+    printf("response cache passed\n");
+
+    /*** Test 16: Shared-memory cache seen through two attachments ***/
+    char shm_name[64];
+    snprintf(shm_name, sizeof(shm_name), "/dns_proxy_test_%ld", (long)getpid());
+    ResponseCache *sa = cache_attach_shared(shm_name, 64);
+    ResponseCache *sb = cache_attach_shared(shm_name, 4096); /* size comes from the creator */
+    assert(sa != NULL && sb != NULL && sa->shm != sb->shm && sb->mask == sa->mask);
+    cr[sizeof(cq) + 9] = 100;
+    assert(cache_lookup(sb, cq, sizeof(cq), out, sizeof(out), 3000) == -1);
+    assert(cache_store(sa, cq, sizeof(cq), cr, cr_len, 3000) == 0);
+    cq[0] = 0xCC;
+    assert(cache_lookup(sb, cq, sizeof(cq), out, sizeof(out), 3040) == cr_len);
+    assert(out[0] == 0xCC && out[sizeof(cq) + 9] == 60);
+    assert(cache_save(sb, snap_path, 3040) == 1);
+    cache_free(sa);
+    cache_free(sb);
+
+    sa = cache_attach_shared(shm_name, 64); /* outlives its processes */
+    assert(sa != NULL && cache_lookup(sa, cq, sizeof(cq), out, sizeof(out), 3050) == cr_len);
+    cache_free(sa);
+    shm_unlink(shm_name);
+    sa = cache_attach_shared(shm_name, 64);
+    assert(cache_lookup(sa, cq, sizeof(cq), out, sizeof(out), 3050) == -1);
+    assert(cache_load(sa, snap_path, 3050) == 1);
+    remove(snap_path);
+    assert(cache_lookup(sa, cq, sizeof(cq), out, sizeof(out), 3050) == cr_len);
+    cache_free(sa);
+    shm_unlink(shm_name);
+    printf("shared cache passed\n");
+
+    /*** Test 17: Case-insensitive cache keys preserving 0x20 casing ***/
+    rc = cache_new(64);
+    memcpy(cq + 13, "wWw", 3);
+    memcpy(cr + 13, "www", 3); /* upstream that lower-cases the question */
+    assert(cache_store(rc, cq, sizeof(cq), cr, cr_len, 4000) == 0);
+    memcpy(cq + 13, "WwW", 3);
+    memcpy(cq + 17, "EXAMPLE", 7);
+    assert(cache_lookup(rc, cq, sizeof(cq), out, sizeof(out), 4000) == cr_len);
+    assert(memcmp(out + 12, cq + 12, sizeof(cq) - 16) == 0);
+    assert(memcmp(out + sizeof(cq), ans, sizeof(ans)) == 0);
+    cq[18] = 'y'; /* a different name still misses */
+    assert(cache_lookup(rc, cq, sizeof(cq), out, sizeof(out), 4000) == -1);
+    cache_free(rc);
+    printf("cache key folding passed\n");
+
+    /*** Test 18: Upstream IDs, 0x20 casing and rejection of forged replies ***/
+    UpstreamRng rng;
+    memset(&rng, 0, sizeof(rng));
+    rng.used = 16;
+    assert(upstream_random(&rng) == 0xade0b876); /* ChaCha20, zero key (RFC 7539 A.1) */
+    upstream_rng_seed(&rng);
+    unsigned char mixed[sizeof(cq) - 16];
+    int upper = 0;
+    for (int i = 0; i < 4; i++) {
+        memcpy(mixed, cq + 12, sizeof(mixed));
+        upstream_randomize_case(mixed, sizeof(mixed), &rng);
+        for (size_t k = 0; k < sizeof(mixed); k++) {
+            assert((mixed[k] | 0x20) == (cq[12 + k] | 0x20) || mixed[k] == cq[12 + k]);
+            upper += mixed[k] >= 'A' && mixed[k] <= 'Z';
+        }
+        assert(mixed[0] == 3 && mixed[4] == 7 && mixed[12] == 3);
+    }
+    assert(upper > 0);
+
+    int fake = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in fake_addr;
+    memset(&fake_addr, 0, sizeof(fake_addr));
+    fake_addr.sin_family = AF_INET;
+    fake_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t fake_len = sizeof(fake_addr);
+    assert(fake >= 0 && bind(fake, (struct sockaddr *)&fake_addr, sizeof(fake_addr)) == 0);
+    assert(getsockname(fake, (struct sockaddr *)&fake_addr, &fake_len) == 0);
+
+    pid_t child = fork();
+    assert(child >= 0);
+    if (child == 0) {
+        /* Fake upstream: three forgeries, then the genuine echo. */
+        unsigned char q[512];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t qn = recvfrom(fake, q, sizeof(q), 0, (struct sockaddr *)&from, &from_len);
+        if (qn < 17) _exit(1);
+        q[2] |= 0x80;
+        int other = socket(AF_INET, SOCK_DGRAM, 0);
+        sendto(other, q, (size_t)qn, 0, (struct sockaddr *)&from, from_len);
+        q[0] ^= 1;
+        sendto(fake, q, (size_t)qn, 0, (struct sockaddr *)&from, from_len);
+        q[0] ^= 1;
+        q[13] ^= 0x20;
+        sendto(fake, q, (size_t)qn, 0, (struct sockaddr *)&from, from_len);
+        q[13] ^= 0x20;
+        sendto(fake, q, (size_t)qn, 0, (struct sockaddr *)&from, from_len);
+        _exit(0);
+    }
+    char fake_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &fake_addr.sin_addr, fake_ip, sizeof(fake_ip));
+    Upstream up;
+    assert(upstream_init(&up, fake_ip, ntohs(fake_addr.sin_port), NULL) == 0);
+    memcpy(cq + 12, "\3wWw\7eXaMpLe\3cOm", 16);
+    int un = upstream_exchange(&up, cq, sizeof(cq), out, sizeof(out));
+    int status;
+    waitpid(child, &status, 0);
+    close(fake);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(un == (int)sizeof(cq) && (out[2] & 0x80) && memcmp(out, cq, 2) == 0);
+    assert(memcmp(out + 12, cq + 12, sizeof(cq) - 12) == 0);
+    assert(up.stats.queries == 1 && up.stats.answered == 1 && up.stats.bad_source == 1 &&
+           up.stats.bad_id == 1 && up.stats.bad_question == 1);
+    upstream_close(&up);
+    printf("upstream anti-spoofing passed\n");
+
+    /*** Test 19: Overload detection from queue fill and loop lag ***/
+    int lsock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in lsock_addr;
+    memset(&lsock_addr, 0, sizeof(lsock_addr));
+    lsock_addr.sin_family = AF_INET;
+    lsock_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t lsock_len = sizeof(lsock_addr);
+    int small_buf = 4096;
+    assert(lsock >= 0 && setsockopt(lsock, SOL_SOCKET, SO_RCVBUF, &small_buf, sizeof(small_buf)) == 0);
+    assert(bind(lsock, (struct sockaddr *)&lsock_addr, sizeof(lsock_addr)) == 0);
+    assert(getsockname(lsock, (struct sockaddr *)&lsock_addr, &lsock_len) == 0);
+
+    Admission adm;
+    admission_init(&adm, lsock, 50, 0, 0, 0);
+    assert(admission_sample(&adm, 1) == 0 && admission_forward(&adm) == 1);
+    for (int i = 0; i < 64; i++)
+        sendto(lsock, cq, sizeof(cq), 0, (struct sockaddr *)&lsock_addr, sizeof(lsock_addr));
+    assert(admission_sample(&adm, 2) == 1 && adm.queue_pct >= 50);
+    assert(admission_forward(&adm) == 0 && adm.shed == 1 && adm.episodes == 1);
+    while (recv(lsock, out, sizeof(out), MSG_DONTWAIT) > 0)
+        ;
+    assert(admission_sample(&adm, 3) == 0 && adm.queue_pct == 0);
+
+    admission_init(&adm, lsock, 0, 200, 1, 0); /* lag only */
+    sendto(lsock, cq, sizeof(cq), 0, (struct sockaddr *)&lsock_addr, sizeof(lsock_addr));
+    assert(admission_sample(&adm, 150) == 0 && adm.lag_ms == 150);
+    assert(admission_sample(&adm, 250) == 1 && admission_forward(&adm) == 0);
+    recv(lsock, out, sizeof(out), 0);
+    assert(admission_sample(&adm, 260) == 0 && adm.lag_ms == 0);
+    close(lsock);
+    printf("admission control passed\n");
+
+    /*** Test 20: Miss queue order and capacity, latency quantiles ***/
+    MissQueue mq;
+    assert(miss_queue_init(&mq) == 0 && miss_queue_pop(&mq) == NULL);
+    SchedPacket *sp = miss_queue_reserve(&mq);
+    sp->len = 0;
+    miss_queue_commit(&mq);
+    sp = miss_queue_reserve(&mq);
+    sp->len = -1; /* answered locally: not committed, the slot is reused */
+    assert(miss_queue_reserve(&mq) == sp);
+    sp->len = 1;
+    miss_queue_commit(&mq);
+    assert(mq.count == 2 && miss_queue_pop(&mq)->len == 0 && miss_queue_pop(&mq)->len == 1);
+    for (int i = 0; i < SCHED_QUEUE; i++) {
+        assert(miss_queue_reserve(&mq) != NULL);
+        miss_queue_commit(&mq);
+    }
+    assert(miss_queue_reserve(&mq) == NULL && mq.peak == SCHED_QUEUE);
+    miss_queue_free(&mq);
+
+    LatencyHistogram lh;
+    memset(&lh, 0, sizeof(lh));
+    for (int i = 0; i < 98; i++) latency_add(&lh, 3);   /* bucket [2, 4) */
+    latency_add(&lh, 1000);                             /* bucket [512, 1024) */
+    latency_add(&lh, 1e9);                              /* beyond the last bucket */
+    assert(lh.total == 100 && lh.count[1] == 98 && lh.count[9] == 1);
+    assert(lh.count[LATENCY_BUCKETS - 1] == 1);
+    assert(latency_quantile(&lh, 0.5) == 4 && latency_quantile(&lh, 0.99) == 1024);
+    assert(latency_quantile(&lh, 1.0) == 1e9);
+    printf("scheduler passed\n");
+
+    /*** Test 21: Pinned workers sharing one port ***/
+    int w1 = worker_socket(0, 1, 0);
+    struct sockaddr_in w_addr;
+    socklen_t w_len = sizeof(w_addr);
+    assert(w1 >= 0 && getsockname(w1, (struct sockaddr *)&w_addr, &w_len) == 0);
+    int w2 = worker_socket(ntohs(w_addr.sin_port), 1, 0);
+    assert(w2 >= 0);
+    close(w1);
+    close(w2);
+
+    Workers wk;
+    assert(workers_start(&wk, 2, 1) == 0);
+    if (wk.index == 1) _exit(wk.cpu >= 0 && wk.node == worker_cpu_node(wk.cpu) ? 0 : 1);
+    assert(wk.count == 2 && wk.pids[1] > 0 && wk.cpu >= 0);
+    waitpid(wk.pids[1], &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    wk.pids[1] = 0;
+    printf("workers passed\n");
+
+    /*** Test 22: Reuseport steering by client IP and by QNAME ***/
+    for (int mode = STEER_CLIENT; mode <= STEER_QNAME; mode++) {
+        int g[2];
+        g[0] = worker_socket(0, 1, -1);
+        assert(g[0] >= 0 && getsockname(g[0], (struct sockaddr *)&w_addr, &w_len) == 0);
+        g[1] = worker_socket(ntohs(w_addr.sin_port), 1, -1);
+        assert(g[1] >= 0 && worker_steer(g[1], 2, (SteerMode)mode) == 0);
+        w_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        for (int i = 0; i < 8; i++) {
+            int c = socket(AF_INET, SOCK_DGRAM, 0); /* a new source port each time */
+            if (mode == STEER_QNAME) cq[13] = (unsigned char)(i & 1 ? 'W' : 'w');
+            sendto(c, cq, sizeof(cq), 0, (struct sockaddr *)&w_addr, sizeof(w_addr));
+            close(c);
+        }
+        int got[2] = { 0, 0 };
+        for (int k = 0; k < 2; k++)
+            while (recv(g[k], out, sizeof(out), MSG_DONTWAIT) > 0) got[k]++;
+        assert(got[0] + got[1] == 8 && (got[0] == 8 || got[1] == 8));
+        if (mode == STEER_QNAME) {
+            /* Same client, different names: spread over both sockets. */
+            for (int i = 0; i < 16; i++) {
+                cq[14] = (unsigned char)('a' + i);
+                sendto(g[0], cq, sizeof(cq), 0, (struct sockaddr *)&w_addr, sizeof(w_addr));
+            }
+            cq[13] = 'w';
+            cq[14] = 'W';
+            got[0] = got[1] = 0;
+            for (int k = 0; k < 2; k++)
+                while (recv(g[k], out, sizeof(out), MSG_DONTWAIT) > 0) got[k]++;
+            assert(got[0] + got[1] == 16 && got[0] > 0 && got[1] > 0);
+        }
+        close(g[0]);
+        close(g[1]);
+    }
+    printf("reuseport steering passed\n");
+
+    /*** Test 23: Busy polling backs off to sleeping when idle ***/
+    BusyPoll bp;
+    busy_poll_init(&bp, 0, 5);
+    assert(busy_poll_flags(&bp, 0) == 0 && bp.polls == 0);
+    busy_poll_init(&bp, 1, 5);
+    assert(busy_poll_flags(&bp, 0) == MSG_DONTWAIT);
+    busy_poll_update(&bp, 0, 0);
+    assert(busy_poll_flags(&bp, 3) == MSG_DONTWAIT);
+    busy_poll_update(&bp, 0, 3);
+    assert(busy_poll_flags(&bp, 6) == 0 && bp.sleeps == 1 && bp.empty_polls == 2);
+    busy_poll_update(&bp, 1, 7);
+    assert(busy_poll_flags(&bp, 8) == MSG_DONTWAIT && bp.polls == 3);
+    printf("busy polling passed\n");
+
+    /*** Test 24: Socket buffers, kernel drop counting and receive timestamps ***/
+    {
+        int rx = socket(AF_INET, SOCK_DGRAM, 0);
+        int tx = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in rx_addr;
+        memset(&rx_addr, 0, sizeof(rx_addr));
+        rx_addr.sin_family = AF_INET;
+        rx_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t rx_len = sizeof(rx_addr);
+        assert(bind(rx, (struct sockaddr *)&rx_addr, sizeof(rx_addr)) == 0);
+        assert(getsockname(rx, (struct sockaddr *)&rx_addr, &rx_len) == 0);
+
+        NetOptions no = { 1 << 20, 0, 1, 1, 0, 0 };
+        NetStats ns;
+        memset(&ns, 0, sizeof(ns));
+        /* Without CAP_NET_ADMIN the size may be capped, but never silently. */
+        if (netopt_apply(rx, &no, &ns) == 0) assert(ns.rcvbuf >= no.rcvbuf);
+        assert(ns.rcvbuf > 0 && ns.sndbuf > 0);
+        /* The kernel switches receive timestamping on asynchronously. */
+        struct timespec stamp_on = { 0, 20 * 1000000L };
+        nanosleep(&stamp_on, NULL);
+
+        /* A tiny buffer overflows; the next packet carries the drop count. */
+        no.rcvbuf = 1;
+        netopt_apply(rx, &no, &ns);
+        for (int i = 0; i < 64; i++)
+            sendto(tx, out, sizeof(out), 0, (struct sockaddr *)&rx_addr, sizeof(rx_addr));
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        struct timespec stamp;
+        int queued = 0;
+        while (netopt_recv(rx, out, sizeof(out), &from, &from_len, MSG_DONTWAIT, &ns, NULL) > 0)
+            queued++;
+        assert(queued > 0 && queued < 64 && ns.kernel_drops == 0);
+        sendto(tx, out, 16, 0, (struct sockaddr *)&rx_addr, sizeof(rx_addr));
+        from_len = sizeof(from);
+        assert(netopt_recv(rx, out, sizeof(out), &from, &from_len, 0, &ns, &stamp) == 16);
+        assert(ns.kernel_drops == (uint32_t)(64 - queued));
+        assert(from_len == sizeof(from) && from.sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+        assert(stamp.tv_sec > 0);
+        close(rx);
+        close(tx);
+    }
+    printf("socket options passed\n");
+
+    /*** Test 25: Kernel timestamps include time queued in the socket buffer ***/
+    {
+        struct timespec none = { 0, 0 };
+        assert(netopt_age_ms(&none) == 0);
+        int rx = socket(AF_INET, SOCK_DGRAM, 0);
+        int tx = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in rx_addr;
+        memset(&rx_addr, 0, sizeof(rx_addr));
+        rx_addr.sin_family = AF_INET;
+        rx_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t rx_len = sizeof(rx_addr);
+        assert(bind(rx, (struct sockaddr *)&rx_addr, sizeof(rx_addr)) == 0);
+        assert(getsockname(rx, (struct sockaddr *)&rx_addr, &rx_len) == 0);
+        NetOptions no = { 0, 0, 0, 1, 0, 0 };
+        NetStats ns;
+        memset(&ns, 0, sizeof(ns));
+        assert(netopt_apply(rx, &no, &ns) == 0);
+
+        sendto(tx, out, 16, 0, (struct sockaddr *)&rx_addr, sizeof(rx_addr));
+        struct timespec wait = { 0, 30 * 1000000L };
+        nanosleep(&wait, NULL);
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        struct timespec stamp;
+        assert(netopt_recv(rx, out, sizeof(out), &from, &from_len, 0, &ns, &stamp) == 16);
+        double age = netopt_age_ms(&stamp);
+        assert(age >= 25 && age < 5000);
+        close(rx);
+        close(tx);
+    }
+    printf("queueing delay passed\n");
+
+    /*** Test 26: UDP GSO reply batching and GRO receive splitting ***/
+    {
+        int rx = socket(AF_INET, SOCK_DGRAM, 0);
+        int tx = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in rx_addr;
+        memset(&rx_addr, 0, sizeof(rx_addr));
+        rx_addr.sin_family = AF_INET;
+        rx_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t rx_len = sizeof(rx_addr);
+        assert(bind(rx, (struct sockaddr *)&rx_addr, sizeof(rx_addr)) == 0);
+        assert(getsockname(rx, (struct sockaddr *)&rx_addr, &rx_len) == 0);
+        NetOptions rx_opts = { 0, 0, 0, 0, 0, 1 }, tx_opts = { 0, 0, 0, 0, 1, 0 };
+        NetStats rx_ns, tx_ns;
+        memset(&rx_ns, 0, sizeof(rx_ns));
+        memset(&tx_ns, 0, sizeof(tx_ns));
+        netopt_apply(rx, &rx_opts, &rx_ns);
+        netopt_apply(tx, &tx_opts, &tx_ns);
+
+        ReplyBatch *rb = malloc(sizeof(ReplyBatch));
+        GroBuffer *gb = gro_buffer_new();
+        assert(rb && gb);
+        reply_batch_init(rb, tx, tx_ns.gso);
+        /* Five equal replies and a short one that ends the run; then two that cannot merge. */
+        size_t sizes[8] = { 100, 100, 100, 100, 100, 40, 100, 200 };
+        unsigned char msg[200];
+        for (int i = 0; i < 8; i++) {
+            memset(msg, 'a' + i, sizes[i]);
+            reply_send(rb, &rx_addr, sizeof(rx_addr), msg, sizes[i]);
+        }
+        reply_flush(rb);
+        if (tx_ns.gso) assert(rb->gso_sends == 1 && rb->gso_replies == 6);
+
+        for (int i = 0; i < 8; i++) {
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t n = netopt_recv_segment(rx, rx_ns.gro ? gb : NULL, out, sizeof(out), &from,
+                                            &from_len, 0, &rx_ns, NULL);
+            assert(n == (ssize_t)sizes[i] && out[0] == 'a' + i && out[n - 1] == 'a' + i);
+            assert(from.sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+        }
+        if (tx_ns.gso && rx_ns.gro) assert(rx_ns.gro_receives == 1 && rx_ns.gro_segments == 6);
+
+        /* Replies above one MTU go out on their own, in order. */
+        unsigned char big[1600], got[1600];
+        unsigned long sends = rb->gso_sends;
+        reply_send(rb, &rx_addr, sizeof(rx_addr), msg, 100);
+        for (int i = 0; i < 2; i++) {
+            memset(big, 'x' + i, sizeof(big));
+            reply_send(rb, &rx_addr, sizeof(rx_addr), big, sizeof(big));
+        }
+        reply_flush(rb);
+        assert(rb->gso_sends == sends);
+        size_t big_sizes[3] = { 100, sizeof(big), sizeof(big) };
+        for (int i = 0; i < 3; i++) {
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t n = netopt_recv_segment(rx, rx_ns.gro ? gb : NULL, got, sizeof(got), &from,
+                                            &from_len, 0, &rx_ns, NULL);
+            assert(n == (ssize_t)big_sizes[i]);
+            if (i > 0) assert(got[0] == 'x' + i - 1 && got[n - 1] == 'x' + i - 1);
+        }
+        free(rb);
+        gro_buffer_free(gb);
+        close(rx);
+        close(tx);
+    }
+    printf("UDP GSO/GRO passed\n");
+
+    /*** Test 27: XDP frame parsing and in-place answers ***/
+    {
+        /* Ethernet + IPv4 + UDP from 10.0.0.2:40000 to 10.0.0.1:5353, carrying cq. */
+        unsigned char frame[XDP_FRAME_SIZE];
+        memset(frame, 0, sizeof(frame));
+        const unsigned char dst_mac[6] = { 2, 0, 0, 0, 0, 1 }, src_mac[6] = { 2, 0, 0, 0, 0, 2 };
+        memcpy(frame, dst_mac, 6);
+        memcpy(frame + 6, src_mac, 6);
+        frame[12] = 0x08;
+        unsigned char *ip = frame + 14, *udp = frame + 34;
+        size_t total = 28 + sizeof(cq);
+        ip[0] = 0x45;
+        ip[2] = (unsigned char)(total >> 8);
+        ip[3] = (unsigned char)total;
+        ip[8] = 64;
+        ip[9] = 17;
+        const unsigned char src_ip[4] = { 10, 0, 0, 2 }, dst_ip[4] = { 10, 0, 0, 1 };
+        memcpy(ip + 12, src_ip, 4);
+        memcpy(ip + 16, dst_ip, 4);
+        uint32_t sum = 0;
+        for (int i = 0; i < 20; i += 2) sum += (uint32_t)(ip[i] << 8 | ip[i + 1]);
+        while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+        ip[10] = (unsigned char)(~sum >> 8);
+        ip[11] = (unsigned char)~sum;
+        udp[0] = 40000 >> 8;
+        udp[1] = 40000 & 0xff;
+        udp[2] = 5353 >> 8;
+        udp[3] = 5353 & 0xff;
+        udp[5] = (unsigned char)(8 + sizeof(cq));
+        memcpy(frame + XDP_HEADERS, cq, sizeof(cq));
+        size_t frame_len = XDP_HEADERS + sizeof(cq);
+
+        struct sockaddr_in xc;
+        size_t dns_len;
+        assert(xdp_parse(frame, frame_len, 5353, &xc, &dns_len) == 0);
+        assert(dns_len == sizeof(cq) && ntohs(xc.sin_port) == 40000);
+        assert(memcmp(&xc.sin_addr.s_addr, src_ip, 4) == 0);
+        assert(xdp_parse(frame, frame_len, 53, &xc, &dns_len) < 0);
+        assert(xdp_parse(frame, XDP_HEADERS + 4, 5353, &xc, &dns_len) < 0);
+        ip[6] = 0x20; /* more fragments */
+        assert(xdp_parse(frame, frame_len, 5353, &xc, &dns_len) < 0);
+        ip[6] = 0;
+        ip[11] ^= 1; /* bad header checksum */
+        assert(xdp_parse(frame, frame_len, 5353, &xc, &dns_len) < 0);
+        ip[11] ^= 1;
+
+        unsigned char answer[64];
+        memset(answer, 0xab, sizeof(answer));
+        int n = xdp_build_reply(frame, sizeof(frame), answer, sizeof(answer));
+        assert(n == XDP_HEADERS + (int)sizeof(answer));
+        assert(memcmp(frame, src_mac, 6) == 0 && memcmp(frame + 6, dst_mac, 6) == 0);
+        assert(memcmp(ip + 12, dst_ip, 4) == 0 && memcmp(ip + 16, src_ip, 4) == 0);
+        assert((udp[0] << 8 | udp[1]) == 5353 && (udp[2] << 8 | udp[3]) == 40000);
+        assert((udp[4] << 8 | udp[5]) == 8 + (int)sizeof(answer));
+        assert(memcmp(frame + XDP_HEADERS, answer, sizeof(answer)) == 0);
+        /* The rewritten frame is a valid datagram from the server's port. */
+        assert(xdp_parse(frame, (size_t)n, 40000, &xc, &dns_len) == 0 && dns_len == sizeof(answer));
+        assert(xdp_build_reply(frame, 100, answer, sizeof(answer)) < 0);
+    }
+    printf("XDP frames passed\n");
+
+    /*** Test 28: Client retransmissions of in-flight requests are absorbed ***/
+    {
+        Dedup dd;
+        assert(dedup_init(&dd, 16) == 0 && dd.mask == 15);
+        struct sockaddr_in dc;
+        memset(&dc, 0, sizeof(dc));
+        dc.sin_family = AF_INET;
+        dc.sin_addr.s_addr = htonl(0x0a000002);
+        dc.sin_port = htons(40000);
+        unsigned char dq[sizeof(cq)];
+        memcpy(dq, cq, sizeof(cq));
+        uint64_t k = dedup_key(&dc, dq, sizeof(dq));
+        assert(k != 0 && k == dedup_key(&dc, cq, sizeof(cq)));
+        dq[1] ^= 1; /* another ID */
+        assert(dedup_key(&dc, dq, sizeof(dq)) != k);
+        dq[1] ^= 1;
+        dq[14] ^= 1; /* another name */
+        assert(dedup_key(&dc, dq, sizeof(dq)) != k);
+        dq[14] ^= 1;
+        dc.sin_port = htons(40001);
+        assert(dedup_key(&dc, dq, sizeof(dq)) != k);
+
+        assert(dedup_duplicate(&dd, k, 1000, 1000) == 0);
+        dedup_start(&dd, k, 1000);
+        assert(dedup_duplicate(&dd, k, 1900, 1900) == 1);  /* resent while queued */
+        dedup_done(&dd, k, 3000);
+        assert(dedup_duplicate(&dd, k, 2500, 3001) == 1);  /* waited in the socket meanwhile */
+        assert(dedup_duplicate(&dd, k, 3500, 3500) == 0);  /* after the reply: served */
+        assert(dd.absorbed == 2 && dd.tracked == 1);
+        dedup_start(&dd, k, 4000);
+        assert(dedup_duplicate(&dd, k, 4000 + DEDUP_STALE_MS, 4000 + DEDUP_STALE_MS) == 0);
+
+        /* An exchange that timed out: the resend that waited meanwhile is forwarded. */
+        dedup_start(&dd, k, 20000);
+        dedup_forget(&dd, k);
+        assert(dedup_duplicate(&dd, k, 21000, 22000) == 0 && dd.absorbed == 2);
+
+        /* More requests than slots: the oldest are evicted, the table keeps working. */
+        for (uint64_t i = 1; i <= 64; i++) dedup_start(&dd, i * 16 + 3, 5000 + (double)i);
+        assert(dedup_duplicate(&dd, 64 * 16 + 3, 6000, 6000) == 1);
+        assert(dedup_duplicate(&dd, 1 * 16 + 3, 6000, 6000) == 0);
+        dedup_free(&dd);
+    }
+    printf("retransmission dedup passed\n");
+
+    /*** Test 29: Upstream health probes and circuit breaker ***/
+    {
+        /* Two servers on one port: A answers its probes, B stays silent until re-admitted. */
+        int srv_a = socket(AF_INET, SOCK_DGRAM, 0), srv_b = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in at;
+        memset(&at, 0, sizeof(at));
+        at.sin_family = AF_INET;
+        at.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t at_len = sizeof(at);
+        assert(bind(srv_a, (struct sockaddr *)&at, sizeof(at)) == 0);
+        assert(getsockname(srv_a, (struct sockaddr *)&at, &at_len) == 0);
+        at.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1);
+        assert(bind(srv_b, (struct sockaddr *)&at, sizeof(at)) == 0);
+
+        UpstreamHealth h;
+        upstream_health_defaults(&h);
+        strcpy(h.name, "health.example.");
+        h.interval_ms = 10;
+        h.timeout_ms = 20;
+        h.max_failures = 2;
+        h.cooldown_ms = 50;
+        Upstream hu;
+        assert(upstream_init(&hu, "127.0.0.1, 127.0.0.2", ntohs(at.sin_port), &h) == 0);
+        assert(hu.count == 2 && upstream_available(&hu) == 2);
+
+        unsigned char pq[512];
+        struct sockaddr_in from;
+        socklen_t from_len;
+        struct timespec settle = { 0, 2 * 1000000L }; /* loopback delivery */
+        ssize_t pn;
+        double t0 = 1000;
+        for (int round = 0; round < 2; round++) {
+            upstream_health_check(&hu, t0 + 25 * round);
+            nanosleep(&settle, NULL);
+            from_len = sizeof(from);
+            pn = recvfrom(srv_a, pq, sizeof(pq), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+            assert(pn == 12 + 16 + 4 && memcmp(pq + 12, "\6health\7example\0", 16) == 0);
+            pq[2] |= 0x80;
+            sendto(srv_a, pq, (size_t)pn, 0, (struct sockaddr *)&from, from_len);
+            assert(recv(srv_b, pq, sizeof(pq), MSG_DONTWAIT) == pn);
+        }
+        nanosleep(&settle, NULL);
+        /* B's second probe times out: two failures in a row take it out. */
+        upstream_health_check(&hu, t0 + 50);
+        assert(hu.servers[0].state == UPSTREAM_CLOSED && hu.servers[0].failures == 0);
+        assert(hu.servers[1].state == UPSTREAM_OPEN && hu.servers[1].trips == 1);
+        assert(hu.servers[1].probe_failures == 2 && upstream_available(&hu) == 1);
+        while (recv(srv_a, pq, sizeof(pq), MSG_DONTWAIT) > 0) {}
+
+        /* Still cooling down: no probe to B. Then one half-open probe, answered. */
+        upstream_health_check(&hu, t0 + 90);
+        assert(recv(srv_b, pq, sizeof(pq), MSG_DONTWAIT) < 0 && hu.servers[1].probes == 2);
+        upstream_health_check(&hu, t0 + 100);
+        assert(hu.servers[1].state == UPSTREAM_HALF_OPEN && hu.servers[1].probes == 3);
+        nanosleep(&settle, NULL);
+        from_len = sizeof(from);
+        pn = recvfrom(srv_b, pq, sizeof(pq), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        assert(pn > 12);
+        pq[2] |= 0x80;
+        sendto(srv_b, pq, (size_t)pn, 0, (struct sockaddr *)&from, from_len);
+        nanosleep(&settle, NULL);
+        upstream_health_check(&hu, t0 + 105);
+        assert(hu.servers[1].state == UPSTREAM_CLOSED && upstream_available(&hu) == 2);
+        upstream_close(&hu);
+
+        /* A lone server answering SERVFAIL is taken out; queries then fail at once. */
+        h.interval_ms = 0;
+        h.max_failures = 1;
+        h.cooldown_ms = 60000;
+        assert(upstream_init(&hu, "127.0.0.2", ntohs(at.sin_port), &h) == 0);
+        hu.servers[0].state = UPSTREAM_OPEN; /* as if a timeout had just tripped it */
+        hu.servers[0].opened_ms = t0 - 60000;
+        upstream_health_check(&hu, t0);
+        nanosleep(&settle, NULL);
+        from_len = sizeof(from);
+        pn = recvfrom(srv_b, pq, sizeof(pq), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        assert(pn > 12);
+        pq[2] |= 0x80;
+        pq[3] = (unsigned char)((pq[3] & 0xF0) | 2);
+        sendto(srv_b, pq, (size_t)pn, 0, (struct sockaddr *)&from, from_len);
+        nanosleep(&settle, NULL);
+        upstream_health_check(&hu, t0 + 5);
+        assert(hu.servers[0].state == UPSTREAM_OPEN && upstream_available(&hu) == 0);
+        unsigned char hq[] = { 0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0,
+                               3, 'c', 'o', 'm', 0, 0, 1, 0, 1 };
+        unsigned char hr[512];
+        assert(upstream_exchange(&hu, hq, sizeof(hq), hr, sizeof(hr)) == -1);
+        assert(hu.stats.unavailable == 1 && hu.stats.queries == 0);
+        int fn = build_servfail_response(hq, sizeof(hq), hr, sizeof(hr));
+        assert(fn == (int)sizeof(hq) && (hr[3] & 0x0F) == 2 && memcmp(hr, hq, 2) == 0);
+        upstream_close(&hu);
+
+        /* A flood of forged replies gives the query up but does not trip the breaker. */
+        assert(upstream_init(&hu, "127.0.0.1", ntohs(at.sin_port), &h) == 0);
+        while (recv(srv_a, pq, sizeof(pq), MSG_DONTWAIT) > 0) {} /* earlier probes */
+        pid_t forger = fork();
+        assert(forger >= 0);
+        if (forger == 0) {
+            from_len = sizeof(from);
+            pn = recvfrom(srv_a, pq, sizeof(pq), 0, (struct sockaddr *)&from, &from_len);
+            if (pn < 12) _exit(1);
+            pq[2] |= 0x80;
+            pq[0] ^= 0x55; /* wrong ID */
+            for (int i = 0; i <= UPSTREAM_MAX_REJECTS; i++)
+                sendto(srv_a, pq, (size_t)pn, 0, (struct sockaddr *)&from, from_len);
+            _exit(0);
+        }
+        assert(upstream_exchange(&hu, hq, sizeof(hq), hr, sizeof(hr)) == -1);
+        waitpid(forger, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        assert(hu.stats.reject_limit == 1 && hu.stats.timeouts == 0);
+        assert(hu.stats.bad_id == UPSTREAM_MAX_REJECTS + 1);
+        assert(hu.servers[0].state == UPSTREAM_CLOSED && hu.servers[0].failures == 0);
+        upstream_close(&hu);
+        close(srv_a);
+        close(srv_b);
+    }
+    printf("upstream health passed\n");
+
+    /*** Test 30: Upstream exchanges in flight together ***/
+    {
+        int fs = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in fa;
+        memset(&fa, 0, sizeof(fa));
+        fa.sin_family = AF_INET;
+        fa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t fa_len = sizeof(fa);
+        assert(bind(fs, (struct sockaddr *)&fa, sizeof(fa)) == 0);
+        assert(getsockname(fs, (struct sockaddr *)&fa, &fa_len) == 0);
+        Upstream fu;
+        assert(upstream_init(&fu, "127.0.0.1", ntohs(fa.sin_port), NULL) == 0);
+
+        /* Three queries out at once; the server answers the last two in reverse order. */
+        unsigned char fq[3][21];
+        int handles[3];
+        double t0 = 1000;
+        for (int i = 0; i < 3; i++) {
+            unsigned char q[21] = { 0x50, (unsigned char)i, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0,
+                                    3, 'x', 'Y', 'z', 0, 0, 1, 0, 1 };
+            q[13] = (unsigned char)('a' + i);
+            memcpy(fq[i], q, sizeof(q));
+            handles[i] = upstream_send(&fu, fq[i], sizeof(fq[i]), t0);
+            assert(handles[i] >= 0);
+        }
+        assert(fu.in_flight == 3 && fu.stats.queries == 3);
+        struct pollfd pfds[UPSTREAM_POOL_SIZE];
+        int npfds = upstream_poll_fds(&fu, pfds);
+        assert(npfds >= 1 && npfds <= 3);
+        unsigned char fr[512];
+        int frlen;
+        assert(upstream_receive(&fu, t0, fr, sizeof(fr), &frlen) == -1);
+
+        unsigned char sent[3][64];
+        struct sockaddr_in sent_from[3];
+        for (int i = 0; i < 3; i++) {
+            unsigned char pq[64];
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t pn = recvfrom(fs, pq, sizeof(pq), 0, (struct sockaddr *)&from, &from_len);
+            assert(pn == 21);
+            int k = (pq[13] | 0x20) - 'a';
+            assert(k >= 0 && k < 3);
+            memcpy(sent[k], pq, 21);
+            sent_from[k] = from;
+        }
+        for (int k = 2; k >= 1; k--) {
+            sent[k][2] |= 0x80;
+            sendto(fs, sent[k], 21, 0, (struct sockaddr *)&sent_from[k], sizeof(sent_from[k]));
+        }
+        struct timespec settle = { 0, 2 * 1000000L };
+        nanosleep(&settle, NULL);
+        int answered = 0;
+        int h;
+        while ((h = upstream_receive(&fu, t0 + 10, fr, sizeof(fr), &frlen)) >= 0) {
+            int k = h == handles[1] ? 1 : 2;
+            assert(h == handles[k] && frlen == 21 && (fr[2] & 0x80));
+            assert(memcmp(fr, fq[k], 2) == 0 && memcmp(fr + 12, fq[k] + 12, 9) == 0);
+            answered++;
+        }
+        assert(answered == 2 && fu.in_flight == 1 && fu.stats.answered == 2);
+
+        /* The first is given up once its time is over; the server took a failure. */
+        assert(upstream_receive(&fu, t0 + UPSTREAM_TIMEOUT_MS - 1, fr, sizeof(fr), &frlen) == -1);
+        assert(upstream_receive(&fu, t0 + UPSTREAM_TIMEOUT_MS, fr, sizeof(fr), &frlen) ==
+               handles[0]);
+        assert(frlen == -1 && fu.in_flight == 0 && fu.stats.timeouts == 1);
+        assert(fu.servers[0].failures == 1 && upstream_poll_fds(&fu, pfds) == 0);
+        upstream_close(&fu);
+        close(fs);
+    }
+    printf("upstream in flight passed\n");
+
     printf("\nAll tests passed!\n");
     return 0;
 }